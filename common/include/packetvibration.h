@@ -0,0 +1,81 @@
+/*
+	packetvibration.h
+
+	PacketVibration class - packet type that holds the strongest vibration
+		peaks in one sensor channel.
+		[Outgoing] This type is sent from quadcopter to remote
+
+	Fields:
+		channel     : uint8_t, 0-2 = gyroscope x, y, z; 3-5 = accelerometer
+		              x, y, z
+		frequency_n : 32-bit float, frequency of peak n in Hz (0 if none)
+		amplitude_n : 32-bit float, amplitude of peak n in dps or g
+
+	for n = 0 .. PKT_VIBRATION_PEAKS - 1, strongest first, each frequency
+	followed by its amplitude.
+
+	See packet.h for a description of the virtual member functions.
+*/
+
+#ifndef PACKETVIBRATION_H
+#define PACKETVIBRATION_H
+
+#include <string>
+#include <stdint.h>
+
+#include "packet.h"
+
+#define PKT_VIBRATION (char)0b10100010
+
+#define PKT_VIBRATION_PEAKS 3
+
+class PacketVibration : public Packet {
+	public:
+		/**
+			Constructor
+
+			Initializes fields to 0
+		*/
+		PacketVibration();
+
+		/**
+			Constructor
+
+			Initializes the channel, and all peaks to 0
+		*/
+		PacketVibration(uint8_t channel);
+
+		/**
+			Gets the header of this specific Packet. In this case, this will
+			return PKT_VIBRATION
+		*/
+		virtual char getHeader() const;
+
+		virtual bool feedData(std::string &buffer);
+
+		virtual bool getComplete() const;
+
+		virtual std::string serialize() const;
+
+		/**
+			Getters/Setters for packet fields. peak is 0 to
+			PKT_VIBRATION_PEAKS - 1.
+		*/
+		uint8_t getChannel() const;
+		float getFrequency(int peak) const;
+		float getAmplitude(int peak) const;
+
+		void setChannel(uint8_t channel);
+		void setPeak(int peak, float frequency, float amplitude);
+
+	private:
+		// channel field
+		uint8_t mChannel;
+
+		// Peak fields, in order: frequency 0, amplitude 0, frequency 1, ...
+		float mPeaks[2 * PKT_VIBRATION_PEAKS];
+
+		int mCurrentField;
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*
+	packetvibration.cpp
+
+	PacketVibration class - packet type that holds the strongest vibration
+		peaks in one sensor channel.
+		[Outgoing] This type is sent from quadcopter to remote
+
+	See packetvibration.h for the fields.
+*/
+
+#include <string>
+#include <stdint.h>
+
+#include "endianness.h"
+#include "packet.h"
+#include "packetvibration.h"
+
+// Number of fields: the channel, then the peaks
+#define FIELDS (1 + 2 * PKT_VIBRATION_PEAKS)
+
+PacketVibration::PacketVibration() {
+	mChannel = 0;
+	for (int i = 0; i < 2 * PKT_VIBRATION_PEAKS; ++i)
+		mPeaks[i] = 0.0f;
+	mCurrentField = 0;
+}
+
+PacketVibration::PacketVibration(uint8_t channel) {
+	setChannel(channel);
+	for (int i = 0; i < 2 * PKT_VIBRATION_PEAKS; ++i)
+		mPeaks[i] = 0.0f;
+	mCurrentField = 0;
+}
+
+char PacketVibration::getHeader() const {
+	return PKT_VIBRATION;
+}
+
+bool PacketVibration::feedData(std::string &buffer) {
+	if (buffer.size() > 0) {
+		// Restart from beginning if currently complete
+		if (mCurrentField == FIELDS)
+			mCurrentField = 0;
+
+		while (mCurrentField < FIELDS && buffer.size() > 0) {
+			if (mCurrentField == 0) {
+				mChannel = buffer[0];
+				buffer.erase(0, 1);
+				++mCurrentField;
+			} else if (buffer.size() >= 4) {
+				// Read 32-bit float only if there are 4 bytes available
+				LEToHost(&mPeaks[mCurrentField - 1], (float *)&buffer[0], 4);
+				buffer.erase(0, 4);
+				++mCurrentField;
+			} else
+				return false;
+		}
+
+		if (mCurrentField == FIELDS)
+			return true;
+	}
+	return false;
+}
+
+bool PacketVibration::getComplete() const {
+	return (mCurrentField == FIELDS);
+}
+
+std::string PacketVibration::serialize() const {
+	std::string result;
+	result.push_back((char)mChannel);
+	for (int i = 0; i < 2 * PKT_VIBRATION_PEAKS; ++i) {
+		float swapped;
+		hostToLE(&swapped, &mPeaks[i], 4);
+		result.append((char *)&swapped, 4);
+	}
+	return result;
+}
+
+uint8_t PacketVibration::getChannel() const {
+	return mChannel;
+}
+
+float PacketVibration::getFrequency(int peak) const {
+	return mPeaks[2 * peak];
+}
+
+float PacketVibration::getAmplitude(int peak) const {
+	return mPeaks[2 * peak + 1];
+}
+
+void PacketVibration::setChannel(uint8_t channel) {
+	mChannel = channel;
+}
+
+void PacketVibration::setPeak(int peak, float frequency, float amplitude) {
+	mPeaks[2 * peak] = frequency;
+	mPeaks[2 * peak + 1] = amplitude;
+}
@@ -14,6 +14,7 @@
 
 #include "packetmotion.h"
 #include "packetdiagnostic.h"
+#include "packetvibration.h"
 
 RadioConnection::RadioConnection(Radio *radio) {
 	if (!radio)
@@ -82,6 +83,10 @@ Packet *RadioConnection::receive() {
 							mCurrentPacket = new PacketDiagnostic();
 							break;
 
+						case PKT_VIBRATION:
+							mCurrentPacket = new PacketVibration();
+							break;
+
 						default:
 							found = false;
 							break;
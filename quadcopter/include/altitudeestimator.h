@@ -0,0 +1,96 @@
+/*
+	altitudeestimator.h
+
+	AltitudeEstimator class - estimates altitude and vertical velocity from
+		the barometer and the accelerometer.
+
+	A third-order complementary filter. The vertical acceleration, from the
+	accelerometer, is integrated into velocity and altitude at every update
+	(predict()); each barometer reading (correct()) pulls them towards the
+	barometer's altitude, and also learns a bias in the acceleration, which
+	a small error in the accelerometer's calibration or tilt would
+	otherwise turn into a runaway velocity. The barometer's noise is
+	filtered out on time scales shorter than the time constant, and the
+	accelerometer's drift on longer ones.
+
+	The gains place all three poles of the error dynamics at -1/time
+	constant:
+
+		altitude += 3/T   * error * dt
+		velocity += 3/T^2 * error * dt
+		bias     -= 1/T^3 * error * dt
+
+	where dt is the time since the last correction, so the barometer may
+	read at any rate slower than the updates.
+
+	Time is measured by the dtime passed to predict(), so that simulation
+	is exact. Doesn't lock or allocate.
+*/
+
+#ifndef ALTITUDEESTIMATOR_H
+#define ALTITUDEESTIMATOR_H
+
+// Default time constant, in seconds
+#define ALTITUDE_TIME_CONSTANT 1.5f
+
+// Standard gravity, m/s^2, to convert accelerometer readings
+#define ALTITUDE_GRAVITY 9.80665f
+
+class AltitudeEstimator {
+	public:
+		/**
+			Constructor
+
+			timeconstant is in seconds: longer trusts the accelerometer more,
+			shorter the barometer.
+		*/
+		AltitudeEstimator(float timeconstant = ALTITUDE_TIME_CONSTANT);
+
+		/**
+			Set the time constant, in seconds
+		*/
+		void setTimeConstant(float timeconstant);
+
+		/**
+			Advance the estimate by dtime seconds with the measured vertical
+			acceleration (m/s^2, positive up, gravity removed).
+		*/
+		void predict(float accel, float dtime);
+
+		/**
+			Correct the estimate with a barometer altitude, in metres. The
+			first reading (after construction or reset()) sets the altitude.
+		*/
+		void correct(float altitude);
+
+		/**
+			Start again from the next barometer reading, with no velocity or
+			bias
+		*/
+		void reset();
+
+		/**
+			Returns true once a barometer reading has been given
+		*/
+		bool isValid();
+
+		/**
+			Return the estimated altitude (metres), vertical velocity (m/s,
+			positive up) and acceleration bias (m/s^2)
+		*/
+		float getAltitude();
+		float getVelocity();
+		float getBias();
+
+	private:
+		float mK1, mK2, mK3; // Gains from the time constant
+
+		float mAltitude,
+		      mVelocity,
+		      mBias;
+		float mSinceCorrection; // Seconds of predict() since correct()
+		bool  mValid;
+};
+
+#endif
+
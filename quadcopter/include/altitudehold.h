@@ -0,0 +1,95 @@
+/*
+	altitudehold.h
+
+	AltitudeHold class - holds altitude with the throttle, from an altitude
+		and climb rate estimate (see AltitudeEstimator).
+
+	Two stages in series, like the angle and rate PIDs: the altitude error
+	sets a climb rate (proportionally, ALTHOLD_ALTITUDE_P), and a PID on the
+	climb rate corrects the throttle that hovered when the hold was engaged.
+	The pilot's throttle stick, centred, holds altitude; moved out of
+	ALTHOLD_DEADBAND it moves the altitude to hold, at up to
+	ALTHOLD_MAX_CLIMB_RATE.
+
+	Time is measured by the dtime passed to update(), so that simulation is
+	exact. Doesn't lock or allocate.
+*/
+
+#ifndef ALTITUDEHOLD_H
+#define ALTITUDEHOLD_H
+
+#include "pidcontroller.h"
+
+// Climb rate (m/s) at full throttle stick, and the part of the stick's
+// travel either side of its centre that holds altitude
+#define ALTHOLD_MAX_CLIMB_RATE 1.0f
+#define ALTHOLD_DEADBAND       0.1f
+
+// Default climb rate (m/s) per metre of altitude error, PID coefficients
+// of the climb rate controller (throttle per m/s), and the most throttle
+// it adds to or takes from the hover throttle
+#define ALTHOLD_ALTITUDE_P 1.0f
+#define ALTHOLD_CLIMB_P    0.1f
+#define ALTHOLD_CLIMB_I    0.05f
+#define ALTHOLD_CLIMB_D    0.0f
+#define ALTHOLD_CLIMB_LIMIT 0.25f
+
+class AltitudeHold {
+	public:
+		AltitudeHold();
+		~AltitudeHold();
+
+		/**
+			Set the coefficients: climb rate per metre of altitude error, and
+			the climb rate PID's
+		*/
+		void setPID(float altitudep, float climbp, float climbi,
+				float climbd);
+
+		/**
+			Start holding the given altitude (metres), from the given
+			throttle (the one that hovers, as near as is known)
+		*/
+		void engage(float altitude, float hoverthrottle);
+
+		/**
+			Stop holding; update() must not be called until engage()
+		*/
+		void disengage();
+
+		/**
+			Returns true between engage() and disengage()
+		*/
+		bool isEngaged();
+
+		/**
+			Returns the throttle to fly for the next dtime seconds, given the
+			pilot's throttle stick (0 to 1, centred at 0.5) and the estimated
+			altitude (metres) and climb rate (m/s).
+		*/
+		float update(float stick, float altitude, float climbrate,
+				float dtime);
+
+		/**
+			Returns the altitude being held
+		*/
+		float getTargetAltitude();
+
+	private:
+		bool  mEngaged;
+		float mTargetAltitude,
+		      mHoverThrottle,
+		      mAltitudeP;
+
+		PIDController *mPIDClimb;
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as the
+			PID is owned.
+		*/
+		AltitudeHold(const AltitudeHold &other);
+		AltitudeHold &operator=(const AltitudeHold &other);
+};
+
+#endif
+
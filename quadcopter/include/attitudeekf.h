@@ -0,0 +1,172 @@
+/*
+	attitudeekf.h
+
+	AttitudeEKF class - extended Kalman filter for attitude, gyroscope bias,
+		altitude and vertical velocity.
+
+	State (EKF_STATES = 9):
+
+		q0-q3  : attitude quaternion, rotating the quadcopter's axes into
+		         the world's (X to magnetic north, Z down: level, the
+		         accelerometer reads -1g on Z)
+		bx-bz  : gyroscope bias (rad/s)
+		h, v   : altitude (metres) and vertical velocity (m/s, up)
+
+	predict() integrates the gyroscope (less the bias) into the attitude,
+	and the accelerometer's vertical part (through the attitude) into the
+	velocity and altitude. Each sensor then corrects the state as it comes
+	in, as independent scalar measurements, so no matrix is ever inverted:
+
+		correctAccelerometer() : the direction of "up" (roll and pitch)
+		correctHeading()       : the magnetometer's heading (yaw)
+		correctAltitude()      : the barometer's altitude
+
+	Corrections tie the bias to the attitude error: the gyroscope's bias on
+	each axis is learnt as soon as some measurement sees its effect (roll
+	and pitch from the accelerometer, yaw only with headings).
+
+	All vectors are in the accelerometer's axes, as calibrated; gyroscope
+	rates in degrees/second about those axes (right-handed). Angles are
+	returned in Drive's conventions (see Drive::calculateOrientation()).
+
+	Uses Matrix (matrix.h): no heap, all dimensions fixed at compile time.
+	Doesn't lock or allocate, so may be stepped by the control loop.
+*/
+
+#ifndef ATTITUDEEKF_H
+#define ATTITUDEEKF_H
+
+#include "geometry.h"
+#include "matrix.h"
+
+#define EKF_STATES 9
+
+// Default noise: gyroscope (deg/s), gyroscope bias drift (deg/s per
+// sqrt(second)), vertical acceleration (m/s^2), accelerometer (g),
+// heading (degrees) and altitude (metres)
+#define EKF_GYRO_NOISE     0.5f
+#define EKF_BIAS_DRIFT     0.01f
+#define EKF_VACCEL_NOISE   0.5f
+#define EKF_ACCEL_NOISE    0.05f
+#define EKF_HEADING_NOISE  5.0f
+#define EKF_ALTITUDE_NOISE 0.5f
+
+// An accelerometer reading further than this (in g) from 1g is not used
+// as "up": the quadcopter is accelerating
+#define EKF_ACCEL_GATE 0.15f
+
+class AttitudeEKF {
+	public:
+		typedef Matrix<float, EKF_STATES, 1>          State;
+		typedef Matrix<float, EKF_STATES, EKF_STATES> Covariance;
+		typedef Matrix<float, 1, EKF_STATES>          Observation;
+
+		/**
+			Constructor
+
+			Starts level, at heading 0 and altitude 0, with no bias. See
+			initialize().
+		*/
+		AttitudeEKF();
+
+		/**
+			Set the noise (standard deviations, in the units of the EKF_*_NOISE
+			defaults)
+		*/
+		void setNoise(float gyro, float biasdrift, float vaccel, float accel,
+				float heading, float altitude);
+
+		/**
+			Start again with the attitude from an accelerometer reading (g)
+			and heading (degrees), no bias, and the altitude unknown until
+			the next correctAltitude().
+		*/
+		void initialize(const Vector3<float> &accel, float heading);
+
+		/**
+			Advance the state by dtime seconds, with the gyroscope's reading
+			(deg/s) and the accelerometer's (g)
+		*/
+		void predict(const Vector3<float> &gyro, const Vector3<float> &accel,
+				float dtime);
+
+		/**
+			Correct with an accelerometer reading (g). Ignored if the
+			reading isn't about 1g (see EKF_ACCEL_GATE). Returns true if
+			used.
+		*/
+		bool correctAccelerometer(const Vector3<float> &accel);
+
+		/**
+			Correct with a heading, in degrees (as from
+			Magnetometer::getHeading())
+		*/
+		void correctHeading(float heading);
+
+		/**
+			Correct with an altitude, in metres (as from
+			Barometer::getAltitude()). The first sets the altitude.
+		*/
+		void correctAltitude(float altitude);
+
+		/**
+			Return the attitude in degrees, as Drive's roll, pitch and yaw
+		*/
+		float getRoll();
+		float getPitch();
+		float getYaw();
+
+		/**
+			Returns the direction of "up" in the quadcopter's axes, as the
+			accelerometer would read it at rest (g)
+		*/
+		Vector3<float> getUp();
+
+		/**
+			Returns the estimated gyroscope bias, in deg/s
+		*/
+		Vector3<float> getGyroBias();
+
+		/**
+			Return the altitude (metres) and vertical velocity (m/s, up)
+		*/
+		float getAltitude();
+		float getVelocity();
+
+		/**
+			Returns true once an altitude has been given
+		*/
+		bool isAltitudeValid();
+
+		/**
+			Returns the state's covariance
+		*/
+		const Covariance &getCovariance();
+
+	private:
+		State      mX;
+		Covariance mP;
+		bool       mAltitudeValid;
+
+		// Noise variances, in the state's units
+		float mGyroVar,
+		      mBiasVar,
+		      mVAccelVar,
+		      mAccelVar,
+		      mHeadingVar,
+		      mAltitudeVar;
+
+		/**
+			Apply a scalar measurement with observation row h, innovation
+			(measured - predicted) and variance
+		*/
+		void update(const Observation &h, float innovation, float variance);
+
+		/**
+			Rescale the quaternion to unit length
+		*/
+		void normalize();
+};
+
+#endif
+
@@ -0,0 +1,211 @@
+/*
+	barometer.h
+
+	Barometer class - interface for the BMP085 (on GY80 board)
+
+	The BMP085 measures temperature and pressure on command, taking 4.5ms
+	for a temperature and up to 25.5ms for a pressure conversion (longer
+	with more oversampling). Rather than sleeping through these, update()
+	is called every control loop update and steps a state machine: when the
+	running conversion has had its time, its result is read and the next
+	conversion started, in one transaction; otherwise nothing is done. The
+	loop is never held up for longer than one transaction, which can also
+	be sent through an I2CEngine so that it doesn't wait at all.
+
+	Pressure is converted continuously, with a temperature conversion (which
+	the pressure compensation needs) after every BAROMETER_TEMP_INTERVAL
+	pressures, as temperature changes slowly. Time is measured by the dtime
+	passed to update(), so that simulation is exact.
+
+	Readings are compensated with the chip's factory calibration (read at
+	construction) as in the BMP085 datasheet.
+*/
+
+#ifndef BAROMETER_H
+#define BAROMETER_H
+
+#ifndef __cplusplus
+#error This header requires C++
+#endif
+
+#include <stdint.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cengine.h"
+
+// Pressure conversions per temperature conversion
+#define BAROMETER_TEMP_INTERVAL 10
+
+// Standard pressure at sea level, in Pa
+#define BAROMETER_SEA_LEVEL 101325.0f
+
+class BarometerException : public Exception {
+	public:
+		BarometerException(const std::string &msg, const std::string &file,
+				int line) : Exception(msg, file, line) { }
+};
+
+class Barometer {
+	public:
+		/**
+			Pressure oversampling: more samples averaged per conversion give
+			less noise, but take longer. RMS noise is about 0.5m of altitude
+			at OSS_ULTRA_LOW_POWER, and 0.25m at OSS_ULTRA_HIGH_RES.
+		*/
+		enum Oversampling {
+			OSS_ULTRA_LOW_POWER = 0, // 1 sample, 4.5ms
+			OSS_STANDARD = 1,        // 2 samples, 7.5ms
+			OSS_HIGH_RES = 2,        // 4 samples, 13.5ms
+			OSS_ULTRA_HIGH_RES = 3   // 8 samples, 25.5ms
+		};
+
+		/**
+			Constructor
+
+			Creates a BMP085 interface via the given (already instantiated)
+			I2C interface. Throughout the lifetime of the object, the given
+			slave address is used for communication.
+
+			The class is NOT responsible for destroying i2c! This must be done
+			by the user of this class.
+
+			Also, the user must ensure that the I2C object remains valid for as
+			long as this Barometer object is used.
+
+			Reads the calibration and starts a temperature conversion.
+
+			Throws I2CException if I2C communication fails.
+			       BarometerException if the calibration is invalid (e.g. no
+			       BMP085 at the address).
+		*/
+		Barometer(I2C *i2c, uint8_t slaveaddr,
+				Oversampling oss = OSS_ULTRA_HIGH_RES);
+
+		/**
+			Destructor
+
+			Waits for a transaction still being sent by an engine.
+		*/
+		~Barometer();
+
+		/**
+			Step the conversions by dtime seconds. Returns true if a new
+			pressure reading has come in.
+
+			engine, if not 0, sends the transactions (the result of one
+			conversion and start of the next) instead of waiting for them;
+			their results are used by the next call. Give the same engine
+			every time.
+
+			Doesn't throw exceptions or allocate: a failed transaction is
+			counted (see getErrors()), and the conversion it was for is run
+			again.
+		*/
+		bool update(float dtime, I2CEngine *engine = 0);
+
+		/**
+			Returns the last compensated pressure, in Pa, and temperature, in
+			degrees C. Both are 0 until the first reading.
+		*/
+		float getPressure();
+		float getTemperature();
+
+		/**
+			Returns the altitude of the last pressure reading, in metres, given
+			the pressure at sea level (or at any reference height, to which
+			the altitude is then relative).
+		*/
+		float getAltitude(float sealevel = BAROMETER_SEA_LEVEL);
+
+		/**
+			Returns the number of pressure readings, and of failed
+			transactions.
+		*/
+		long getSamples();
+		long getErrors();
+
+		/**
+			The international barometric formula: altitude in metres at the
+			given pressure, relative to the reference pressure.
+		*/
+		static float pressureToAltitude(float pressure, float reference);
+
+	private:
+		enum Conversion {
+			CONVERSION_TEMPERATURE = 0,
+			CONVERSION_PRESSURE = 1
+		};
+
+		I2C          *mI2C;
+		uint8_t      mSlaveAddr;
+		Oversampling mOss;
+
+		// Calibration (AC1-AC6, B1, B2, MB, MC, MD)
+		int16_t  mAC1, mAC2, mAC3;
+		uint16_t mAC4, mAC5, mAC6;
+		int16_t  mB1, mB2, mMB, mMC, mMD;
+
+		// State: the conversion running, the time left until its result is
+		// ready, and pressures since the last temperature. mRestart is set
+		// after a failed transaction, when it isn't known whether the
+		// conversion was started.
+		Conversion mConversion;
+		float      mWait;
+		int        mPressures;
+		bool       mRestart;
+
+		// Transaction buffers: result register, result, next command
+		char    mResultRegister;
+		uint8_t mResult[3];
+		char    mCommand[2];
+		Conversion     mNext;   // Conversion the command starts
+		I2CTransaction *mStep;  // For an engine
+		I2CEngine      *mEngine;
+
+		int32_t mB5;        // Temperature term of the compensation
+		float   mPressure,
+		        mTemperature;
+		long    mSamples,
+		        mErrors;
+
+		/**
+			Returns the time, in seconds, that the given conversion takes
+		*/
+		float getConversionTime(Conversion conversion);
+
+		/**
+			Returns the conversion to follow the running one
+		*/
+		Conversion getNextConversion();
+
+		/**
+			Use the result of the conversion that was running, which is in
+			mResult, and move on to mNext. Returns true for a new pressure.
+		*/
+		bool finish();
+
+		/**
+			Count a failed transaction, and start the running conversion again
+			on the next update
+		*/
+		void fail();
+
+		/**
+			Compensate raw readings, as in the datasheet, into mTemperature
+			(and mB5) and mPressure. Return false if the reading can't be
+			compensated.
+		*/
+		bool compensateTemperature(int32_t ut);
+		bool compensatePressure(int32_t up);
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as an
+			engine may refer to the transaction.
+		*/
+		Barometer(const Barometer &other);
+		Barometer &operator=(const Barometer &other);
+};
+
+#endif
+
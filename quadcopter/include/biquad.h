@@ -0,0 +1,93 @@
+/*
+	biquad.h
+
+	Biquad class - second order IIR filter section
+
+	Implemented in transposed direct form II, which needs only two state
+	variables and behaves well with float precision. Coefficients are
+	calculated by the set*() functions from the RBJ "Audio EQ Cookbook"
+	formulas; a newly constructed Biquad passes its input straight through.
+
+	process() does no allocation and no branching, so it is suitable for use
+	inside the control loop.
+*/
+
+#ifndef BIQUAD_H
+#define BIQUAD_H
+
+class Biquad {
+	public:
+		/**
+			Constructor
+
+			Initializes the filter as a pass-through (output = input).
+		*/
+		Biquad();
+
+		/**
+			Configure as a 2nd order low-pass filter.
+
+				cutoff     : -3dB frequency in Hz
+				samplerate : rate at which process() is called, in Hz
+				q          : quality factor. 0.7071 (default) gives a
+				             Butterworth response (maximally flat passband)
+
+			cutoff is clipped to just below half of samplerate. The filter state
+			is kept, so this can be called while the filter is running.
+		*/
+		void setLowPass(float cutoff, float samplerate, float q = 0.7071f);
+
+		/**
+			Configure as a notch (band-reject) filter.
+
+				center     : frequency removed completely, in Hz
+				samplerate : rate at which process() is called, in Hz
+				q          : quality factor; the -3dB width of the notch is
+				             about center / q, narrower towards half of
+				             samplerate
+
+			The gain is 1 far from center, including at 0Hz. center is
+			clipped to just below half of samplerate. The filter state is
+			kept, as with setLowPass().
+		*/
+		void setNotch(float center, float samplerate, float q);
+
+		/**
+			Configure as a pass-through (output = input).
+		*/
+		void setPassThrough();
+
+		/**
+			Filter a single sample and return the filtered value.
+		*/
+		float process(float in) {
+			float out = mB0 * in + mZ1;
+			mZ1 = mB1 * in - mA1 * out + mZ2;
+			mZ2 = mB2 * in - mA2 * out;
+			return out;
+		}
+
+		/**
+			Reset the filter state such that it is settled at the given value
+			(i.e. as if value had been fed for a long time).
+		*/
+		void reset(float value = 0.0f);
+
+		/**
+			Get the normalized coefficients of the filter (a0 = 1), for
+			implementations that process several filters at once.
+		*/
+		void getCoefficients(float &b0, float &b1, float &b2,
+				float &a1, float &a2);
+
+	private:
+		// Coefficients, normalized such that a0 = 1
+		float mB0, mB1, mB2,
+		      mA1, mA2;
+
+		// State
+		float mZ1, mZ2;
+};
+
+#endif
+
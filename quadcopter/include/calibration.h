@@ -0,0 +1,338 @@
+/*
+	calibration.h
+
+	Sensor calibration - models that correct raw accelerometer, gyroscope
+		and magnetometer readings, and the estimators that find them.
+
+	AccelCalibration corrects the accelerometer with a 3x3 matrix (scale,
+	and misalignment between the axes) and an offset:
+
+		calibrated = matrix * raw + offset
+
+	It is found by AccelCalibrator from the readings in six positions (each
+	axis pointing up, then down). In each position the true reading is
+	known to be 1g along one axis, so the matrix and offset are the least
+	squares fit of the raw readings onto those. This fixes the scale and
+	cross-axis errors that make attitude errors grow with tilt, which an
+	offset alone cannot.
+
+	MagCalibration corrects the magnetometer for hard iron (fields that turn
+	with the quadcopter, from magnetized parts and currents, which offset
+	the reading) and soft iron (metal that distorts the Earth's field,
+	which scales it differently along each axis):
+
+		calibrated = matrix * (raw - offset)
+
+	It is found by MagCalibrator from readings taken while the quadcopter
+	is turned through every orientation. Uncorrected these lie on an
+	ellipsoid, which is fitted; the offset is its centre, and the matrix
+	scales its axes to the mean radius, so that the corrected readings lie
+	on a sphere of the same field strength.
+
+	GyroCalibration subtracts a bias that may vary linearly with the
+	gyroscope's temperature. It is found by GyroBiasEstimator from readings
+	taken while the sensors are still; StillnessDetector decides when that
+	is, from the variance of the readings over a short window.
+
+	Applying a calibration does no allocation and no branching, so it can be
+	done in the control loop. The estimators are all testable with
+	synthetic data (see tests/test_calibration.cpp).
+*/
+
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <string>
+
+#include "exception.h"
+#include "geometry.h"
+
+// Default thresholds for StillnessDetector: variance of each gyroscope
+// axis in dps^2, and of each accelerometer axis in g^2
+#define STILL_GYRO_VARIANCE  0.25f
+#define STILL_ACCEL_VARIANCE 0.0004f
+
+// Temperature range (in Gyroscope::readTemperature() units) that
+// GyroBiasEstimator needs to see before it fits a temperature slope
+#define GYROCAL_MIN_TEMP_SPAN 3.0f
+
+// Fewest readings MagCalibrator fits, and the least range (as a fraction
+// of the largest) each axis must be turned through
+#define MAGCAL_MIN_SAMPLES 50
+#define MAGCAL_MIN_SPAN    0.5f
+
+class CalibrationException : public Exception {
+	public:
+		CalibrationException(const std::string &msg, const std::string &file,
+				int line) : Exception(msg, file, line) { }
+};
+
+struct AccelCalibration {
+	Matrix3<float> matrix;
+	Vector3<float> offset;
+	bool           fitted; // True if found by a six-position fit
+
+	// Identity (no correction)
+	AccelCalibration() : matrix(1.0f), offset(0.0f, 0.0f, 0.0f),
+			fitted(false)
+		{ }
+
+	Vector3<float> apply(const Vector3<float> &raw) const {
+		Vector3<float> v = matrix * raw;
+		v.x += offset.x;
+		v.y += offset.y;
+		v.z += offset.z;
+		return v;
+	}
+};
+
+struct GyroCalibration {
+	Vector3<float> bias;    // Bias at reftemp, dps
+	Vector3<float> slope;   // Change of bias per unit of temperature
+	float          reftemp;
+
+	// No correction
+	GyroCalibration() : bias(0.0f, 0.0f, 0.0f), slope(0.0f, 0.0f, 0.0f),
+			reftemp(0.0f)
+		{ }
+
+	Vector3<float> apply(const Vector3<float> &raw, float temp) const {
+		float dt = temp - reftemp;
+		return Vector3<float>(raw.x - (bias.x + slope.x * dt),
+		                      raw.y - (bias.y + slope.y * dt),
+		                      raw.z - (bias.z + slope.z * dt));
+	}
+};
+
+struct MagCalibration {
+	Matrix3<float> matrix;  // Soft iron
+	Vector3<float> offset;  // Hard iron, gauss
+
+	// Identity (no correction)
+	MagCalibration() : matrix(1.0f), offset(0.0f, 0.0f, 0.0f)
+		{ }
+
+	Vector3<float> apply(const Vector3<float> &raw) const {
+		return matrix * Vector3<float>(raw.x - offset.x, raw.y - offset.y,
+				raw.z - offset.z);
+	}
+};
+
+class StillnessDetector {
+	public:
+		/**
+			Constructor
+
+			window is the number of samples over which the variance is
+			measured. The sensors are considered still when the variance of
+			every axis of both sensors is below the given thresholds.
+		*/
+		StillnessDetector(int window,
+				float gyrovariance = STILL_GYRO_VARIANCE,
+				float accelvariance = STILL_ACCEL_VARIANCE);
+
+		/**
+			Destructor
+		*/
+		~StillnessDetector();
+
+		/**
+			Add a pair of readings. Returns isStill().
+		*/
+		bool feed(const Vector3<float> &accel, const Vector3<float> &gyro);
+
+		/**
+			Returns true if the window is full and the readings in it are
+			still.
+		*/
+		bool isStill();
+
+		/**
+			Mean of the readings in the window
+		*/
+		Vector3<float> getAccelMean();
+		Vector3<float> getGyroMean();
+
+		/**
+			Returns the number of samples in the window.
+		*/
+		int getWindow();
+
+		/**
+			Empty the window.
+		*/
+		void reset();
+
+	private:
+		int   mWindow,
+		      mCount,    // Samples in the window, up to mWindow
+		      mCurrent;  // Next position in the ring
+		float mGyroVariance,
+		      mAccelVariance;
+
+		// Ring of the last mWindow samples, 6 values each (accel, gyro)
+		float *mSamples;
+
+		// Running sums of the values and their squares
+		double mSum[6],
+		       mSumSq[6];
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as the
+			detector owns its storage.
+		*/
+		StillnessDetector(const StillnessDetector &other);
+		StillnessDetector &operator=(const StillnessDetector &other);
+};
+
+class AccelCalibrator {
+	public:
+		/**
+			Constructor
+		*/
+		AccelCalibrator();
+
+		/**
+			Add the mean reading of the accelerometer, held still in one
+			position. The position is recognized by the axis with the largest
+			reading and its sign, so positions may be given in any order. A
+			second reading for the same position replaces the first.
+
+			Returns the position: 0 = +X, 1 = -X, 2 = +Y, 3 = -Y, 4 = +Z,
+			5 = -Z (the sign being that of the raw reading).
+		*/
+		int addPosition(const Vector3<float> &mean);
+
+		/**
+			Returns the number of different positions added so far.
+		*/
+		int getNumPositions();
+
+		/**
+			Returns true once all six positions have been added.
+		*/
+		bool isComplete();
+
+		/**
+			Fit the calibration to the six positions. Each raw reading is
+			mapped as close as possible (least squares) to exactly 1g along
+			its axis.
+
+			Throws CalibrationException if not all positions have been added
+			or the readings are degenerate.
+		*/
+		AccelCalibration fit();
+
+		/**
+			Forget all positions.
+		*/
+		void reset();
+
+	private:
+		Vector3<float> mPositions[6];
+		bool           mHave[6];
+};
+
+class MagCalibrator {
+	public:
+		/**
+			Constructor
+		*/
+		MagCalibrator();
+
+		/**
+			Add a raw magnetometer reading. Readings are summed as they come,
+			not stored, so any number may be added; doesn't allocate.
+		*/
+		void addSample(const Vector3<float> &raw);
+
+		/**
+			Returns the number of readings added.
+		*/
+		int getSamples();
+
+		/**
+			Fit the calibration: the axis-aligned ellipsoid
+
+				A x^2 + B y^2 + C z^2 + D x + E y + F z = 1
+
+			closest (least squares) to the readings.
+
+			Throws CalibrationException if fewer than MAGCAL_MIN_SAMPLES have
+			been added, an axis was turned through less than MAGCAL_MIN_SPAN
+			of the others' range, or the readings don't fit an ellipsoid.
+		*/
+		MagCalibration fit();
+
+		/**
+			Forget everything added.
+		*/
+		void reset();
+
+	private:
+		// Normal equations of the fit: sums of row * row^T and of row, with
+		// row = [x^2, y^2, z^2, x, y, z]
+		double mA[6][6],
+		       mB[6];
+		int    mSamples;
+
+		Vector3<float> mMin,
+		               mMax;
+};
+
+class GyroBiasEstimator {
+	public:
+		/**
+			Constructor
+		*/
+		GyroBiasEstimator();
+
+		/**
+			Add the mean of a window of still gyroscope readings, the
+			temperature at the time, and the number of samples in the window
+			(used as its weight).
+		*/
+		void addStill(const Vector3<float> &mean, float temp, int samples);
+
+		/**
+			Start over from an existing calibration, weighted as the given
+			number of samples. A temperature model (non-zero slope) is added
+			as two points on its line, GYROCAL_MIN_TEMP_SPAN apart around its
+			reference temperature, so that windows added later refine the
+			model rather than fit a constant in its place.
+		*/
+		void seed(const GyroCalibration &cal, int samples);
+
+		/**
+			Returns the total number of samples added.
+		*/
+		int getSamples();
+
+		/**
+			Fit the calibration. If the windows added cover at least
+			GYROCAL_MIN_TEMP_SPAN of temperature, the bias is fitted as a
+			line against temperature; otherwise it is the (constant) mean.
+
+			Throws CalibrationException if nothing has been added.
+		*/
+		GyroCalibration fit();
+
+		/**
+			Forget everything added.
+		*/
+		void reset();
+
+	private:
+		// Weighted sums for the linear regression of bias on temperature
+		double mWeight,
+		       mTemp,
+		       mTempSq,
+		       mBias[3],
+		       mTempBias[3];
+		float  mTempMin,
+		       mTempMax;
+		int    mSamples;
+};
+
+#endif
+
@@ -0,0 +1,128 @@
+/*
+	cascade.h
+
+	Cascade class - the attitude controller: an Angle PID and a Rate PID in
+		series per axis, and the motor mix
+
+	This idea is taken from:
+		blog.oscarliang.net/quadcopter-pid-explained-tuning/
+	For each axis, there are 2 PIDs in series. The first in the series takes
+	the angle of the system, while the second takes the angular rate. This
+	means the first one sets the "desired rotational rate" and the second
+	one tries to achieve that angular rate.
+
+	Each stage is a PIDBank with one lane per axis (see Axis), so that all
+	axes of a stage are stepped together. The stages are separate calls,
+	feedAngles() then feedRates(), so that Drive's auto-tuner can take the
+	place of either stage's PID on one axis in between. mix() turns the
+	Rate PIDs' corrections into motor speeds.
+
+	Yaw has two modes. In heading hold, the yaw Angle PID is fed the
+	wrap-aware heading error, so crossing +/-180 degrees never looks like a
+	full turn of error, and the commanded turn rate is fed forward to the
+	Rate PID so that the Angle PID only corrects the residual. In rate mode
+	the yaw Rate PID is given the commanded turn rate alone.
+
+	This is what Drive::stabilize() runs each update; tests/test_yaw.cpp
+	runs it against a simulated yaw axis.
+*/
+
+#ifndef CASCADE_H
+#define CASCADE_H
+
+#include "geometry.h"
+#include "pidbank.h"
+
+// PID controller limits. Angle PIDs output degrees/second; Rate PIDs output
+// motor speed differences x100 (see mix()).
+#define PID_ANGLE_OUTPUT_LIMIT   180.0f
+#define PID_ANGLE_INTEGRAL_LIMIT 60.0f
+#define PID_RATE_OUTPUT_LIMIT    50.0f
+#define PID_RATE_INTEGRAL_LIMIT  20.0f
+
+// Cutoff of the PID derivative filters, as a fraction of the update rate
+#define PID_DFILTER_RATIO        0.25f
+
+class Cascade {
+	public:
+		/**
+			Axes of rotation, in the order used by the PID stages
+		*/
+		enum Axis {
+			AXIS_ROLL = 0,
+			AXIS_PITCH = 1,
+			AXIS_YAW = 2,
+			NUM_AXES = 3
+		};
+
+		/**
+			Constructor
+
+			Creates both stages for a loop run at updaterate (Hz), with all
+			coefficients and targets 0. Outputs and integrals are limited
+			(PID_ANGLE_OUTPUT_LIMIT etc.) so that a large error, or sitting
+			on the ground with the motors stopped, can't wind the
+			integrators up.
+		*/
+		Cascade(int updaterate);
+
+		/**
+			Destructor
+		*/
+		~Cascade();
+
+		/**
+			Returns the Angle PIDs (1st in series) and Rate PIDs (2nd in
+			series), for setting coefficients, resetting and saving. Owned by
+			the Cascade.
+		*/
+		PIDBank *getAngle();
+		PIDBank *getRate();
+
+		/**
+			Step the Angle stage. angles are the current roll, pitch and yaw
+			(heading), and targets the wanted ones, in degrees. yawrate is
+			the commanded turn rate (dps); headinghold selects the yaw mode
+			(the target heading is ignored in rate mode).
+
+			Writes the error each Angle PID is correcting (target - angle;
+			for yaw, the wrapped heading error, or 0 in rate mode) into
+			errors, and the Rate PIDs' targets (dps) into ratetargets, each
+			with room for NUM_AXES. Neither is fed to the Rate stage until
+			feedRates().
+		*/
+		void feedAngles(const float *angles, const float *targets,
+				float yawrate, bool headinghold, float dtime, float *errors,
+				float *ratetargets);
+
+		/**
+			Step the Rate stage: the Rate PIDs track ratetargets (dps, as
+			from feedAngles()) with the measured rates (gyro, dps, x y z as
+			roll, pitch and yaw). Writes their outputs, the corrections for
+			mix(), into corrections (room for NUM_AXES).
+		*/
+		void feedRates(const float *ratetargets, const Vector3<float> &gyro,
+				float dtime, float *corrections);
+
+		/**
+			Mix the corrections (as from feedRates()) into the speeds of the
+			four motors around throttle (0 to 1), clamped at 0.
+			motorspeeds has room for 4: front left, front right, rear right
+			and rear left.
+		*/
+		static void mix(float throttle, const float *corrections,
+				float *motorspeeds);
+
+	private:
+		PIDBank *mAngle,
+		        *mRate;
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as
+			the cascade owns its PIDBanks.
+		*/
+		Cascade(const Cascade &other);
+		Cascade &operator=(const Cascade &other);
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+	configstore.h
+
+	ConfigStore class - persistent configuration of the quadcopter
+		(calibration, PID gains and gain schedule, motor channels, update
+		rate, smoothing, sensor filters) in a small binary file.
+
+	File format (all values little-endian):
+
+		Header (16 bytes)
+			char[4]  magic "QCFG"
+			uint16   format version (CONFIG_VERSION when written)
+			uint16   reserved, 0
+			uint32   payload size in bytes
+			uint32   CRC-32 (IEEE) of the payload
+		Payload
+			uint32   sections present (CONFIG_* bits)
+			Calibration: float32 accel matrix[9] (row-major), accel
+			             offset[3], uint32 accel fitted, float32 gyro
+			             bias[3], gyro slope[3], gyro reference temperature
+			Gains:       float32 angle P, I, D, rate P, I, D
+			Motors:      int32 front left, front right, rear right, rear left
+			Timing:      int32 update rate, smoothing
+			Magnetometer: float32 soft iron matrix[9] (row-major), hard iron
+			             offset[3]
+			Filters:     per channel (CONFIG_FILTER_CHANNELS), per stage
+			             (FILTER_MAX_STAGES): uint32 type, float32
+			             frequency, param (see FilterStage)
+			Schedule:    uint32 breakpoint count, then
+			             CONFIG_SCHEDULE_POINTS breakpoints of float32
+			             throttle, voltage, angle P, I, D, rate P, I, D (the
+			             first count of them used, see GainSchedule)
+
+	Every field is always present in the payload; the section bits say
+	which hold real values. New fields are only ever appended, so a payload
+	longer than this version knows is still read (the extra is ignored).
+	One shorter than this version writes is read as far as it goes, as
+	long as it has the fields of the first version (up to Timing); the
+	sections it doesn't have are left out.
+
+	Saving is atomic: the file is written under a temporary name, flushed to
+	disk with fsync() and renamed over the old file, so a crash or power cut
+	leaves either the old or the new configuration, never a partial one.
+	Loading maps the file and checks its size and checksum before decoding
+	the fields, which are at fixed offsets - there is no text to parse.
+
+	The INI format that calibration.ini was written in can be imported, for
+	migrating from older versions.
+*/
+
+#ifndef CONFIGSTORE_H
+#define CONFIGSTORE_H
+
+#include <stdint.h>
+#include <string>
+
+#include "exception.h"
+#include "calibration.h"
+#include "filterchain.h"
+#include "gainschedule.h"
+
+#define CONFIG_VERSION 1
+
+// Sections of Config
+#define CONFIG_CALIBRATION 0x01
+#define CONFIG_GAINS       0x02
+#define CONFIG_MOTORS      0x04
+#define CONFIG_TIMING      0x08
+#define CONFIG_MAGNETOMETER 0x10
+#define CONFIG_FILTERS     0x20
+#define CONFIG_SCHEDULE    0x40
+
+// Channels of Config::filters: gyroscope x, y, z, then accelerometer x, y, z
+#define CONFIG_FILTER_CHANNELS 6
+
+// Room for breakpoints in Config::schedule
+#define CONFIG_SCHEDULE_POINTS 16
+
+class ConfigException : public Exception {
+	public:
+		ConfigException(const std::string &msg, const std::string &file,
+				int line) : Exception(msg, file, line) { }
+};
+
+struct Config {
+	uint32_t sections; // Which of the below hold values (CONFIG_* bits)
+
+	// CONFIG_CALIBRATION
+	AccelCalibration accel;
+	GyroCalibration  gyro;
+
+	// CONFIG_GAINS, as P, I, D
+	float angleGains[3],
+	      rateGains[3];
+
+	// CONFIG_MOTORS, PWM channels: front left, front right, rear right,
+	// rear left (the order of the Drive constructor's arguments)
+	int motors[4];
+
+	// CONFIG_TIMING, see the Drive constructor
+	int updateRate,
+	    smoothing;
+
+	// CONFIG_MAGNETOMETER
+	MagCalibration mag;
+
+	// CONFIG_FILTERS, the stages of each channel (see FilterChain). Unused
+	// stages are FILTER_NONE.
+	FilterStage filters[CONFIG_FILTER_CHANNELS][FILTER_MAX_STAGES];
+
+	// CONFIG_SCHEDULE, the gain schedule's breakpoints (see GainSchedule).
+	// The first scheduleCount are used; none means no schedule.
+	int                      scheduleCount;
+	GainSchedule::Breakpoint schedule[CONFIG_SCHEDULE_POINTS];
+
+	// No sections
+	Config();
+};
+
+class ConfigStore {
+	public:
+		/**
+			Constructor
+
+			Uses the given file for load() and save(). Nothing is read or
+			written until then.
+		*/
+		ConfigStore(const std::string &filename);
+
+		/**
+			Returns the filename passed to the constructor.
+		*/
+		const std::string &getFilename();
+
+		/**
+			Load the configuration from the file.
+
+			Throws ConfigException if the file does not exist, cannot be read
+			or is not a valid configuration file (wrong magic, too short,
+			checksum mismatch, or more than CONFIG_SCHEDULE_POINTS
+			breakpoints).
+		*/
+		Config load();
+
+		/**
+			Atomically replace the file with the given configuration.
+
+			Throws ConfigException if the file could not be written, or if
+			scheduleCount is not between 0 and CONFIG_SCHEDULE_POINTS. The
+			previous file, if any, is left untouched in that case.
+		*/
+		void save(const Config &config);
+
+		/**
+			Read the calibration from a legacy INI file (key=value lines, as
+			calibration.ini). Returns a Config with only CONFIG_CALIBRATION
+			set. Unknown keys are ignored.
+
+			Throws ConfigException if the file cannot be opened.
+		*/
+		static Config importIni(const std::string &filename);
+
+	private:
+		std::string mFilename;
+};
+
+#endif
+
@@ -9,6 +9,11 @@
 	To use the Drive class, call the move() and turn() functions to set the
 	desired amount of translational and rotational motion (respectively).
 	
+	The motors only run once armed (arm()), and the Drive watches the radio
+	link (packetReceived()), the sensors and its own update timing, making
+	the quadcopter descend or stopping the motors if any of them fail. See
+	FlightState.
+
 	When constructing the Drive object, set the update rate to a value that
 	matches the update rate of the sensors for best performance.
 
@@ -22,6 +27,13 @@
 	on signals to maintain a consistent update rate, and instantiating multiple
 	Drive objects will conflict with each other (one might be ignored entirely).
 
+	Built with FIXED_RATE_LOOP defined (make FIXED_RATE_LOOP=1), the Rate
+	stage and the motor mix run in integer arithmetic (see FixedRateLoop),
+	from the latest raw gyroscope reading to PWM counts. The Angle stage and
+	the estimators stay in float. The integer stage takes the same
+	calibration and EKF bias off the reading, but not the smoothing, the
+	filter chain or the notches, and its Rate stage can't be auto-tuned.
+
 DEPRECATED:
 	Then call update(), which will actually calculate and send appropriate
 	speeds to each motor in order to achieve the desired motion.
@@ -34,20 +46,58 @@ DEPRECATED:
 #include <sys/time.h>
 #include <signal.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "exception.h"
 #include "pwm.h"
 #include "motor.h"
 #include "accelerometer.h"
 #include "gyroscope.h"
+#include "magnetometer.h"
+#include "barometer.h"
+#include "altitudeestimator.h"
+#include "altitudehold.h"
+#include "attitudeekf.h"
 #include "geometry.h"
 #include "pidcontroller.h"
-
-class CalibrationException : public Exception {
-	public:
-		CalibrationException(const std::string &msg, const std::string &file,
-				int line) : Exception(msg, file, line) { }
-};
+#include "pidbank.h"
+#include "cascade.h"
+#include "fixedrateloop.h"
+#include "rawsamples.h"
+#include "relaytuner.h"
+#include "gainschedule.h"
+#include "calibration.h"
+#include "configstore.h"
+#include "startupsequence.h"
+#include "flightstate.h"
+#include "supervisor.h"
+#include "i2cengine.h"
+#include "vibrationanalyzer.h"
+#include "notchbank.h"
+#include "filterchain.h"
+
+// Configuration (calibration and PID coefficients) is saved in CONFIG_FILE.
+// CONFIG_LEGACY_FILE is the calibration file of earlier versions, imported if
+// CONFIG_FILE does not exist yet.
+#define CONFIG_FILE        "quadcopter.cfg"
+#define CONFIG_LEGACY_FILE "calibration.ini"
+
+// Time, in milliseconds from construction, for which the motors are held at
+// the priming signal before the Drive is ready
+#define DRIVE_PRIME_TIME 3000
+
+// Time constant (seconds) with which yaw is pulled towards the
+// magnetometer's heading, and the most tilt (degrees) at which the
+// heading is used
+#define DRIVE_MAG_TIME_CONSTANT 2.0f
+#define DRIVE_MAG_MAX_TILT      45.0f
+
+// With NOTCH_PEAKS, the weakest vibration peak (dps) that is notched
+#define DRIVE_NOTCH_MIN_AMPLITUDE 0.5f
+
+// Consecutive updates whose motor writes are held back by the previous ones
+// still being on the bus, before that counts as an I2C failure
+#define DRIVE_PWM_MAX_DEFERRED 10
 
 class DriveException : public Exception {
 	public:
@@ -57,6 +107,99 @@ class DriveException : public Exception {
 
 class Drive {
 	public:
+		/**
+			How the yaw axis interprets the value passed to turn().
+
+				YAW_RATE         : turn() sets a rotational rate directly. With
+				                   turn(0.0f) the rate controller only resists
+				                   rotation; heading is free to drift.
+				YAW_HEADING_HOLD : turn() moves a target heading at the given
+				                   rate, and the yaw Angle PID holds that
+				                   heading (cascaded into the yaw Rate PID, the
+				                   same as roll and pitch).
+		*/
+		enum YawMode {
+			YAW_RATE = 0,
+			YAW_HEADING_HOLD = 1
+		};
+
+		/**
+			How the throttle (the Z of move()) is interpreted.
+
+				THROTTLE_DIRECT         : the throttle is the motor speed
+				                          (before stabilization).
+				THROTTLE_ALTITUDE_HOLD  : with the throttle centred (0.5,
+				                          within ALTHOLD_DEADBAND), the
+				                          altitude is held; moving it up or
+				                          down climbs or descends, at up to
+				                          ALTHOLD_MAX_CLIMB_RATE. Needs a
+				                          barometer (see setBarometer()).
+		*/
+		enum ThrottleMode {
+			THROTTLE_DIRECT = 0,
+			THROTTLE_ALTITUDE_HOLD = 1
+		};
+
+		/**
+			How the orientation (and altitude) are estimated.
+
+				ESTIMATOR_COMPLEMENTARY : calculateOrientation() blends the
+				                          integrated gyroscope with the
+				                          accelerometer (and magnetometer),
+				                          and AltitudeEstimator fuses the
+				                          barometer.
+				ESTIMATOR_EKF           : AttitudeEKF fuses them all, also
+				                          estimating (and removing) the
+				                          gyroscope's bias in flight.
+		*/
+		enum Estimator {
+			ESTIMATOR_COMPLEMENTARY = 0,
+			ESTIMATOR_EKF = 1
+		};
+
+		/**
+			Where the notch filters on the rates fed to the Rate PIDs (see
+			NotchBank) are centred.
+
+				NOTCH_OFF   : no notches; the rates pass straight through.
+				NOTCH_PEAKS : at the strongest vibration peaks of each
+				              gyroscope axis, as found by the
+				              VibrationAnalyzer (see
+				              setVibrationAnalyzer()), folded to
+				              where they alias to at the update
+				              rate.
+				NOTCH_MOTOR : at the harmonics of the commanded motor speed
+				              (the throttle), on all axes.
+		*/
+		enum NotchMode {
+			NOTCH_OFF = 0,
+			NOTCH_PEAKS = 1,
+			NOTCH_MOTOR = 2
+		};
+
+		/**
+			Axes of rotation, in the order used by the PID stages
+		*/
+		enum Axis {
+			AXIS_ROLL = Cascade::AXIS_ROLL,
+			AXIS_PITCH = Cascade::AXIS_PITCH,
+			AXIS_YAW = Cascade::AXIS_YAW,
+			NUM_AXES = Cascade::NUM_AXES
+		};
+
+		/**
+			Which stage of the cascade startAutoTune() works on.
+
+				TUNE_RATE  : the relay drives the motors directly and the
+				             angular rate is measured. Tune this first.
+				TUNE_ANGLE : the relay drives the Rate PID's target and the
+				             angle is measured. Needs a working Rate PID.
+		*/
+		enum TuneLoop {
+			TUNE_RATE = 0,
+			TUNE_ANGLE = 1
+		};
+
 		/**
 			Constructor
 
@@ -64,8 +207,14 @@ class Drive {
 			object. Each channel corresponds to the physical position of the
 			motor it controls, as described by the argument name.
 
-			The function will block for 3 seconds, waiting for motors to be
-			primed.
+			The constructor does not block. The motors are sent the priming
+			signal, and a startup thread then loads the configuration and
+			fills the sensor buffers while the ESCs prime (DRIVE_PRIME_TIME).
+			Once all of that is done the Drive is ready: see isReady(),
+			waitReady() and setReadyCallback(). Until then update() does
+			nothing, so the update timer may be started early, and the caller
+			is free to do other things (such as connect the radio). Don't
+			change the PID coefficients or calibrate before then.
 
 			smoothing controls how many accelerometer frames are averaged
 			(1 frame corresponds to a call to update())
@@ -74,12 +223,21 @@ class Drive {
 			frames/second (Hz). Ideally this should be synchronous with the
 			update rate of the sensors and equate to a period of whole nanoseconds.
 
-			The constructor looks for a file named "calibration.ini". If it
-			is found, the values contained are used as calibration for the
-			sensors. Otherwise, no calibration is used (until a call to
-			calibrate()).
-
-			Throws PWMException and I2CException.
+			The sensor calibration and PID coefficients are loaded from the
+			config file CONFIG_FILE (see ConfigStore). If it does not exist,
+			the calibration is imported from CONFIG_LEGACY_FILE (the INI
+			format of earlier versions) and saved to CONFIG_FILE. Without
+			either, no calibration is used (until a call to calibrate()). The
+			config file's filters (CONFIG_FILTERS) are applied to each
+			reading, at the update rate, before it is averaged and
+			calibrated; invalid ones are left out, with a warning. If the
+			config file has a gain schedule (CONFIG_SCHEDULE), it is set and
+			gain scheduling turned on (see setGainSchedule()).
+
+			Throws PWMException and I2CException if the motors could not be
+			set up, and DriveException if the startup thread could not be
+			started. Sensor failures during startup make it fail instead (see
+			getStartupState()).
 		*/
 		Drive(PWM *pwm,
 				Accelerometer *accel,
@@ -96,6 +254,38 @@ class Drive {
 		*/
 		~Drive();
 
+		/**
+			Returns the state of startup: STATE_STARTING until ready (or
+			failed). See StartupSequence.
+		*/
+		StartupSequence::State getStartupState();
+
+		/**
+			Returns true once startup has finished and the Drive is controlling
+			the motors. Does not block.
+		*/
+		bool isReady();
+
+		/**
+			Block until startup has finished, or until millis milliseconds
+			have passed (0 waits indefinitely). Returns true if ready, false
+			if startup failed or the wait timed out.
+		*/
+		bool waitReady(unsigned int millis = 0);
+
+		/**
+			Set a function to be called (from the startup thread) when startup
+			finishes, with ready = false if it failed. If it already has, the
+			function is called right away.
+		*/
+		void setReadyCallback(StartupSequence::Callback callback, void *data);
+
+		/**
+			Returns the seconds from construction until ready, or -1 if not
+			ready yet.
+		*/
+		float getStartupTime();
+
 		/**
 			Start the system timer that will send a signal to run the update
 			routine. The update routine will run automatically on a schedule
@@ -152,6 +342,37 @@ class Drive {
 		*/
 		void turn(float speed);
 
+		/**
+			Select how the yaw axis is controlled. See YawMode.
+
+			Switching into YAW_HEADING_HOLD captures the current perceived yaw
+			as the heading to hold. Switching modes resets the state of the yaw
+			PID controllers.
+		*/
+		void setYawMode(YawMode mode);
+
+		/**
+			Returns the current YawMode.
+		*/
+		YawMode getYawMode();
+
+		/**
+			Select how the orientation is estimated. See Estimator. The EKF
+			starts, at the next update, from the current estimate.
+		*/
+		void setEstimator(Estimator estimator);
+
+		/**
+			Returns the current Estimator.
+		*/
+		Estimator getEstimator();
+
+		/**
+			Set the rotational rate, in degrees/second, that corresponds to
+			turn(1.0f). Defaults to 90 degrees/second.
+		*/
+		void setMaxYawRate(float dps);
+
 		/**
 			Update the motor speeds, actually applying the values fed through
 			move() and turn(). Only the last values sent to these functions are
@@ -172,6 +393,173 @@ class Drive {
 		*/
 		void stop();
 
+		/**
+			Arm, disarm or kill the motors (see FlightState). The motors only
+			run while armed, or in failsafe. Takes effect at the next update;
+			arming is refused unless the commanded throttle (move()'s z) is
+			low, the radio link is fresh and the sensors are working, and
+			then takes FLIGHT_ARMING_TIME. A refused arm() is dropped, not
+			retried; getFlightReason() tells why.
+		*/
+		void arm();
+		void disarm();
+		void kill();
+
+		/**
+			Note that a packet has arrived from the radio. Call on every packet
+			received; if none arrives for FLIGHT_LINK_TIMEOUT while armed, the
+			quadcopter descends (failsafe).
+		*/
+		void packetReceived();
+
+		/**
+			Returns the flight state, and the reason it was entered (or the
+			last arm() refused).
+		*/
+		FlightState::State  getFlightState();
+		FlightState::Reason getFlightReason();
+
+		/**
+			Give the Supervisor to send a heartbeat to on every update, or 0
+			for none. The Drive does not own it, nor start it.
+		*/
+		void setSupervisor(Supervisor *supervisor);
+
+		/**
+			Give the VibrationAnalyzer that NOTCH_PEAKS takes the peaks
+			from, or 0 for none. The Drive does not tap it (its readings,
+			at the update rate, can't show vibration above half of it); a
+			VibrationSampler feeds it readings at the sensors' output data
+			rate. The Drive does not own the analyzer, nor start it.
+		*/
+		void setVibrationAnalyzer(VibrationAnalyzer *analyzer);
+
+		/**
+			Select where the notch filters on the Rate PIDs' input are
+			centred. See NotchMode. fullspeed is, for NOTCH_MOTOR, the
+			motors' rotation at full throttle, in Hz. The notches move at
+			the next trackNotches(), and keep their state.
+
+			Unlike more smoothing (the constructor's smoothing), which delays
+			every rate, the notches only remove the motor vibration; the
+			orientation estimate is still fed the unfiltered rates.
+
+			Throws DriveException for NOTCH_PEAKS without a
+			VibrationAnalyzer sampling faster than the update rate, whose
+			peaks would be no more than aliases in the readings the loop
+			already has.
+		*/
+		void setNotchMode(NotchMode mode, float fullspeed = 0.0f);
+
+		/**
+			Returns the current NotchMode
+		*/
+		NotchMode getNotchMode();
+
+		/**
+			Move the notches as the NotchMode asks, working out their
+			coefficients, and hand them over to the update thread, which
+			takes them at its next update. Call regularly (10 to 20 times a
+			second) from one thread other than the update thread, such as
+			the main loop, so that updates never calculate coefficients.
+			Without calls to this, the notches stay where they are.
+
+			With NOTCH_PEAKS, the notches move when the analyzer has new
+			peaks. If it is busy, the next call tries again.
+		*/
+		void trackNotches();
+
+		/**
+			Read the sensors through the given I2CEngine, or synchronously if
+			0 (the default). With an engine, each update submits the next
+			read and uses the one submitted by the previous update, so the
+			bus transfer overlaps the update's computation, and the samples
+			are up to one update period old. The Drive does not own the
+			engine, which must outlive it.
+
+			Throws I2CException if the read could not be set up.
+		*/
+		void setI2CEngine(I2CEngine *engine);
+
+		/**
+			Send the motor speeds through the given I2CEngine, or
+			synchronously if 0 (the default); see PWM::setEngine(). Each update
+			submits its motor writes once they are computed. With the sensors
+			and PWM on separate buses and engines, the writes go out while the
+			next update's sensor read is under way on the other bus. The
+			Drive does not own the engine, which must outlive it.
+
+			Call before startTimer().
+
+			Throws I2CException if writes still queued could not be sent.
+		*/
+		void setPWMEngine(I2CEngine *engine);
+
+		/**
+			Correct the yaw estimate with the given magnetometer, or 0 for
+			none (the default, in which case yaw is integrated from the
+			gyroscope alone and drifts). While the quadcopter is within
+			DRIVE_MAG_MAX_TILT of level, yaw is pulled towards the
+			tilt-compensated heading with time constant
+			DRIVE_MAG_TIME_CONSTANT, so gyroscope drift is removed without
+			passing on the magnetometer's noise. At startup yaw starts at the
+			heading.
+
+			The magnetometer is read every update, through the sensors'
+			I2CEngine if there is one, in a transaction of its own; a failed
+			read only stops the correction until the next good one. The
+			Drive does not own the magnetometer. Call straight after
+			construction, so that startup finds it, and not once the timer
+			has started.
+
+			Throws I2CException if the read could not be set up.
+		*/
+		void setMagnetometer(Magnetometer *magnetometer);
+
+		/**
+			Estimate altitude with the given barometer, or 0 for none (the
+			default). The barometer is stepped every update, through the
+			sensors' I2CEngine if there is one, and its readings are fused
+			with the accelerometer's vertical acceleration (see
+			AltitudeEstimator); a failed reading only delays the next. The
+			Drive does not own the barometer. Don't call once the timer has
+			started.
+		*/
+		void setBarometer(Barometer *barometer);
+
+		/**
+			Select how the throttle is interpreted. See ThrottleMode.
+
+			Switching into THROTTLE_ALTITUDE_HOLD captures, at the next
+			update, the estimated altitude as the altitude to hold, and the
+			throttle as the one that hovers, which the climb rate controller
+			corrects from there; so switch once flying steadily. See
+			AltitudeHold. The throttle stays direct without a barometer (or
+			before its first reading) and while not armed.
+		*/
+		void setThrottleMode(ThrottleMode mode);
+
+		/**
+			Returns the current ThrottleMode.
+		*/
+		ThrottleMode getThrottleMode();
+
+		/**
+			Set the altitude hold coefficients: the climb rate per metre of
+			altitude error, and the climb rate PID's. Defaults are
+			ALTHOLD_ALTITUDE_P and ALTHOLD_CLIMB_P/I/D.
+		*/
+		void setPIDAltitude(float altitudep, float climbp, float climbi,
+				float climbd);
+
+		/**
+			Return the estimated altitude (metres above sea level, at standard
+			pressure) and climb rate (m/s), as of the last call to update(). 0
+			without a barometer.
+		*/
+		float getAltitude();
+		float getClimbRate();
+
 		/*
 			Returns the perceived roll angle, as of the last call to update().
 			0 = upright
@@ -190,11 +578,28 @@ class Drive {
 		*/
 		float getYaw();
 
+		/**
+			Returns the angular rates (dps, x y z as roll, pitch and yaw)
+			fed to the Rate PIDs by the last call to update(): the gyroscope
+			reading after calibration, less the estimator's bias, with the
+			motor vibration notched out
+		*/
+		Vector3<float> getRates();
+
+		/**
+			Returns the gyroscope bias (dps, in the same axes as getRates())
+			that the estimator has taken off the rates, as of the last call
+			to update(). 0 with ESTIMATOR_COMPLEMENTARY, which leaves the
+			bias to the calibration.
+		*/
+		Vector3<float> getGyroBias();
+
 		/**
 			Set the coefficients for the Angle PID controller.
 
 			Also resets any state previously accumulated by the Angle PID
-			controller.
+			controller, and turns gain scheduling off (see
+			setGainScheduling()).
 		*/
 		void setPIDAngle(float p, float i, float d);
 
@@ -202,30 +607,181 @@ class Drive {
 			Set the coefficients for the Rate PID controller.
 
 			Also resets any state previously accumulated by the Rate PID
-			controller.
+			controller, and turns gain scheduling off (see
+			setGainScheduling()).
 		*/
 		void setPIDRate(float p, float i, float d);
 
+		/**
+			Save the coefficients last given to setPIDAngle()/setPIDRate() to
+			CONFIG_FILE, so that the constructor sets them the next time.
+			Other sections of the file are kept.
+
+			Throws ConfigException if the file could not be written.
+		*/
+		void saveGains();
+
+		/**
+			Set a copy of the given gain schedule, built, and turn gain
+			scheduling on. Replaces any previously set schedule; can be called
+			while the update timer is running.
+
+			Throws GainScheduleException if the schedule has no breakpoints.
+			The previous schedule, if any, is kept in that case.
+		*/
+		void setGainSchedule(const GainSchedule &schedule);
+
+		/**
+			Save the breakpoints of the schedule last given to
+			setGainSchedule() to CONFIG_FILE (CONFIG_SCHEDULE), so that the
+			constructor sets it the next time. Without a schedule, an empty
+			one is saved, which the constructor ignores. Other sections of the
+			file are kept.
+
+			Throws ConfigException if the file could not be written or the
+			schedule has more than CONFIG_SCHEDULE_POINTS breakpoints.
+		*/
+		void saveGainSchedule();
+
+		/**
+			Turn gain scheduling on or off. While on, the coefficients of both
+			stages are looked up from the gain schedule every update, by the
+			throttle actually flown (mThrottle, FlightState's output, which
+			differs from move()'s z while disarmed or in failsafe) and battery
+			voltage. While off, the coefficients last given to
+			setPIDAngle()/setPIDRate() are used.
+
+			Switching does not reset any PID state; the integral terms carry
+			over without a jump in output. Has no effect if no schedule has
+			been set.
+		*/
+		void setGainScheduling(bool enabled);
+
+		/**
+			Returns true if gain scheduling is on.
+		*/
+		bool isGainScheduling();
+
+		/**
+			Set the battery voltage used for gain scheduling. Only matters if
+			the schedule has breakpoints at more than one voltage.
+		*/
+		void setBatteryVoltage(float volts);
+
+		/**
+			Start auto-tuning one axis of one stage (see RelayTuner and
+			TuneLoop). The stage's PID for that axis is replaced by a relay of
+			the given amplitude, in the units of the stage's output (motor
+			speed difference x100 for TUNE_RATE, degrees/second for
+			TUNE_ANGLE, clipped to the stage's output limit). The other axes
+			and stages keep running normally.
+
+			The relay oscillates around the current target (level, for roll
+			and pitch with move() at 0), so the quadcopter should be hovering
+			or held in a rig. Tuning is aborted if roll or pitch passes
+			AUTOTUNE_MAX_ANGLE or no steady oscillation is found within
+			AUTOTUNE_TIMEOUT seconds.
+
+			When tuning finishes, the gains from the given rule are set for
+			the tuned axis (only) of that stage if apply is true, and are
+			available from getAutoTuneResult() either way. Applying the gains
+			turns gain scheduling off.
+
+			Throws DriveException for TUNE_RATE if built with
+			FIXED_RATE_LOOP.
+		*/
+		void startAutoTune(Axis axis, TuneLoop loop, float amplitude,
+				RelayTuner::Rule rule = RelayTuner::RULE_TYREUS_LUYBEN,
+				bool apply = true);
+
+		/**
+			Stop auto-tuning, returning the tuned axis to its PID. No gains are
+			applied.
+		*/
+		void stopAutoTune();
+
+		/**
+			Returns the state of the last auto-tune. STATE_RUNNING while
+			tuning, then STATE_DONE or STATE_FAILED.
+		*/
+		RelayTuner::State getAutoTuneState();
+
+		/**
+			Get the gains found by the last auto-tune. Returns false if it has
+			not finished successfully.
+		*/
+		bool getAutoTuneResult(float &p, float &i, float &d);
+
 		/*
 			Calibrate sensors. Reads sensors for the given number of
-			milliseconds at 100Hz. Then, averages the readings and uses these
-			values as the "zero position" of the sensors in future
-			calculations.
+			milliseconds at 100Hz. The gyroscope bias is estimated from the
+			windows of readings in which the sensors were still (see
+			StillnessDetector), so a knock during calibration is ignored
+			rather than averaged in.
+
+			Unless a six-position accelerometer calibration has been done
+			(see calibratePosition()), the accelerometer is also calibrated
+			such that the current position reads as level, as an offset only.
 
 			CAUTION: This function should only be called when the sensors are
 			completely still (0 linear and rotational motion) and perfectly
 			in the upright position.
 
-			Upon completion, the calibrated values are saved to file
-			"calibration.ini" to eliminate the need to recalibrate every time.
+			Upon completion, the calibrated values are saved to CONFIG_FILE to
+			eliminate the need to recalibrate every time.
+
+			Waits for startup to finish first (see waitReady()).
 
 			Throws I2CException if sensors cannot be read.
-			       CalibrationException if the calibration could not be saved
-			       to file. This is probably not fatal, but the calibration
-			       will not be remembered the next time the program runs.
+			       DriveException if startup failed.
+			       CalibrationException if the sensors were never still.
+			       ConfigException if the calibration could not be saved to
+			       file. This is probably not fatal, but the calibration will
+			       not be remembered the next time the program runs.
 		*/
 		void calibrate(unsigned int millis = 200);
 
+		/**
+			Capture one position of the six-position accelerometer
+			calibration. Hold the quadcopter still with one axis pointing
+			straight up or down; waits up to millis milliseconds for a still
+			window of readings. Positions may be captured in any order, and
+			capturing a position again replaces it.
+
+			Once all six positions have been captured, the calibration (scale,
+			misalignment and offset) is fitted, used and saved to
+			CONFIG_FILE. Returns the number of positions captured.
+
+			Waits for startup to finish first (see waitReady()).
+
+			Throws I2CException if sensors cannot be read.
+			       DriveException if startup failed.
+			       CalibrationException if the sensors were not still, or
+			       the calibration could not be fitted.
+			       ConfigException if the calibration could not be saved.
+		*/
+		int calibratePosition(unsigned int millis = 2000);
+
+		/**
+			Calibrate the magnetometer for hard and soft iron (see
+			MagCalibration). Reads it for the given number of milliseconds,
+			during which the quadcopter must be turned through every
+			orientation (e.g. a full turn about each axis). The calibration is
+			then used, and saved to CONFIG_FILE. Returns the number of
+			readings it was fitted to. Calibrate with the quadcopter as it
+			flies (battery fitted), away from other metal.
+
+			Waits for startup to finish first (see waitReady()).
+
+			Throws I2CException if the magnetometer cannot be read.
+			       DriveException if there is no magnetometer, or startup
+			       failed.
+			       CalibrationException if it was not turned through enough
+			       orientations.
+			       ConfigException if the calibration could not be saved.
+		*/
+		int calibrateMagnetometer(unsigned int millis = 30000);
+
 		/**
 			Update the motor speeds, actually applying the values fed through
 			move() and turn(). Only the last values sent to these functions are
@@ -244,10 +800,16 @@ class Drive {
 		
 		friend void *updateThreadEntry(void *);
 		friend void updateThreadExit(Drive *);
+		friend void *startupThreadEntry(void *);
 
+		PWM           *mPWM;
 		Accelerometer *mAccelerometer;
 		Gyroscope     *mGyroscope;
 
+		// Startup (see runStartup())
+		StartupSequence *mStartup;
+		pthread_t       mStartupThread;
+
 		// Update routine & signals
 		timer_t          mTimerID;
 		struct sigaction mTimerAction;
@@ -276,37 +838,114 @@ class Drive {
 		float          mRotate;
 		Vector3<float> mTranslate;
 
-		// Current perceived orientation
+		// Arming and failsafe. mThrottle is the throttle actually flown
+		// (from mFlight). mI2COk is cleared by any failed sensor read or
+		// motor write, and reported to mFlight every update. mPWMDeferred
+		// counts consecutive updates whose motor writes were deferred.
+		FlightState *mFlight;
+		float       mThrottle;
+		bool        mI2COk;
+		int         mPWMDeferred;
+
+		// Heartbeat target, 0 if none. Not owned.
+		Supervisor *mSupervisor;
+
+		// Peaks for NOTCH_PEAKS, 0 if none. Not owned.
+		VibrationAnalyzer *mVibration;
+
+		// Notches on the Rate PIDs' input. mNotch is only retuned by
+		// trackNotches(), from the mode it last applied (mNotchApplied);
+		// mNotchAnalyses is the analysis its peaks were last taken from.
+		NotchBank *mNotch;
+		NotchMode mNotchMode,
+		          mNotchApplied;
+		float     mNotchFullSpeed;
+		int       mNotchAnalyses;
+
+		// Asynchronous sensor reads, if mI2CEngine (not owned) is set
+		I2CEngine      *mI2CEngine;
+		I2CTransaction *mSensorRead;
+
+		// Magnetometer (not owned), 0 if none. mMagField is the latest
+		// calibrated reading, valid if mMagValid.
+		Magnetometer   *mMagnetometer;
+		I2CTransaction *mMagRead;
+		MagCalibration mMagCal;
+		Vector3<float> mMagField;
+		bool           mMagValid;
+
+		// Yaw control configuration
+		YawMode mYawMode;
+		float   mMaxYawRate; // degrees/second at turn(1.0f)
+
+		// Barometer (not owned), 0 if none, and the altitude estimate
+		Barometer         *mBarometer;
+		AltitudeEstimator *mAltitude;
+
+		// Estimator selection, and the EKF. mEKFStarted is cleared to
+		// start the EKF again from the current estimate.
+		Estimator   mEstimator;
+		AttitudeEKF *mEKF;
+		bool        mEKFStarted;
+
+		// Throttle control configuration. mAltitudeHold is engaged while it
+		// has taken over the throttle.
+		ThrottleMode mThrottleMode;
+		AltitudeHold *mAltitudeHold;
+
+		// Current perceived orientation, and the rates last fed to the Rate
+		// PIDs
 		float mRoll,
 		      mPitch,
 		      mYaw;
+		Vector3<float> mRates;
 
 		// Target orientation (to achieve desired movement)
+		// mTargetYaw is only meaningful in YAW_HEADING_HOLD mode; it is kept
+		// in the range [-180, 180).
 		float mTargetRoll,
 		      mTargetPitch,
 		      mTargetYaw;
 
+		// Auto-tuning (see startAutoTune())
+		RelayTuner       *mTuner;
+		bool             mTuneActive; // Tuner is replacing a PID lane
+		Axis             mTuneAxis;
+		TuneLoop         mTuneLoop;
+		RelayTuner::Rule mTuneRule;
+		bool             mTuneApply;
+
 		/*
-			Two PID controllers per axis of rotation
-			This idea is taken from:
-				blog.oscarliang.net/quadcopter-pid-explained-tuning/
-			For each axis, there are 2 PIDs in series. The first in the series
-			takes the angle of the system, while the second takes the angular
-			rate. This means the first one sets the "desired rotational rate" and
-			the second one tries to achieve that angular rate.
-
-			This is similar to the cascaded PID system described on Wikipedia,
-			except that the second in series takes a different attribute.
-		*/
-		PIDController // Angle PID (1st in series)
-		              *mPIDRollAngle,
-		              *mPIDPitchAngle,
-		              *mPIDYawAngle,
-
-						  // Rate PID (2nd in series)
-		              *mPIDRollRate,
-		              *mPIDPitchRate,
-		              *mPIDYawRate;
+			Two PID controllers per axis of rotation, in series (see
+			Cascade). This is similar to the cascaded PID system described on
+			Wikipedia, except that the second in series takes a different
+			attribute. mPIDAngle and mPIDRate are its stages, owned by
+			mCascade.
+		*/
+		Cascade *mCascade;
+		PIDBank *mPIDAngle, // Angle PIDs (1st in series)
+		        *mPIDRate;  // Rate PIDs (2nd in series)
+
+		// The Rate stage and mixer in integer arithmetic, used instead of
+		// mPIDRate's if built with FIXED_RATE_LOOP (otherwise 0), with the
+		// same gains. mGyroSample holds the latest raw gyroscope reading
+		// for it, in mGyroRaw (register order).
+		FixedRateLoop *mFixedLoop;
+		int16_t       mGyroRaw[3];
+		uint64_t      mGyroRawTime;
+		RawSamples    *mGyroSample;
+
+		// Coefficients from setPIDAngle()/setPIDRate(), used while gain
+		// scheduling is off
+		float mAngleGains[3],
+		      mRateGains[3];
+
+		// Gain scheduling (see setGainScheduling()). mScheduleLock guards
+		// mSchedule being replaced while the update thread reads it.
+		GainSchedule    *mSchedule;
+		bool            mScheduleEnabled;
+		float           mBatteryVoltage;
+		pthread_mutex_t mScheduleLock;
 
 		// How many frames of accelerometer values to average
 		int mSmoothing;
@@ -321,28 +960,125 @@ class Drive {
 		Vector3<float> *mGyroValue;
 		int mGyroValueCurrent;
 
-		// Offset values based on sensor calibration
-		// These values should be SUBTRACTED from sensor readings to obtain
-		// the "zero" value.
-		Vector3<float> mAccelOffset;
-		Vector3<float> mGyroOffset;
+		// Filters from the config file, applied to each reading before it
+		// is stored in mAccelValue/mGyroValue (channels as
+		// CONFIG_FILTER_CHANNELS). mAccelLast and mGyroLast are the latest
+		// unfiltered readings, held for the filters when a read fails.
+		FilterChain    *mFilter;
+		Vector3<float> mAccelLast,
+		               mGyroLast;
+
+		// Sensor calibration, applied to the averaged readings every update.
+		// mGyroCal is refitted on the update thread (trackGyroBias()) and
+		// replaced by calibrate() on the caller's, so it and mGyroBias are
+		// guarded by mGyroCalLock. The update thread applies its own copy,
+		// mGyroCalApplied, taken whenever the lock is free.
+		AccelCalibration mAccelCal;
+		GyroCalibration  mGyroCal,
+		                 mGyroCalApplied;
+		pthread_mutex_t  mGyroCalLock;
+		AccelCalibrator  mAccelCalibrator; // Positions for calibratePosition()
+
+		// Gyroscope temperature, for mGyroCal. Read every mUpdateRate
+		// updates (once a second).
+		float mGyroTemperature;
+		int   mTemperatureCountdown;
+
+		// While the quadcopter sits on the ground (throttle 0) and is still,
+		// the gyroscope bias keeps being estimated, so that the temperature
+		// model fills in as the sensors warm up. The estimate starts from
+		// the stored calibration (see GyroBiasEstimator::seed()).
+		StillnessDetector *mStill;
+		GyroBiasEstimator mGyroBias;
+		int               mStillCountdown; // Updates until the next window
 
 		// Time of the last update of orientation values
 		struct timeval mLastUpdate;
 
 		/**
-			Update the sensor value buffers.
+			The stages of startup, run by the startup thread: load the
+			configuration, fill the sensor buffers, then hold the priming
+			signal until DRIVE_PRIME_TIME after construction and stop the
+			motors. Returns early if mStartup is cancelled.
+		*/
+		void runStartup();
+
+		/**
+			Update the sensor value buffers, through the filters (see
+			storeReadings()). A reading that fails is left out (the buffer
+			keeps the previous values) and clears mI2COk.
+			With an I2CEngine, so does a read that hasn't completed by the
+			next update.
 
 			Does not throw exceptions.
 		*/
 		void updateSensors();
 
+		/**
+			Read the magnetometer into mMagField, or through engine if not 0
+			(using the reading submitted by the last update). A failed or
+			saturated reading clears mMagValid.
+
+			Does not throw exceptions.
+		*/
+		void updateMagnetometer(I2CEngine *engine);
+
+		/**
+			Step the barometer (through engine if not 0), and the altitude
+			estimate with the vertical part of accel (calibrated, in g).
+
+			Does not throw exceptions.
+		*/
+		void updateAltitude(float dtime, Vector3<float> accel,
+				I2CEngine *engine);
+
+		/**
+			Estimate the orientation with the EKF, instead of
+			calculateOrientation(). The gyroscope's rates have the EKF's bias
+			estimate removed, for stabilize().
+		*/
+		void estimateEKF(float dtime, Vector3<float> accel,
+				Vector3<float> &gyro);
+
+		/**
+			Get the altitude and climb rate from the estimator in use.
+			Returns false if there is no estimate yet.
+		*/
+		bool getAltitudeEstimate(float &altitude, float &climbrate);
+
+		/**
+			Set the speed of all motors and send them to the PWM (flushing
+			them to its engine, if any). Clears mI2COk if that fails, or if
+			the writes have been deferred behind earlier ones for
+			DRIVE_PWM_MAX_DEFERRED updates in a row. A busy bus alone is not
+			a failure.
+
+			Does not throw exceptions.
+		*/
+		void setMotorSpeeds(const float *speeds);
+
+		/**
+			As setMotorSpeeds(), but with each motor's PWM count (as from
+			FixedRateLoop), sent as it is, without dithering
+
+			Does not throw exceptions.
+		*/
+		void setMotorCounts(const uint16_t *counts);
+
+		/**
+			Flush the motors' loads for setMotorSpeeds()/setMotorCounts(),
+			and account for the result in mI2COk and mPWMDeferred
+		*/
+		void flushMotors();
+
 		/**
 			Calculate orientation based on stored sensor values (i.e. call
 			updateSensors() before using this). dtime is the change in time since
 			the last call to this function.
 
-			Stores results in mRoll, mPitch, and mYaw.
+			Stores results in mRoll, mPitch, and mYaw. With a magnetometer
+			reading, yaw is corrected towards its heading; with dtime 0, it
+			is set to the heading.
 		*/
 		void calculateOrientation(float dtime, Vector3<float> accel,
 				Vector3<float> gyro);
@@ -353,11 +1089,52 @@ class Drive {
 			desired orientation per mRoll/mPitch/mYaw.
 
 			gyro should be the current, averaged gyroscope reading. This is to
-			avoid recalculating the average.
+			avoid recalculating the average. dtime is the time since the last
+			call, in seconds.
+
+			Adjusts motor speeds accordingly, around mThrottle.
+		*/
+		void stabilize(Vector3<float> gyro, float dtime);
+
+		/**
+			The Rate stage and mixer of stabilize() in mFixedLoop: tracks
+			ratetargets (dps, roll pitch yaw) with mGyroRaw, and sends the
+			motors' PWM counts.
+		*/
+		void stabilizeFixed(const float *ratetargets);
+
+		/**
+			Set the coefficients of both stages from the gain schedule, if gain
+			scheduling is on. Skipped for this update if the schedule is being
+			replaced.
+		*/
+		void applyGainSchedule();
 
-			Adjusts motor speeds accordingly.
+		/**
+			Set the given coefficients on all axes of both stages, without
+			resetting any state.
 		*/
-		void stabilize(Vector3<float> gyro);
+		void setGains(const float *angle, const float *rate);
+
+		/**
+			Called from stabilize() once the tuner has stopped running. Applies
+			the result if requested and hands the axis back to its PID.
+		*/
+		void finishAutoTune();
+
+		/**
+			Read the gyroscope temperature into mGyroTemperature. Keeps the
+			previous value if the read fails.
+		*/
+		void updateTemperature();
+
+		/**
+			Feed the stillness detector while on the ground, and update the
+			gyroscope calibration from every still window. Then copy it to
+			mGyroCalApplied. Skipped while calibrate() holds mGyroCalLock.
+		*/
+		void trackGyroBias(const Vector3<float> &accel,
+				const Vector3<float> &gyro);
 
 		/**
 			Returns the average of the values in mAccelValue
@@ -370,30 +1147,42 @@ class Drive {
 		Vector3<float> averageGyroscope();
 
 		/**
-			Save the values currently used as calibration to disk.
+			Pass new readings through mFilter, and store them in mAccelValue
+			and mGyroValue. Either may be 0 if its read failed: it is left
+			out of the buffer, and its last reading is held for the filters,
+			so that they keep stepping once per update on every channel.
+		*/
+		void storeReadings(const Vector3<float> *accel,
+				const Vector3<float> *gyro);
 
-			File format:
-				AccelX=###.###
-				AccelY=###.###
-				AccelZ=###.###
-				GyroX=###.###
-				GyroY=###.###
-				GyroZ=###.###
+		/**
+			Settle mFilter at the current averaged readings
+		*/
+		void resetFilter();
+
+		/**
+			Load the calibration and PID coefficients from CONFIG_FILE, or
+			import the calibration from CONFIG_LEGACY_FILE if there is none.
 
-			Lines may appear in any order, and numbers must be float
-			format.
+			Throws ConfigException if neither could be loaded.
+		*/
+		void loadConfig();
+
+		/**
+			Replace the given sections (CONFIG_* bits) of CONFIG_FILE with
+			those of config, keeping the others. If the file cannot be loaded,
+			it is replaced with only the given sections.
 
-			Throws CalibrationException if the file could not be written.
+			Throws ConfigException if the file could not be written.
 		*/
-		void saveCalibration(const std::string &filename);
+		void updateConfig(const Config &config, uint32_t sections);
 
 		/**
-			Loads the values from the calibration file into the calibration
-			member variables.
+			Save the values currently used as calibration to CONFIG_FILE.
 
-			Throws CalibrationException if the file does not exist.
+			Throws ConfigException if the file could not be written.
 		*/
-		void loadCalibration(const std::string &filename);
+		void saveCalibration();
 };
 
 #endif
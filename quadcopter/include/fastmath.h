@@ -0,0 +1,121 @@
+/*
+	fastmath.h
+
+	Single-precision approximations of the libm functions used by the
+	estimators every update. All are inline, branch-light and stay in float
+	(libm's atan2(), sin() and cos() take and return doubles, which is slow
+	on the Raspberry Pi's VFP).
+
+	Maximum errors, checked against libm by tests/test_fastmath.cpp:
+
+		fastAtan2()   : FAST_ATAN2_MAX_ERROR radians (absolute)
+		fastInvSqrt() : FAST_INVSQRT_MAX_ERROR (relative)
+		fastSqrt()    : exact (the FPU's instruction)
+		fastSinCos()  : FAST_SINCOS_MAX_ERROR (absolute, |angle| <= 1000)
+
+	All well below the sensors' own noise (the accelerometer's angle is
+	good to a few tenths of a degree).
+*/
+
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+#define FAST_ATAN2_MAX_ERROR   2.0e-6f
+#define FAST_INVSQRT_MAX_ERROR 5.0e-6f
+#define FAST_SINCOS_MAX_ERROR  2.0e-7f
+
+// Unit conversions, in float
+#define DEGREES_PER_RADIAN 57.29577951f
+#define RADIANS_PER_DEGREE 0.01745329252f
+
+#define FAST_PI      3.14159265f
+#define FAST_HALF_PI 1.57079633f
+
+/**
+	atan2(y, x) in radians, in [-pi, pi]. An odd minimax polynomial on
+	[0, 1] for atan(min / max), then the octant is restored. Returns 0 for
+	(0, 0); doesn't distinguish signed zeros.
+*/
+inline float fastAtan2(float y, float x) {
+	float ax = fabsf(x), ay = fabsf(y);
+	float hi = (ax > ay ? ax : ay),
+	      lo = (ax > ay ? ay : ax);
+	if (hi == 0.0f)
+		return 0.0f;
+
+	float z = lo / hi, z2 = z * z;
+	float a = z * (0.99997726f + z2 * (-0.33262347f + z2 * (0.19354346f
+			+ z2 * (-0.11643287f + z2 * (0.05265332f
+			+ z2 * -0.01172120f)))));
+
+	if (ay > ax)
+		a = FAST_HALF_PI - a;
+	if (x < 0.0f)
+		a = FAST_PI - a;
+	return (y < 0.0f ? -a : a);
+}
+
+/**
+	fastAtan2(), in degrees
+*/
+inline float fastAtan2Degrees(float y, float x) {
+	return fastAtan2(y, x) * DEGREES_PER_RADIAN;
+}
+
+/**
+	1 / sqrt(x), for x > 0: an estimate from the float's bits, refined by
+	two Newton-Raphson steps
+*/
+inline float fastInvSqrt(float x) {
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	bits = 0x5f375a86 - (bits >> 1);
+	float y;
+	memcpy(&y, &bits, sizeof(y));
+
+	float half = 0.5f * x;
+	y = y * (1.5f - half * y * y);
+	y = y * (1.5f - half * y * y);
+	return y;
+}
+
+/**
+	sqrt(x) in float, 0 for x <= 0. The FPU's square root instruction
+	(VFP's vsqrt, SSE's sqrtss) is faster than x * fastInvSqrt(x), so this
+	only keeps the work out of double and skips libm's errno handling.
+*/
+inline float fastSqrt(float x) {
+	return (x > 0.0f ? __builtin_sqrtf(x) : 0.0f);
+}
+
+/**
+	Sine and cosine of an angle in radians, together. The angle is reduced
+	to [-pi/4, pi/4] around the nearest multiple of pi/2, and both
+	polynomials evaluated there.
+*/
+inline void fastSinCos(float radians, float &sine, float &cosine) {
+	float qf = radians * (2.0f / FAST_PI);
+	int   q = (int)(qf + (qf >= 0.0f ? 0.5f : -0.5f));
+
+	// pi/2 in three parts, the first two short enough that q times them is
+	// exact (Cody-Waite reduction)
+	float r = ((radians - q * 1.5703125f) - q * 4.83870506e-4f)
+			- q * -4.37113883e-8f;
+	float r2 = r * r;
+	float s = r + r * r2 * (-1.66666667e-1f + r2 * (8.33333333e-3f
+			+ r2 * (-1.98412698e-4f + r2 * 2.75573192e-6f)));
+	float c = 1.0f + r2 * (-0.5f + r2 * (4.16666667e-2f
+			+ r2 * (-1.38888889e-3f + r2 * 2.48015873e-5f)));
+
+	// Quadrant, without branches: odd quadrants swap sine and cosine, and
+	// the signs follow q
+	float odd = (float)(q & 1);
+	sine = (s + (c - s) * odd) * (float)(1 - (q & 2));
+	cosine = (c + (s - c) * odd) * (float)(1 - ((q + 1) & 2));
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+	fft.h
+
+	RealFFT class - fast Fourier transform of real samples, radix-2
+
+	transform() replaces size real samples with their spectrum, in the
+	caller's buffer, packed as:
+
+		data[0]          : X[0]          (real, the DC component)
+		data[1]          : X[size / 2]   (real, the Nyquist component)
+		data[2k], [2k+1] : X[k] real and imaginary parts, 0 < k < size / 2
+
+	X[k] = sum of x[n] * e^(-2 pi i k n / size), unnormalized; the bins
+	above size / 2 are the conjugates of those below, so are not stored.
+
+	The samples are treated as size / 2 complex values, transformed by an
+	iterative radix-2 FFT and then split into the spectrum of the real
+	signal. The bit reversal is folded into the copy into the object's
+	workspace, which keeps real and imaginary parts in separate arrays, and
+	each stage's twiddle factors are stored contiguously, so the butterfly
+	loops run over consecutive elements and are vectorized by the compiler.
+	Tables and workspace are allocated once, by the constructor; transform()
+	does not allocate, but an object must not be used by two threads at once.
+*/
+
+#ifndef FFT_H
+#define FFT_H
+
+// Range of transform sizes
+#define FFT_MIN_SIZE 4
+#define FFT_MAX_SIZE 65536
+
+class RealFFT {
+	public:
+		/**
+			Constructor
+
+			size is the number of real samples per transform. It is rounded
+			down to a power of two, within FFT_MIN_SIZE to FFT_MAX_SIZE (see
+			getSize()).
+		*/
+		RealFFT(int size);
+
+		/**
+			Destructor
+		*/
+		~RealFFT();
+
+		/**
+			Returns the number of samples per transform
+		*/
+		int getSize();
+
+		/**
+			Transform getSize() real samples in data into their packed
+			spectrum (see above), in place
+		*/
+		void transform(float *data);
+
+		/**
+			From a packed spectrum, fill power with |X[k]|^2 for
+			k = 0 .. getSize() / 2 (getSize() / 2 + 1 values)
+		*/
+		void power(const float *data, float *power);
+
+	private:
+		int   mSize,
+		      mHalf;        // Complex points, mSize / 2
+
+		int   *mReverse;    // Bit reversal of mHalf indices
+
+		// Workspace, in bit-reversed then natural order
+		float *mRe,
+		      *mIm;
+
+		// Twiddle factors for the stage of span h (h = 1, 2, 4 .. mHalf / 2)
+		// at [h - 1 .. 2h - 2], e^(-pi i k / h)
+		float *mTwiddleRe,
+		      *mTwiddleIm;
+
+		// Twiddle factors for the split into the real spectrum,
+		// e^(-2 pi i k / mSize) for k = 0 .. mHalf / 2
+		float *mSplitRe,
+		      *mSplitIm;
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as
+			the object owns its tables.
+		*/
+		RealFFT(const RealFFT &other);
+		RealFFT &operator=(const RealFFT &other);
+};
+
+#endif
@@ -0,0 +1,205 @@
+/*
+	filterchain.h
+
+	FilterChain class - per-channel chains of filter stages for pre-filtering
+		the sensor readings, compiled into one flat array
+
+	Each channel (e.g. a sensor axis) is given its own list of stages with
+	setStages(), typically from the configuration (see Config::filters).
+	The stage types are:
+
+		FILTER_LOWPASS1 : first order low-pass. frequency is the -3dB cutoff.
+		FILTER_LOWPASS2 : second order low-pass (Biquad::setLowPass()).
+		                  frequency is the -3dB cutoff, param the q
+		                  (0.7071 : Butterworth).
+		FILTER_NOTCH    : notch (Biquad::setNotch()). frequency is the
+		                  centre, param the q.
+		FILTER_BANDSTOP : the same section as a notch, given by the edges of
+		                  the band instead: frequency is the lower -3dB
+		                  edge, param the upper.
+		FILTER_MEDIAN   : median of the last param readings (odd, 3 to
+		                  FILTER_MAX_MEDIAN). Removes single spikes that a
+		                  linear filter would only spread out.
+
+	compile() then lays out every stage of every channel in a single array
+	of coefficients and state, and builds a list of steps over it, which
+	process() walks once per tick, front to back, with no allocation and no
+	lookups: the data of the next step always follows that of the last.
+	Each step is a run of up to four neighbouring channels with the same
+	type of stage at the same position in their chains (e.g. the first stage
+	of all three gyroscope axes), one channel in each lane of a vector, as
+	in PIDBank: the run's channels are filtered together in a handful of
+	vector operations, rather than each through a dispatch of its own. A
+	channel without stages costs nothing.
+
+	Stages set after compile() take effect at the next compile(). Neither
+	setStages() nor compile() may be called while another thread is in
+	process().
+*/
+
+#ifndef FILTERCHAIN_H
+#define FILTERCHAIN_H
+
+#include <string>
+#include <stdint.h>
+
+#include "exception.h"
+
+// Most stages per channel, and the longest median window
+#define FILTER_MAX_STAGES 4
+#define FILTER_MAX_MEDIAN 7
+
+class FilterException : public Exception {
+	public:
+		FilterException(const std::string &msg, const std::string &file,
+				int line) : Exception(msg, file, line) { }
+};
+
+enum FilterType {
+	FILTER_NONE = 0,      // Empty slot, skipped
+	FILTER_LOWPASS1 = 1,
+	FILTER_LOWPASS2 = 2,
+	FILTER_NOTCH = 3,
+	FILTER_BANDSTOP = 4,
+	FILTER_MEDIAN = 5
+};
+
+struct FilterStage {
+	FilterType type;
+	float      frequency,  // Hz, see FilterType
+	           param;
+
+	// FILTER_NONE
+	FilterStage();
+	FilterStage(FilterType type, float frequency, float param = 0.0f);
+};
+
+class FilterChain {
+	public:
+		/**
+			Constructor
+
+			samplerate is the rate at which process() is called, in Hz.
+			Every channel starts without stages.
+		*/
+		FilterChain(float samplerate, int channels);
+
+		/**
+			Destructor
+		*/
+		~FilterChain();
+
+		/**
+			Returns the number of channels
+		*/
+		int getChannels();
+
+		/**
+			Replace the stages of a channel with the given count stages, in
+			the order they are applied. FILTER_NONE stages are skipped.
+
+			Throws FilterException, leaving the channel unchanged, if the
+			channel does not exist, there are more than FILTER_MAX_STAGES
+			stages, or a stage is invalid (a type not listed above, a
+			frequency outside 0 to half the sample rate, a q <= 0, a band's
+			edges the wrong way round or a bad median window).
+		*/
+		void setStages(int channel, const FilterStage *stages, int count);
+
+		/**
+			Returns the number of stages (not counting FILTER_NONE) of a
+			channel, as set
+		*/
+		int getStageCount(int channel);
+
+		/**
+			Lay out the stages into the flat array for process(). Filter
+			state starts at 0; see reset().
+		*/
+		void compile();
+
+		/**
+			Filter one reading of every channel, in place
+		*/
+		void process(float *values);
+
+		/**
+			Reset the state such that each channel is settled at the given
+			value (as if it had been fed for a long time)
+		*/
+		void reset(const float *values);
+
+	private:
+		/*
+			A step of process(): the type of stage, the run of lanes (up to
+			4) channels from channel it works on, and the number of vectors
+			of mData it owns (which start where those of the previous step
+			end)
+		*/
+		struct Step {
+			uint8_t  type;
+			uint8_t  channel;
+			uint8_t  lanes;
+			uint16_t size;
+		};
+
+		typedef float v4sf __attribute__((vector_size(16)));
+
+		float mSampleRate;
+		int   mChannels;
+
+		// Stages as set, FILTER_MAX_STAGES per channel
+		FilterStage *mStages;
+		int         *mCounts;
+
+		// Compiled
+		Step *mSteps;
+		int  mNumSteps;
+		v4sf *mData;
+
+		/**
+			Throws FilterException if the stage is invalid
+		*/
+		void validate(const FilterStage &stage);
+
+		/**
+			Returns a channel's stage at the given position in its chain
+		*/
+		const FilterStage &stageAt(int channel, int level) {
+			return mStages[channel * FILTER_MAX_STAGES + level];
+		}
+
+		/**
+			Returns the number of channels (at most 4), from channel on,
+			whose stage at level can be run together with channel's, or 0 if
+			channel has no stage there
+		*/
+		int runLength(int level, int channel);
+
+		/**
+			Returns the number of vectors of mData a stage's step takes
+		*/
+		static int dataSize(const FilterStage &stage);
+
+		/**
+			Write a stage's initial coefficients and state into the given
+			lane of its step's data
+		*/
+		void initialize(const FilterStage &stage, v4sf *data, int lane);
+
+		/**
+			Returns a reference to a lane's element of a vector
+		*/
+		static float &at(v4sf &vector, int lane) {
+			return ((float *)&vector)[lane];
+		}
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as
+			the chain owns its arrays.
+		*/
+		FilterChain(const FilterChain &other);
+		FilterChain &operator=(const FilterChain &other);
+};
+
+#endif
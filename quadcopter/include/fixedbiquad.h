@@ -0,0 +1,75 @@
+/*
+	fixedbiquad.h
+
+	FixedBiquad class - Biquad in integer arithmetic
+
+	The same transposed direct form II section as Biquad, on Q16 signals
+	with Q2.29 coefficients (see fixedpoint.h). The coefficients are
+	converted from a configured Biquad, so every response Biquad offers is
+	available, and the two agree to within the rounding of the formats.
+
+	process() is integer-only, and does no allocation and no branching.
+*/
+
+#ifndef FIXEDBIQUAD_H
+#define FIXEDBIQUAD_H
+
+#include <stdint.h>
+
+#include "fixedpoint.h"
+#include "biquad.h"
+
+class FixedBiquad {
+	public:
+		/**
+			Constructor
+
+			Initializes the filter as a pass-through (output = input).
+		*/
+		FixedBiquad();
+
+		/**
+			Take the coefficients of the given (float) Biquad. The state is
+			kept, as with Biquad's set*() functions.
+		*/
+		void set(Biquad &biquad);
+
+		/**
+			Configure as a 2nd order low-pass filter. See Biquad::setLowPass().
+		*/
+		void setLowPass(float cutoff, float samplerate, float q = 0.7071f);
+
+		/**
+			Configure as a pass-through (output = input).
+		*/
+		void setPassThrough();
+
+		/**
+			Filter a single Q16 sample and return the filtered value.
+		*/
+		int32_t process(int32_t in) {
+			int32_t out = saturate32(roundShift((int64_t)mB0 * in,
+					BIQUAD_Q_SHIFT) + mZ1);
+			mZ1 = saturate32(roundShift((int64_t)mB1 * in
+					- (int64_t)mA1 * out, BIQUAD_Q_SHIFT) + mZ2);
+			mZ2 = saturate32(roundShift((int64_t)mB2 * in
+					- (int64_t)mA2 * out, BIQUAD_Q_SHIFT));
+			return out;
+		}
+
+		/**
+			Reset the filter state such that it is settled at the given Q16
+			value. See Biquad::reset().
+		*/
+		void reset(int32_t value = 0);
+
+	private:
+		// Coefficients (a0 = 1), Q2.29
+		int32_t mB0, mB1, mB2,
+		        mA1, mA2;
+
+		// State, Q16
+		int32_t mZ1, mZ2;
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*
+	fixedpid.h
+
+	FixedPID class - PIDController in integer arithmetic, at a fixed rate
+
+	Behaves as a PIDController fed at a fixed samplerate with its defaults:
+	derivative on the measurement (optionally filtered), and conditional
+	integration (ANTIWINDUP_CLAMP) against the output limits. Values,
+	targets and the output are Q16 (see fixedpoint.h), in the units the
+	float controller would use.
+
+	As the rate is fixed, the time step is folded into the gains when they
+	are set: I * dtime and D / dtime are single FixedGains, so feed() has
+	no division.
+
+	feed() is integer-only and does not allocate or read the clock.
+*/
+
+#ifndef FIXEDPID_H
+#define FIXEDPID_H
+
+#include <stdint.h>
+
+#include "fixedpoint.h"
+#include "fixedbiquad.h"
+
+class FixedPID {
+	public:
+		/**
+			Constructor
+
+			All coefficients and the target start at 0, with no limits and
+			an unfiltered derivative. samplerate is the rate feed() will be
+			called at, in Hz.
+		*/
+		FixedPID(float samplerate);
+
+		/**
+			Set the coefficients, in the float controller's units
+		*/
+		void setPID(float p, float i, float d);
+
+		/**
+			Set the target (Q16)
+		*/
+		void setTarget(int32_t target);
+
+		/**
+			Limit the output and the integral term's contribution to it. See
+			PIDController::setOutputLimits() and setIntegralLimit().
+		*/
+		void setOutputLimits(float min, float max);
+		void setIntegralLimit(float limit);
+
+		/**
+			Filter the derivative with a 2nd order low-pass at cutoff Hz. See
+			PIDController::setDerivativeFilter().
+		*/
+		void setDerivativeFilter(float cutoff);
+
+		/**
+			Feed a Q16 value, one sample period after the last, and return
+			the new output (Q16)
+		*/
+		int32_t feed(int32_t value);
+
+		/**
+			Returns the last output (Q16)
+		*/
+		int32_t output();
+
+		/**
+			Reset the integral term and the derivative's history
+		*/
+		void reset();
+
+	private:
+		float       mSampleRate;
+
+		FixedGain   mP,
+		            mIdt,  // I * dtime
+		            mDdt;  // D / dtime
+		int32_t     mTarget,
+		            mOutputMin,
+		            mOutputMax,
+		            mIntegralLimit;
+
+		FixedBiquad mDerivativeFilter;
+
+		// State
+		int32_t     mIntegralTerm,
+		            mLastInput,
+		            mOutput;
+		bool        mHasLastInput;
+};
+
+#endif
@@ -0,0 +1,124 @@
+/*
+	fixedpoint.h
+
+	Fixed-point formats and arithmetic for the integer control path (see
+	FixedRateLoop), for targets without an FPU.
+
+	Signals are Q16: int32_t with 16 fraction bits, e.g. degrees/second or
+	a motor speed fraction. That covers +/-32768 with a resolution of
+	1.5e-5, far finer than any sensor. Filter coefficients are Q2.29
+	(BIQUAD_Q_SHIFT), enough for the range of a stable biquad's (|a1| < 2).
+
+	Gains, whose sizes vary by orders of magnitude (a PID's I times dtime
+	against its D over dtime), are FixedGain: a 30-bit mantissa with its
+	own shift, so every gain keeps full precision.
+
+	Products are formed in 64 bits (one SMULL on ARM) and rounded back.
+	Everything saturates instead of wrapping. Only construction from float
+	(done once, when configuring) touches floating point.
+*/
+
+#ifndef FIXEDPOINT_H
+#define FIXEDPOINT_H
+
+#include <stdint.h>
+#include <math.h>
+
+#define Q16_SHIFT 16
+#define Q16_ONE   (1 << Q16_SHIFT)
+
+#define BIQUAD_Q_SHIFT 29
+
+/**
+	Clip a 64-bit intermediate to int32_t
+*/
+inline int32_t saturate32(int64_t value) {
+	if (value > INT32_MAX)
+		return INT32_MAX;
+	if (value < INT32_MIN)
+		return INT32_MIN;
+	return (int32_t)value;
+}
+
+/**
+	Clip value to [min, max]
+*/
+inline int32_t clip32(int32_t value, int32_t min, int32_t max) {
+	return (value < min ? min : (value > max ? max : value));
+}
+
+/**
+	Shift right by shift bits (> 0), rounding to nearest
+*/
+inline int64_t roundShift(int64_t value, int shift) {
+	return (value + ((int64_t)1 << (shift - 1))) >> shift;
+}
+
+/**
+	Conversions between float and a fixed-point value with the given number
+	of fraction bits (rounded, saturated)
+*/
+inline int32_t toFixed(float value, int fraction) {
+	double scaled = floor((double)value * (double)((int64_t)1 << fraction)
+			+ 0.5);
+	if (scaled > (double)INT32_MAX)
+		return INT32_MAX;
+	if (scaled < (double)INT32_MIN)
+		return INT32_MIN;
+	return (int32_t)scaled;
+}
+
+inline float fromFixed(int32_t value, int fraction) {
+	return (float)((double)value / (double)((int64_t)1 << fraction));
+}
+
+inline int32_t toQ16(float value) {
+	return toFixed(value, Q16_SHIFT);
+}
+
+inline float fromQ16(int32_t value) {
+	return fromFixed(value, Q16_SHIFT);
+}
+
+/**
+	A gain (multiplier) of any size, as mantissa * 2^-shift, with the
+	mantissa normalized to 30 bits
+*/
+struct FixedGain {
+	int32_t mantissa;
+	int     shift;
+
+	// Zero
+	FixedGain() : mantissa(0), shift(0)
+		{ }
+
+	explicit FixedGain(float gain) {
+		int exponent;
+		double m = frexp((double)gain, &exponent); // |m| in [0.5, 1)
+		shift = 30 - exponent;
+		if (gain == 0.0f || shift > 62) {
+			mantissa = 0;
+			shift = 0;
+		} else if (shift < 1) {
+			// Too large to represent: the largest there is
+			mantissa = (gain > 0.0f ? INT32_MAX : -INT32_MAX);
+			shift = 1;
+		} else
+			mantissa = (int32_t)floor(m * (double)(1 << 30) + 0.5);
+	}
+
+	/**
+		Returns value * gain, in value's format
+	*/
+	int32_t apply(int32_t value) const {
+		if (shift == 0)
+			return 0;
+		return saturate32(roundShift((int64_t)value * mantissa, shift));
+	}
+
+	float toFloat() const {
+		return (float)ldexp((double)mantissa, -shift);
+	}
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+	fixedrateloop.h
+
+	FixedRateLoop class - the rate stage of the control loop in integer
+		arithmetic, from raw gyroscope counts to PWM counts.
+
+	Each update() takes the gyroscope's raw int16 reading and, for each
+	axis (0 roll = gyroscope X, 1 pitch = Y, 2 yaw = Z, as Drive):
+
+		calibration : counts * dps/LSB - bias at the configured temperature
+		filter      : a FixedBiquad low-pass (pass-through by default)
+		Rate PID    : a FixedPID, towards the target rate
+
+	then mixes the corrections with the throttle exactly as
+	Drive::stabilize() does, and converts each motor's speed to the 12-bit
+	count Motor and PWM::setHighTime() would have produced, ready for
+	PWM::setExactLoad().
+
+	Rates and targets are Q16 degrees/second, the throttle a Q16 fraction
+	(see fixedpoint.h). Configuration takes float, once; update() is
+	integer-only, so the loop runs on FPU-less co-processors, and doesn't
+	allocate or lock. tests/test_fixedpoint.cpp checks it against the float
+	path. Drive::stabilize() runs its Rate stage and mix on it if built with
+	FIXED_RATE_LOOP.
+*/
+
+#ifndef FIXEDRATELOOP_H
+#define FIXEDRATELOOP_H
+
+#include <stdint.h>
+
+#include "fixedpoint.h"
+#include "fixedbiquad.h"
+#include "fixedpid.h"
+#include "calibration.h"
+
+#define FIXED_RATE_AXES 3
+
+class FixedRateLoop {
+	public:
+		/**
+			Constructor
+
+			samplerate is the rate update() will be called at, in Hz. Starts
+			with a scale of 1 dps/LSB, no bias, unfiltered, all PID
+			coefficients 0 and a motor range of 0 to 4095 counts.
+		*/
+		FixedRateLoop(float samplerate);
+
+		/**
+			Destructor
+		*/
+		~FixedRateLoop();
+
+		/**
+			Set the gyroscope's scale, in degrees/second per LSB (e.g.
+			0.07 at 2000dps)
+		*/
+		void setGyroScale(float dpsperlsb);
+
+		/**
+			Take the bias from a gyroscope calibration, at the given
+			temperature (update again as the temperature changes)
+		*/
+		void setGyroCalibration(const GyroCalibration &calibration,
+				float temperature);
+
+		/**
+			Low-pass the calibrated rates at cutoff Hz (<= 0: no filter)
+		*/
+		void setGyroFilter(float cutoff);
+
+		/**
+			Configure the Rate PID of one axis, or of all. See FixedPID.
+		*/
+		void setPID(int axis, float p, float i, float d);
+		void setPID(float p, float i, float d);
+		void setOutputLimits(float min, float max);
+		void setIntegralLimit(float limit);
+		void setDerivativeFilter(float cutoff);
+
+		/**
+			Set the motors' signal range as given to Motor (high times in
+			milliseconds for speeds 0 and 1), at the PWM's frequency (Hz)
+		*/
+		void setMotorRange(float min_hightime, float max_hightime,
+				float frequency);
+
+		/**
+			Run one step: raw gyroscope counts (x, y, z), Q16 target rates
+			(roll, pitch, yaw) and the Q16 throttle in, one PWM count per
+			motor (front left, front right, rear right, rear left) out
+		*/
+		void update(const int16_t *raw, const int32_t *targets,
+				int32_t throttle, uint16_t *counts);
+
+		/**
+			Return the last filtered rate (Q16 dps) and Rate PID output (Q16)
+			of an axis
+		*/
+		int32_t getRate(int axis);
+		int32_t getCorrection(int axis);
+
+		/**
+			Reset the filters and PIDs
+		*/
+		void reset();
+
+	private:
+		float       mSampleRate;
+
+		FixedGain   mScale;  // dps/LSB, into Q16
+		int32_t     mBias[FIXED_RATE_AXES];
+		FixedBiquad mFilter[FIXED_RATE_AXES];
+		FixedPID    *mPID[FIXED_RATE_AXES];
+
+		// Mixer: corrections are in hundredths of a motor speed
+		FixedGain   mCorrectionScale;
+		int32_t     mMinCount,   // Q16 counts at speed 0
+		            mCountSpan;  // Q16 counts from speed 0 to 1
+
+		int32_t     mRate[FIXED_RATE_AXES],
+		            mCorrection[FIXED_RATE_AXES];
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as
+			the loop owns its PIDs.
+		*/
+		FixedRateLoop(const FixedRateLoop &other);
+		FixedRateLoop &operator=(const FixedRateLoop &other);
+};
+
+#endif
@@ -0,0 +1,178 @@
+/*
+	flightstate.h
+
+	FlightState class - arming and failsafe state machine, stepped by the
+		control loop.
+
+	States:
+
+		STATE_DISARMED : motors stopped. arm() moves to STATE_ARMING, if the
+		                 throttle is low, the radio link is fresh and the
+		                 sensors are working.
+		STATE_ARMING   : motors still stopped, for FLIGHT_ARMING_TIME. Any
+		                 fault, raising the throttle or disarm() goes back to
+		                 STATE_DISARMED; otherwise on to STATE_ARMED.
+		STATE_ARMED    : flying; the commanded throttle is passed through.
+		STATE_FAILSAFE : the link was lost, the sensors are failing or the
+		                 loop is overrunning. The throttle ramps down from
+		                 where it was at FLIGHT_DESCENT_RATE, ignoring the
+		                 pilot, until it reaches 0 (STATE_DISARMED). Only
+		                 disarm() and kill() are obeyed.
+		STATE_KILLED   : motors stopped immediately, by kill() or by the
+		                 sensors failing for too long to descend safely.
+		                 Stays killed until disarm().
+
+	Watchdogs, all measured in the loop's own time (the dtime passed to
+	update()), so that simulation is exact:
+
+		Link    : time since packetReceived() over FLIGHT_LINK_TIMEOUT
+		I2C     : FLIGHT_I2C_FAILSAFE consecutive updates with a failed
+		          transaction (FLIGHT_I2C_KILL to kill)
+		Overrun : FLIGHT_MAX_OVERRUNS consecutive updates more than
+		          FLIGHT_OVERRUN_FACTOR update periods apart
+
+	Every watchdog and command is checked on every update(), so the reaction
+	to a fault comes at the first update after its threshold is crossed:
+	within one update period of the threshold.
+
+	arm(), disarm(), kill() and packetReceived() may be called from any
+	thread; they don't lock, and take effect at the next update(). update()
+	and the functions that read its results must only be called from the
+	control loop, except getState() and getReason(), which may be called
+	from anywhere.
+*/
+
+#ifndef FLIGHTSTATE_H
+#define FLIGHTSTATE_H
+
+// Seconds without a packet before failsafe
+#define FLIGHT_LINK_TIMEOUT 0.5f
+
+// Consecutive updates with an I2C failure before failsafe, and before the
+// motors are killed outright
+#define FLIGHT_I2C_FAILSAFE 5
+#define FLIGHT_I2C_KILL     25
+
+// An update more than FLIGHT_OVERRUN_FACTOR periods after the last is an
+// overrun. FLIGHT_MAX_OVERRUNS in a row trigger failsafe.
+#define FLIGHT_OVERRUN_FACTOR 2.0f
+#define FLIGHT_MAX_OVERRUNS   5
+
+// Seconds spent in STATE_ARMING, and the highest throttle allowed to arm
+#define FLIGHT_ARMING_TIME       1.0f
+#define FLIGHT_ARM_MAX_THROTTLE  0.05f
+
+// Throttle decrease per second in STATE_FAILSAFE
+#define FLIGHT_DESCENT_RATE 0.1f
+
+class FlightState {
+	public:
+		enum State {
+			STATE_DISARMED = 0,
+			STATE_ARMING = 1,
+			STATE_ARMED = 2,
+			STATE_FAILSAFE = 3,
+			STATE_KILLED = 4
+		};
+
+		/**
+			Why the current state was entered, or why the last arm() was
+			refused
+		*/
+		enum Reason {
+			REASON_NONE = 0,
+			REASON_COMMAND = 1,       // arm(), disarm() or kill()
+			REASON_LINK_LOST = 2,
+			REASON_SENSOR_FAULT = 3,  // Consecutive I2C failures
+			REASON_OVERRUN = 4,
+			REASON_THROTTLE_HIGH = 5, // Throttle above FLIGHT_ARM_MAX_THROTTLE
+			REASON_DESCENDED = 6      // Failsafe descent finished
+		};
+
+		/**
+			Constructor
+
+			updaterate is the rate at which update() is meant to be called, in
+			Hz, for the overrun watchdog. Starts in STATE_DISARMED.
+		*/
+		FlightState(int updaterate);
+
+		/**
+			Commands. Take effect at the next update().
+		*/
+		void arm();
+		void disarm();
+		void kill();
+
+		/**
+			Note that a packet has arrived over the radio link
+		*/
+		void packetReceived();
+
+		/**
+			Step the state machine. dtime is the time since the last update,
+			in seconds; throttle is the commanded throttle (0.0 to 1.0);
+			i2cok is false if any I2C transaction failed since the last
+			update. Returns the new state.
+		*/
+		State update(float dtime, float throttle, bool i2cok);
+
+		/**
+			Returns the current state / the reason it was entered.
+		*/
+		State  getState();
+		Reason getReason();
+
+		/**
+			Returns true if the motors should be running (STATE_ARMED or
+			STATE_FAILSAFE).
+		*/
+		bool isMotorsEnabled();
+
+		/**
+			Returns the throttle to fly with, as of the last update(): the
+			commanded throttle when armed, the descent throttle in failsafe,
+			otherwise 0.
+		*/
+		float getThrottle();
+
+		/**
+			Returns the seconds since the last packet, as of the last update()
+		*/
+		float getPacketAge();
+
+	private:
+		// Commands waiting for update(), as bits
+		enum Command {
+			COMMAND_ARM = 1,
+			COMMAND_DISARM = 2,
+			COMMAND_KILL = 4
+		};
+
+		int    mCommands;        // Set atomically by any thread
+		int    mPackets;         // Incremented atomically by packetReceived()
+		int    mSeenPackets;     // mPackets at the last update()
+
+		State  mState;           // Written atomically, for getState()
+		Reason mReason;
+
+		float  mOverrunTime;     // dtime above which an update has overrun
+		float  mPacketAge;
+		int    mI2CFailures,     // Consecutive
+		       mOverruns;        // Consecutive
+		float  mArmingTime;      // Time spent in STATE_ARMING
+		float  mThrottle;        // Output throttle
+
+		/**
+			Change state, with the given reason
+		*/
+		void enter(State state, Reason reason);
+
+		/**
+			Returns the first watchdog to have tripped (REASON_NONE if none)
+		*/
+		Reason checkWatchdogs();
+};
+
+#endif
+
@@ -0,0 +1,128 @@
+/*
+	gainschedule.h
+
+	GainSchedule class - table of PID coefficients keyed by throttle (and,
+		optionally, battery voltage), for gain scheduling.
+
+	Rotor authority changes a lot over the throttle range (and as the battery
+	sags), so a single set of coefficients is either sluggish at low throttle
+	or oscillates at high throttle. A GainSchedule holds coefficients for both
+	stages of Drive's cascade at a number of breakpoints, and interpolates
+	linearly between them.
+
+	Breakpoints may be placed anywhere. build() resamples them onto a uniform
+	grid (GAINSCHEDULE_THROTTLE_POINTS x GAINSCHEDULE_VOLTAGE_POINTS), so that
+	lookup() is a constant-time bilinear interpolation with no searching. The
+	resampling keeps the breakpoints' values to within the grid spacing.
+
+	The breakpoints are kept in the config file, as its CONFIG_SCHEDULE
+	section (see ConfigStore); Drive loads them from there.
+*/
+
+#ifndef GAINSCHEDULE_H
+#define GAINSCHEDULE_H
+
+#include <string>
+#include <vector>
+
+#include "exception.h"
+
+// Size of the resampled table. Throttle 0.0 - 1.0 in steps of 1/32, and the
+// voltage range of the breakpoints in 8 steps.
+#define GAINSCHEDULE_THROTTLE_POINTS 33
+#define GAINSCHEDULE_VOLTAGE_POINTS  9
+
+class GainScheduleException : public Exception {
+	public:
+		GainScheduleException(const std::string &msg, const std::string &file,
+				int line) : Exception(msg, file, line) { }
+};
+
+class GainSchedule {
+	public:
+		/**
+			Coefficients of both stages, in the form taken by
+			PIDController::setPID()
+		*/
+		struct Gains {
+			float angle[3], // P, I, D of the Angle PIDs
+			      rate[3];  // P, I, D of the Rate PIDs
+		};
+
+		/**
+			One set of coefficients and the point they apply at
+		*/
+		struct Breakpoint {
+			float throttle, voltage;
+			Gains gains;
+		};
+
+		/**
+			Constructor
+
+			Creates an empty schedule. Add breakpoints with addBreakpoint(),
+			then call build().
+		*/
+		GainSchedule();
+
+		/**
+			Add a breakpoint. throttle is in the range of Drive's throttle (0.0
+			to 1.0). voltage is ignored unless breakpoints are given at more
+			than one voltage.
+
+			Has no effect on lookup() until the next build().
+		*/
+		void addBreakpoint(float throttle, float voltage, const Gains &gains);
+
+		/**
+			Returns the number of breakpoints added.
+		*/
+		int getBreakpointCount();
+
+		/**
+			Returns the breakpoint at the given index (0 to
+			getBreakpointCount() - 1). Breakpoints are kept sorted by
+			voltage, then throttle.
+		*/
+		const Breakpoint &getBreakpoint(int index);
+
+		/**
+			Resample the breakpoints onto the lookup grid. Values outside the
+			range of the breakpoints are held at the nearest breakpoint.
+
+			Throws GainScheduleException if there are no breakpoints.
+		*/
+		void build();
+
+		/**
+			Returns true until build() has succeeded.
+		*/
+		bool isEmpty();
+
+		/**
+			Returns the interpolated coefficients for the given throttle and
+			battery voltage. Does not allocate.
+
+			Must not be called on an empty schedule.
+		*/
+		Gains lookup(float throttle, float voltage);
+
+	private:
+		std::vector<Breakpoint> mBreakpoints;
+
+		// Resampled table, [voltage][throttle]
+		Gains mTable[GAINSCHEDULE_VOLTAGE_POINTS][GAINSCHEDULE_THROTTLE_POINTS];
+		int   mVoltagePoints; // 1 if scheduled by throttle only
+		float mVoltageMin,
+		      mVoltageScale;  // Grid index per volt
+		bool  mBuilt;
+
+		/**
+			Interpolate the breakpoints at exactly the given voltage (which
+			must be one of theirs) along throttle.
+		*/
+		Gains interpolateThrottle(float voltage, float throttle);
+};
+
+#endif
+
@@ -1,62 +1,134 @@
 /*
 	geometry.h
 
-	Structs and functions related to geometry.
+	Structs and functions related to geometry: small vectors, 3x3 matrices
+	and quaternions. Everything is inline, in this header.
+
+	Vector2 and Vector3 operations are GEOMETRY_CONSTEXPR (constexpr from
+	C++11 on), so constant vectors are folded at compile time.
+
+	Vector4f is a 16-byte aligned float vector whose operations use SSE or
+	NEON when the compiler targets them (-msse, -mfpu=neon), and plain C++
+	otherwise; define GEOMETRY_NO_SIMD to force the plain C++. For 3D work w
+	is 0, and results match Vector3<float>'s to rounding.
 */
 
 #ifndef GEOMETRY_H
 #define GEOMETRY_H
 
+#include <math.h>
+
+#if __cplusplus >= 201103L
+	#define GEOMETRY_CONSTEXPR constexpr
+#else
+	#define GEOMETRY_CONSTEXPR inline
+#endif
+
+#if !defined(GEOMETRY_NO_SIMD)
+	#if defined(__SSE__)
+		#define GEOMETRY_SSE
+		#include <xmmintrin.h>
+	#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+		#define GEOMETRY_NEON
+		#include <arm_neon.h>
+	#endif
+#endif
+
 #define PI 3.1415926535
 
-// Returns the sign of the given number 
+// Returns the sign of the given number
 // (+1 / 0 / -1)
 template<typename T>
 int sign(T val) {
 	return (T(0) < val) - (val < T(0));
 }
 
+// Wraps the given angle (in degrees) into the range [-180, 180)
+template<typename T>
+T wrapAngle(T angle) {
+	angle = fmod(angle + T(180), T(360));
+	if (angle < T(0))
+		angle += T(360);
+	return angle - T(180);
+}
+
+// Returns the shortest signed rotation (in degrees) that takes angle from to
+// angle to. The result is always in the range [-180, 180), so e.g. going from
+// 170 to -170 gives +20 rather than -340.
+template<typename T>
+T angleDifference(T to, T from) {
+	return wrapAngle(to - from);
+}
+
+// Square roots for the types used below
+inline float squareRoot(float value) {
+	return sqrtf(value);
+}
+
+inline double squareRoot(double value) {
+	return sqrt(value);
+}
+
 template<typename T>
 struct Vector2 {
 	T x, y;
 
 	Vector2() { }
 
-	Vector2(T nx, T ny) : x(nx), y(ny)
-			{ }
-
-	Vector2(const Vector2 &other) : x(other.x), y(other.y)
+	GEOMETRY_CONSTEXPR Vector2(T nx, T ny) : x(nx), y(ny)
 			{ }
 
-	void operator+=(const Vector2<T> &other) {
+	Vector2<T> &operator+=(const Vector2<T> &other) {
 		x += other.x;
 		y += other.y;
+		return *this;
 	}
 
-	void operator-=(const Vector2<T> &other) {
+	Vector2<T> &operator-=(const Vector2<T> &other) {
 		x -= other.x;
 		y -= other.y;
+		return *this;
+	}
+
+	Vector2<T> &operator*=(T scalar) {
+		x *= scalar;
+		y *= scalar;
+		return *this;
 	}
 
-	Vector2<T> operator-() {
+	Vector2<T> &operator/=(T scalar) {
+		x /= scalar;
+		y /= scalar;
+		return *this;
+	}
+
+	GEOMETRY_CONSTEXPR Vector2<T> operator-() const {
 		return Vector2<T>(-x, -y);
 	}
 
-	Vector2<T> operator+(const Vector2<T> &other) {
+	GEOMETRY_CONSTEXPR Vector2<T> operator+(const Vector2<T> &other) const {
 		return Vector2<T>(x + other.x, y + other.y);
 	}
 
-	Vector2<T> operator-(const Vector2<T> &other) {
-		return (*this) + (-other);
+	GEOMETRY_CONSTEXPR Vector2<T> operator-(const Vector2<T> &other) const {
+		return Vector2<T>(x - other.x, y - other.y);
 	}
 
-	Vector2<T> operator*(T scalar) {
+	GEOMETRY_CONSTEXPR Vector2<T> operator*(T scalar) const {
 		return Vector2<T>(x * scalar, y * scalar);
 	}
 
-	Vector2<T> operator/(T scalar) {
+	GEOMETRY_CONSTEXPR Vector2<T> operator/(T scalar) const {
 		return Vector2<T>(x / scalar, y / scalar);
 	}
+
+	GEOMETRY_CONSTEXPR bool operator==(const Vector2<T> &other) const {
+		return x == other.x && y == other.y;
+	}
+
+	GEOMETRY_CONSTEXPR bool operator!=(const Vector2<T> &other) const {
+		return !(*this == other);
+	}
 };
 
 template<typename T>
@@ -65,55 +137,468 @@ struct Vector3 {
 
 	Vector3() { }
 
-	Vector3(T nx, T ny, T nz) : x(nx), y(ny), z(nz)
+	GEOMETRY_CONSTEXPR Vector3(T nx, T ny, T nz) : x(nx), y(ny), z(nz)
 			{ }
 
-	Vector3(const Vector3 &other) : x(other.x), y(other.y), z(other.z)
-			{ }
-
-	void operator+=(const Vector3<T> &other) {
+	Vector3<T> &operator+=(const Vector3<T> &other) {
 		x += other.x;
 		y += other.y;
 		z += other.z;
+		return *this;
 	}
 
-	void operator-=(const Vector3<T> &other) {
+	Vector3<T> &operator-=(const Vector3<T> &other) {
 		x -= other.x;
 		y -= other.y;
 		z -= other.z;
+		return *this;
+	}
+
+	Vector3<T> &operator*=(T scalar) {
+		x *= scalar;
+		y *= scalar;
+		z *= scalar;
+		return *this;
+	}
+
+	Vector3<T> &operator/=(T scalar) {
+		x /= scalar;
+		y /= scalar;
+		z /= scalar;
+		return *this;
 	}
 
-	Vector3<T> operator-() {
+	GEOMETRY_CONSTEXPR Vector3<T> operator-() const {
 		return Vector3<T>(-x, -y, -z);
 	}
 
-	Vector3<T> operator+(const Vector3<T> &other) {
+	GEOMETRY_CONSTEXPR Vector3<T> operator+(const Vector3<T> &other) const {
 		return Vector3<T>(x + other.x, y + other.y, z + other.z);
 	}
 
-	Vector3<T> operator-(const Vector3<T> &other) {
-		return (*this) + (-other);
+	GEOMETRY_CONSTEXPR Vector3<T> operator-(const Vector3<T> &other) const {
+		return Vector3<T>(x - other.x, y - other.y, z - other.z);
+	}
+
+	GEOMETRY_CONSTEXPR Vector3<T> operator*(T scalar) const {
+		return Vector3<T>(x * scalar, y * scalar, z * scalar);
+	}
+
+	GEOMETRY_CONSTEXPR Vector3<T> operator/(T scalar) const {
+		return Vector3<T>(x / scalar, y / scalar, z / scalar);
+	}
+
+	GEOMETRY_CONSTEXPR bool operator==(const Vector3<T> &other) const {
+		return x == other.x && y == other.y && z == other.z;
+	}
+
+	GEOMETRY_CONSTEXPR bool operator!=(const Vector3<T> &other) const {
+		return !(*this == other);
+	}
+};
+
+template<typename T>
+GEOMETRY_CONSTEXPR Vector2<T> operator*(T scalar, const Vector2<T> &v) {
+	return v * scalar;
+}
+
+template<typename T>
+GEOMETRY_CONSTEXPR Vector3<T> operator*(T scalar, const Vector3<T> &v) {
+	return v * scalar;
+}
+
+/**
+	Dot and cross products
+*/
+template<typename T>
+GEOMETRY_CONSTEXPR T dot(const Vector2<T> &a, const Vector2<T> &b) {
+	return a.x * b.x + a.y * b.y;
+}
+
+template<typename T>
+GEOMETRY_CONSTEXPR T dot(const Vector3<T> &a, const Vector3<T> &b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template<typename T>
+GEOMETRY_CONSTEXPR Vector3<T> cross(const Vector3<T> &a,
+		const Vector3<T> &b) {
+	return Vector3<T>(a.y * b.z - a.z * b.y,
+	                  a.z * b.x - a.x * b.z,
+	                  a.x * b.y - a.y * b.x);
+}
+
+/**
+	Calculates the magnitude of the given Vector (and its square, which
+	needs no square root)
+*/
+template<typename T>
+GEOMETRY_CONSTEXPR T magnitudeSquared(const Vector2<T> &vector) {
+	return dot(vector, vector);
+}
+
+template<typename T>
+GEOMETRY_CONSTEXPR T magnitudeSquared(const Vector3<T> &vector) {
+	return dot(vector, vector);
+}
+
+template<typename T>
+T magnitude(const Vector2<T> &vector) {
+	return squareRoot(magnitudeSquared(vector));
+}
+
+template<typename T>
+T magnitude(const Vector3<T> &vector) {
+	return squareRoot(magnitudeSquared(vector));
+}
+
+/**
+	Returns the given Vector scaled to unit length. A zero Vector is
+	returned unchanged.
+*/
+template<typename T>
+Vector2<T> normalize(const Vector2<T> &vector) {
+	T m = magnitude(vector);
+	return (m > T(0) ? vector / m : vector);
+}
+
+template<typename T>
+Vector3<T> normalize(const Vector3<T> &vector) {
+	T m = magnitude(vector);
+	return (m > T(0) ? vector / m : vector);
+}
+
+/**
+	3x3 matrix, stored row-major (m[row][column])
+*/
+template<typename T>
+struct Matrix3 {
+	T m[3][3];
+
+	Matrix3() { }
+
+	// Diagonal matrix with d on the diagonal (d = 1 gives the identity)
+	explicit Matrix3(T d) {
+		for (int r = 0; r < 3; ++r)
+			for (int c = 0; c < 3; ++c)
+				m[r][c] = (r == c ? d : T(0));
+	}
+
+	// Matrix with the given rows
+	Matrix3(const Vector3<T> &row0, const Vector3<T> &row1,
+			const Vector3<T> &row2) {
+		setRow(0, row0);
+		setRow(1, row1);
+		setRow(2, row2);
+	}
+
+	Vector3<T> row(int r) const {
+		return Vector3<T>(m[r][0], m[r][1], m[r][2]);
+	}
+
+	Vector3<T> column(int c) const {
+		return Vector3<T>(m[0][c], m[1][c], m[2][c]);
+	}
+
+	void setRow(int r, const Vector3<T> &v) {
+		m[r][0] = v.x;
+		m[r][1] = v.y;
+		m[r][2] = v.z;
+	}
+
+	Vector3<T> operator*(const Vector3<T> &v) const {
+		return Vector3<T>(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+		                  m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+		                  m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+	}
+
+	Matrix3<T> operator*(const Matrix3<T> &other) const {
+		Matrix3<T> result;
+		for (int r = 0; r < 3; ++r)
+			for (int c = 0; c < 3; ++c)
+				result.m[r][c] = m[r][0] * other.m[0][c]
+						+ m[r][1] * other.m[1][c] + m[r][2] * other.m[2][c];
+		return result;
+	}
+
+	Matrix3<T> operator*(T scalar) const {
+		Matrix3<T> result;
+		for (int r = 0; r < 3; ++r)
+			for (int c = 0; c < 3; ++c)
+				result.m[r][c] = m[r][c] * scalar;
+		return result;
+	}
+
+	Matrix3<T> transpose() const {
+		Matrix3<T> result;
+		for (int r = 0; r < 3; ++r)
+			for (int c = 0; c < 3; ++c)
+				result.m[c][r] = m[r][c];
+		return result;
+	}
+
+	T determinant() const {
+		return dot(row(0), cross(row(1), row(2)));
+	}
+};
+
+/**
+	Rotation quaternion (w + xi + yj + zk). Unit length, to represent a
+	rotation; normalize() after accumulating many products.
+*/
+template<typename T>
+struct Quaternion {
+	T w, x, y, z;
+
+	// The identity: no rotation
+	GEOMETRY_CONSTEXPR Quaternion() : w(T(1)), x(T(0)), y(T(0)), z(T(0))
+			{ }
+
+	GEOMETRY_CONSTEXPR Quaternion(T nw, T nx, T ny, T nz)
+			: w(nw), x(nx), y(ny), z(nz)
+			{ }
+
+	/**
+		Rotation by the given angle (degrees, right-handed) about a unit
+		axis
+	*/
+	static Quaternion<T> fromAxisAngle(const Vector3<T> &axis, T degrees) {
+		T half = degrees * T(PI / 360.0), s = sin(half);
+		return Quaternion<T>(cos(half), axis.x * s, axis.y * s, axis.z * s);
+	}
+
+	/**
+		Rotation by a rotation vector: about its direction, by its
+		magnitude (degrees). Small vectors (e.g. body rates times dtime)
+		are handled without dividing by their magnitude.
+	*/
+	static Quaternion<T> fromRotationVector(const Vector3<T> &v) {
+		T angle = magnitude(v);
+		if (angle < T(1e-6))
+			return Quaternion<T>(T(1), v.x * T(PI / 360.0),
+					v.y * T(PI / 360.0), v.z * T(PI / 360.0));
+		return fromAxisAngle(v / angle, angle);
 	}
 
-	Vector3<T> operator*(T scalar) {
-		return Vector2<T>(x * scalar, y * scalar, z * scalar);
+	// The rotation of other, then this
+	GEOMETRY_CONSTEXPR Quaternion<T> operator*(const Quaternion<T> &other)
+			const {
+		return Quaternion<T>(
+				w * other.w - x * other.x - y * other.y - z * other.z,
+				w * other.x + x * other.w + y * other.z - z * other.y,
+				w * other.y - x * other.z + y * other.w + z * other.x,
+				w * other.z + x * other.y - y * other.x + z * other.w);
 	}
 
-	Vector3<T> operator/(T scalar) {
-		return Vector2<T>(x / scalar, y / scalar, z / scalar);
+	// The inverse rotation (for a unit quaternion)
+	GEOMETRY_CONSTEXPR Quaternion<T> conjugate() const {
+		return Quaternion<T>(w, -x, -y, -z);
+	}
+
+	/**
+		Rotate a vector (q v q*), without building the products:
+		t = 2 (q.xyz x v), v' = v + w t + q.xyz x t
+	*/
+	Vector3<T> rotate(const Vector3<T> &v) const {
+		Vector3<T> u(x, y, z), t = cross(u, v) * T(2);
+		return v + t * w + cross(u, t);
+	}
+
+	/**
+		Returns the rotation as a matrix: toMatrix() * v == rotate(v). To
+		rotate more than a couple of vectors, the matrix is much cheaper.
+	*/
+	Matrix3<T> toMatrix() const {
+		Matrix3<T> r;
+		r.m[0][0] = T(1) - T(2) * (y * y + z * z);
+		r.m[0][1] = T(2) * (x * y - w * z);
+		r.m[0][2] = T(2) * (x * z + w * y);
+		r.m[1][0] = T(2) * (x * y + w * z);
+		r.m[1][1] = T(1) - T(2) * (x * x + z * z);
+		r.m[1][2] = T(2) * (y * z - w * x);
+		r.m[2][0] = T(2) * (x * z - w * y);
+		r.m[2][1] = T(2) * (y * z + w * x);
+		r.m[2][2] = T(1) - T(2) * (x * x + y * y);
+		return r;
 	}
 };
 
+template<typename T>
+GEOMETRY_CONSTEXPR T dot(const Quaternion<T> &a, const Quaternion<T> &b) {
+	return a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template<typename T>
+T magnitude(const Quaternion<T> &q) {
+	return squareRoot(dot(q, q));
+}
+
+template<typename T>
+Quaternion<T> normalize(const Quaternion<T> &q) {
+	T m = magnitude(q);
+	if (!(m > T(0)))
+		return Quaternion<T>();
+	return Quaternion<T>(q.w / m, q.x / m, q.y / m, q.z / m);
+}
+
 /**
-	Calculates the magnitude of the given Vector
+	Four floats, aligned for SIMD loads. Arrays of these (e.g. of sensor
+	samples) are processed a whole vector per instruction. Loads and stores
+	don't require the alignment (heap arrays on older compilers may not
+	have it), but are fastest with it.
 */
-//int magnitude(Vector2<int> vector);
-float magnitude(Vector2<float> vector);
-double magnitude(Vector2<double> vector);
+struct __attribute__((aligned(16))) Vector4f {
+	float x, y, z, w;
+
+	Vector4f() { }
+
+	GEOMETRY_CONSTEXPR Vector4f(float nx, float ny, float nz,
+			float nw = 0.0f) : x(nx), y(ny), z(nz), w(nw)
+			{ }
+
+	explicit GEOMETRY_CONSTEXPR Vector4f(const Vector3<float> &v)
+			: x(v.x), y(v.y), z(v.z), w(0.0f)
+			{ }
 
-//int magnitude(Vector3<int> vector);
-float magnitude(Vector3<float> vector);
-double magnitude(Vector3<double> vector);
+	GEOMETRY_CONSTEXPR Vector3<float> xyz() const {
+		return Vector3<float>(x, y, z);
+	}
+};
+
+#if defined(GEOMETRY_SSE)
 
+inline __m128 loadVector4f(const Vector4f &v) {
+	return _mm_loadu_ps(&v.x);
+}
+
+inline Vector4f storeVector4f(__m128 value) {
+	Vector4f v;
+	_mm_storeu_ps(&v.x, value);
+	return v;
+}
+
+#elif defined(GEOMETRY_NEON)
+
+inline float32x4_t loadVector4f(const Vector4f &v) {
+	return vld1q_f32(&v.x);
+}
+
+inline Vector4f storeVector4f(float32x4_t value) {
+	Vector4f v;
+	vst1q_f32(&v.x, value);
+	return v;
+}
+
+#endif
+
+inline Vector4f operator+(const Vector4f &a, const Vector4f &b) {
+#if defined(GEOMETRY_SSE)
+	return storeVector4f(_mm_add_ps(loadVector4f(a), loadVector4f(b)));
+#elif defined(GEOMETRY_NEON)
+	return storeVector4f(vaddq_f32(loadVector4f(a), loadVector4f(b)));
+#else
+	return Vector4f(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w);
+#endif
+}
+
+inline Vector4f operator-(const Vector4f &a, const Vector4f &b) {
+#if defined(GEOMETRY_SSE)
+	return storeVector4f(_mm_sub_ps(loadVector4f(a), loadVector4f(b)));
+#elif defined(GEOMETRY_NEON)
+	return storeVector4f(vsubq_f32(loadVector4f(a), loadVector4f(b)));
+#else
+	return Vector4f(a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w);
+#endif
+}
+
+inline Vector4f operator*(const Vector4f &a, float scalar) {
+#if defined(GEOMETRY_SSE)
+	return storeVector4f(_mm_mul_ps(loadVector4f(a), _mm_set1_ps(scalar)));
+#elif defined(GEOMETRY_NEON)
+	return storeVector4f(vmulq_n_f32(loadVector4f(a), scalar));
+#else
+	return Vector4f(a.x * scalar, a.y * scalar, a.z * scalar, a.w * scalar);
 #endif
+}
+
+inline Vector4f operator*(float scalar, const Vector4f &a) {
+	return a * scalar;
+}
+
+inline Vector4f operator-(const Vector4f &a) {
+	return a * -1.0f;
+}
+
+inline Vector4f &operator+=(Vector4f &a, const Vector4f &b) {
+	return a = a + b;
+}
 
+inline Vector4f &operator-=(Vector4f &a, const Vector4f &b) {
+	return a = a - b;
+}
+
+inline Vector4f &operator*=(Vector4f &a, float scalar) {
+	return a = a * scalar;
+}
+
+/**
+	Component-wise product
+*/
+inline Vector4f multiply(const Vector4f &a, const Vector4f &b) {
+#if defined(GEOMETRY_SSE)
+	return storeVector4f(_mm_mul_ps(loadVector4f(a), loadVector4f(b)));
+#elif defined(GEOMETRY_NEON)
+	return storeVector4f(vmulq_f32(loadVector4f(a), loadVector4f(b)));
+#else
+	return Vector4f(a.x * b.x, a.y * b.y, a.z * b.z, a.w * b.w);
+#endif
+}
+
+/**
+	Dot product of all four components (of x, y and z, while w is 0)
+*/
+inline float dot(const Vector4f &a, const Vector4f &b) {
+#if defined(GEOMETRY_SSE)
+	__m128 m = _mm_mul_ps(loadVector4f(a), loadVector4f(b));
+	__m128 s = _mm_add_ps(m, _mm_movehl_ps(m, m));  // x+z, y+w
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(s);
+#elif defined(GEOMETRY_NEON)
+	float32x4_t m = vmulq_f32(loadVector4f(a), loadVector4f(b));
+	float32x2_t s = vadd_f32(vget_low_f32(m), vget_high_f32(m));
+	return vget_lane_f32(vpadd_f32(s, s), 0);
+#else
+	return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+#endif
+}
+
+/**
+	Cross product of x, y and z (w of the result is 0). NEON has no cheap
+	lane rotation, so there it is plain C++.
+*/
+inline Vector4f cross(const Vector4f &a, const Vector4f &b) {
+#if defined(GEOMETRY_SSE)
+	__m128 va = loadVector4f(a), vb = loadVector4f(b);
+	__m128 ayzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1)),
+	       byzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(va, byzx), _mm_mul_ps(ayzx, vb));
+	return storeVector4f(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+#else
+	return Vector4f(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+			a.x * b.y - a.y * b.x, 0.0f);
+#endif
+}
+
+inline float magnitude(const Vector4f &v) {
+	return sqrtf(dot(v, v));
+}
+
+/**
+	Returns v scaled to unit length (unchanged if zero)
+*/
+inline Vector4f normalize(const Vector4f &v) {
+	float m = magnitude(v);
+	return (m > 0.0f ? v * (1.0f / m) : v);
+}
+
+#endif
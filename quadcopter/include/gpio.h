@@ -9,7 +9,8 @@
 
 typedef enum {
 	GPIO_MODE_IN = 0,
-	GPIO_MODE_OUT
+	GPIO_MODE_OUT = 1,
+	GPIO_MODE_ALT0 = 4 // Alternate function 0, e.g. I2C on pins 2 and 3
 } GPIOMode;
 
 typedef enum {
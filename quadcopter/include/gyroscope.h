@@ -18,7 +18,9 @@
 
 #include "exception.h"
 #include "i2c.h"
+#include "i2cengine.h"
 #include "geometry.h"
+#include "rawsamples.h"
 
 class Gyroscope {
 	public:
@@ -116,14 +118,121 @@ class Gyroscope {
 		*/
 		Vector3<float> read();
 
+		/**
+			Read the temperature of the gyroscope, in degrees C relative to an
+			unknown (per chip) offset. Only changes in temperature are
+			meaningful, e.g. for modelling the drift of the gyroscope's bias.
+
+			Throws I2CException if I2C communication fails.
+		*/
+		float readTemperature();
+
+		/**
+			Add the messages for a read() to transaction, for sending through
+			an I2CEngine. Once it has completed successfully, readQueued()
+			returns the result. The gyroscope keeps the buffers, so only one
+			transaction at a time should be set up this way.
+
+			Throws I2CException if the transaction is full or pending.
+		*/
+		void queueRead(I2CTransaction *transaction);
+
+		/**
+			As queueRead(), but the output is read into values (3 raw
+			counts, in register order, for RawSamples::add()), which the
+			caller keeps valid until the transaction completes. For a
+			reader of its own alongside the one set up by queueRead(), such
+			as VibrationSampler.
+
+			Throws I2CException if the transaction is full or pending.
+		*/
+		void queueRead(I2CTransaction *transaction, int16_t *values);
+
+		/**
+			Returns the output read by the last transaction set up with
+			queueRead(), as read() would have.
+		*/
+		Vector3<float> readQueued();
+
+		/**
+			Returns the scale of a range in dps per LSB (L3G4200D doc,
+			sensitivity).
+			A constant expression, so a fixed range costs nothing at run time.
+		*/
+		static GEOMETRY_CONSTEXPR float scale(Range range) {
+			return (range == RANGE_250DPS ? 0.00875f :
+			        range == RANGE_500DPS ? 0.0175f :
+			                                0.07f);
+		}
+
+		/**
+			Returns the scale of the current range in dps per LSB
+		*/
+		float getScale();
+
+		/**
+			Convert raw output (x, y, z as read from the data registers) to
+			dps in the accelerometer's axes, for a range fixed at compile time
+		*/
+		template<Range R>
+		static Vector3<float> convertRaw(const int16_t *values) {
+			return Vector3<float>(values[1] * scale(R), values[0] * scale(R),
+					values[2] * scale(R));
+		}
+
+		/**
+			Convert count raw readings (consecutive x, y, z triplets, e.g. a
+			FIFO burst) to dps in the accelerometer's axes at the given scale
+			(see getScale()). One multiply per axis, in a loop the compiler
+			can vectorize.
+		*/
+		static void convertRaw(const int16_t *values, Vector3<float> *out,
+				int count, float scale);
+
+		/**
+			Read the current output as raw counts, and append it to samples
+			with the time it was read (the middle of the transfer). Returns
+			false, reading nothing, if samples is full.
+
+			Throws I2CException if I2C communication fails.
+		*/
+		bool readRaw(RawSamples *samples);
+
+		/**
+			Append the output read by the last transaction set up with
+			queueRead() to samples, as raw counts, with the given time (e.g.
+			rawSampleTime() once the transaction completed). Returns false if
+			samples is full.
+		*/
+		bool readQueuedRaw(RawSamples *samples, uint64_t time);
+
+		/**
+			Convert samples to dps at the given scale (see getScale()) into
+			the arrays x, y and z, each with room for samples.count. X and Y
+			are swapped into the accelerometer's axes, as read().
+		*/
+		static void convertRaw(const RawSamples &samples, float *x, float *y,
+				float *z, float scale);
+
 	private:
 		I2C     *mI2C;
 		uint8_t mSlaveAddr;
 
 		bool       mSleep;
 		Range      mRange;
+		float      mScale;  // dps per LSB at mRange
 		SampleRate mRate;
 
+		// Register and output buffers for queueRead()
+		char    mQueuedRegister;
+		int16_t mQueuedValues[3];
+
+		/**
+			Convert raw output to dps for the current range, and to the
+			accelerometer's axes
+		*/
+		Vector3<float> convert(const int16_t *values);
+
 		/**
 			Set sleep mode and sample rate at same time (since they are part of
 			the same hardware register). Uses values from mSleep and mRate.
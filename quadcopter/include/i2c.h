@@ -18,6 +18,17 @@
 #include <i2c.h>
 
 #include "exception.h"
+#include "i2cstats.h"
+#include "i2cbusclear.h"
+
+// Default retry policy (see I2CRetryPolicy)
+#define I2C_RETRY_COUNT       2
+#define I2C_RETRY_BACKOFF     100  // microseconds
+#define I2C_RETRY_MAX_BACKOFF 800  // microseconds
+#define I2C_RETRY_BUDGET      2000 // microseconds
+
+// Not a 7-bit address; forces the next operation to select its slave
+#define I2C_NO_SLAVE 0xFF
 
 class I2CException : public Exception {
 	public:
@@ -25,6 +36,31 @@ class I2CException : public Exception {
 				: Exception(msg, file, line) { }
 };
 
+/**
+	How an I2C operation that fails is retried. Retries are spaced by
+	backoff microseconds, doubling each time up to maxBackoff, and stop
+	once retries have been made or another would take the operation
+	(counted from its first attempt) past budget microseconds. Only errors
+	that can be transient are retried: no acknowledge, timeouts, lost
+	arbitration, general I/O errors and short transfers.
+
+	The default budget is a fifth of a 100Hz update, so that a recoverable
+	glitch costs a retry rather than a missed update.
+*/
+struct I2CRetryPolicy {
+	int retries,
+	    backoff,
+	    maxBackoff,
+	    budget;
+
+	/**
+		Constructor
+
+		Sets the defaults, I2C_RETRY_COUNT etc.
+	*/
+	I2CRetryPolicy();
+};
+
 class I2C {
 	public:
 		/**
@@ -48,7 +84,7 @@ class I2C {
 		/**
 			Destructor
 		*/
-		~I2C();
+		virtual ~I2C();
 
 		/**
 			Send the given data to I2C slave with slaveaddr.
@@ -90,6 +126,61 @@ class I2C {
 		*/
 		void sendTransaction();
 
+		/**
+			Sends count messages as a single transaction, without touching the
+			queue used by enqueueWrite()/enqueueRead(). As this uses no other
+			state of the object, it may be called from another thread (e.g.
+			an I2CEngine's bus thread) while this one is in use; the kernel
+			serializes the transfers.
+
+			Throws I2CException if the operation fails.
+		*/
+		void transfer(struct i2c_msg *msgs, int count);
+
+		/**
+			Returns the statistics recorded for every write(), read() and
+			transfer() (see I2CStats)
+		*/
+		I2CStats *getStats();
+
+		/**
+			Set / get how failed operations are retried. Set before the
+			object is used from other threads. A failure that persists past
+			the policy throws I2CException as before.
+		*/
+		void           setRetryPolicy(const I2CRetryPolicy &policy);
+		I2CRetryPolicy getRetryPolicy();
+
+		/**
+			Give an I2CBusClear to run before retrying, if SDA is found stuck
+			low, or 0 for none (the default). The I2C object does not own it.
+		*/
+		void setBusClear(I2CBusClear *busclear);
+
+		/**
+			Returns the number of retries made, and of bus clears run
+		*/
+		long getRetries();
+		long getBusClears();
+
+	protected:
+		/**
+			Constructor for subclasses that simulate a bus: opens no device.
+		*/
+		I2C();
+
+		/**
+			One attempt at each operation, without retrying or recording
+			statistics. Return 0 on success, -1 for a short transfer,
+			otherwise the errno. Don't throw. Subclasses may override these to
+			simulate a bus.
+		*/
+		virtual int rawWrite(uint8_t slaveaddr, const void *data,
+				size_t length);
+		virtual int rawRead(uint8_t slaveaddr, void *buffer, size_t length,
+				size_t *bytesread);
+		virtual int rawTransfer(struct i2c_msg *msgs, int count);
+
 	private:
 		int         mFd;            // File descriptor to device
 		std::string mFilename;      // The filename that refers to the device
@@ -98,6 +189,43 @@ class I2C {
 
 		std::vector<struct i2c_msg> mQueue;
 
+		I2CStats *mStats;
+
+		I2CRetryPolicy mPolicy;
+		I2CBusClear    *mBusClear;
+		long           mRetries,   // Accessed atomically
+		               mBusClears;
+
+		/**
+			Make sure slaveaddr is selected for write() and read(). Returns 0,
+			or the errno.
+		*/
+		int select(uint8_t slaveaddr);
+
+		/**
+			One attempt at each operation (see rawWrite() etc.), recorded in
+			mStats
+		*/
+		int attemptWrite(uint8_t slaveaddr, const void *data, size_t length);
+		int attemptRead(uint8_t slaveaddr, void *buffer, size_t length,
+				size_t *bytesread);
+		int attemptTransfer(struct i2c_msg *msgs, int count);
+
+		/**
+			Decide whether to retry after attempt (counting from 0) failed with
+			error, for an operation that started at start (see
+			I2CStats::getTime()). If so, clears the bus if it is stuck, waits
+			out the backoff (updated in backoff) and returns true. reselect
+			forgets the selected slave, for write() and read().
+		*/
+		bool retry(int error, int attempt, int64_t start, int64_t &backoff,
+				bool reselect);
+
+		/**
+			Returns true if error may be transient
+		*/
+		static bool isRetryable(int error);
+
 		/**
 			Private copy constructor
 			Disallows copying of I2C objects, as the I2C interface contains
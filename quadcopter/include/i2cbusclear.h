@@ -0,0 +1,99 @@
+/*
+	i2cbusclear.h
+
+	I2CBusClear class - frees an I2C bus held by a slave, by clocking SCL
+		from GPIO.
+
+	A slave reset or glitched mid-read can be left driving SDA low, waiting
+	for clocks to finish sending its byte. Until it lets go the bus
+	controller can't send a start, and every transfer fails. The standard
+	remedy (I2C specification, 3.1.16) is to take over the pins, toggle SCL
+	up to 9 times until SDA is released, then send a stop.
+
+	The pins are driven open-drain, as the bus expects: low by outputting
+	0, high by switching to input and letting the pull-ups raise the line.
+	Afterwards they are handed back to the I2C controller (alternate
+	function 0).
+
+	Uses the GPIO interface in gpio.h, so gpio_init() must have succeeded.
+	Subclasses may override the line functions, e.g. to simulate a bus.
+*/
+
+#ifndef I2CBUSCLEAR_H
+#define I2CBUSCLEAR_H
+
+// GPIO pins of the Raspberry Pi's (rev 2) /dev/i2c-1
+#define I2C_BUSCLEAR_SDA 2
+#define I2C_BUSCLEAR_SCL 3
+
+// Half a clock period, in microseconds (100kHz), and most clocks sent
+#define I2C_BUSCLEAR_HALF_PERIOD 5
+#define I2C_BUSCLEAR_CLOCKS      9
+
+class I2CBusClear {
+	public:
+		/**
+			Constructor
+
+			sda and scl are the BCM GPIO pin numbers of the bus.
+		*/
+		I2CBusClear(int sda = I2C_BUSCLEAR_SDA, int scl = I2C_BUSCLEAR_SCL);
+
+		virtual ~I2CBusClear();
+
+		/**
+			Returns true if SDA is being held low. Only meaningful while no
+			transfer is in progress.
+		*/
+		bool isStuck();
+
+		/**
+			Run the bus-clear sequence, if SDA is stuck. Returns true if the
+			bus is free afterwards. Takes well under a millisecond; doesn't
+			allocate.
+
+			Only one clear runs at a time; a call while another is running
+			returns false straight away. Transfers attempted during a clear
+			fail (and may be retried).
+		*/
+		bool clear();
+
+		/**
+			Returns the number of clears run, and the number of clocks sent
+			over all of them.
+		*/
+		int getClears();
+		int getClocks();
+
+	protected:
+		/**
+			Drive a line low, or release it to be pulled high
+		*/
+		virtual void setSDA(bool high);
+		virtual void setSCL(bool high);
+
+		/**
+			Returns the level on SDA
+		*/
+		virtual bool readSDA();
+
+		/**
+			Hand the pins back to the I2C controller
+		*/
+		virtual void restore();
+
+		/**
+			Wait half a clock period
+		*/
+		virtual void delay();
+
+	private:
+		int  mSDA,
+		     mSCL;
+		bool mBusy;    // Accessed atomically
+		int  mClears,
+		     mClocks;  // Accessed atomically
+};
+
+#endif
+
@@ -0,0 +1,240 @@
+/*
+	i2cengine.h
+
+	I2CTransaction class - a batch of I2C messages, sent as one transfer,
+		that completes asynchronously.
+	I2CEngine class - sends I2CTransactions from a dedicated bus thread, so
+		that the thread submitting them doesn't wait for the bus.
+
+	At 100kHz, reading a sensor holds the bus for several hundred
+	microseconds. With I2C::sendTransaction() the control loop spends that
+	time blocked in the kernel; submitted to an I2CEngine instead, the read
+	for the next update happens while the loop computes this one.
+
+	submit() puts a pointer to the transaction in a bounded lock-free ring
+	(one sequence number per slot, so any number of threads may submit) and
+	wakes the bus thread with a semaphore. It doesn't lock or allocate, so it
+	may be called from the control loop's signal handler. The bus thread
+	sends transactions in the order they were submitted, then marks each
+	complete and calls its callback, if any.
+
+	Transactions are owned by the caller, and must stay valid (along with
+	the buffers given to them) until complete. A transaction can be
+	resubmitted as it is once complete, so a periodic read is set up once and
+	submitted every update. Completion can be polled with isComplete(),
+	waited for with I2CEngine::wait() (like a future), or handled in the
+	callback (which runs in the bus thread and must not block).
+*/
+
+#ifndef I2CENGINE_H
+#define I2CENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <linux/i2c.h>
+
+#include "exception.h"
+#include "i2c.h"
+
+// Most messages in one transaction (enough for a write to every PCA9685
+// channel), and default submission ring size (a power of two)
+#define I2C_TRANSACTION_MAX_MSGS 16
+#define I2C_ENGINE_QUEUE_SIZE    16
+
+class I2CTransaction {
+	public:
+		enum Status {
+			STATUS_IDLE = 0,    // Never submitted
+			STATUS_PENDING = 1, // Submitted, not yet complete
+			STATUS_DONE = 2,
+			STATUS_FAILED = 3
+		};
+
+		/**
+			Called from the bus thread once transaction completes. data is the
+			pointer given to setCallback().
+		*/
+		typedef void (*Callback)(I2CTransaction *transaction, void *data);
+
+		/**
+			Constructor
+
+			Creates an empty transaction, with no callback.
+		*/
+		I2CTransaction();
+
+		/**
+			Add a write / read message, as I2C::enqueueWrite() and
+			I2C::enqueueRead(). The buffer is used when the transaction is sent,
+			not copied.
+
+			Throws I2CException if the transaction already has
+			I2C_TRANSACTION_MAX_MSGS messages, or is pending.
+		*/
+		void addWrite(uint8_t slaveaddr, const void *buffer, size_t length);
+		void addRead(uint8_t slaveaddr, void *buffer, size_t length);
+
+		/**
+			Remove all messages. Throws I2CException if pending.
+		*/
+		void clear();
+
+		/**
+			Returns the number of messages.
+		*/
+		int getCount();
+
+		/**
+			Set the function to call on completion, or 0 for none. Only change
+			this while the transaction isn't pending.
+		*/
+		void setCallback(Callback callback, void *data);
+
+		/**
+			Returns the status. Doesn't lock.
+		*/
+		Status getStatus();
+
+		/**
+			Returns true if the transaction has been sent (successfully or not)
+			since it was last submitted.
+		*/
+		bool isComplete();
+
+	private:
+		struct i2c_msg mMsgs[I2C_TRANSACTION_MAX_MSGS];
+		int            mCount;
+
+		Callback mCallback;
+		void     *mCallbackData;
+
+		Status   mStatus; // Accessed atomically
+
+		friend class I2CEngine;
+
+		/**
+			Add a message. Throws I2CException if full or pending.
+		*/
+		void add(uint8_t slaveaddr, uint16_t flags, void *buffer,
+				size_t length);
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as the
+			engine refers to transactions by address.
+		*/
+		I2CTransaction(const I2CTransaction &other);
+		I2CTransaction &operator=(const I2CTransaction &other);
+};
+
+class I2CEngine {
+	public:
+		/**
+			Constructor
+
+			Starts the bus thread, sending transactions over the given
+			(already instantiated) I2C interface, which must outlive the
+			engine. Synchronous use of i2c from other threads remains allowed
+			(see I2C::transfer()).
+
+			queuesize is the most transactions that can be waiting at once,
+			rounded up to a power of two.
+
+			Throws I2CException if the bus thread could not be started.
+		*/
+		I2CEngine(I2C *i2c, int queuesize = I2C_ENGINE_QUEUE_SIZE);
+
+		/**
+			Destructor
+
+			Sends any transactions still waiting, then stops the bus thread.
+		*/
+		virtual ~I2CEngine();
+
+		/**
+			Submit a transaction to be sent. Doesn't lock or allocate, so can be
+			called from any thread, or from a signal handler.
+
+			Returns false (and leaves the transaction alone) if it is already
+			pending, or the queue is full.
+		*/
+		bool submit(I2CTransaction *transaction);
+
+		/**
+			Wait for a submitted transaction to complete, for up to millis
+			milliseconds (0 to wait forever). Returns true if it completed
+			successfully. Not for use in a signal handler.
+		*/
+		bool wait(I2CTransaction *transaction, int millis = 0);
+
+		/**
+			Returns the number of transactions sent, and of those that failed
+		*/
+		long getCompleted();
+		long getFailed();
+
+	protected:
+		/**
+			Send count messages as one transfer. Returns true on success.
+			Called from the bus thread only; the default sends them through
+			I2C::transfer().
+		*/
+		virtual bool transfer(struct i2c_msg *msgs, int count);
+
+		/**
+			Stop the bus thread, after the transactions still waiting are
+			sent. Subclasses overriding transfer() must call this from their
+			destructor, so that the thread is gone before they are. Idempotent.
+		*/
+		void shutdown();
+
+	private:
+		// One slot of the submission ring. A slot is free for the producer of
+		// position pos when sequence == pos, and filled for the consumer when
+		// sequence == pos + 1.
+		struct Slot {
+			size_t         sequence;
+			I2CTransaction *transaction;
+		};
+
+		I2C    *mI2C;
+		Slot   *mSlots;
+		size_t mMask;    // Ring size - 1
+		size_t mHead,    // Next position to submit, shared by producers
+		       mTail;    // Next position to send, bus thread only
+
+		sem_t  mWakeup;  // Posted once per submit, and to stop
+
+		pthread_t       mThread;
+		bool            mRunning,
+		                mStopping; // Accessed atomically
+		pthread_mutex_t mMutex;    // For wait()
+		pthread_cond_t  mCond;
+
+		long mCompleted,
+		     mFailed;     // Accessed atomically
+
+		friend void *i2cEngineThreadEntry(void *);
+
+		/**
+			The bus thread
+		*/
+		void run();
+
+		/**
+			Take the next transaction from the ring, or 0 if empty
+		*/
+		I2CTransaction *take();
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as the
+			engine owns a thread.
+		*/
+		I2CEngine(const I2CEngine &other);
+		I2CEngine &operator=(const I2CEngine &other);
+};
+
+#endif
+
@@ -0,0 +1,191 @@
+/*
+	i2cstats.h
+
+	I2CStats class - per-slave transaction counters, error counts and
+		latency histograms for an I2C bus, and an estimate of how busy the
+		bus is.
+	I2CSlaveStats, I2CStatsSnapshot - a copy of the counters, for reporting.
+
+	Every I2C object keeps an I2CStats (see I2C::getStats()), recorded on
+	every write(), read() and transfer(), whichever thread (or signal
+	handler) makes them. Recording only adds to fixed counters atomically,
+	so it never locks or allocates.
+
+	Bus utilization is estimated two ways, over the time between two
+	snapshots:
+
+		busy : time spent inside transfers, as measured. Includes the
+		       driver's overhead, so it is an upper bound.
+		wire : time the transferred bits take at the bus clock (9 bits a
+		       byte, address bytes included, plus start and stop). A lower
+		       bound; close to busy means the bus clock is the limit.
+
+	A transaction with messages to several slaves counts once for each, its
+	latency split between them by bytes. A failed transaction counts as an
+	error for each of them, as the failing slave can't be told apart.
+*/
+
+#ifndef I2CSTATS_H
+#define I2CSTATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ostream>
+#include <vector>
+#include <linux/i2c.h>
+
+// Bus clock assumed for wire time, in Hz
+#define I2C_STATS_CLOCK 100000
+
+// Latency histogram: bucket 0 is under I2C_STATS_BUCKET_BASE
+// microseconds, each following bucket doubles, and the last takes the rest
+#define I2C_STATS_BUCKETS     12
+#define I2C_STATS_BUCKET_BASE 64
+
+// Number of 7-bit slave addresses
+#define I2C_STATS_SLAVES 128
+
+class I2CStats {
+	public:
+		/**
+			Kinds of error counted. A transfer that moves fewer bytes than
+			asked is ERROR_SHORT; any errno not listed is ERROR_OTHER.
+		*/
+		enum Error {
+			ERROR_REMOTEIO = 0, // Slave didn't acknowledge
+			ERROR_TIMEDOUT = 1,
+			ERROR_IO = 2,
+			ERROR_NXIO = 3,
+			ERROR_AGAIN = 4,    // Lost arbitration
+			ERROR_SHORT = 5,
+			ERROR_OTHER = 6,
+			NUM_ERRORS = 7
+		};
+
+		/**
+			Constructor
+
+			clock is the bus clock, in Hz, for estimating wire time.
+		*/
+		I2CStats(int clock = I2C_STATS_CLOCK);
+
+		/**
+			Set the bus clock used for estimating wire time, in Hz
+		*/
+		void setClock(int clock);
+
+		/**
+			Record a single-message transfer with slaveaddr of the given
+			number of bytes, which took latency microseconds. error is 0 on
+			success, -1 for a short transfer, otherwise the errno.
+		*/
+		void record(uint8_t slaveaddr, size_t bytes, int64_t latency,
+				int error);
+
+		/**
+			Record a transfer of count messages (see record())
+		*/
+		void record(const struct i2c_msg *msgs, int count, int64_t latency,
+				int error);
+
+		/**
+			Returns a copy of the counters, for the slaves that have had any
+			traffic. Allocates; not for use in a signal handler.
+		*/
+		struct I2CStatsSnapshot snapshot();
+
+		/**
+			Returns a monotonic time in microseconds, for measuring latency
+		*/
+		static int64_t getTime();
+
+		/**
+			Returns the error kind for an error given to record()
+		*/
+		static Error classify(int error);
+
+		/**
+			Returns a short name for the error kind
+		*/
+		static const char *getErrorName(int kind);
+
+	private:
+		struct Counters {
+			int64_t transactions,
+			        bytes,
+			        errors,
+			        errorCounts[NUM_ERRORS],
+			        histogram[I2C_STATS_BUCKETS],
+			        latencyTotal, // microseconds
+			        latencyMax;
+		};
+
+		// All accessed atomically
+		Counters mSlaves[I2C_STATS_SLAVES];
+		int64_t  mBusyTime,  // microseconds
+		         mWireTime;  // nanoseconds
+		int      mClock;
+		int64_t  mStart;     // When constructed
+
+		/**
+			Add one slave's part of a transfer
+		*/
+		void add(uint8_t slaveaddr, size_t bytes, int64_t latency,
+				int error);
+};
+
+/**
+	Counters for one slave
+*/
+struct I2CSlaveStats {
+	uint8_t address;
+	int64_t transactions,
+	        bytes,
+	        errors,
+	        errorCounts[I2CStats::NUM_ERRORS],
+	        histogram[I2C_STATS_BUCKETS],
+	        latencyTotal, // microseconds
+	        latencyMax;   // Since construction, even in a difference
+
+	/**
+		Returns the mean latency in microseconds, or 0 with no transactions
+	*/
+	float getMeanLatency() const;
+
+	/**
+		Returns the fraction of transactions that failed
+	*/
+	float getErrorRate() const;
+};
+
+/**
+	Counters for a bus, at one time or (from since()) over an interval
+*/
+struct I2CStatsSnapshot {
+	int64_t time,     // When taken, microseconds (see I2CStats::getTime())
+	        elapsed,  // Microseconds covered by the counters
+	        busyTime, // microseconds
+	        wireTime; // microseconds
+	std::vector<I2CSlaveStats> slaves;
+
+	/**
+		Returns the estimated bus utilization, 0.0 to 1.0, from the measured
+		busy time / the wire time
+	*/
+	float getUtilization() const;
+	float getWireUtilization() const;
+
+	/**
+		Returns the counters for the interval from earlier to this
+	*/
+	I2CStatsSnapshot since(const I2CStatsSnapshot &earlier) const;
+
+	/**
+		Print the counters: the utilization, then a line per slave and a
+		line of its latency histogram.
+	*/
+	void print(std::ostream &out) const;
+};
+
+#endif
+
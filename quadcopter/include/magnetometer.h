@@ -0,0 +1,196 @@
+/*
+	magnetometer.h
+
+	Magnetometer class - interface for the HMC5883L (on GY80 board)
+
+	Allows for modifying the sleep state of the HMC5883L (for reduced power
+	consumption), setting configuration states, and reading values.
+
+	The three axes are read in one burst: the register pointer
+	auto-increments through the six output registers, so a single read
+	(after a write of the first register's address) returns them all.
+
+	getHeading() gives the tilt-compensated heading of a (calibrated, see
+	MagCalibration) field reading, using the accelerometer's reading as
+	"up".
+*/
+
+#ifndef MAGNETOMETER_H
+#define MAGNETOMETER_H
+
+#ifndef __cplusplus
+#error This header requires C++
+#endif
+
+#include <stdint.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cengine.h"
+#include "geometry.h"
+
+// Raw output of an axis that overflowed its range
+#define MAGNETOMETER_OVERFLOW -4096
+
+class Magnetometer {
+	public:
+		enum Gain {
+			GAIN_0_88GA = 0, // +/- 0.88 gauss
+			GAIN_1_3GA = 1,
+			GAIN_1_9GA = 2,
+			GAIN_2_5GA = 3,
+			GAIN_4_0GA = 4,
+			GAIN_4_7GA = 5,
+			GAIN_5_6GA = 6,
+			GAIN_8_1GA = 7
+		};
+
+		enum SampleRate {
+			SRATE_0_75HZ = 0,
+			SRATE_1_5HZ = 1,
+			SRATE_3HZ = 2,
+			SRATE_7_5HZ = 3,
+			SRATE_15HZ = 4,
+			SRATE_30HZ = 5,
+			SRATE_75HZ = 6
+		};
+
+		/**
+			Constructor
+
+			Creates an HMC5883L interface via the given (already instantiated)
+			I2C interface. Throughout the lifetime of the object, the given
+			slave address is used for communication.
+
+			The class is NOT responsible for destroying i2c! This must be done
+			by the user of this class.
+
+			Also, the user must ensure that the I2C object remains valid for as
+			long as this Magnetometer object is used.
+
+				i2c       : the I2C connection to communicate through
+				slaveaddr : I2C slave address of the HMC5883L
+				gain      : configuration for the range of field strengths
+				            that the HMC5883L will handle before output values
+				            overflow. The Earth's field is at most 0.65
+				            gauss, so the default leaves room for the
+				            quadcopter's own.
+				rate      : configuration for the sampling frequency (output
+				            rate in continuous measurement mode)
+
+			After construction, the magnetometer is measuring continuously
+			(not sleeping).
+
+			Throws I2CException if I2C communication fails.
+		*/
+		Magnetometer(I2C *i2c, uint8_t slaveaddr,
+				Gain gain = GAIN_1_3GA,
+				SampleRate rate = SRATE_75HZ);
+
+		/**
+			Destructor
+
+			Puts the magnetometer into idle mode.
+		*/
+		~Magnetometer();
+
+		/**
+			Set the mode of the HMC5883L.
+
+				sleep : true  = idle mode
+				                Reduced power consumption; no measurements
+				        false = continuous measurement mode
+				                Sample rate is as specified
+
+			Throws I2CException if I2C communication fails.
+		*/
+		void setSleep(bool sleep);
+
+		/**
+			Set the output range. Must be a value from the Gain enum. The
+			first reading after a change uses the previous gain.
+
+			Throws I2CException if I2C communication fails.
+		*/
+		void setGain(Gain gain);
+
+		/**
+			Set the sampling frequency, which determines how often the
+			magnetometer will update the output values (obtained using read())
+
+			Throws I2CException if I2C communication fails.
+		*/
+		void setSampleRate(SampleRate rate);
+
+		/**
+			Read the current output of the magnetometer.
+
+			The value returned is a Vector3 containing the field strength
+			along each axis (x, y, z), in gauss, in the axes of the
+			accelerometer. The HMC5883L doesn't give the sign of an axis that
+			overflowed, which reads as the negative end of the range; see
+			isSaturated().
+
+			Throws I2CException if I2C communication fails.
+		*/
+		Vector3<float> read();
+
+		/**
+			Add the messages for a read() to transaction, for sending through
+			an I2CEngine. Once it has completed successfully, readQueued()
+			returns the result. The magnetometer keeps the buffers, so only one
+			transaction at a time should be set up this way.
+
+			Throws I2CException if the transaction is full or pending.
+		*/
+		void queueRead(I2CTransaction *transaction);
+
+		/**
+			Returns the output read by the last transaction set up with
+			queueRead(), as read() would have.
+		*/
+		Vector3<float> readQueued();
+
+		/**
+			Returns true if any axis overflowed in the last reading returned
+			by read() or readQueued().
+		*/
+		bool isSaturated();
+
+		/**
+			Returns the tilt-compensated heading of the magnetic field in
+			degrees, in [-180, 180). field is a (calibrated) reading of
+			the magnetometer, and accel one of the accelerometer, in the same
+			axes, which gives the direction of "up". Rotating the quadcopter
+			about its Z axis changes the heading by the same angle, in the
+			same direction as the gyroscope's Z axis (and Drive's yaw).
+
+			The heading is of the X axis projected onto the horizontal plane,
+			so it becomes meaningless as X approaches vertical.
+		*/
+		static float getHeading(const Vector3<float> &field,
+				const Vector3<float> &accel);
+
+	private:
+		I2C     *mI2C;
+		uint8_t mSlaveAddr;
+
+		bool       mSleep;
+		Gain       mGain;
+		SampleRate mRate;
+		bool       mSaturated;
+
+		// Register and output buffers for queueRead(). Big-endian, in the
+		// order X, Z, Y.
+		char    mQueuedRegister;
+		uint8_t mQueuedValues[6];
+
+		/**
+			Convert the raw (big-endian X, Z, Y) output to gauss for the
+			current gain. Sets mSaturated.
+		*/
+		Vector3<float> convert(const uint8_t *values);
+};
+
+#endif
+
@@ -0,0 +1,140 @@
+/*
+	matrix.h
+
+	Fixed-size matrices, for small filters (see AttitudeEKF).
+
+	The dimensions are template parameters, so a Matrix is just its
+	elements: it lives on the stack or in its owner, never on the heap, and
+	mismatched dimensions are compile errors. Every loop has compile-time
+	bounds, which the compiler unrolls completely for the small sizes used
+	here (and vectorizes, at -O3), so there is no per-element loop overhead
+	or indexing arithmetic left at run time.
+
+	Storage is row-major: m[row][column]. A column vector is a Matrix with
+	one column.
+*/
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+template<typename T, int R, int C>
+struct Matrix {
+	T m[R][C];
+
+	Matrix() { }
+
+	// Diagonal matrix with d on the diagonal (d = 0 gives zero, and d = 1
+	// the identity if square)
+	explicit Matrix(T d) {
+		for (int r = 0; r < R; ++r)
+			for (int c = 0; c < C; ++c)
+				m[r][c] = (r == c ? d : T(0));
+	}
+
+	T &operator()(int r, int c) {
+		return m[r][c];
+	}
+
+	const T &operator()(int r, int c) const {
+		return m[r][c];
+	}
+
+	// Element of a column vector
+	T &operator[](int r) {
+		return m[r][0];
+	}
+
+	const T &operator[](int r) const {
+		return m[r][0];
+	}
+
+	void operator+=(const Matrix<T, R, C> &other) {
+		for (int r = 0; r < R; ++r)
+			for (int c = 0; c < C; ++c)
+				m[r][c] += other.m[r][c];
+	}
+
+	void operator-=(const Matrix<T, R, C> &other) {
+		for (int r = 0; r < R; ++r)
+			for (int c = 0; c < C; ++c)
+				m[r][c] -= other.m[r][c];
+	}
+
+	void operator*=(T scalar) {
+		for (int r = 0; r < R; ++r)
+			for (int c = 0; c < C; ++c)
+				m[r][c] *= scalar;
+	}
+
+	Matrix<T, R, C> operator+(const Matrix<T, R, C> &other) const {
+		Matrix<T, R, C> result = *this;
+		result += other;
+		return result;
+	}
+
+	Matrix<T, R, C> operator-(const Matrix<T, R, C> &other) const {
+		Matrix<T, R, C> result = *this;
+		result -= other;
+		return result;
+	}
+
+	Matrix<T, R, C> operator*(T scalar) const {
+		Matrix<T, R, C> result = *this;
+		result *= scalar;
+		return result;
+	}
+
+	template<int K>
+	Matrix<T, R, K> operator*(const Matrix<T, C, K> &other) const {
+		Matrix<T, R, K> result;
+		for (int r = 0; r < R; ++r)
+			for (int k = 0; k < K; ++k) {
+				T sum = T(0);
+				for (int c = 0; c < C; ++c)
+					sum += m[r][c] * other.m[c][k];
+				result.m[r][k] = sum;
+			}
+		return result;
+	}
+
+	Matrix<T, C, R> transpose() const {
+		Matrix<T, C, R> result;
+		for (int r = 0; r < R; ++r)
+			for (int c = 0; c < C; ++c)
+				result.m[c][r] = m[r][c];
+		return result;
+	}
+};
+
+/**
+	Returns a * b^T, without forming the transpose
+*/
+template<typename T, int R, int C, int K>
+Matrix<T, R, K> multiplyTransposed(const Matrix<T, R, C> &a,
+		const Matrix<T, K, C> &b) {
+	Matrix<T, R, K> result;
+	for (int r = 0; r < R; ++r)
+		for (int k = 0; k < K; ++k) {
+			T sum = T(0);
+			for (int c = 0; c < C; ++c)
+				sum += a.m[r][c] * b.m[k][c];
+			result.m[r][k] = sum;
+		}
+	return result;
+}
+
+/**
+	Make a square matrix exactly symmetric (averaging across the diagonal),
+	as a covariance should be but rounding lets drift
+*/
+template<typename T, int N>
+void symmetrize(Matrix<T, N, N> &a) {
+	for (int r = 0; r < N; ++r)
+		for (int c = r + 1; c < N; ++c) {
+			T mean = (a.m[r][c] + a.m[c][r]) * T(0.5);
+			a.m[r][c] = mean;
+			a.m[c][r] = mean;
+		}
+}
+
+#endif
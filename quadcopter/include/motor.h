@@ -71,6 +71,11 @@ class Motor {
 		*/
 		float getSpeed();
 
+		/**
+			Get the PWM channel the motor is on
+		*/
+		int getChannel();
+
 		/**
 			Update the signal sent to the motor. This is important for
 			maintaining a more precise speed. Because the PWM controller only
@@ -0,0 +1,209 @@
+/*
+	notchbank.h
+
+	NotchBank class - notch filters on the three gyroscope axes, whose
+		centres follow the motor vibration
+
+	Each axis passes through NOTCH_SECTIONS notch filters (Biquad::setNotch())
+	in series, one per vibration peak or motor harmonic. Unlike a longer
+	moving average (see Drive's smoothing), a notch only removes a narrow band
+	around its centre, so the rates below it, which the Rate PIDs act on, are
+	delayed very little.
+
+	The axes are filtered together: each section keeps its coefficients and
+	state in 4-wide vectors (GCC vector extensions, as PIDBank) with one axis
+	per element, so a step of process() is a handful of vector operations per
+	section. Each axis has its own centres.
+
+	Centres are changed in two steps. The set*() and track*() functions work
+	out new coefficients into a staging copy, which publish() hands over
+	through a single atomic flag; process() takes them at the start of its
+	next call. process() therefore never sees half-written coefficients, and
+	never waits or calculates them itself. If process() hasn't taken the last
+	coefficients yet, publish() returns false and leaves them staged, to be
+	published by a later call. The filter state is kept when the centres
+	move.
+
+	process() and reset() must be called by one thread (the update loop);
+	the set*(), track*() and publish() functions by one thread, which may be
+	the same one.
+*/
+
+#ifndef NOTCHBANK_H
+#define NOTCHBANK_H
+
+#include "geometry.h"
+#include "vibrationanalyzer.h"
+
+// Notches per axis
+#define NOTCH_SECTIONS VIBRATION_PEAKS
+
+// Default quality factor (centre / -3dB width)
+#define NOTCH_DEFAULT_Q 3.0f
+
+// Lowest centre (Hz), so that a notch never reaches down to the rates the
+// PIDs act on. Centres above NOTCH_MAX_RATIO of the sample rate are not
+// notched either.
+#define NOTCH_MIN_FREQUENCY 15.0f
+#define NOTCH_MAX_RATIO     0.45f
+
+// Least change of the motor fundamental (Hz) for which trackMotorSpeed()
+// works out new coefficients
+#define NOTCH_RETUNE_STEP 0.5f
+
+class NotchBank {
+	public:
+		/**
+			Constructor
+
+			samplerate is the rate at which process() is called, in Hz. q is
+			the quality factor of every notch. All sections start as
+			pass-throughs.
+		*/
+		NotchBank(float samplerate, float q = NOTCH_DEFAULT_Q);
+
+		/**
+			Filter a gyroscope reading (x, y and z each through its own
+			notches), taking any newly published coefficients first
+		*/
+		Vector3<float> process(const Vector3<float> &in) {
+			if (__atomic_load_n(&mPendingReady, __ATOMIC_ACQUIRE))
+				takePending();
+
+			v4sf value = { in.x, in.y, in.z, 0.0f };
+			for (int s = 0; s < NOTCH_SECTIONS; ++s) {
+				Section &sec = mSections[s];
+				v4sf out = sec.b0 * value + sec.z1;
+				sec.z1 = sec.b1 * value - sec.a1 * out + sec.z2;
+				sec.z2 = sec.b2 * value - sec.a2 * out;
+				value = out;
+			}
+			return Vector3<float>(value[0], value[1], value[2]);
+		}
+
+		/**
+			Reset the filter state such that it is settled at the given
+			reading
+		*/
+		void reset(const Vector3<float> &value = Vector3<float>(0.0f, 0.0f,
+				0.0f));
+
+		/**
+			Stage a notch at center Hz for the given section (0 ..
+			NOTCH_SECTIONS - 1) and axis (0 .. 2, x .. z), or a pass-through
+			if center is 0 or outside NOTCH_MIN_FREQUENCY to NOTCH_MAX_RATIO
+			of the sample rate. Invalid sections and axes are ignored. Takes
+			effect once published.
+		*/
+		void setNotch(int section, int axis, float center);
+
+		/**
+			Stage notches for an axis at the given vibration peaks (as from
+			VibrationAnalyzer::getPeaks()), one section per peak. Peaks
+			weaker than minamplitude, and sections beyond count, pass
+			through. Peaks above half the sample rate (found in readings
+			taken faster than process() is called) are folded back to where
+			they alias to, as trackMotorSpeed().
+		*/
+		void setPeaks(int axis, const VibrationPeak *peaks, int count,
+				float minamplitude);
+
+		/**
+			Stage pass-throughs for every section and axis
+		*/
+		void clear();
+
+		/**
+			Stage notches on all axes at the harmonics of the motor speed, and
+			publish() them: section i at (i + 1) times speed * fullspeed,
+			where fullspeed is the motors' rotation at speed 1.0, in Hz.
+			Frequencies above half the sample rate are folded back to where
+			they alias to, which is where they appear in the readings.
+			Returns publish()'s result.
+
+			Nothing new is staged if the fundamental has moved less than
+			NOTCH_RETUNE_STEP since the last call (or clear()).
+		*/
+		bool trackMotorSpeed(float speed, float fullspeed);
+
+		/**
+			Hand the staged coefficients over to process(), if anything was
+			staged since the last call. Returns false, leaving them staged,
+			if process() has not yet taken the last ones.
+		*/
+		bool publish();
+
+		/**
+			Returns the staged centre of a section and axis, in Hz, or 0 if
+			it passes through
+		*/
+		float getCenter(int section, int axis);
+
+		/**
+			Returns the number of times process() has taken new
+			coefficients
+		*/
+		int getRetunes();
+
+	private:
+		typedef float v4sf __attribute__((vector_size(16)));
+
+		/*
+			Coefficients and state of one section, for all axes
+		*/
+		struct Section {
+			v4sf b0, b1, b2, a1, a2;
+			v4sf z1, z2;
+		};
+
+		/*
+			Coefficients only, as staged and handed over
+		*/
+		struct Coefficients {
+			v4sf b0, b1, b2, a1, a2;
+		};
+
+		float mSampleRate,
+		      mQ;
+
+		// process()'s
+		Section mSections[NOTCH_SECTIONS];
+		int     mRetunes;
+
+		// Handed over while mPendingReady (accessed atomically) is set
+		Coefficients mPending[NOTCH_SECTIONS];
+		int          mPendingReady;
+
+		// The writer's
+		Coefficients mStaged[NOTCH_SECTIONS];
+		float        mCenters[NOTCH_SECTIONS][3];
+		float        mLastFundamental;
+		bool         mUnpublished;    // Staged since the last publish()
+
+		/**
+			Returns where frequency (Hz) aliases to at the sample rate, from
+			0 to half the sample rate
+		*/
+		float fold(float frequency);
+
+		/**
+			Copy mPending into mSections and clear mPendingReady
+		*/
+		void takePending();
+
+		/**
+			Returns a reference to an axis' element of a vector
+		*/
+		static float &at(v4sf &vector, int axis) {
+			return ((float *)&vector)[axis];
+		}
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as
+			the pending coefficients are shared with another thread.
+		*/
+		NotchBank(const NotchBank &other);
+		NotchBank &operator=(const NotchBank &other);
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+	pidbank.h
+
+	PIDBank class - a set of independent PID controllers that are all fed at
+		the same time, with the same time step.
+
+	Each controller in the bank is a "lane", and behaves exactly as a
+	PIDController with the same configuration would when fed with
+	feed(value, dtime). The difference is the layout: the state and
+	coefficients of all lanes are stored in blocks of four lanes, one float4
+	per field, and feed() steps a whole block at a time with float4 vector
+	operations. GCC's
+	vector extensions are used, which compile to NEON on the Pi 2+ and SSE on
+	x86, or to plain scalar code where neither is available.
+
+	Stepping a bank costs roughly the same as stepping four single
+	PIDControllers, however many lanes (up to the next multiple of four) are
+	used. Adding axes (altitude, position) is therefore almost free.
+
+	feed() does not allocate, branch per lane or read the clock.
+*/
+
+#ifndef PIDBANK_H
+#define PIDBANK_H
+
+#include "pidcontroller.h"
+
+class PIDBank {
+	public:
+		/**
+			Constructor
+
+			Creates a bank of the given number of lanes. All lanes start with a
+			target of 0, all coefficients 0, and the same defaults as a new
+			PIDController (no limits, unfiltered derivative on measurement,
+			ANTIWINDUP_CLAMP).
+		*/
+		PIDBank(int lanes);
+
+		/**
+			Destructor
+		*/
+		~PIDBank();
+
+		/**
+			Returns the number of lanes in the bank.
+		*/
+		int getLanes();
+
+		/**
+			Feed one input value per lane (values must hold getLanes()
+			values). dtime is the time elapsed since the previous feed, in
+			seconds, and is shared by all lanes. Feeds with dtime <= 0 are
+			ignored.
+		*/
+		void feed(const float *values, float dtime);
+
+		/**
+			Get the current output of the given lane. See
+			PIDController::output().
+		*/
+		float output(int lane) {
+			return ((float *)&mBlocks[lane / 4].output)[lane % 4];
+		}
+
+		/**
+			Per-lane configuration. These behave as the PIDController functions
+			of the same name. Invalid lane numbers are ignored.
+		*/
+		void setTarget(int lane, float target);
+		void setPID(int lane, float p, float i, float d);
+		void setFeedForward(int lane, float ff);
+		void setSetpointWeights(int lane, float b, float c);
+		void setOutputLimits(int lane, float min, float max);
+		void setIntegralLimit(int lane, float limit);
+		void setAntiWindup(int lane, PIDController::AntiWindup mode,
+				float tracking = 0.0f);
+		void setDerivativeFilter(int lane, float cutoff, float samplerate);
+
+		/**
+			Returns the integral term's contribution to the lane's output.
+		*/
+		float getIntegral(int lane) {
+			return ((float *)&mBlocks[lane / 4].integralterm)[lane % 4];
+		}
+
+		/**
+			Reset the accumulated state of a single lane, or of all lanes. See
+			PIDController::reset().
+		*/
+		void reset(int lane);
+		void reset();
+
+	private:
+		typedef float v4sf __attribute__((vector_size(16)));
+		typedef int   v4si __attribute__((vector_size(16)));
+
+		int mLanes;
+		int mNumBlocks; // Number of blocks, i.e. lanes rounded up / 4
+
+		/*
+			Coefficients and state for four lanes. Blocks are stored one after
+			another, so that each step of feed() works through a single
+			contiguous structure.
+		*/
+		struct Block {
+			// Coefficients
+			v4sf target,
+			     proportional,
+			     integral,
+			     derivative,
+			     feedforward,
+			     weightp,
+			     weightd,
+			     outputmin,
+			     outputmax,
+			     integrallimit,
+			     tracking;     // Back-calculation gain actually used
+			v4si backcalc;     // All bits set : lane uses ANTIWINDUP_BACKCALC
+
+			// Derivative filter (Biquad) coefficients
+			v4sf b0, b1, b2, a1, a2;
+
+			// State
+			v4sf integralterm,
+			     lastinput,
+			     z1, z2,
+			     output;
+			v4si haslastinput;
+		};
+
+		Block *mBlocks;
+
+		// Tracking gain as requested through setAntiWindup() (<= 0 : auto)
+		float *mTrackingParam;
+
+		/**
+			Recalculate the tracking gain used for the given lane, after any
+			of its coefficients change.
+		*/
+		void updateTracking(int lane);
+
+		/**
+			Returns a reference to the given lane's element of a field of
+			mBlocks, e.g. at(&Block::target, 5)
+		*/
+		float &at(v4sf Block::*field, int lane) {
+			return ((float *)&(mBlocks[lane / 4].*field))[lane % 4];
+		}
+		int &at(v4si Block::*field, int lane) {
+			return ((int *)&(mBlocks[lane / 4].*field))[lane % 4];
+		}
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as the
+			bank owns its storage.
+		*/
+		PIDBank(const PIDBank &other);
+		PIDBank &operator=(const PIDBank &other);
+};
+
+#endif
+
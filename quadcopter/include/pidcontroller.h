@@ -1,17 +1,35 @@
 /*
 	pidcontroller.h
 
-	PIDController class - accepts a single input feed and gives output 
+	PIDController class - accepts a single input feed and gives output
 */
 
 #ifndef PIDCONTROLLER_H
 #define PIDCONTROLLER_H
 
 #include <sys/time.h>
-#include <list>
+
+#include "biquad.h"
 
 class PIDController {
 	public:
+		/**
+			How the integral term is kept from winding up while the output is
+			saturated (see setOutputLimits()).
+
+				ANTIWINDUP_CLAMP    : conditional integration. The error is not
+				                      integrated while doing so would drive the
+				                      output further into saturation.
+				ANTIWINDUP_BACKCALC : back-calculation. The amount by which the
+				                      output is saturated is fed back into the
+				                      integral term, bleeding it off at the
+				                      tracking rate.
+		*/
+		enum AntiWindup {
+			ANTIWINDUP_CLAMP = 0,
+			ANTIWINDUP_BACKCALC = 1
+		};
+
 		/**
 			Initialize a software PID controller with given target value and
 			coefficients. What the controller does:
@@ -27,20 +45,33 @@ class PIDController {
 			this constructor are multiplied correspondingly to get the final
 			output of the controller.
 
-			accum_size determines how many inputs are retained for the
-			purposes of calculating the Derivative term.
+			By default there are no output or integral limits, the derivative
+			is unfiltered, and the derivative acts on the measurement only (so
+			changes of target do not cause a derivative "kick").
 		*/
 		PIDController(float target,
 		              float proportional,
 		              float integral,
-		              float derivative,
-		              size_t accum_size = 3);
+		              float derivative);
 
 		/**
 			Feed an input value to the controller.
+
+			The time elapsed since the previous feed is measured from the
+			system clock.
 		*/
 		void feed(float value);
 
+		/**
+			Feed an input value to the controller, using dtime (in seconds) as
+			the time elapsed since the previous feed instead of the system
+			clock. Useful when the caller already knows the period of its
+			control loop (or is running a simulation).
+
+			Does not allocate memory. Feeds with dtime <= 0 are ignored.
+		*/
+		void feed(float value, float dtime);
+
 		/**
 			Get the current output of the controller. Consecutive calls to
 			this function will be the same between calls to feed().
@@ -62,6 +93,9 @@ class PIDController {
 
 		/**
 			Set the coefficient for the integral term.
+
+			The accumulated integral is stored already multiplied by this
+			coefficient, so changing it does not cause a jump in the output.
 		*/
 		void setI(float i);
 
@@ -76,34 +110,91 @@ class PIDController {
 		void setPID(float p, float i, float d);
 
 		/**
-			Resets any state accumulated previously (sets the integral sum back
-			to 0, and resets the derivative buffer to 0)
+			Set the feed-forward coefficient. The output includes
+			ff * target, which lets the controller respond to a change of
+			target without waiting for an error to build up. Defaults to 0.
+		*/
+		void setFeedForward(float ff);
+
+		/**
+			Set the setpoint weights for the proportional (b) and derivative
+			(c) terms. These terms act on (b * target - value) and
+			(c * target - value) respectively, whereas the integral term always
+			acts on the full error.
+
+			Lowering b reduces overshoot on a change of target without
+			affecting disturbance rejection. Defaults are b = 1, c = 0
+			(derivative on measurement).
+		*/
+		void setSetpointWeights(float b, float c);
+
+		/**
+			Limit the output to the range [min, max]. Anti-windup only has an
+			effect when the output can saturate.
+		*/
+		void setOutputLimits(float min, float max);
+
+		/**
+			Limit the magnitude of the integral term's contribution to the
+			output (i.e. after multiplying by the I coefficient).
+		*/
+		void setIntegralLimit(float limit);
+
+		/**
+			Select the anti-windup method. tracking is the back-calculation
+			gain in 1/seconds; if it is 0 or less, it is derived from the
+			coefficients as 1/sqrt(Ti * Td) = sqrt(I/D), or I/P without a
+			derivative term. Defaults to ANTIWINDUP_CLAMP.
+		*/
+		void setAntiWindup(AntiWindup mode, float tracking = 0.0f);
+
+		/**
+			Low-pass filter the derivative term with a 2nd order Butterworth
+			filter of the given cutoff (Hz). samplerate is the rate at which
+			feed() is called. A cutoff of 0 or less disables the filter.
+		*/
+		void setDerivativeFilter(float cutoff, float samplerate);
+
+		/**
+			Resets any state accumulated previously (sets the integral back
+			to 0 and clears the derivative history and filter). Coefficients,
+			limits and target are kept.
 		*/
 		void reset();
 
-		float getSumError() {
-			return mSumError;
+		/**
+			Returns the integral term's current contribution to the output.
+		*/
+		float getIntegral() {
+			return mIntegralTerm;
 		}
 
 	private:
 		float mTarget,
 		      mProportional,
 		      mIntegral,
-		      mDerivative;
+		      mDerivative,
+		      mFeedForward;
 
-		struct Event {
-			Event(float e, float t) : error(e), time(t) { }
-			float error;
-			float time;  // in seconds
-		};
+		float mWeightP,  // Setpoint weight of proportional term (b)
+		      mWeightD;  // Setpoint weight of derivative term (c)
+
+		float mOutputMin,
+		      mOutputMax,
+		      mIntegralLimit;
+
+		AntiWindup mAntiWindup;
+		float      mTracking;     // Back-calculation gain (<= 0 : automatic)
+
+		float  mIntegralTerm;     // Accumulated I * error * time
+		float  mLastInput;        // Previous derivative input
+		bool   mHasLastInput;     // False until the first feed after reset()
+		bool   mFilterDerivative;
+		Biquad mDerivativeFilter;
 
-		std::list<Event> mAccumulator;     // Past inputs
-		size_t           mAccumulatorSize; // How many past inputs to track
-		float            mSumError;        // Sum of past errors (Integral)
 		float mOutput;      // Calculated output (avoid repeated calculations)
 
 		struct timeval mLastUpdate;
-		float mTimeCurrent;
 };
 
 #endif
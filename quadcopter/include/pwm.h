@@ -10,6 +10,11 @@
 	
 	Note that PWM output continues while the PCA9685 sleeps; however, the output
 	cannot be modified.
+
+	Given an I2CEngine (setEngine()), channel loads are not written as they are
+	set, but queued and sent by flush() as one transaction, by the engine's
+	bus thread. With the PCA9685 on a bus of its own, the motor writes then go
+	out while the sensors are being read on theirs.
 */
 
 #ifndef PWM_H
@@ -24,6 +29,10 @@
 
 #include "exception.h"
 #include "i2c.h"
+#include "i2cengine.h"
+
+// Size of the frame written by PWM::getAllOffFrame()
+#define PWM_ALLOFF_FRAME_SIZE 5
 
 class PWMException : public Exception {
 	public:
@@ -33,6 +42,15 @@ class PWMException : public Exception {
 
 class PWM {
 	public:
+		/**
+			Outcome of flush()
+		*/
+		enum FlushResult {
+			FLUSH_SENT = 0,     // Submitted, or nothing to send
+			FLUSH_DEFERRED = 1, // Previous writes still on the bus
+			FLUSH_FAILED = 2    // Previous writes failed, or submit failed
+		};
+
 		/**
 			Constructor
 
@@ -64,6 +82,11 @@ class PWM {
 		*/
 		void setFrequency(unsigned int hertz);
 
+		/**
+			Get the PWM frequency in Hertz, as last set
+		*/
+		unsigned int getFrequency();
+
 		/**
 			Set PWM load, based on a load factor.
 
@@ -107,6 +130,32 @@ class PWM {
 		*/
 		void setExactLoad(unsigned int channel, uint16_t count);
 
+		/**
+			Send channel loads through the given I2CEngine (which must use the
+			same bus as this PWM object, and outlive it), or synchronously if 0
+			(the default). Waits for any writes still in flight, and when
+			going back to synchronous writes, sends the ones still queued.
+
+			Not to be called while another thread is setting loads.
+
+			Throws I2CException if I2C communication fails.
+		*/
+		void setEngine(I2CEngine *engine);
+
+		/**
+			With an I2CEngine, submit the loads set since the last flush: one
+			write per changed channel, in one transaction. Doesn't block or
+			allocate, so may be called from the control loop's signal handler.
+			Without an engine there is nothing to do.
+
+			If the previous flush's writes are still on the bus, the new loads
+			stay queued for the next flush and FLUSH_DEFERRED is returned:
+			the bus is busy, but nothing has failed. If they failed, they are
+			queued again and FLUSH_FAILED is returned, as for a write that
+			failed synchronously.
+		*/
+		FlushResult flush();
+
 		/**
 			Update dithering for the PWM signal on the given channel.
 
@@ -129,6 +178,17 @@ class PWM {
 		*/
 		void setSleep(bool enabled);
 
+		/**
+			Fill buffer with the register write (PWM_ALLOFF_FRAME_SIZE bytes)
+			that turns every channel fully off at once. For sending to the
+			PCA9685 without going through a PWM object, e.g. from a thread
+			that must not wait on one (see Supervisor).
+
+			The PCA9685 must have register auto-increment on, which
+			setFrequency() does.
+		*/
+		static void getAllOffFrame(uint8_t *buffer);
+
 	private:
 		I2C     *mI2C;
 		uint8_t mSlaveAddr;
@@ -139,6 +199,15 @@ class PWM {
 		uint16_t mCount[16]; // The count out of 4095 to switch from ON to OFF
 		uint16_t mCounter[16];
 
+		// Queued output, if mEngine (not owned) is set. Bit n of mDirty is
+		// set when channel n has a load not yet submitted; mSent holds the
+		// channels in mOutput. mFrames holds mOutput's register writes.
+		I2CEngine      *mEngine;
+		I2CTransaction *mOutput;
+		uint8_t        mFrames[16][5];
+		uint16_t       mDirty,
+		               mSent;
+
 		struct timeval mFrameStart; // start time of the current dither frame
 		long mFrameLength; // length of dithering frame, in microseconds
 
@@ -147,6 +216,20 @@ class PWM {
 			the dithering frame (i.e. set mFrameStart to current time).
 		*/
 		void resetFrame();
+
+		/**
+			Fill buffer with the 5-byte register write that sets channel's
+			count, clipped to 4095
+		*/
+		void getLoadFrame(unsigned int channel, uint16_t count,
+				uint8_t *buffer);
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as the
+			engine may refer to the output transaction.
+		*/
+		PWM(const PWM &other);
+		PWM &operator=(const PWM &other);
 };
 
 #endif
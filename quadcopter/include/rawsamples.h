@@ -0,0 +1,88 @@
+/*
+	rawsamples.h
+
+	RawSamples - raw sensor readings with their acquisition times, in
+		structure-of-arrays layout
+
+	For recording, calibration and batch processing, which need the counts
+	as the chip gave them and when, rather than converted values. The
+	caller owns the arrays; RawSamples only points at them and counts:
+
+		int16_t  x[64], y[64], z[64];
+		uint64_t t[64];
+		RawSamples samples(x, y, z, t, 64);
+		while (accel.readRaw(&samples))
+			...
+
+	Counts stay in the chip's own axes. Conversion to physical units is a
+	separate pass (scaleRaw(), or the drivers' convertRaw()), one array at
+	a time so that the compiler vectorizes it, and is skipped altogether
+	when samples are only logged.
+
+	Times are nanoseconds of CLOCK_MONOTONIC (rawSampleTime()).
+*/
+
+#ifndef RAWSAMPLES_H
+#define RAWSAMPLES_H
+
+#include <stdint.h>
+#include <time.h>
+
+struct RawSamples {
+	int16_t  *x, *y, *z;
+	uint64_t *time;
+	int      capacity;
+	int      count;
+
+	RawSamples(int16_t *nx, int16_t *ny, int16_t *nz, uint64_t *ntime,
+			int ncapacity)
+			: x(nx), y(ny), z(nz), time(ntime), capacity(ncapacity),
+			  count(0) { }
+
+	bool full() const {
+		return count >= capacity;
+	}
+
+	/**
+		Append a reading (x, y, z, in the chip's register order) taken at
+		time. Returns false, adding nothing, if the arrays are full.
+	*/
+	bool add(const int16_t *values, uint64_t t) {
+		if (full())
+			return false;
+		x[count] = values[0];
+		y[count] = values[1];
+		z[count] = values[2];
+		time[count] = t;
+		++count;
+		return true;
+	}
+
+	/**
+		Empty, to fill the same arrays again
+	*/
+	void clear() {
+		count = 0;
+	}
+};
+
+/**
+	Returns the current time for a RawSamples, in nanoseconds of
+	CLOCK_MONOTONIC
+*/
+static inline uint64_t rawSampleTime() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+	out[i] = in[i] * scale for count counts. in and out must not overlap.
+*/
+static inline void scaleRaw(const int16_t *__restrict__ in,
+		float *__restrict__ out, int count, float scale) {
+	for (int i = 0; i < count; ++i)
+		out[i] = in[i] * scale;
+}
+
+#endif
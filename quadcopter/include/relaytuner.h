@@ -0,0 +1,154 @@
+/*
+	relaytuner.h
+
+	RelayTuner class - finds PID gains for a loop by relay feedback
+		(Astrom-Hagglund auto-tuning).
+
+	While running, the tuner takes the place of a PID controller: it is fed
+	the loop's error and its output drives the plant. The output is a relay,
+	+amplitude or -amplitude depending on the sign of the error (with a
+	little hysteresis to ignore noise). Any loop with enough lag settles into
+	a steady oscillation under relay control, and the period and amplitude of
+	that oscillation give the ultimate period Tu and ultimate gain Ku of the
+	loop, i.e. the period at which it would oscillate under proportional
+	control and the gain needed to get there. Ku and Tu are then turned into
+	PID gains with one of the classic tuning rules.
+
+	The oscillation is bounded by the relay amplitude, so the plant never
+	moves further than it needs to. A handful of cycles is enough, which for
+	an attitude loop is a few seconds.
+
+	feed() does not allocate, so the tuner can run inside the control loop.
+*/
+
+#ifndef RELAYTUNER_H
+#define RELAYTUNER_H
+
+// Number of consecutive, consistent oscillation cycles needed to finish
+#define RELAYTUNER_CYCLES    3
+
+// Maximum relative spread of period and amplitude over those cycles
+#define RELAYTUNER_TOLERANCE 0.05f
+
+class RelayTuner {
+	public:
+		/**
+			Rules for converting the ultimate gain and period to PID gains.
+
+				RULE_ZIEGLER_NICHOLS : Kp = 0.6 Ku, Ti = Tu / 2, Td = Tu / 8.
+				                       Fast, but with a lot of overshoot.
+				RULE_TYREUS_LUYBEN   : Kp = Ku / 2.2, Ti = 2.2 Tu,
+				                       Td = Tu / 6.3. More conservative, and
+				                       better suited to loops that are
+				                       nearly integrating, like attitude.
+		*/
+		enum Rule {
+			RULE_ZIEGLER_NICHOLS = 0,
+			RULE_TYREUS_LUYBEN = 1
+		};
+
+		enum State {
+			STATE_IDLE = 0,    // Not started, or stopped
+			STATE_RUNNING = 1, // Oscillating, measuring
+			STATE_DONE = 2,    // Ku and Tu are available
+			STATE_FAILED = 3   // Timed out or aborted
+		};
+
+		/**
+			Constructor
+
+			The tuner starts out idle.
+		*/
+		RelayTuner();
+
+		/**
+			Start tuning.
+
+				amplitude  : relay output magnitude, in the units of the
+				             controller output that the tuner replaces
+				hysteresis : the error must pass +/- hysteresis before the
+				             relay switches. Should be above the noise on the
+				             measurement.
+				timeout    : give up (STATE_FAILED) if no steady oscillation
+				             is found within this many seconds
+
+			Any previous result is discarded.
+		*/
+		void start(float amplitude, float hysteresis, float timeout = 10.0f);
+
+		/**
+			Stop tuning and go back to STATE_IDLE. The previous result, if
+			any, is discarded.
+		*/
+		void stop();
+
+		/**
+			Give up on the current run (STATE_FAILED), e.g. because the plant
+			has moved outside a safe range.
+		*/
+		void abort();
+
+		/**
+			Feed the current error (target - value) of the loop being tuned,
+			with dtime the time since the previous feed in seconds. Returns
+			the output to apply to the plant in place of the controller's.
+
+			Returns 0 unless the state is STATE_RUNNING.
+		*/
+		float feed(float error, float dtime);
+
+		/**
+			Returns the current state.
+		*/
+		State getState();
+
+		/**
+			Returns the measured ultimate gain (output units per unit of
+			error) and ultimate period (seconds). Only meaningful in
+			STATE_DONE.
+		*/
+		float getUltimateGain();
+		float getUltimatePeriod();
+
+		/**
+			Calculate PID gains from the measured Ku and Tu with the given
+			rule. The gains are in the form taken by PIDController::setPID()
+			(i.e. I = Kp / Ti, D = Kp * Td).
+
+			Returns false, leaving p, i and d unchanged, if not in STATE_DONE.
+		*/
+		bool getGains(Rule rule, float &p, float &i, float &d);
+
+	private:
+		State mState;
+
+		float mAmplitude,
+		      mHysteresis,
+		      mTimeout;
+
+		float mTime;      // Seconds since start()
+		float mOutput;    // Current relay output (+/- mAmplitude)
+
+		// Current cycle, from one upward switch of the relay to the next
+		float mCycleStart,
+		      mCycleMin,
+		      mCycleMax;
+		int   mUpSwitches; // Number of upward switches so far
+
+		// Most recent complete cycles, as a ring
+		float mPeriods[RELAYTUNER_CYCLES],
+		      mAmplitudes[RELAYTUNER_CYCLES];
+		int   mNumCycles;
+
+		float mUltimateGain,
+		      mUltimatePeriod;
+
+		/**
+			Record a completed cycle and finish if the last RELAYTUNER_CYCLES
+			of them agree.
+		*/
+		void endCycle(float period, float amplitude);
+};
+
+#endif
+
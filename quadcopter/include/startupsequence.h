@@ -0,0 +1,188 @@
+/*
+	startupsequence.h
+
+	StartupSequence class - tracks the stages that must finish before the
+	quadcopter is ready to fly, and lets other threads wait for (or be told
+	of) readiness.
+
+	The stages are independent and may finish in any order, from any thread:
+
+		STAGE_PRIMING : the ESCs have been sent the priming signal for long
+		                enough (a fixed time, which the other stages overlap)
+		STAGE_WARMUP  : the sensors have been read and the smoothing buffers
+		                filled
+		STAGE_CONFIG  : the calibration and PID coefficients have been loaded
+
+	Once all have completed, the sequence is ready. If any fails, it has
+	failed and will never be ready. Either way the callback, if any, is
+	called exactly once.
+
+	isReady() does not lock, so it can be polled from the control loop (which
+	runs in a signal handler, see Drive::startTimer()).
+*/
+
+#ifndef STARTUPSEQUENCE_H
+#define STARTUPSEQUENCE_H
+
+#include <string>
+#include <time.h>
+#include <pthread.h>
+
+class StartupSequence {
+	public:
+		enum Stage {
+			STAGE_PRIMING = 0,
+			STAGE_WARMUP = 1,
+			STAGE_CONFIG = 2,
+			NUM_STAGES = 3
+		};
+
+		enum State {
+			STATE_STARTING = 0,
+			STATE_READY = 1,
+			STATE_FAILED = 2
+		};
+
+		/**
+			Called once the sequence is ready (ready = true) or has failed
+			(ready = false). data is the pointer given to setCallback().
+		*/
+		typedef void (*Callback)(bool ready, void *data);
+
+		/**
+			Constructor
+
+			Starts the clock that getStageTime() and getReadyTime() measure
+			from. No stages are complete.
+		*/
+		StartupSequence();
+
+		/**
+			Destructor
+
+			Does not wait for anything; the owner must make sure no other
+			thread is using the sequence.
+		*/
+		~StartupSequence();
+
+		/**
+			Mark a stage as complete. Completing the last stage makes the
+			sequence ready, wakes wait() and calls the callback (from this
+			thread). Completing a stage twice, or after a failure, has no
+			effect.
+		*/
+		void complete(Stage stage);
+
+		/**
+			Mark the sequence as failed, with the given reason. Wakes wait()
+			and calls the callback. Has no effect once ready or failed.
+		*/
+		void fail(const std::string &reason);
+
+		/**
+			Returns true if the given stage has completed.
+		*/
+		bool isComplete(Stage stage);
+
+		/**
+			Returns the state of the whole sequence.
+		*/
+		State getState();
+
+		/**
+			Returns true once all stages have completed. Does not lock.
+		*/
+		bool isReady();
+
+		/**
+			Block until the sequence is ready or has failed, or until millis
+			milliseconds have passed (0 waits indefinitely). Returns true if
+			ready.
+		*/
+		bool wait(unsigned int millis = 0);
+
+		/**
+			Sleep for millis milliseconds, for use by the threads doing the
+			stages. Returns early, with false, if cancel() is called.
+		*/
+		bool sleep(unsigned int millis);
+
+		/**
+			Wake everything in sleep() and make future calls return false
+			immediately. For stopping the threads doing the stages.
+		*/
+		void cancel();
+
+		/**
+			Returns true if cancel() has been called.
+		*/
+		bool isCancelled();
+
+		/**
+			Set the function called when the sequence becomes ready or fails.
+			If it already has, the callback is called right away, from this
+			thread. Replaces any previous callback that has not been called.
+		*/
+		void setCallback(Callback callback, void *data);
+
+		/**
+			Seconds since construction
+		*/
+		float getElapsed();
+
+		/**
+			Seconds from construction until the given stage completed, or -1
+			if it has not.
+		*/
+		float getStageTime(Stage stage);
+
+		/**
+			Seconds from construction until the sequence became ready, or -1
+			if it has not.
+		*/
+		float getReadyTime();
+
+		/**
+			Returns the reason given to fail(), or an empty string.
+		*/
+		std::string getError();
+
+	private:
+		pthread_mutex_t mLock;
+		pthread_cond_t  mChanged;   // Signalled on every change of state
+
+		int             mComplete;  // Bits (1 << Stage) of completed stages
+		State           mState;
+		bool            mReady;     // Set atomically, for isReady()
+		bool            mCancelled;
+		std::string     mError;
+
+		struct timespec mStart;
+		float           mStageTime[NUM_STAGES],
+		                mReadyTime;
+
+		Callback        mCallback;
+		void            *mCallbackData;
+
+		/**
+			Returns the time millis milliseconds from now on the clock used by
+			mChanged
+		*/
+		struct timespec deadline(unsigned int millis);
+
+		/**
+			Set the final state (with mLock held). Returns the callback to
+			call once the lock is released, or 0.
+		*/
+		Callback finish(State state);
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as the
+			sequence owns a mutex.
+		*/
+		StartupSequence(const StartupSequence &other);
+		StartupSequence &operator=(const StartupSequence &other);
+};
+
+#endif
+
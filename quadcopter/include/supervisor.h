@@ -0,0 +1,175 @@
+/*
+	supervisor.h
+
+	Supervisor class - watches the control loop's heartbeat, keeps the
+		hardware watchdog petted while it is alive, and turns the motors off
+		if it stops.
+
+	The control loop calls heartbeat() every update (Drive does this when
+	given a Supervisor, see Drive::setSupervisor()). The supervisor thread
+	wakes every update period. If no heartbeat has come for missedticks
+	periods, the loop is taken to be stuck (a deadlock, or an I2C transfer
+	that never returns) and the supervisor trips:
+
+		- It writes the PCA9685's all-channels-off frame (see
+		  PWM::getAllOffFrame()) straight to the I2C bus, as a single
+		  I2C_RDWR transfer prepared at construction. This uses the
+		  supervisor's own handle on the bus, so it doesn't depend on the
+		  state of the I2C object the loop may be stuck in, and needs no
+		  allocation. It is retried every period until it succeeds.
+		- It stops petting the watchdog device, so the hardware resets the
+		  system after the watchdog's timeout.
+
+	Tripping latches; the heartbeat coming back doesn't undo it. The
+	reaction time, from the last heartbeat to the frame being sent, is at
+	most (missedticks + 1) update periods plus the transfer itself.
+
+	Until the first heartbeat (the loop may not be running yet) the
+	watchdog is petted and nothing is checked. A clean stop() disarms the
+	watchdog with the magic close character, where the driver allows it.
+
+	The watchdog device is anything that accepts writes the way
+	/dev/watchdog does; the tests use a FIFO (see tests/simulator.h).
+*/
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <pthread.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "exception.h"
+#include "pwm.h"
+
+// Default watchdog device, and number of update periods without a
+// heartbeat before tripping
+#define SUPERVISOR_WATCHDOG     "/dev/watchdog"
+#define SUPERVISOR_MISSED_TICKS 3
+
+// Timeout requested from the watchdog device, in seconds
+#define SUPERVISOR_WATCHDOG_TIMEOUT 1
+
+class SupervisorException : public Exception {
+	public:
+		SupervisorException(const std::string &msg, const std::string &file,
+				int line) : Exception(msg, file, line) { }
+};
+
+class Supervisor {
+	public:
+		/**
+			Constructor
+
+			watchdog is the watchdog device to pet, or "" for none.
+			i2cdevice and pwmaddr are the I2C bus and address of the PCA9685
+			to turn off when tripping, or "" for none. updaterate is the rate
+			of the control loop, in Hz.
+
+			The supervisor doesn't run until start().
+
+			Throws SupervisorException if a device could not be opened.
+		*/
+		Supervisor(const std::string &watchdog, const std::string &i2cdevice,
+				uint8_t pwmaddr, int updaterate,
+				int missedticks = SUPERVISOR_MISSED_TICKS);
+
+		/**
+			Destructor
+
+			stop()s the supervisor.
+		*/
+		~Supervisor();
+
+		/**
+			Start the supervisor thread.
+
+			Throws SupervisorException if the thread could not be started.
+		*/
+		void start();
+
+		/**
+			Stop the supervisor thread. If it has not tripped, the watchdog is
+			disarmed (magic close).
+		*/
+		void stop();
+
+		/**
+			Note that the control loop is alive. Doesn't lock or allocate, so
+			can be called from a signal handler.
+		*/
+		void heartbeat();
+
+		/**
+			Returns true once the supervisor has tripped.
+		*/
+		bool isTripped();
+
+		/**
+			Returns true once the all-off frame has been sent successfully.
+		*/
+		bool isFrameSent();
+
+		/**
+			Returns the number of times sending the frame has been tried.
+		*/
+		int getFrameAttempts();
+
+		/**
+			Returns the seconds from the last heartbeat until tripping, or -1
+			if not tripped.
+		*/
+		float getReactionTime();
+
+	private:
+		int   mWatchdogFd,   // -1 if none
+		      mI2CFd;        // -1 if none
+		long  mPeriod;       // Update period, in nanoseconds
+		int   mMissedTicks;
+
+		// Prepared all-off transfer
+		uint8_t                    mFrame[PWM_ALLOFF_FRAME_SIZE];
+		struct i2c_msg             mFrameMsg;
+		struct i2c_rdwr_ioctl_data mFrameTransfer;
+
+		pthread_t mThread;
+		bool      mRunning;
+
+		// Shared with the thread, accessed atomically
+		int   mHeartbeats;
+		bool  mStopping,
+		      mTripped,
+		      mFrameSent;
+		int   mFrameAttempts;
+		float mReactionTime;
+
+		friend void *supervisorThreadEntry(void *);
+
+		/**
+			The supervisor thread
+		*/
+		void run();
+
+		/**
+			Pet the watchdog, if there is one
+		*/
+		void pet();
+
+		/**
+			Send the prepared all-off frame. Returns true on success.
+		*/
+		bool sendFrame();
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as the
+			supervisor owns a thread and devices.
+		*/
+		Supervisor(const Supervisor &other);
+		Supervisor &operator=(const Supervisor &other);
+};
+
+#endif
+
@@ -0,0 +1,247 @@
+/*
+	vibrationanalyzer.h
+
+	VibrationAnalyzer class - spectrum of the gyroscope and accelerometer
+		readings, to find the motor and propeller vibration in them
+
+	Readings are handed to tap() with the time they were taken. They must
+	come faster than twice the highest vibration frequency of interest:
+	motor and propeller vibration is mostly 80 to 300Hz, so readings taken
+	at the control loop's update rate (100Hz, Nyquist limit 50Hz) would
+	show it only as aliases. VibrationSampler reads the sensors for the
+	analyzer at their output data rate instead. tap() only copies the
+	reading into a lock-free ring shared with the analyzer's thread, so it
+	costs a few stores and never waits; if the thread falls behind,
+	readings are dropped (see getDropped()) rather than the caller held
+	up.
+
+	The thread, at the lowest scheduling priority (SCHED_IDLE), keeps the
+	last size readings of each channel. Every size / 2 new readings (50%
+	overlap) it takes the spectrum of each channel: the mean is removed, a
+	Hann window applied and a RealFFT taken. It then finds the strongest
+	VIBRATION_PEAKS local maxima above the minimum frequency, refining each
+	one's frequency and amplitude between bins (Gaussian interpolation, and
+	the Hann window's response at that offset). Amplitudes are those of a
+	sine in the channel's units (dps, g).
+
+	Frequencies are worked out at the rate the window's readings were
+	actually taken, from their times, rather than the nominal rate. A
+	reading that comes more than VIBRATION_MAX_GAP periods after the one
+	before (e.g. after reads failed) starts the window again, as the
+	spectrum of readings with a gap in them is not to be trusted. A single
+	missing reading is let through: it only shifts the readings after it
+	by a period, which smears the peaks a little.
+
+	The results are read with getPeaks() and getSpectrum(), from any
+	thread; quadcopter.cpp sends the peaks over the radio as
+	PacketVibration.
+
+	Only one thread may call tap(), and analyze() must not be called while
+	the analyzer's thread is running.
+*/
+
+#ifndef VIBRATIONANALYZER_H
+#define VIBRATIONANALYZER_H
+
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "exception.h"
+#include "geometry.h"
+#include "fft.h"
+
+#define VIBRATION_CHANNELS 6
+#define VIBRATION_PEAKS    3
+
+// Default readings per spectrum, and lowest frequency reported (Hz)
+#define VIBRATION_DEFAULT_SIZE    256
+#define VIBRATION_MIN_FREQUENCY   10.0f
+
+// Readings the tap holds for the thread (a power of two)
+#define VIBRATION_TAP_SIZE 1024
+
+// Longest time between readings, in periods at the nominal sample rate,
+// before the window starts again
+#define VIBRATION_MAX_GAP 2.5f
+
+class VibrationException : public Exception {
+	public:
+		VibrationException(const std::string &msg, const std::string &file,
+				int line) : Exception(msg, file, line) { }
+};
+
+struct VibrationPeak {
+	float frequency;  // Hz
+	float amplitude;  // Channel units (dps or g)
+};
+
+class VibrationAnalyzer {
+	public:
+		enum Channel {
+			CHANNEL_GYRO_X = 0,
+			CHANNEL_GYRO_Y = 1,
+			CHANNEL_GYRO_Z = 2,
+			CHANNEL_ACCEL_X = 3,
+			CHANNEL_ACCEL_Y = 4,
+			CHANNEL_ACCEL_Z = 5
+		};
+
+		/**
+			Constructor
+
+			samplerate is the nominal rate readings are tapped at, in Hz.
+			size is the number of readings per spectrum, rounded down to a
+			power of two (see RealFFT); the resolution is samplerate / size.
+			Peaks below minfrequency are not reported.
+
+			The analyzer doesn't run until start(), but tap() can be called
+			before.
+		*/
+		VibrationAnalyzer(float samplerate,
+				int size = VIBRATION_DEFAULT_SIZE,
+				float minfrequency = VIBRATION_MIN_FREQUENCY);
+
+		/**
+			Destructor
+
+			stop()s the analyzer.
+		*/
+		~VibrationAnalyzer();
+
+		/**
+			Hand over a reading, taken at time (nanoseconds, as
+			rawSampleTime()). Doesn't lock, allocate or wait.
+		*/
+		void tap(const Vector3<float> &gyro, const Vector3<float> &accel,
+				uint64_t time);
+
+		/**
+			Start the analyzer thread.
+
+			Throws VibrationException if the thread could not be started.
+		*/
+		void start();
+
+		/**
+			Stop the analyzer thread
+		*/
+		void stop();
+
+		/**
+			Take the readings tapped so far, and work out the spectra if
+			enough new readings have come in. Returns true if they were.
+			This is what the thread runs; call it directly only when the
+			thread isn't running.
+		*/
+		bool analyze();
+
+		/**
+			Copy the last peaks of a channel, strongest first, into peaks
+			(room for VIBRATION_PEAKS). Returns how many there are (0 before
+			the first spectrum).
+		*/
+		int getPeaks(Channel channel, VibrationPeak *peaks);
+
+		/**
+			As getPeaks(), but returns -1 rather than wait if the thread is
+			storing new results. For the control loop, which must not wait
+			on a thread of the lowest priority.
+		*/
+		int tryGetPeaks(Channel channel, VibrationPeak *peaks);
+
+		/**
+			Copy the last spectrum of a channel into amplitudes (room for
+			getSize() / 2 + 1), as the amplitude of a sine at each bin
+		*/
+		void getSpectrum(Channel channel, float *amplitudes);
+
+		/**
+			Returns the readings per spectrum, and the frequency of one bin
+			(Hz)
+		*/
+		int getSize();
+		float getResolution();
+
+		/**
+			Returns the sample rate of the last spectrum, as measured from
+			the readings' times, or the nominal rate before the first (Hz)
+		*/
+		float getSampleRate();
+
+		/**
+			Returns the number of spectra worked out so far, the readings
+			dropped because the tap was full, and the times the window
+			started again because of a gap in the readings
+		*/
+		int getAnalyses();
+		int getDropped();
+		int getGaps();
+
+	private:
+		struct Reading {
+			float    values[VIBRATION_CHANNELS];
+			uint64_t time;
+		};
+
+		float    mSampleRate;
+		uint64_t mMaxGap;     // ns
+		int      mSize;
+		float    mMinFrequency;
+
+		// Tap. The producer moves mTapHead, the thread mTapTail; both are
+		// accessed atomically.
+		Reading  *mTap;
+		unsigned mTapHead,
+		         mTapTail;
+		int      mDropped;
+
+		// The thread's
+		RealFFT *mFFT;
+		float    *mHistory[VIBRATION_CHANNELS];  // Circular, mSize each
+		uint64_t *mHistoryTime;
+		int      mHistoryPos,
+		         mHistoryCount,
+		         mFresh;         // Readings since the last spectrum
+		int      mGaps;          // Accessed atomically
+		float   *mWindow,
+		        *mWork,
+		        *mPower,
+		        *mAmplitude[VIBRATION_CHANNELS];
+
+		// Results, under mLock
+		pthread_mutex_t mLock;
+		float           *mSpectrum[VIBRATION_CHANNELS];
+		VibrationPeak   mPeaks[VIBRATION_CHANNELS][VIBRATION_PEAKS];
+		int             mPeakCount[VIBRATION_CHANNELS];
+		int             mAnalyses;
+		float           mMeasuredRate;
+
+		pthread_t mThread;
+		bool      mRunning,
+		          mStopping;  // Accessed atomically
+
+		friend void *vibrationThreadEntry(void *);
+
+		/**
+			The analyzer thread
+		*/
+		void run();
+
+		/**
+			Work out the spectrum and peaks of a channel from its history,
+			into mAmplitude[channel] and peaks, with a bin resolution
+			(Hz). Returns the number of peaks.
+		*/
+		int analyzeChannel(int channel, VibrationPeak *peaks,
+				float resolution);
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as
+			the analyzer owns a thread and buffers.
+		*/
+		VibrationAnalyzer(const VibrationAnalyzer &other);
+		VibrationAnalyzer &operator=(const VibrationAnalyzer &other);
+};
+
+#endif
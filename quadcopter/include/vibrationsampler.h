@@ -0,0 +1,157 @@
+/*
+	vibrationsampler.h
+
+	VibrationSampler class - reads the gyroscope and accelerometer at their
+		output data rate for a VibrationAnalyzer
+
+	The control loop reads the sensors once per update (100Hz), which can
+	only show vibration below 50Hz; the motors and propellers vibrate at 80
+	to 300Hz. The sampler reads them separately, at the sensors' output data
+	rate (e.g. 400Hz, which shows up to 200Hz), so that the analyzer sees
+	the vibration where it is rather than its aliases.
+
+	Its thread wakes every sample period and submits a read of both sensors
+	(one I2CTransaction, into buffers of its own) to the sensors'
+	I2CEngine, alongside the control loop's reads. If the last read hasn't
+	completed yet, that sample is skipped (see getMissed()). On completion,
+	in the bus thread, the raw counts are appended to RawSamples with the
+	time the read completed. Every VIBRATION_SAMPLER_BATCH samples they are
+	converted (the drivers' convertRaw(), a pass per axis) and tapped into
+	the analyzer with their times, from which it works out the rate they
+	were actually taken at. Failed and skipped reads leave gaps in the
+	times; the analyzer does not analyze across more than one missing
+	sample (see VIBRATION_MAX_GAP).
+
+	The sampler must be the only thread tapping the analyzer.
+*/
+
+#ifndef VIBRATIONSAMPLER_H
+#define VIBRATIONSAMPLER_H
+
+#include <stdint.h>
+#include <string>
+#include <pthread.h>
+
+#include "exception.h"
+#include "i2cengine.h"
+#include "accelerometer.h"
+#include "gyroscope.h"
+#include "rawsamples.h"
+#include "vibrationanalyzer.h"
+
+// Samples converted and tapped at once
+#define VIBRATION_SAMPLER_BATCH 16
+
+class VibrationSamplerException : public Exception {
+	public:
+		VibrationSamplerException(const std::string &msg,
+				const std::string &file, int line)
+				: Exception(msg, file, line) { }
+};
+
+class VibrationSampler {
+	public:
+		/**
+			Constructor
+
+			Reads accel and gyro through engine every 1 / samplerate
+			seconds, for analyzer (whose sample rate should be the same).
+			samplerate should not be above the sensors' output data rate,
+			as set with their setSampleRate(). None of these are owned, and
+			all must outlive the sampler.
+
+			The sampler doesn't run until start().
+		*/
+		VibrationSampler(I2CEngine *engine, Accelerometer *accel,
+				Gyroscope *gyro, VibrationAnalyzer *analyzer,
+				float samplerate);
+
+		/**
+			Destructor
+
+			stop()s the sampler.
+		*/
+		~VibrationSampler();
+
+		/**
+			Start the sampler thread.
+
+			Throws VibrationSamplerException if the thread could not be
+			started.
+		*/
+		void start();
+
+		/**
+			Stop the sampler thread, and wait for its last read to complete
+		*/
+		void stop();
+
+		/**
+			Returns the number of samples read, of samples skipped because
+			the last read was still on the bus (or the engine's queue was
+			full), and of reads that failed
+		*/
+		long getSamples();
+		long getMissed();
+		long getFailed();
+
+	private:
+		I2CEngine         *mEngine;
+		VibrationAnalyzer *mAnalyzer;
+		long              mPeriod;  // ns
+
+		// The read, and its buffers
+		I2CTransaction *mRead;
+		int16_t        mAccelValues[3],
+		               mGyroValues[3];
+
+		// The bus thread's. Raw samples until a batch is full, and the
+		// batch converted.
+		int16_t    mAccelRaw[3][VIBRATION_SAMPLER_BATCH],
+		           mGyroRaw[3][VIBRATION_SAMPLER_BATCH];
+		uint64_t   mTimes[VIBRATION_SAMPLER_BATCH];
+		RawSamples mAccelSamples,
+		           mGyroSamples;
+		float      mAccelScale,
+		           mGyroScale;
+		float      mAccel[3][VIBRATION_SAMPLER_BATCH],
+		           mGyro[3][VIBRATION_SAMPLER_BATCH];
+
+		pthread_t mThread;
+		bool      mRunning;
+
+		// Accessed atomically
+		bool mStopping;
+		long mSubmitted,
+		     mHandled,    // Completions the callback has finished with
+		     mSamples,
+		     mMissed,
+		     mFailed;
+
+		friend void *vibrationSamplerThreadEntry(void *);
+
+		/**
+			The sampler thread
+		*/
+		void run();
+
+		/**
+			Completion of mRead, in the bus thread
+		*/
+		static void readComplete(I2CTransaction *transaction, void *data);
+
+		/**
+			Convert the batch of raw samples and tap them into the analyzer
+		*/
+		void flush();
+
+		/**
+			Private copy constructor and assignment. Disallows copying, as
+			the sampler owns a thread, and the engine refers to its read by
+			address.
+		*/
+		VibrationSampler(const VibrationSampler &other);
+		VibrationSampler &operator=(const VibrationSampler &other);
+};
+
+#endif
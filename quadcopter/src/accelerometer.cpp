@@ -9,7 +9,9 @@
 
 #include "exception.h"
 #include "i2c.h"
+#include "i2cengine.h"
 #include "geometry.h"
+#include "rawsamples.h"
 #include "accelerometer.h"
 
 // ADXL345 Register Addresses
@@ -29,6 +31,9 @@ Accelerometer::Accelerometer(I2C *i2c, uint8_t slaveaddr, Range range,
 	mI2C = i2c;
 	mSlaveAddr = slaveaddr;
 	mRange = range;
+	mScale = scale(range);
+	mQueuedRegister = DATAX0;
+	mQueuedValues[0] = mQueuedValues[1] = mQueuedValues[2] = 0;
 
 	setSleep(true);
 	setRange(range);
@@ -76,6 +81,7 @@ void Accelerometer::setSleep(bool sleep) {
 
 void Accelerometer::setRange(Range range) {
 	mRange = range;
+	mScale = scale(range);
 
 	char buffer[2];
 	buffer[0] = DATA_FORMAT;
@@ -91,8 +97,6 @@ void Accelerometer::setSampleRate(SampleRate rate) {
 }
 
 Vector3<float> Accelerometer::read() {
-	Vector3<float> vector;
-	float factor;
 	int16_t values[3];
 	char buffer = DATAX0;
 
@@ -100,27 +104,71 @@ Vector3<float> Accelerometer::read() {
 	mI2C->enqueueRead(mSlaveAddr, values, 6);
 	mI2C->sendTransaction();
 
-	// From ADXL345 doc, p. 4
-	// Described as LSB/g. Number of discrete values per g
-	switch (mRange) {
-		case RANGE_2G:
-			factor = 256.0f;
-			break;
-		case RANGE_4G:
-			factor = 128.0f;
-			break;
-		case RANGE_8G:
-			factor = 64.0f;
-			break;
-		case RANGE_16G:
-			factor = 32.0f;
-			break;
-	}
+	return convert(values);
+}
+
+void Accelerometer::queueRead(I2CTransaction *transaction) {
+	mQueuedRegister = DATAX0;
+	transaction->addWrite(mSlaveAddr, &mQueuedRegister, 1);
+	transaction->addRead(mSlaveAddr, mQueuedValues, 6);
+}
+
+void Accelerometer::queueRead(I2CTransaction *transaction, int16_t *values) {
+	// mQueuedRegister only ever holds DATAX0
+	transaction->addWrite(mSlaveAddr, &mQueuedRegister, 1);
+	transaction->addRead(mSlaveAddr, values, 6);
+}
+
+Vector3<float> Accelerometer::readQueued() {
+	return convert(mQueuedValues);
+}
+
+bool Accelerometer::readRaw(RawSamples *samples) {
+	if (samples->full())
+		return false;
+
+	int16_t values[3];
+	char buffer = DATAX0;
+
+	uint64_t start = rawSampleTime();
+	mI2C->enqueueWrite(mSlaveAddr, &buffer, 1);
+	mI2C->enqueueRead(mSlaveAddr, values, 6);
+	mI2C->sendTransaction();
+	uint64_t end = rawSampleTime();
+
+	return samples->add(values, start + (end - start) / 2);
+}
+
+bool Accelerometer::readQueuedRaw(RawSamples *samples, uint64_t time) {
+	return samples->add(mQueuedValues, time);
+}
+
+void Accelerometer::convertRaw(const RawSamples &samples, float *x, float *y,
+		float *z, float scale) {
+	scaleRaw(samples.x, x, samples.count, scale);
+	scaleRaw(samples.y, y, samples.count, scale);
+	scaleRaw(samples.z, z, samples.count, scale);
+}
 
-	vector.x = (float)values[0] / factor;
-	vector.y = (float)values[1] / factor;
-	vector.z = (float)values[2] / factor;
+float Accelerometer::getScale() {
+	return mScale;
+}
 
-	return vector;
+void Accelerometer::convertRaw(const int16_t *values, Vector3<float> *out,
+		int count, float scale) {
+	for (int i = 0; i < count; ++i) {
+		out[i].x = values[3 * i] * scale;
+		out[i].y = values[3 * i + 1] * scale;
+		out[i].z = values[3 * i + 2] * scale;
+	}
 }
 
+/*
+	Private member functions
+*/
+
+Vector3<float> Accelerometer::convert(const int16_t *values) {
+	// The scale is resolved by setRange(), so this is a multiply per axis
+	return Vector3<float>(values[0] * mScale, values[1] * mScale,
+			values[2] * mScale);
+}
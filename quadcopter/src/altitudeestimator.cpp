@@ -0,0 +1,71 @@
+/*
+	altitudeestimator.cpp
+
+	AltitudeEstimator class - estimates altitude and vertical velocity from
+		the barometer and the accelerometer.
+*/
+
+#include "altitudeestimator.h"
+
+AltitudeEstimator::AltitudeEstimator(float timeconstant) {
+	setTimeConstant(timeconstant);
+	reset();
+}
+
+void AltitudeEstimator::setTimeConstant(float timeconstant) {
+	if (timeconstant <= 0.0f)
+		timeconstant = ALTITUDE_TIME_CONSTANT;
+	mK1 = 3.0f / timeconstant;
+	mK2 = 3.0f / (timeconstant * timeconstant);
+	mK3 = 1.0f / (timeconstant * timeconstant * timeconstant);
+}
+
+void AltitudeEstimator::predict(float accel, float dtime) {
+	if (!mValid)
+		return;
+
+	float a = accel - mBias;
+	mAltitude += (mVelocity + 0.5f * a * dtime) * dtime;
+	mVelocity += a * dtime;
+	mSinceCorrection += dtime;
+}
+
+void AltitudeEstimator::correct(float altitude) {
+	if (!mValid) {
+		mAltitude = altitude;
+		mValid = true;
+		mSinceCorrection = 0.0f;
+		return;
+	}
+
+	float error = altitude - mAltitude,
+	      dtime = mSinceCorrection;
+	mAltitude += mK1 * error * dtime;
+	mVelocity += mK2 * error * dtime;
+	mBias     -= mK3 * error * dtime;
+	mSinceCorrection = 0.0f;
+}
+
+void AltitudeEstimator::reset() {
+	mAltitude = 0.0f;
+	mVelocity = 0.0f;
+	mBias = 0.0f;
+	mSinceCorrection = 0.0f;
+	mValid = false;
+}
+
+bool AltitudeEstimator::isValid() {
+	return mValid;
+}
+
+float AltitudeEstimator::getAltitude() {
+	return mAltitude;
+}
+
+float AltitudeEstimator::getVelocity() {
+	return mVelocity;
+}
+
+float AltitudeEstimator::getBias() {
+	return mBias;
+}
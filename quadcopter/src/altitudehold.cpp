@@ -0,0 +1,82 @@
+/*
+	altitudehold.cpp
+
+	AltitudeHold class - holds altitude with the throttle, from an altitude
+		and climb rate estimate (see AltitudeEstimator).
+*/
+
+#include <math.h>
+
+#include "geometry.h"
+#include "pidcontroller.h"
+#include "altitudehold.h"
+
+AltitudeHold::AltitudeHold() {
+	mEngaged = false;
+	mTargetAltitude = 0.0f;
+	mHoverThrottle = 0.0f;
+	mAltitudeP = ALTHOLD_ALTITUDE_P;
+
+	mPIDClimb = new PIDController(0.0f, ALTHOLD_CLIMB_P, ALTHOLD_CLIMB_I,
+			ALTHOLD_CLIMB_D);
+	mPIDClimb->setOutputLimits(-ALTHOLD_CLIMB_LIMIT, ALTHOLD_CLIMB_LIMIT);
+	mPIDClimb->setIntegralLimit(ALTHOLD_CLIMB_LIMIT);
+}
+
+AltitudeHold::~AltitudeHold() {
+	delete mPIDClimb;
+}
+
+void AltitudeHold::setPID(float altitudep, float climbp, float climbi,
+		float climbd) {
+	mAltitudeP = altitudep;
+	mPIDClimb->setPID(climbp, climbi, climbd);
+}
+
+void AltitudeHold::engage(float altitude, float hoverthrottle) {
+	mTargetAltitude = altitude;
+	mHoverThrottle = hoverthrottle;
+	mPIDClimb->reset();
+	mEngaged = true;
+}
+
+void AltitudeHold::disengage() {
+	mEngaged = false;
+}
+
+bool AltitudeHold::isEngaged() {
+	return mEngaged;
+}
+
+float AltitudeHold::update(float stick, float altitude, float climbrate,
+		float dtime) {
+	// Outside the deadband, the stick sets the climb rate, which moves the
+	// altitude to hold
+	float offset = stick - 0.5f,
+	      rate = 0.0f;
+	if (fabs(offset) > ALTHOLD_DEADBAND)
+		rate = (offset - sign(offset) * ALTHOLD_DEADBAND)
+				/ (0.5f - ALTHOLD_DEADBAND) * ALTHOLD_MAX_CLIMB_RATE;
+	mTargetAltitude += rate * dtime;
+
+	// Don't let the target run away from a quadcopter that can't follow
+	if (mAltitudeP > 0.0f) {
+		float reach = ALTHOLD_MAX_CLIMB_RATE / mAltitudeP;
+		if (mTargetAltitude > altitude + reach)
+			mTargetAltitude = altitude + reach;
+		if (mTargetAltitude < altitude - reach)
+			mTargetAltitude = altitude - reach;
+	}
+
+	float climb = mAltitudeP * (mTargetAltitude - altitude);
+	if (climb > ALTHOLD_MAX_CLIMB_RATE)  climb = ALTHOLD_MAX_CLIMB_RATE;
+	if (climb < -ALTHOLD_MAX_CLIMB_RATE) climb = -ALTHOLD_MAX_CLIMB_RATE;
+
+	mPIDClimb->setTarget(climb);
+	mPIDClimb->feed(climbrate, dtime);
+	return mHoverThrottle + mPIDClimb->output();
+}
+
+float AltitudeHold::getTargetAltitude() {
+	return mTargetAltitude;
+}
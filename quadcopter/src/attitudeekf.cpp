@@ -0,0 +1,320 @@
+/*
+	attitudeekf.cpp
+
+	AttitudeEKF class - extended Kalman filter for attitude, gyroscope bias,
+		altitude and vertical velocity.
+*/
+
+#include <math.h>
+
+#include "geometry.h"
+#include "fastmath.h"
+#include "matrix.h"
+#include "altitudeestimator.h"
+#include "attitudeekf.h"
+
+// Positions in the state
+#define Q0 0
+#define BX 4
+#define H  7
+#define V  8
+
+AttitudeEKF::AttitudeEKF() {
+	setNoise(EKF_GYRO_NOISE, EKF_BIAS_DRIFT, EKF_VACCEL_NOISE,
+			EKF_ACCEL_NOISE, EKF_HEADING_NOISE, EKF_ALTITUDE_NOISE);
+	initialize(Vector3<float>(0.0f, 0.0f, -1.0f), 0.0f);
+}
+
+void AttitudeEKF::setNoise(float gyro, float biasdrift, float vaccel,
+		float accel, float heading, float altitude) {
+	mGyroVar = gyro * gyro * RADIANS_PER_DEGREE * RADIANS_PER_DEGREE;
+	mBiasVar = biasdrift * biasdrift * RADIANS_PER_DEGREE * RADIANS_PER_DEGREE;
+	mVAccelVar = vaccel * vaccel;
+	mAccelVar = accel * accel;
+	mHeadingVar = heading * heading * RADIANS_PER_DEGREE * RADIANS_PER_DEGREE;
+	mAltitudeVar = altitude * altitude;
+}
+
+void AttitudeEKF::initialize(const Vector3<float> &accel, float heading) {
+	// The shortest rotation taking the accelerometer's "up" to the world's
+	// (0, 0, -1)
+	float norm = sqrt(accel.x * accel.x + accel.y * accel.y
+			+ accel.z * accel.z);
+	float ux = 0.0f, uy = 0.0f, uz = -1.0f;
+	if (norm > 0.0f) {
+		ux = accel.x / norm;
+		uy = accel.y / norm;
+		uz = accel.z / norm;
+	}
+
+	// q = (1 + u.d, u x d), d = (0, 0, -1); upside down, turn about X
+	float q0 = 1.0f - uz, q1 = -uy, q2 = ux, q3 = 0.0f;
+	if (q0 < 1e-6f) {
+		q0 = 0.0f;
+		q1 = 1.0f;
+		q2 = 0.0f;
+	}
+	mX = State(0.0f);
+	mX[Q0] = q0;
+	mX[Q0 + 1] = q1;
+	mX[Q0 + 2] = q2;
+	mX[Q0 + 3] = q3;
+	normalize();
+
+	// Then turn about the world's Z to the heading
+	float turn = angleDifference(heading, getYaw()) * RADIANS_PER_DEGREE * 0.5f;
+	float c = cos(turn), s = sin(turn);
+	q0 = mX[Q0];
+	q1 = mX[Q0 + 1];
+	q2 = mX[Q0 + 2];
+	q3 = mX[Q0 + 3];
+	mX[Q0]     = c * q0 - s * q3;
+	mX[Q0 + 1] = c * q1 - s * q2;
+	mX[Q0 + 2] = c * q2 + s * q1;
+	mX[Q0 + 3] = c * q3 + s * q0;
+	normalize();
+
+	// About 10 degrees of attitude, 2 deg/s of bias, 1m/s
+	mP = Covariance(0.0f);
+	for (int i = 0; i < 4; ++i)
+		mP(Q0 + i, Q0 + i) = 0.01f;
+	for (int i = 0; i < 3; ++i)
+		mP(BX + i, BX + i) = (float)(4.0 * RADIANS_PER_DEGREE * RADIANS_PER_DEGREE);
+	mP(H, H) = mAltitudeVar;
+	mP(V, V) = 1.0f;
+	mAltitudeValid = false;
+}
+
+void AttitudeEKF::predict(const Vector3<float> &gyro,
+		const Vector3<float> &accel, float dtime) {
+	float q0 = mX[Q0], q1 = mX[Q0 + 1], q2 = mX[Q0 + 2], q3 = mX[Q0 + 3];
+	float wx = gyro.x * RADIANS_PER_DEGREE - mX[BX],
+	      wy = gyro.y * RADIANS_PER_DEGREE - mX[BX + 1],
+	      wz = gyro.z * RADIANS_PER_DEGREE - mX[BX + 2];
+	float hdt = 0.5f * dtime;
+
+	// dq/dt = 1/2 q (x) (0, w), and its derivative by the rates, Xi
+	float xi[4][3] = {
+		{ -q1, -q2, -q3 },
+		{  q0, -q3,  q2 },
+		{  q3,  q0, -q1 },
+		{ -q2,  q1,  q0 }
+	};
+
+	Covariance f(1.0f);
+	f(0, 1) = -hdt * wx; f(0, 2) = -hdt * wy; f(0, 3) = -hdt * wz;
+	f(1, 0) =  hdt * wx; f(1, 2) =  hdt * wz; f(1, 3) = -hdt * wy;
+	f(2, 0) =  hdt * wy; f(2, 1) = -hdt * wz; f(2, 3) =  hdt * wx;
+	f(3, 0) =  hdt * wz; f(3, 1) =  hdt * wy; f(3, 2) = -hdt * wx;
+	for (int r = 0; r < 4; ++r)
+		for (int c = 0; c < 3; ++c)
+			f(Q0 + r, BX + c) = -hdt * xi[r][c];
+
+	Matrix<float, 4, 3> xim;
+	for (int r = 0; r < 4; ++r)
+		for (int c = 0; c < 3; ++c)
+			xim(r, c) = xi[r][c];
+	Matrix<float, 4, 4> qnoise = multiplyTransposed(xim, xim);
+
+	mX[Q0]     = q0 + hdt * (-q1 * wx - q2 * wy - q3 * wz);
+	mX[Q0 + 1] = q1 + hdt * ( q0 * wx + q2 * wz - q3 * wy);
+	mX[Q0 + 2] = q2 + hdt * ( q0 * wy - q1 * wz + q3 * wx);
+	mX[Q0 + 3] = q3 + hdt * ( q0 * wz + q1 * wy - q2 * wx);
+
+	// Vertical acceleration: the world's Z (down) of the accelerometer's
+	// reading, less gravity. Its derivative by the attitude, d.
+	if (mAltitudeValid) {
+		float fx = accel.x, fy = accel.y, fz = accel.z;
+		float down = 2.0f * (q1 * q3 - q0 * q2) * fx
+				+ 2.0f * (q2 * q3 + q0 * q1) * fy
+				+ (q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3) * fz;
+		float a = (-down - 1.0f) * ALTITUDE_GRAVITY;
+		float d[4] = {
+			2.0f * (-q2 * fx + q1 * fy + q0 * fz),
+			2.0f * ( q3 * fx + q0 * fy - q1 * fz),
+			2.0f * (-q0 * fx + q3 * fy - q2 * fz),
+			2.0f * ( q1 * fx + q2 * fy + q3 * fz)
+		};
+		for (int i = 0; i < 4; ++i) {
+			f(V, Q0 + i) = -ALTITUDE_GRAVITY * dtime * d[i];
+			f(H, Q0 + i) = 0.5f * dtime * f(V, Q0 + i);
+		}
+		f(H, V) = dtime;
+
+		mX[H] += (mX[V] + 0.5f * a * dtime) * dtime;
+		mX[V] += a * dtime;
+	}
+	normalize();
+
+	// P = F P F^T + Q
+	mP = multiplyTransposed(f * mP, f);
+	for (int r = 0; r < 4; ++r)
+		for (int c = 0; c < 4; ++c)
+			mP(Q0 + r, Q0 + c) += hdt * hdt * mGyroVar * qnoise(r, c);
+	for (int i = 0; i < 3; ++i)
+		mP(BX + i, BX + i) += mBiasVar * dtime;
+	if (mAltitudeValid) {
+		float dt2 = dtime * dtime;
+		mP(H, H) += 0.25f * dt2 * dt2 * mVAccelVar;
+		mP(H, V) += 0.5f * dt2 * dtime * mVAccelVar;
+		mP(V, H) += 0.5f * dt2 * dtime * mVAccelVar;
+		mP(V, V) += dt2 * mVAccelVar;
+	}
+	symmetrize(mP);
+}
+
+bool AttitudeEKF::correctAccelerometer(const Vector3<float> &accel) {
+	float norm = fastSqrt(accel.x * accel.x + accel.y * accel.y
+			+ accel.z * accel.z);
+	if (fabs(norm - 1.0f) > EKF_ACCEL_GATE)
+		return false;
+	float measured[3] = { accel.x / norm, accel.y / norm, accel.z / norm };
+
+	// One axis at a time, each against the state the last left. "Up" is
+	// minus the last row of the rotation.
+	for (int axis = 0; axis < 3; ++axis) {
+		float q0 = mX[Q0], q1 = mX[Q0 + 1], q2 = mX[Q0 + 2], q3 = mX[Q0 + 3];
+		float up;
+		Observation h(0.0f);
+		switch (axis) {
+			case 0:
+				up = -2.0f * (q1 * q3 - q0 * q2);
+				h(0, 0) = 2.0f * q2;  h(0, 1) = -2.0f * q3;
+				h(0, 2) = 2.0f * q0;  h(0, 3) = -2.0f * q1;
+				break;
+			case 1:
+				up = -2.0f * (q2 * q3 + q0 * q1);
+				h(0, 0) = -2.0f * q1; h(0, 1) = -2.0f * q0;
+				h(0, 2) = -2.0f * q3; h(0, 3) = -2.0f * q2;
+				break;
+			default:
+				up = -(q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3);
+				h(0, 0) = -2.0f * q0; h(0, 1) = 2.0f * q1;
+				h(0, 2) = 2.0f * q2;  h(0, 3) = -2.0f * q3;
+				break;
+		}
+		update(h, measured[axis] - up, mAccelVar);
+	}
+	normalize();
+	symmetrize(mP);
+	return true;
+}
+
+void AttitudeEKF::correctHeading(float heading) {
+	// Heading of the X axis: atan2 of its world X and Y (the rotation's
+	// first column)
+	float q0 = mX[Q0], q1 = mX[Q0 + 1], q2 = mX[Q0 + 2], q3 = mX[Q0 + 3];
+	float r00 = q0 * q0 + q1 * q1 - q2 * q2 - q3 * q3,
+	      r10 = 2.0f * (q1 * q2 + q0 * q3);
+	float n = r00 * r00 + r10 * r10;
+	if (n < 1e-6f)
+		return; // X is vertical; there is no heading
+
+	float dr00[4] = { 2.0f * q0, 2.0f * q1, -2.0f * q2, -2.0f * q3 },
+	      dr10[4] = { 2.0f * q3, 2.0f * q2,  2.0f * q1,  2.0f * q0 };
+	Observation h(0.0f);
+	for (int i = 0; i < 4; ++i)
+		h(0, Q0 + i) = (r00 * dr10[i] - r10 * dr00[i]) / n;
+
+	float predicted = fastAtan2Degrees(r10, r00);
+	update(h, angleDifference(heading, predicted) * RADIANS_PER_DEGREE,
+			mHeadingVar);
+	normalize();
+	symmetrize(mP);
+}
+
+void AttitudeEKF::correctAltitude(float altitude) {
+	if (!mAltitudeValid) {
+		// Start here, at rest, uncorrelated with the attitude
+		for (int i = 0; i < EKF_STATES; ++i) {
+			mP(H, i) = mP(i, H) = 0.0f;
+			mP(V, i) = mP(i, V) = 0.0f;
+		}
+		mX[H] = altitude;
+		mX[V] = 0.0f;
+		mP(H, H) = mAltitudeVar;
+		mP(V, V) = 1.0f;
+		mAltitudeValid = true;
+		return;
+	}
+
+	Observation h(0.0f);
+	h(0, H) = 1.0f;
+	update(h, altitude - mX[H], mAltitudeVar);
+	normalize();
+	symmetrize(mP);
+}
+
+float AttitudeEKF::getRoll() {
+	Vector3<float> up = getUp();
+	return fastAtan2Degrees(up.x, -up.z);
+}
+
+float AttitudeEKF::getPitch() {
+	Vector3<float> up = getUp();
+	return fastAtan2Degrees(up.y,
+			-sign(up.z) * fastSqrt(up.x * up.x + up.z * up.z));
+}
+
+float AttitudeEKF::getYaw() {
+	float q0 = mX[Q0], q1 = mX[Q0 + 1], q2 = mX[Q0 + 2], q3 = mX[Q0 + 3];
+	return wrapAngle(fastAtan2Degrees(2.0f * (q1 * q2 + q0 * q3),
+			q0 * q0 + q1 * q1 - q2 * q2 - q3 * q3));
+}
+
+Vector3<float> AttitudeEKF::getUp() {
+	float q0 = mX[Q0], q1 = mX[Q0 + 1], q2 = mX[Q0 + 2], q3 = mX[Q0 + 3];
+	return Vector3<float>(-2.0f * (q1 * q3 - q0 * q2),
+			-2.0f * (q2 * q3 + q0 * q1),
+			-(q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3));
+}
+
+Vector3<float> AttitudeEKF::getGyroBias() {
+	return Vector3<float>(mX[BX] * DEGREES_PER_RADIAN, mX[BX + 1] * DEGREES_PER_RADIAN,
+			mX[BX + 2] * DEGREES_PER_RADIAN);
+}
+
+float AttitudeEKF::getAltitude() {
+	return mX[H];
+}
+
+float AttitudeEKF::getVelocity() {
+	return mX[V];
+}
+
+bool AttitudeEKF::isAltitudeValid() {
+	return mAltitudeValid;
+}
+
+const AttitudeEKF::Covariance &AttitudeEKF::getCovariance() {
+	return mP;
+}
+
+/*
+	Private member functions
+*/
+
+void AttitudeEKF::update(const Observation &h, float innovation,
+		float variance) {
+	// With P symmetric, H P = (P H^T)^T, so one product does
+	State ph = multiplyTransposed(mP, h);
+	float s = (h * ph)(0, 0) + variance;
+	if (s <= 0.0f)
+		return;
+
+	State k = ph * (1.0f / s);
+	mX += k * innovation;
+	mP -= multiplyTransposed(k, ph);
+}
+
+void AttitudeEKF::normalize() {
+	float n = mX[Q0] * mX[Q0] + mX[Q0 + 1] * mX[Q0 + 1]
+			+ mX[Q0 + 2] * mX[Q0 + 2] + mX[Q0 + 3] * mX[Q0 + 3];
+	if (n <= 0.0f) {
+		mX[Q0] = 1.0f;
+		return;
+	}
+	float inv = fastInvSqrt(n);
+	for (int i = 0; i < 4; ++i)
+		mX[Q0 + i] *= inv;
+}
@@ -0,0 +1,280 @@
+/*
+	barometer.cpp
+
+	Barometer class - interface for the BMP085 (on GY80 board)
+*/
+
+#include <stdint.h>
+#include <math.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cengine.h"
+#include "barometer.h"
+
+// BMP085 Register Addresses
+#define CALIBRATION 0xAA // AC1 (MSB) through MD (LSB), 22 bytes
+#define CONTROL     0xF4
+#define RESULT      0xF6 // MSB, LSB, XLSB
+
+// CONTROL values
+#define CONTROL_TEMPERATURE 0x2E
+#define CONTROL_PRESSURE    0x34 // | oversampling << 6
+
+Barometer::Barometer(I2C *i2c, uint8_t slaveaddr, Oversampling oss) {
+	mI2C = i2c;
+	mSlaveAddr = slaveaddr;
+	mOss = oss;
+
+	mResultRegister = RESULT;
+	for (int i = 0; i < 3; ++i)
+		mResult[i] = 0;
+	mStep = new I2CTransaction();
+	mEngine = 0;
+
+	mB5 = 0;
+	mPressure = 0.0f;
+	mTemperature = 0.0f;
+	mSamples = 0;
+	mErrors = 0;
+	mPressures = 0;
+
+	// Factory calibration: 11 big-endian words. None is 0 or 0xFFFF.
+	uint8_t values[22];
+	char    buffer = CALIBRATION;
+	try {
+		mI2C->enqueueWrite(mSlaveAddr, &buffer, 1);
+		mI2C->enqueueRead(mSlaveAddr, values, 22);
+		mI2C->sendTransaction();
+	} catch (...) {
+		delete mStep;
+		throw;
+	}
+
+	uint16_t words[11];
+	for (int i = 0; i < 11; ++i) {
+		words[i] = (uint16_t)((values[i * 2] << 8) | values[i * 2 + 1]);
+		if (words[i] == 0x0000 || words[i] == 0xFFFF) {
+			delete mStep;
+			THROW_EXCEPT(BarometerException,
+					"Invalid BMP085 calibration (no BMP085 at the address?)");
+		}
+	}
+	mAC1 = (int16_t)words[0];
+	mAC2 = (int16_t)words[1];
+	mAC3 = (int16_t)words[2];
+	mAC4 = words[3];
+	mAC5 = words[4];
+	mAC6 = words[5];
+	mB1  = (int16_t)words[6];
+	mB2  = (int16_t)words[7];
+	mMB  = (int16_t)words[8];
+	mMC  = (int16_t)words[9];
+	mMD  = (int16_t)words[10];
+
+	// Temperature first: pressure compensation needs it
+	mConversion = CONVERSION_TEMPERATURE;
+	mNext = CONVERSION_TEMPERATURE;
+	mRestart = false;
+	mCommand[0] = CONTROL;
+	mCommand[1] = CONTROL_TEMPERATURE;
+	try {
+		mI2C->write(mSlaveAddr, mCommand, 2);
+	} catch (...) {
+		delete mStep;
+		throw;
+	}
+	mWait = getConversionTime(CONVERSION_TEMPERATURE);
+}
+
+Barometer::~Barometer() {
+	if (mEngine)
+		mEngine->wait(mStep, 100);
+	delete mStep;
+}
+
+bool Barometer::update(float dtime, I2CEngine *engine) {
+	bool sample = false;
+	mWait -= dtime;
+
+	if (engine) {
+		mEngine = engine;
+
+		// Use the step sent by the last update
+		switch (mStep->getStatus()) {
+			case I2CTransaction::STATUS_PENDING:
+				return false;
+
+			case I2CTransaction::STATUS_DONE:
+				sample = finish();
+				break;
+
+			case I2CTransaction::STATUS_FAILED:
+				fail();
+				break;
+
+			default:
+				break;
+		}
+		mStep->clear();
+	}
+
+	if (mWait > 0.0f)
+		return sample;
+
+	// The running conversion is done: read its result and start the next.
+	// After a failure, it isn't known whether a conversion was started, so
+	// the conversion is only started again.
+	mNext = (mRestart ? mConversion : getNextConversion());
+	mCommand[0] = CONTROL;
+	mCommand[1] = (mNext == CONVERSION_TEMPERATURE ? CONTROL_TEMPERATURE
+			: CONTROL_PRESSURE | (mOss << 6));
+
+	if (engine) {
+		if (!mRestart) {
+			mStep->addWrite(mSlaveAddr, &mResultRegister, 1);
+			mStep->addRead(mSlaveAddr, mResult, 3);
+		}
+		mStep->addWrite(mSlaveAddr, mCommand, 2);
+		if (!engine->submit(mStep)) {
+			mStep->clear();
+			fail();
+			return sample;
+		}
+		mWait = getConversionTime(mNext);
+		return sample;
+	}
+
+	try {
+		if (!mRestart) {
+			mI2C->enqueueWrite(mSlaveAddr, &mResultRegister, 1);
+			mI2C->enqueueRead(mSlaveAddr, mResult, 3);
+		}
+		mI2C->enqueueWrite(mSlaveAddr, mCommand, 2);
+		mI2C->sendTransaction();
+	} catch (Exception &e) {
+		fail();
+		return sample;
+	}
+	mWait = getConversionTime(mNext);
+	return finish();
+}
+
+float Barometer::getPressure() {
+	return mPressure;
+}
+
+float Barometer::getTemperature() {
+	return mTemperature;
+}
+
+float Barometer::getAltitude(float sealevel) {
+	return pressureToAltitude(mPressure, sealevel);
+}
+
+long Barometer::getSamples() {
+	return mSamples;
+}
+
+long Barometer::getErrors() {
+	return mErrors;
+}
+
+float Barometer::pressureToAltitude(float pressure, float reference) {
+	// From BMP085 doc, p. 14
+	return 44330.0f * (1.0f - pow(pressure / reference, 1.0f / 5.255f));
+}
+
+/*
+	Private member functions
+*/
+
+float Barometer::getConversionTime(Conversion conversion) {
+	// From BMP085 doc, p. 10: maximum conversion times
+	static const float pressuretimes[4] = {
+		0.0045f, 0.0075f, 0.0135f, 0.0255f
+	};
+	return (conversion == CONVERSION_TEMPERATURE ? 0.0045f
+			: pressuretimes[mOss]);
+}
+
+Barometer::Conversion Barometer::getNextConversion() {
+	if (mConversion == CONVERSION_PRESSURE
+			&& mPressures + 1 < BAROMETER_TEMP_INTERVAL)
+		return CONVERSION_PRESSURE;
+	return (mConversion == CONVERSION_TEMPERATURE ? CONVERSION_PRESSURE
+			: CONVERSION_TEMPERATURE);
+}
+
+bool Barometer::finish() {
+	bool restarted = mRestart;
+	Conversion finished = mConversion;
+	mConversion = mNext;
+	mRestart = false;
+	if (restarted)
+		return false;
+
+	if (finished == CONVERSION_TEMPERATURE) {
+		int32_t ut = (mResult[0] << 8) | mResult[1];
+		// A bad reading keeps the last temperature; the next conversion
+		// after the running one is a temperature again
+		if (compensateTemperature(ut))
+			mPressures = 0;
+		else
+			++mErrors;
+		return false;
+	}
+
+	int32_t up = ((mResult[0] << 16) | (mResult[1] << 8) | mResult[2])
+			>> (8 - mOss);
+	++mPressures;
+	if (!compensatePressure(up)) {
+		++mErrors;
+		return false;
+	}
+	++mSamples;
+	return true;
+}
+
+void Barometer::fail() {
+	++mErrors;
+	mRestart = true;
+	mWait = 0.0f;
+}
+
+bool Barometer::compensateTemperature(int32_t ut) {
+	// From BMP085 doc, p. 13
+	int32_t x1 = ((ut - (int32_t)mAC6) * (int32_t)mAC5) >> 15;
+	if (x1 + mMD == 0)
+		return false;
+	int32_t x2 = ((int32_t)mMC << 11) / (x1 + mMD);
+	mB5 = x1 + x2;
+	mTemperature = ((mB5 + 8) >> 4) / 10.0f;
+	return true;
+}
+
+bool Barometer::compensatePressure(int32_t up) {
+	// From BMP085 doc, p. 13
+	int32_t b6 = mB5 - 4000;
+	int32_t x1 = ((int32_t)mB2 * ((b6 * b6) >> 12)) >> 11;
+	int32_t x2 = ((int32_t)mAC2 * b6) >> 11;
+	int32_t x3 = x1 + x2;
+	int32_t b3 = ((((int32_t)mAC1 * 4 + x3) << mOss) + 2) / 4;
+
+	x1 = ((int32_t)mAC3 * b6) >> 13;
+	x2 = ((int32_t)mB1 * ((b6 * b6) >> 12)) >> 16;
+	x3 = ((x1 + x2) + 2) >> 2;
+	uint32_t b4 = ((uint32_t)mAC4 * (uint32_t)(x3 + 32768)) >> 15;
+	if (b4 == 0)
+		return false;
+	uint32_t b7 = ((uint32_t)up - b3) * (uint32_t)(50000 >> mOss);
+
+	int32_t p = (b7 < 0x80000000 ? (b7 * 2) / b4 : (b7 / b4) * 2);
+	x1 = (p >> 8) * (p >> 8);
+	x1 = (x1 * 3038) >> 16;
+	x2 = (-7357 * p) >> 16;
+	p += (x1 + x2 + 3791) >> 4;
+
+	mPressure = (float)p;
+	return true;
+}
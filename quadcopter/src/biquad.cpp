@@ -0,0 +1,74 @@
+/*
+	biquad.cpp
+
+	Biquad class - second order IIR filter section
+*/
+
+#include <math.h>
+
+#include "geometry.h"
+#include "biquad.h"
+
+Biquad::Biquad() {
+	setPassThrough();
+	reset();
+}
+
+void Biquad::setLowPass(float cutoff, float samplerate, float q) {
+	if (cutoff > samplerate * 0.49f)
+		cutoff = samplerate * 0.49f;
+
+	float w0 = 2.0f * PI * cutoff / samplerate;
+	float cosw0 = cosf(w0);
+	float alpha = sinf(w0) / (2.0f * q);
+	float a0 = 1.0f + alpha;
+
+	mB0 = (1.0f - cosw0) / 2.0f / a0;
+	mB1 = (1.0f - cosw0) / a0;
+	mB2 = mB0;
+	mA1 = -2.0f * cosw0 / a0;
+	mA2 = (1.0f - alpha) / a0;
+}
+
+void Biquad::setNotch(float center, float samplerate, float q) {
+	if (center > samplerate * 0.49f)
+		center = samplerate * 0.49f;
+
+	float w0 = 2.0f * PI * center / samplerate;
+	float cosw0 = cosf(w0);
+	float alpha = sinf(w0) / (2.0f * q);
+	float a0 = 1.0f + alpha;
+
+	mB0 = 1.0f / a0;
+	mB1 = -2.0f * cosw0 / a0;
+	mB2 = mB0;
+	mA1 = mB1;
+	mA2 = (1.0f - alpha) / a0;
+}
+
+void Biquad::setPassThrough() {
+	mB0 = 1.0f;
+	mB1 = 0.0f;
+	mB2 = 0.0f;
+	mA1 = 0.0f;
+	mA2 = 0.0f;
+}
+
+void Biquad::reset(float value) {
+	// Steady state of transposed direct form II with constant input x and
+	// output y = gain * x
+	float gain = (mB0 + mB1 + mB2) / (1.0f + mA1 + mA2);
+	float out = value * gain;
+	mZ1 = out - mB0 * value;
+	mZ2 = mB2 * value - mA2 * out;
+}
+
+void Biquad::getCoefficients(float &b0, float &b1, float &b2,
+		float &a1, float &a2) {
+	b0 = mB0;
+	b1 = mB1;
+	b2 = mB2;
+	a1 = mA1;
+	a2 = mA2;
+}
+
@@ -0,0 +1,393 @@
+/*
+	calibration.cpp
+
+	Sensor calibration - models that correct raw accelerometer, gyroscope
+		and magnetometer readings, and the estimators that find them.
+*/
+
+#include <math.h>
+
+#include "exception.h"
+#include "geometry.h"
+#include "calibration.h"
+
+/*
+	StillnessDetector
+*/
+
+StillnessDetector::StillnessDetector(int window, float gyrovariance,
+		float accelvariance) {
+	mWindow = (window > 1 ? window : 2);
+	mGyroVariance = gyrovariance;
+	mAccelVariance = accelvariance;
+	mSamples = new float[mWindow * 6];
+	reset();
+}
+
+StillnessDetector::~StillnessDetector() {
+	delete[] mSamples;
+}
+
+bool StillnessDetector::feed(const Vector3<float> &accel,
+		const Vector3<float> &gyro) {
+	float *sample = mSamples + mCurrent * 6;
+
+	// Drop the oldest sample from the sums once the window is full
+	if (mCount == mWindow) {
+		for (int i = 0; i < 6; ++i) {
+			mSum[i] -= sample[i];
+			mSumSq[i] -= (double)sample[i] * sample[i];
+		}
+	} else
+		++mCount;
+
+	sample[0] = accel.x; sample[1] = accel.y; sample[2] = accel.z;
+	sample[3] = gyro.x;  sample[4] = gyro.y;  sample[5] = gyro.z;
+	for (int i = 0; i < 6; ++i) {
+		mSum[i] += sample[i];
+		mSumSq[i] += (double)sample[i] * sample[i];
+	}
+
+	mCurrent = (mCurrent + 1) % mWindow;
+	return isStill();
+}
+
+bool StillnessDetector::isStill() {
+	if (mCount < mWindow)
+		return false;
+
+	for (int i = 0; i < 6; ++i) {
+		double mean = mSum[i] / mCount;
+		double variance = mSumSq[i] / mCount - mean * mean;
+		if (variance > (i < 3 ? mAccelVariance : mGyroVariance))
+			return false;
+	}
+	return true;
+}
+
+Vector3<float> StillnessDetector::getAccelMean() {
+	int n = (mCount > 0 ? mCount : 1);
+	return Vector3<float>(mSum[0] / n, mSum[1] / n, mSum[2] / n);
+}
+
+Vector3<float> StillnessDetector::getGyroMean() {
+	int n = (mCount > 0 ? mCount : 1);
+	return Vector3<float>(mSum[3] / n, mSum[4] / n, mSum[5] / n);
+}
+
+int StillnessDetector::getWindow() {
+	return mWindow;
+}
+
+void StillnessDetector::reset() {
+	mCount = 0;
+	mCurrent = 0;
+	for (int i = 0; i < 6; ++i) {
+		mSum[i] = 0.0;
+		mSumSq[i] = 0.0;
+	}
+}
+
+/*
+	AccelCalibrator
+*/
+
+AccelCalibrator::AccelCalibrator() {
+	reset();
+}
+
+int AccelCalibrator::addPosition(const Vector3<float> &mean) {
+	float values[3] = { mean.x, mean.y, mean.z };
+
+	int axis = 0;
+	for (int i = 1; i < 3; ++i)
+		if (fabs(values[i]) > fabs(values[axis]))
+			axis = i;
+
+	int position = axis * 2 + (values[axis] < 0.0f ? 1 : 0);
+	mPositions[position] = mean;
+	mHave[position] = true;
+	return position;
+}
+
+int AccelCalibrator::getNumPositions() {
+	int count = 0;
+	for (int i = 0; i < 6; ++i)
+		if (mHave[i])
+			++count;
+	return count;
+}
+
+bool AccelCalibrator::isComplete() {
+	return getNumPositions() == 6;
+}
+
+AccelCalibration AccelCalibrator::fit() {
+	if (!isComplete())
+		THROW_EXCEPT(CalibrationException,
+				"Accelerometer calibration needs all six positions");
+
+	// Find the 3x4 matrix W minimizing |W [raw; 1] - expected|^2 over all
+	// positions. Its normal equations are A X = B, with A = sum of
+	// [raw; 1][raw; 1]^T (4x4), B = sum of [raw; 1] expected^T (4x3), and
+	// X = W^T.
+	double a[4][4] = { { 0.0 } },
+	       b[4][3] = { { 0.0 } };
+	for (int p = 0; p < 6; ++p) {
+		double row[4] = { mPositions[p].x, mPositions[p].y, mPositions[p].z,
+		                  1.0 };
+		double expected[3] = { 0.0, 0.0, 0.0 };
+		expected[p / 2] = (p % 2 == 0 ? 1.0 : -1.0);
+
+		for (int i = 0; i < 4; ++i) {
+			for (int j = 0; j < 4; ++j)
+				a[i][j] += row[i] * row[j];
+			for (int j = 0; j < 3; ++j)
+				b[i][j] += row[i] * expected[j];
+		}
+	}
+
+	// Gaussian elimination with partial pivoting
+	for (int col = 0; col < 4; ++col) {
+		int pivot = col;
+		for (int r = col + 1; r < 4; ++r)
+			if (fabs(a[r][col]) > fabs(a[pivot][col]))
+				pivot = r;
+		if (fabs(a[pivot][col]) < 1e-9)
+			THROW_EXCEPT(CalibrationException,
+					"Accelerometer calibration readings are degenerate");
+
+		for (int j = 0; j < 4; ++j) {
+			double t = a[col][j]; a[col][j] = a[pivot][j]; a[pivot][j] = t;
+		}
+		for (int j = 0; j < 3; ++j) {
+			double t = b[col][j]; b[col][j] = b[pivot][j]; b[pivot][j] = t;
+		}
+
+		for (int r = 0; r < 4; ++r) {
+			if (r == col)
+				continue;
+			double f = a[r][col] / a[col][col];
+			for (int j = 0; j < 4; ++j)
+				a[r][j] -= f * a[col][j];
+			for (int j = 0; j < 3; ++j)
+				b[r][j] -= f * b[col][j];
+		}
+	}
+
+	AccelCalibration cal;
+	for (int out = 0; out < 3; ++out)
+		for (int in = 0; in < 3; ++in)
+			cal.matrix.m[out][in] = b[in][out] / a[in][in];
+	cal.offset.x = b[3][0] / a[3][3];
+	cal.offset.y = b[3][1] / a[3][3];
+	cal.offset.z = b[3][2] / a[3][3];
+	cal.fitted = true;
+	return cal;
+}
+
+void AccelCalibrator::reset() {
+	for (int i = 0; i < 6; ++i)
+		mHave[i] = false;
+}
+
+/*
+	MagCalibrator
+*/
+
+MagCalibrator::MagCalibrator() {
+	reset();
+}
+
+void MagCalibrator::addSample(const Vector3<float> &raw) {
+	double row[6] = { raw.x * raw.x, raw.y * raw.y, raw.z * raw.z,
+	                  raw.x, raw.y, raw.z };
+	for (int i = 0; i < 6; ++i) {
+		for (int j = 0; j < 6; ++j)
+			mA[i][j] += row[i] * row[j];
+		mB[i] += row[i];
+	}
+
+	if (mSamples == 0)
+		mMin = mMax = raw;
+	mMin.x = fmin(mMin.x, raw.x);
+	mMin.y = fmin(mMin.y, raw.y);
+	mMin.z = fmin(mMin.z, raw.z);
+	mMax.x = fmax(mMax.x, raw.x);
+	mMax.y = fmax(mMax.y, raw.y);
+	mMax.z = fmax(mMax.z, raw.z);
+	++mSamples;
+}
+
+int MagCalibrator::getSamples() {
+	return mSamples;
+}
+
+MagCalibration MagCalibrator::fit() {
+	if (mSamples < MAGCAL_MIN_SAMPLES)
+		THROW_EXCEPT(CalibrationException,
+				"Magnetometer calibration needs more readings");
+
+	float span[3] = { mMax.x - mMin.x, mMax.y - mMin.y, mMax.z - mMin.z };
+	float widest = fmax(span[0], fmax(span[1], span[2]));
+	for (int i = 0; i < 3; ++i)
+		if (span[i] < widest * MAGCAL_MIN_SPAN || widest <= 0.0f)
+			THROW_EXCEPT(CalibrationException,
+					"Magnetometer was not turned through every orientation");
+
+	// Solve the normal equations A p = B, by Gaussian elimination with
+	// partial pivoting
+	double a[6][6], p[6];
+	for (int i = 0; i < 6; ++i) {
+		for (int j = 0; j < 6; ++j)
+			a[i][j] = mA[i][j];
+		p[i] = mB[i];
+	}
+
+	for (int col = 0; col < 6; ++col) {
+		int pivot = col;
+		for (int r = col + 1; r < 6; ++r)
+			if (fabs(a[r][col]) > fabs(a[pivot][col]))
+				pivot = r;
+		if (fabs(a[pivot][col]) < 1e-12)
+			THROW_EXCEPT(CalibrationException,
+					"Magnetometer calibration readings are degenerate");
+
+		for (int j = 0; j < 6; ++j) {
+			double t = a[col][j]; a[col][j] = a[pivot][j]; a[pivot][j] = t;
+		}
+		double t = p[col]; p[col] = p[pivot]; p[pivot] = t;
+
+		for (int r = 0; r < 6; ++r) {
+			if (r == col)
+				continue;
+			double f = a[r][col] / a[col][col];
+			for (int j = 0; j < 6; ++j)
+				a[r][j] -= f * a[col][j];
+			p[r] -= f * p[col];
+		}
+	}
+	for (int i = 0; i < 6; ++i)
+		p[i] /= a[i][i];
+
+	// Completing the squares: the centre is at -D / 2A (etc.), and the
+	// radius along x is sqrt(G / A), with G = 1 + A cx^2 + B cy^2 + C cz^2
+	if (p[0] <= 0.0 || p[1] <= 0.0 || p[2] <= 0.0)
+		THROW_EXCEPT(CalibrationException,
+				"Magnetometer calibration readings are not an ellipsoid");
+
+	double centre[3], g = 1.0;
+	for (int i = 0; i < 3; ++i) {
+		centre[i] = -p[i + 3] / (2.0 * p[i]);
+		g += p[i] * centre[i] * centre[i];
+	}
+
+	double radius[3], mean = 0.0;
+	for (int i = 0; i < 3; ++i) {
+		radius[i] = sqrt(g / p[i]);
+		mean += radius[i] / 3.0;
+	}
+
+	MagCalibration cal;
+	cal.offset = Vector3<float>(centre[0], centre[1], centre[2]);
+	for (int i = 0; i < 3; ++i)
+		cal.matrix.m[i][i] = mean / radius[i];
+	return cal;
+}
+
+void MagCalibrator::reset() {
+	for (int i = 0; i < 6; ++i) {
+		for (int j = 0; j < 6; ++j)
+			mA[i][j] = 0.0;
+		mB[i] = 0.0;
+	}
+	mSamples = 0;
+	mMin = mMax = Vector3<float>(0.0f, 0.0f, 0.0f);
+}
+
+/*
+	GyroBiasEstimator
+*/
+
+GyroBiasEstimator::GyroBiasEstimator() {
+	reset();
+}
+
+void GyroBiasEstimator::addStill(const Vector3<float> &mean, float temp,
+		int samples) {
+	if (samples <= 0)
+		return;
+
+	double w = samples;
+	double bias[3] = { mean.x, mean.y, mean.z };
+
+	mWeight += w;
+	mTemp += w * temp;
+	mTempSq += w * temp * temp;
+	for (int i = 0; i < 3; ++i) {
+		mBias[i] += w * bias[i];
+		mTempBias[i] += w * temp * bias[i];
+	}
+
+	if (mSamples == 0 || temp < mTempMin) mTempMin = temp;
+	if (mSamples == 0 || temp > mTempMax) mTempMax = temp;
+	mSamples += samples;
+}
+
+void GyroBiasEstimator::seed(const GyroCalibration &cal, int samples) {
+	reset();
+	if (cal.slope.x == 0.0f && cal.slope.y == 0.0f && cal.slope.z == 0.0f) {
+		addStill(cal.bias, cal.reftemp, samples);
+		return;
+	}
+
+	float half = GYROCAL_MIN_TEMP_SPAN / 2.0f;
+	addStill(cal.bias - cal.slope * half, cal.reftemp - half, samples / 2);
+	addStill(cal.bias + cal.slope * half, cal.reftemp + half,
+			samples - samples / 2);
+}
+
+int GyroBiasEstimator::getSamples() {
+	return mSamples;
+}
+
+GyroCalibration GyroBiasEstimator::fit() {
+	if (mSamples == 0)
+		THROW_EXCEPT(CalibrationException,
+				"No still gyroscope readings to calibrate from");
+
+	GyroCalibration cal;
+	double meantemp = mTemp / mWeight;
+	double tempvar = mTempSq / mWeight - meantemp * meantemp;
+	bool   useslope = (mTempMax - mTempMin >= GYROCAL_MIN_TEMP_SPAN
+			&& tempvar > 0.0);
+
+	float bias[3], slope[3];
+	for (int i = 0; i < 3; ++i) {
+		double meanbias = mBias[i] / mWeight;
+		double covariance = mTempBias[i] / mWeight - meantemp * meanbias;
+		bias[i] = meanbias;
+		slope[i] = (useslope ? covariance / tempvar : 0.0);
+	}
+
+	// The fitted line passes through the mean, so use the mean temperature
+	// as the reference
+	cal.reftemp = meantemp;
+	cal.bias = Vector3<float>(bias[0], bias[1], bias[2]);
+	cal.slope = Vector3<float>(slope[0], slope[1], slope[2]);
+	return cal;
+}
+
+void GyroBiasEstimator::reset() {
+	mWeight = 0.0;
+	mTemp = 0.0;
+	mTempSq = 0.0;
+	for (int i = 0; i < 3; ++i) {
+		mBias[i] = 0.0;
+		mTempBias[i] = 0.0;
+	}
+	mTempMin = 0.0f;
+	mTempMax = 0.0f;
+	mSamples = 0;
+}
+
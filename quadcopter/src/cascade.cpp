@@ -0,0 +1,114 @@
+/*
+	cascade.cpp
+
+	Cascade class - the attitude controller: an Angle PID and a Rate PID in
+		series per axis, and the motor mix
+*/
+
+#include "geometry.h"
+#include "pidbank.h"
+#include "cascade.h"
+
+Cascade::Cascade(int updaterate) {
+	// All coefficients and targets start at 0. The yaw Angle PID is fed the
+	// (wrapped) heading error directly, so its target stays 0; see
+	// feedAngles().
+	mAngle = new PIDBank(NUM_AXES);
+	mRate  = new PIDBank(NUM_AXES);
+
+	for (int i = 0; i < NUM_AXES; ++i) {
+		mAngle->setOutputLimits(i, -PID_ANGLE_OUTPUT_LIMIT,
+				PID_ANGLE_OUTPUT_LIMIT);
+		mAngle->setIntegralLimit(i, PID_ANGLE_INTEGRAL_LIMIT);
+		mAngle->setDerivativeFilter(i, updaterate * PID_DFILTER_RATIO,
+				updaterate);
+
+		mRate->setOutputLimits(i, -PID_RATE_OUTPUT_LIMIT,
+				PID_RATE_OUTPUT_LIMIT);
+		mRate->setIntegralLimit(i, PID_RATE_INTEGRAL_LIMIT);
+		mRate->setDerivativeFilter(i, updaterate * PID_DFILTER_RATIO,
+				updaterate);
+	}
+}
+
+Cascade::~Cascade() {
+	delete mAngle;
+	delete mRate;
+}
+
+PIDBank *Cascade::getAngle() {
+	return mAngle;
+}
+
+PIDBank *Cascade::getRate() {
+	return mRate;
+}
+
+void Cascade::feedAngles(const float *angles, const float *targets,
+		float yawrate, bool headinghold, float dtime, float *errors,
+		float *ratetargets) {
+	mAngle->setTarget(AXIS_ROLL, targets[AXIS_ROLL]);
+	mAngle->setTarget(AXIS_PITCH, targets[AXIS_PITCH]);
+
+	// The yaw lane is fed the heading error, negated, since the PID
+	// corrects towards target - value with a target of 0. In rate mode it
+	// is fed no error and its output is ignored.
+	float headingerror = (headinghold
+			? angleDifference(targets[AXIS_YAW], angles[AXIS_YAW]) : 0.0f);
+	float values[NUM_AXES];
+	values[AXIS_ROLL]  = angles[AXIS_ROLL];
+	values[AXIS_PITCH] = angles[AXIS_PITCH];
+	values[AXIS_YAW]   = -headingerror;
+	mAngle->feed(values, dtime);
+
+	errors[AXIS_ROLL]  = targets[AXIS_ROLL] - angles[AXIS_ROLL];
+	errors[AXIS_PITCH] = targets[AXIS_PITCH] - angles[AXIS_PITCH];
+	errors[AXIS_YAW]   = headingerror;
+
+	// The commanded turn rate is fed forward, so that the yaw Angle PID
+	// only has to correct the residual
+	ratetargets[AXIS_ROLL]  = mAngle->output(AXIS_ROLL);
+	ratetargets[AXIS_PITCH] = mAngle->output(AXIS_PITCH);
+	ratetargets[AXIS_YAW]   = yawrate;
+	if (headinghold)
+		ratetargets[AXIS_YAW] += mAngle->output(AXIS_YAW);
+}
+
+void Cascade::feedRates(const float *ratetargets, const Vector3<float> &gyro,
+		float dtime, float *corrections) {
+	for (int axis = 0; axis < NUM_AXES; ++axis)
+		mRate->setTarget(axis, ratetargets[axis]);
+
+	float rates[NUM_AXES];
+	rates[AXIS_ROLL]  = gyro.x;
+	rates[AXIS_PITCH] = gyro.y;
+	rates[AXIS_YAW]   = gyro.z;
+	mRate->feed(rates, dtime);
+
+	for (int axis = 0; axis < NUM_AXES; ++axis)
+		corrections[axis] = mRate->output(axis);
+}
+
+void Cascade::mix(float throttle, const float *corrections,
+		float *motorspeeds) {
+	for (int i = 0; i < 4; ++i)
+		motorspeeds[i] = throttle;
+
+	double d_ends  = corrections[AXIS_PITCH] / 100.0f;
+	double d_sides = corrections[AXIS_ROLL] / 100.0f;
+	double d_yaw   = corrections[AXIS_YAW] / 100.0f;
+
+	// Yaw comes from the reaction torque of the props. The diagonal pairs
+	// (0, 2) and (1, 3) spin in opposite directions, so speeding up one pair
+	// relative to the other turns the frame without changing total thrust.
+	// If the frame turns away from the target, the props are mounted the
+	// other way around: negate d_yaw.
+	motorspeeds[0] += d_ends - d_sides + d_yaw;
+	motorspeeds[1] += d_ends + d_sides - d_yaw;
+	motorspeeds[2] += -d_ends + d_sides + d_yaw;
+	motorspeeds[3] += -d_ends - d_sides - d_yaw;
+
+	for (int i = 0; i < 4; ++i)
+		if (motorspeeds[i] < 0.0f)
+			motorspeeds[i] = 0.0f;
+}
@@ -0,0 +1,420 @@
+/*
+	configstore.cpp
+
+	ConfigStore class - persistent configuration of the quadcopter
+		(calibration, PID gains and gain schedule, motor channels, update
+		rate, smoothing, sensor filters) in a small binary file.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string>
+#include <fstream>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "exception.h"
+#include "endianness.h"
+#include "calibration.h"
+#include "filterchain.h"
+#include "gainschedule.h"
+#include "configstore.h"
+
+#define CONFIG_MAGIC       "QCFG"
+#define CONFIG_HEADER_SIZE 16
+
+// Payload written by this version: sections, then 245 four-byte fields. The
+// first version's had 32, and is the shortest accepted; the magnetometer
+// brought it to 44, and the filters to 116.
+#define CONFIG_PAYLOAD_SIZE         (4 + 245 * 4)
+#define CONFIG_PAYLOAD_MIN_SIZE     (4 + 32 * 4)
+#define CONFIG_PAYLOAD_MAG_SIZE     (4 + 44 * 4)
+#define CONFIG_PAYLOAD_FILTERS_SIZE (4 + 116 * 4)
+
+/**
+	CRC-32 (IEEE 802.3, reflected, polynomial 0xEDB88320) of the given bytes
+*/
+static uint32_t crc32(const unsigned char *data, size_t length) {
+	static uint32_t table[256];
+	static bool     tablebuilt = false;
+
+	if (!tablebuilt) {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1);
+			table[i] = c;
+		}
+		tablebuilt = true;
+	}
+
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < length; ++i)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+	Little-endian field writers and readers. Each advances pos by the size of
+	the field.
+*/
+static void putU32(unsigned char *buf, size_t &pos, uint32_t value) {
+	hostToLE(buf + pos, &value, 4);
+	pos += 4;
+}
+
+static void putU16(unsigned char *buf, size_t &pos, uint16_t value) {
+	hostToLE(buf + pos, &value, 2);
+	pos += 2;
+}
+
+static void putFloat(unsigned char *buf, size_t &pos, float value) {
+	hostToLE(buf + pos, &value, 4);
+	pos += 4;
+}
+
+static uint32_t getU32(const unsigned char *buf, size_t &pos) {
+	uint32_t value;
+	LEToHost(&value, buf + pos, 4);
+	pos += 4;
+	return value;
+}
+
+static uint16_t getU16(const unsigned char *buf, size_t &pos) {
+	uint16_t value;
+	LEToHost(&value, buf + pos, 2);
+	pos += 2;
+	return value;
+}
+
+static float getFloat(const unsigned char *buf, size_t &pos) {
+	float value;
+	LEToHost(&value, buf + pos, 4);
+	pos += 4;
+	return value;
+}
+
+/**
+	write() all of the given bytes, retrying on partial writes. Returns false
+	on error.
+*/
+static bool writeAll(int fd, const unsigned char *data, size_t length) {
+	while (length > 0) {
+		ssize_t written = write(fd, data, length);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+Config::Config() {
+	sections = 0;
+	for (int i = 0; i < 3; ++i) {
+		angleGains[i] = 0.0f;
+		rateGains[i] = 0.0f;
+	}
+	for (int i = 0; i < 4; ++i)
+		motors[i] = 0;
+	updateRate = 0;
+	smoothing = 0;
+	scheduleCount = 0;
+	memset(schedule, 0, sizeof(schedule));
+}
+
+ConfigStore::ConfigStore(const std::string &filename) {
+	mFilename = filename;
+}
+
+const std::string &ConfigStore::getFilename() {
+	return mFilename;
+}
+
+Config ConfigStore::load() {
+	int fd = open(mFilename.c_str(), O_RDONLY);
+	if (fd < 0)
+		THROW_EXCEPT(ConfigException,
+				"Config file (" + mFilename + ") could not be opened");
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		THROW_EXCEPT(ConfigException,
+				"Config file (" + mFilename + ") could not be read");
+	}
+	size_t size = st.st_size;
+	if (size < CONFIG_HEADER_SIZE) {
+		close(fd);
+		THROW_EXCEPT(ConfigException,
+				"Config file (" + mFilename + ") is truncated");
+	}
+
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		THROW_EXCEPT(ConfigException,
+				"Config file (" + mFilename + ") could not be mapped");
+
+	const unsigned char *buf = (const unsigned char *)map;
+	const char *error = 0;
+	Config config;
+
+	size_t pos = 4;
+	uint16_t version = getU16(buf, pos);
+	getU16(buf, pos); // Reserved
+	uint32_t length = getU32(buf, pos);
+	uint32_t crc = getU32(buf, pos);
+
+	if (memcmp(buf, CONFIG_MAGIC, 4) != 0)
+		error = ") is not a config file";
+	else if (version == 0)
+		error = ") has an invalid version";
+	else if (length < CONFIG_PAYLOAD_MIN_SIZE
+			|| length > size - CONFIG_HEADER_SIZE)
+		error = ") is truncated";
+	else if (crc32(buf + CONFIG_HEADER_SIZE, length) != crc)
+		error = ") is corrupt (checksum mismatch)";
+	else {
+		const unsigned char *payload = buf + CONFIG_HEADER_SIZE;
+		pos = 0;
+
+		config.sections = getU32(payload, pos);
+
+		for (int r = 0; r < 3; ++r)
+			for (int c = 0; c < 3; ++c)
+				config.accel.matrix.m[r][c] = getFloat(payload, pos);
+		config.accel.offset.x = getFloat(payload, pos);
+		config.accel.offset.y = getFloat(payload, pos);
+		config.accel.offset.z = getFloat(payload, pos);
+		config.accel.fitted = (getU32(payload, pos) != 0);
+		config.gyro.bias.x = getFloat(payload, pos);
+		config.gyro.bias.y = getFloat(payload, pos);
+		config.gyro.bias.z = getFloat(payload, pos);
+		config.gyro.slope.x = getFloat(payload, pos);
+		config.gyro.slope.y = getFloat(payload, pos);
+		config.gyro.slope.z = getFloat(payload, pos);
+		config.gyro.reftemp = getFloat(payload, pos);
+
+		for (int i = 0; i < 3; ++i)
+			config.angleGains[i] = getFloat(payload, pos);
+		for (int i = 0; i < 3; ++i)
+			config.rateGains[i] = getFloat(payload, pos);
+
+		for (int i = 0; i < 4; ++i)
+			config.motors[i] = (int32_t)getU32(payload, pos);
+
+		config.updateRate = (int32_t)getU32(payload, pos);
+		config.smoothing = (int32_t)getU32(payload, pos);
+
+		// Written by the first version, before the magnetometer
+		if (length < CONFIG_PAYLOAD_MAG_SIZE)
+			config.sections &= ~CONFIG_MAGNETOMETER;
+		else {
+			for (int r = 0; r < 3; ++r)
+				for (int c = 0; c < 3; ++c)
+					config.mag.matrix.m[r][c] = getFloat(payload, pos);
+			config.mag.offset.x = getFloat(payload, pos);
+			config.mag.offset.y = getFloat(payload, pos);
+			config.mag.offset.z = getFloat(payload, pos);
+		}
+
+		// Written before the filters
+		if (length < CONFIG_PAYLOAD_FILTERS_SIZE)
+			config.sections &= ~CONFIG_FILTERS;
+		else {
+			for (int c = 0; c < CONFIG_FILTER_CHANNELS; ++c)
+				for (int i = 0; i < FILTER_MAX_STAGES; ++i) {
+					FilterStage &stage = config.filters[c][i];
+					stage.type = (FilterType)getU32(payload, pos);
+					stage.frequency = getFloat(payload, pos);
+					stage.param = getFloat(payload, pos);
+				}
+		}
+
+		// Written before the gain schedule
+		if (length < CONFIG_PAYLOAD_SIZE)
+			config.sections &= ~CONFIG_SCHEDULE;
+		else {
+			uint32_t count = getU32(payload, pos);
+			if (count > CONFIG_SCHEDULE_POINTS)
+				error = ") has too many gain schedule breakpoints";
+			else
+				config.scheduleCount = count;
+			for (int i = 0; i < CONFIG_SCHEDULE_POINTS; ++i) {
+				GainSchedule::Breakpoint &bp = config.schedule[i];
+				bp.throttle = getFloat(payload, pos);
+				bp.voltage = getFloat(payload, pos);
+				for (int k = 0; k < 3; ++k)
+					bp.gains.angle[k] = getFloat(payload, pos);
+				for (int k = 0; k < 3; ++k)
+					bp.gains.rate[k] = getFloat(payload, pos);
+			}
+		}
+
+		// Sections a newer version may add lie beyond pos, and are ignored
+	}
+
+	munmap(map, size);
+
+	if (error)
+		THROW_EXCEPT(ConfigException, "Config file (" + mFilename + error);
+	return config;
+}
+
+void ConfigStore::save(const Config &config) {
+	if (config.scheduleCount < 0
+			|| config.scheduleCount > CONFIG_SCHEDULE_POINTS)
+		THROW_EXCEPT(ConfigException, "Config file (" + mFilename
+				+ ") cannot hold that many gain schedule breakpoints");
+
+	unsigned char buf[CONFIG_HEADER_SIZE + CONFIG_PAYLOAD_SIZE];
+	unsigned char *payload = buf + CONFIG_HEADER_SIZE;
+	size_t pos = 0;
+
+	putU32(payload, pos, config.sections);
+
+	for (int r = 0; r < 3; ++r)
+		for (int c = 0; c < 3; ++c)
+			putFloat(payload, pos, config.accel.matrix.m[r][c]);
+	putFloat(payload, pos, config.accel.offset.x);
+	putFloat(payload, pos, config.accel.offset.y);
+	putFloat(payload, pos, config.accel.offset.z);
+	putU32(payload, pos, config.accel.fitted ? 1 : 0);
+	putFloat(payload, pos, config.gyro.bias.x);
+	putFloat(payload, pos, config.gyro.bias.y);
+	putFloat(payload, pos, config.gyro.bias.z);
+	putFloat(payload, pos, config.gyro.slope.x);
+	putFloat(payload, pos, config.gyro.slope.y);
+	putFloat(payload, pos, config.gyro.slope.z);
+	putFloat(payload, pos, config.gyro.reftemp);
+
+	for (int i = 0; i < 3; ++i)
+		putFloat(payload, pos, config.angleGains[i]);
+	for (int i = 0; i < 3; ++i)
+		putFloat(payload, pos, config.rateGains[i]);
+
+	for (int i = 0; i < 4; ++i)
+		putU32(payload, pos, (int32_t)config.motors[i]);
+
+	putU32(payload, pos, (int32_t)config.updateRate);
+	putU32(payload, pos, (int32_t)config.smoothing);
+
+	for (int r = 0; r < 3; ++r)
+		for (int c = 0; c < 3; ++c)
+			putFloat(payload, pos, config.mag.matrix.m[r][c]);
+	putFloat(payload, pos, config.mag.offset.x);
+	putFloat(payload, pos, config.mag.offset.y);
+	putFloat(payload, pos, config.mag.offset.z);
+
+	for (int c = 0; c < CONFIG_FILTER_CHANNELS; ++c)
+		for (int i = 0; i < FILTER_MAX_STAGES; ++i) {
+			const FilterStage &stage = config.filters[c][i];
+			putU32(payload, pos, stage.type);
+			putFloat(payload, pos, stage.frequency);
+			putFloat(payload, pos, stage.param);
+		}
+
+	putU32(payload, pos, config.scheduleCount);
+	for (int i = 0; i < CONFIG_SCHEDULE_POINTS; ++i) {
+		const GainSchedule::Breakpoint &bp = config.schedule[i];
+		putFloat(payload, pos, bp.throttle);
+		putFloat(payload, pos, bp.voltage);
+		for (int k = 0; k < 3; ++k)
+			putFloat(payload, pos, bp.gains.angle[k]);
+		for (int k = 0; k < 3; ++k)
+			putFloat(payload, pos, bp.gains.rate[k]);
+	}
+
+	memcpy(buf, CONFIG_MAGIC, 4);
+	pos = 4;
+	putU16(buf, pos, CONFIG_VERSION);
+	putU16(buf, pos, 0);
+	putU32(buf, pos, CONFIG_PAYLOAD_SIZE);
+	putU32(buf, pos, crc32(payload, CONFIG_PAYLOAD_SIZE));
+
+	// Write and flush a temporary file, then rename it over the old one.
+	// rename() within a directory is atomic.
+	std::string temp = mFilename + ".tmp";
+	int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		THROW_EXCEPT(ConfigException,
+				"Config file (" + temp + ") could not be created");
+
+	if (!writeAll(fd, buf, sizeof(buf)) || fsync(fd) != 0) {
+		close(fd);
+		unlink(temp.c_str());
+		THROW_EXCEPT(ConfigException,
+				"Config file (" + temp + ") could not be written");
+	}
+	close(fd);
+
+	if (rename(temp.c_str(), mFilename.c_str()) != 0) {
+		unlink(temp.c_str());
+		THROW_EXCEPT(ConfigException,
+				"Config file (" + mFilename + ") could not be replaced");
+	}
+
+	// Flush the directory too, so that the rename itself is on disk
+	size_t slash = mFilename.rfind('/');
+	std::string dir = (slash == std::string::npos ? "." :
+			(slash == 0 ? "/" : mFilename.substr(0, slash)));
+	int dirfd = open(dir.c_str(), O_RDONLY);
+	if (dirfd >= 0) {
+		fsync(dirfd);
+		close(dirfd);
+	}
+}
+
+Config ConfigStore::importIni(const std::string &filename) {
+	std::ifstream file(filename.c_str(), std::ios_base::in);
+	if (file.fail())
+		THROW_EXCEPT(ConfigException,
+				"Calibration file (" + filename + ") could not be loaded");
+
+	Config config;
+	config.sections = CONFIG_CALIBRATION;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		size_t equals = line.find('=');
+		if (equals == std::string::npos)
+			continue;
+
+		std::string key = line.substr(0, equals);
+		const char *k = key.c_str();
+		float value = strtof(line.c_str() + equals + 1, NULL);
+
+		// Legacy offsets, subtracted from the reading
+		if (key == "AccelX") config.accel.offset.x = -value;
+		else if (key == "AccelY") config.accel.offset.y = -value;
+		else if (key == "AccelZ") config.accel.offset.z = -value;
+
+		else if (key.length() == 8 && strncmp(k, "AccelM", 6) == 0
+				&& k[6] >= '0' && k[6] <= '2' && k[7] >= '0' && k[7] <= '2')
+			config.accel.matrix.m[k[6] - '0'][k[7] - '0'] = value;
+		else if (key == "AccelOffX") config.accel.offset.x = value;
+		else if (key == "AccelOffY") config.accel.offset.y = value;
+		else if (key == "AccelOffZ") config.accel.offset.z = value;
+		else if (key == "AccelFitted") config.accel.fitted = (value != 0.0f);
+
+		else if (key == "GyroX") config.gyro.bias.x = value;
+		else if (key == "GyroY") config.gyro.bias.y = value;
+		else if (key == "GyroZ") config.gyro.bias.z = value;
+		else if (key == "GyroSlopeX") config.gyro.slope.x = value;
+		else if (key == "GyroSlopeY") config.gyro.slope.y = value;
+		else if (key == "GyroSlopeZ") config.gyro.slope.z = value;
+		else if (key == "GyroRefTemp") config.gyro.reftemp = value;
+	}
+
+	return config;
+}
+
@@ -12,8 +12,6 @@
 #include <unistd.h>
 #include <string.h>
 #include <string>
-#include <fstream>
-#include <limits>
 #include <sys/time.h>
 #include <sys/syscall.h>
 #include <signal.h>
@@ -27,7 +25,21 @@
 #include "accelerometer.h"
 #include "gyroscope.h"
 #include "geometry.h"
+#include "fastmath.h"
 #include "pidcontroller.h"
+#include "pidbank.h"
+#include "cascade.h"
+#include "fixedpoint.h"
+#include "fixedrateloop.h"
+#include "rawsamples.h"
+#include "relaytuner.h"
+#include "gainschedule.h"
+#include "calibration.h"
+#include "configstore.h"
+#include "startupsequence.h"
+#include "flightstate.h"
+#include "supervisor.h"
+#include "i2cengine.h"
 #include "drive.h"
 
 // Linux headers don't seem to define this
@@ -35,6 +47,27 @@
 #define sigev_notify_thread_id _sigev_un._tid
 #endif
 
+// Motors' signal range: high times (milliseconds) at speeds 0 and 1
+#define MOTOR_MIN_HIGHTIME 1.26f
+#define MOTOR_MAX_HIGHTIME 1.6f
+
+// Number of samples in each window checked for stillness, when calibrating
+// and when tracking the gyroscope bias on the ground
+#define CALIBRATION_WINDOW 50
+
+// Weight, in samples, of the stored gyroscope calibration against the still
+// windows tracked on the ground
+#define GYRO_SEED_SAMPLES (10 * CALIBRATION_WINDOW)
+
+// Auto-tuning. The relay ignores errors within the hysteresis (above the
+// sensor noise): degrees/second when tuning the Rate stage, degrees when
+// tuning the Angle stage. Tuning is aborted if roll or pitch gets further
+// than AUTOTUNE_MAX_ANGLE (degrees) from level.
+#define AUTOTUNE_RATE_HYSTERESIS  1.0f
+#define AUTOTUNE_ANGLE_HYSTERESIS 0.5f
+#define AUTOTUNE_TIMEOUT          10.0f
+#define AUTOTUNE_MAX_ANGLE        30.0f
+
 // glibc doesn't define gettid
 pid_t gettid() {
 	return syscall(SYS_gettid);
@@ -46,6 +79,11 @@ pid_t gettid() {
 */
 static void timerUpdate(int signal, siginfo_t *info, void *context);
 
+void *startupThreadEntry(void *drv) {
+	((Drive *)drv)->runStartup();
+	return NULL;
+}
+
 /**
 	Entry point for the automatic update thread.
 
@@ -59,9 +97,17 @@ void *updateThreadEntry(void *drv);
 */
 void updateThreadExit(Drive *drv);
 
+/**
+	Entry point for the startup thread. drv is the Drive being started.
+*/
+void *startupThreadEntry(void *drv);
+
 Drive::Drive(PWM *pwm, Accelerometer *accel, Gyroscope *gyro, int frontleft,
 		int frontright, int rearright, int rearleft, int update_rate,
 		int smoothing) {
+	mStartup = new StartupSequence();
+
+	mPWM = pwm;
 	mAccelerometer = accel;
 	mGyroscope = gyro;
 
@@ -83,67 +129,114 @@ Drive::Drive(PWM *pwm, Accelerometer *accel, Gyroscope *gyro, int frontleft,
 		mGyroValue[i].z = 0.0f;
 	}
 
+	mFilter = new FilterChain(mUpdateRate, CONFIG_FILTER_CHANNELS);
+	mAccelLast = Vector3<float>(0.0f, 0.0f, 0.0f);
+	mGyroLast = Vector3<float>(0.0f, 0.0f, 0.0f);
+
 	mRotate = 0.0f;
+	mYawMode = YAW_HEADING_HOLD;
+	mMaxYawRate = 90.0f;
 	mTranslate.x = 0.0f;
 	mTranslate.y = 0.0f;
 	mTranslate.z = 0.0f;
 
+	mFlight = new FlightState(mUpdateRate);
+	mSupervisor = 0;
+	mVibration = 0;
+	mNotch = new NotchBank(mUpdateRate);
+	mNotchMode = NOTCH_OFF;
+	mNotchApplied = NOTCH_OFF;
+	mNotchFullSpeed = 0.0f;
+	mNotchAnalyses = -1;
+	mI2CEngine = 0;
+	mSensorRead = new I2CTransaction();
+	mMagnetometer = 0;
+	mMagRead = new I2CTransaction();
+	mMagField = Vector3<float>(0.0f, 0.0f, 0.0f);
+	mMagValid = false;
+	mBarometer = 0;
+	mAltitude = new AltitudeEstimator();
+	mEstimator = ESTIMATOR_COMPLEMENTARY;
+	mEKF = new AttitudeEKF();
+	mEKFStarted = false;
+	mThrottleMode = THROTTLE_DIRECT;
+	mAltitudeHold = new AltitudeHold();
+	mThrottle = 0.0f;
+	mI2COk = true;
+	mPWMDeferred = 0;
+
 	mRoll  = 0.0f;
 	mPitch = 0.0f;
 	mYaw   = 0.0f;
+	mRates = Vector3<float>(0.0f, 0.0f, 0.0f);
 
 	mTargetRoll  = 0.0f;
 	mTargetPitch = 0.0f;
 	mTargetYaw   = 0.0f;
 
-	mPIDRollAngle  = new PIDController(mTargetRoll,  0.00f, 0.00f, 0.00f, 5);
-	mPIDPitchAngle = new PIDController(mTargetPitch, 0.00f, 0.00f, 0.00f, 5);
-	mPIDYawAngle   = new PIDController(mTargetYaw,   0.00f, 0.00f, 0.00f, 5);
-	mPIDRollRate   = new PIDController(0.0f, 0.00f, 0.00f, 0.00f, 5);
-	mPIDPitchRate  = new PIDController(0.0f, 0.00f, 0.00f, 0.00f, 5);
-	mPIDYawRate    = new PIDController(0.0f, 0.00f, 0.00f, 0.00f, 5);
-
-	mMotors[0] = new Motor(pwm, frontleft, 1.26f, 1.6f);
-	mMotors[1] = new Motor(pwm, frontright, 1.26f, 1.6f);
-	mMotors[2] = new Motor(pwm, rearright, 1.26f, 1.6f);
-	mMotors[3] = new Motor(pwm, rearleft, 1.26f, 1.6f);
-
-	mAccelOffset.x = 0.0f;
-	mAccelOffset.y = 0.0f;
-	mAccelOffset.z = 0.0f;
-	mGyroOffset.x = 0.0f;
-	mGyroOffset.y = 0.0f;
-	mGyroOffset.z = 0.0f;
-	try {
-		loadCalibration("calibration.ini");
-	} catch (CalibrationException &e) {
-		std::cout << "WARNING: Continuimg without calibration" << std::endl;
+	// All coefficients and targets start at 0
+	mCascade  = new Cascade(mUpdateRate);
+	mPIDAngle = mCascade->getAngle();
+	mPIDRate  = mCascade->getRate();
+
+	// The integer Rate stage gets the Rate PIDs' limits, and the motors'
+	// range at the PWM's current frequency
+#ifdef FIXED_RATE_LOOP
+	mFixedLoop = new FixedRateLoop(mUpdateRate);
+	mFixedLoop->setGyroScale(gyro->getScale());
+	mFixedLoop->setOutputLimits(-PID_RATE_OUTPUT_LIMIT,
+			PID_RATE_OUTPUT_LIMIT);
+	mFixedLoop->setIntegralLimit(PID_RATE_INTEGRAL_LIMIT);
+	mFixedLoop->setDerivativeFilter(mUpdateRate * PID_DFILTER_RATIO);
+	mFixedLoop->setMotorRange(MOTOR_MIN_HIGHTIME, MOTOR_MAX_HIGHTIME,
+			pwm->getFrequency());
+#else
+	mFixedLoop = 0;
+#endif
+	mGyroRaw[0] = mGyroRaw[1] = mGyroRaw[2] = 0;
+	mGyroRawTime = 0;
+	mGyroSample = new RawSamples(&mGyroRaw[0], &mGyroRaw[1], &mGyroRaw[2],
+			&mGyroRawTime, 1);
+
+	for (int i = 0; i < 3; ++i) {
+		mAngleGains[i] = 0.0f;
+		mRateGains[i] = 0.0f;
 	}
 
-	// Wait for motors to prime
-	usleep(3000000);
-
-	gettimeofday(&mLastUpdate, NULL);
-
-	// Pre-populate mAccelValue and mGyroValue arrays
-	Vector3<float> aval;
-	Vector3<float> gval;
-	for (int i = 0; i < mSmoothing; ++i) {
-		aval = mAccelerometer->read();
-		gval = mGyroscope->read();
-		mAccelValue[i] = aval;
-		mGyroValue[i] = gval;
-		usleep(10000); // 10,000us = 100Hz
-	}
+	mSchedule = 0;
+	mScheduleEnabled = false;
+	mBatteryVoltage = 0.0f;
+	pthread_mutex_init(&mScheduleLock, NULL);
+	pthread_mutex_init(&mGyroCalLock, NULL);
+
+	mTuner = new RelayTuner();
+	mTuneActive = false;
+	mTuneAxis = AXIS_ROLL;
+	mTuneLoop = TUNE_RATE;
+	mTuneRule = RelayTuner::RULE_TYREUS_LUYBEN;
+	mTuneApply = false;
+
+	mMotors[0] = new Motor(pwm, frontleft, MOTOR_MIN_HIGHTIME,
+			MOTOR_MAX_HIGHTIME);
+	mMotors[1] = new Motor(pwm, frontright, MOTOR_MIN_HIGHTIME,
+			MOTOR_MAX_HIGHTIME);
+	mMotors[2] = new Motor(pwm, rearright, MOTOR_MIN_HIGHTIME,
+			MOTOR_MAX_HIGHTIME);
+	mMotors[3] = new Motor(pwm, rearleft, MOTOR_MIN_HIGHTIME,
+			MOTOR_MAX_HIGHTIME);
+
+	mGyroTemperature = 0.0f;
+	mTemperatureCountdown = 0;
+	mStill = new StillnessDetector(CALIBRATION_WINDOW);
+	mStillCountdown = CALIBRATION_WINDOW;
 	mAccelValueCurrent = 0;
 	mGyroValueCurrent = 0;
+	gettimeofday(&mLastUpdate, NULL);
 
-	Vector3<float> accelAvg = averageAccelerometer();
-	Vector3<float> gyroAvg = averageGyroscope();
-	calculateOrientation(0.0f, accelAvg, gyroAvg);
-
-	// Make sure the motors are resting to start
-	stop();
+	// The motors have been sent the priming signal. The rest of startup
+	// happens in the background while it takes effect.
+	if (pthread_create(&mStartupThread, NULL, startupThreadEntry, this) != 0)
+		THROW_EXCEPT(DriveException, "Could not start the startup thread");
 }
 
 Drive::~Drive() {
@@ -152,20 +245,66 @@ Drive::~Drive() {
 	} catch (Exception &e)
 		{ /* Don't care. Can't do anything about it anyway */ }
 
-	delete[] mAccelValue;
-	delete[] mGyroValue;
+	mStartup->cancel();
+	pthread_join(mStartupThread, NULL);
 
-	delete mPIDRollAngle;
-	delete mPIDPitchAngle;
-	delete mPIDYawAngle;
-	delete mPIDRollRate;
-	delete mPIDPitchRate;
-	delete mPIDYawRate;
+	// The engine may still be filling the sensors' buffers
+	if (mI2CEngine) {
+		mI2CEngine->wait(mSensorRead, 100);
+		mI2CEngine->wait(mMagRead, 100);
+	}
 
+	delete[] mAccelValue;
+	delete[] mGyroValue;
+	delete mFilter;
+
+	delete mCascade;
+	delete mFixedLoop;
+	delete mGyroSample;
+	delete mTuner;
+	delete mNotch;
+	delete mStill;
+	delete mSchedule;
+	delete mFlight;
+	delete mSensorRead;
+	delete mMagRead;
+	delete mAltitude;
+	delete mEKF;
+	delete mAltitudeHold;
+	pthread_mutex_destroy(&mScheduleLock);
+	pthread_mutex_destroy(&mGyroCalLock);
+
+	// Stop the motors with synchronous writes, which don't depend on the
+	// engine still running
+	try {
+		mPWM->setEngine(0);
+	} catch (Exception &e) { }
 	stop();
 	usleep(100000);
 	for (int i = 0; i < 4; ++i)
 		delete mMotors[i];
+
+	delete mStartup;
+}
+
+StartupSequence::State Drive::getStartupState() {
+	return mStartup->getState();
+}
+
+bool Drive::isReady() {
+	return mStartup->isReady();
+}
+
+bool Drive::waitReady(unsigned int millis) {
+	return mStartup->wait(millis);
+}
+
+void Drive::setReadyCallback(StartupSequence::Callback callback, void *data) {
+	mStartup->setCallback(callback, data);
+}
+
+float Drive::getStartupTime() {
+	return mStartup->getReadyTime();
 }
 
 void Drive::startTimer() {
@@ -255,9 +394,186 @@ void Drive::turn(float speed) {
 	mRotate = speed;
 }
 
+void Drive::setYawMode(YawMode mode) {
+	if (mode == YAW_HEADING_HOLD && mYawMode != YAW_HEADING_HOLD)
+		mTargetYaw = mYaw;
+	mYawMode = mode;
+
+	mPIDAngle->reset(AXIS_YAW);
+	mPIDRate->reset(AXIS_YAW);
+}
+
+Drive::YawMode Drive::getYawMode() {
+	return mYawMode;
+}
+
+void Drive::setMaxYawRate(float dps) {
+	mMaxYawRate = dps;
+}
+
 void Drive::stop() {
 	for (int i = 0; i < 4; ++i)
 		mMotors[i]->setSpeed(0.0f);
+	mPWM->flush();
+}
+
+void Drive::arm() {
+	mFlight->arm();
+}
+
+void Drive::disarm() {
+	mFlight->disarm();
+}
+
+void Drive::kill() {
+	mFlight->kill();
+}
+
+void Drive::packetReceived() {
+	mFlight->packetReceived();
+}
+
+FlightState::State Drive::getFlightState() {
+	return mFlight->getState();
+}
+
+FlightState::Reason Drive::getFlightReason() {
+	return mFlight->getReason();
+}
+
+void Drive::setSupervisor(Supervisor *supervisor) {
+	__atomic_store_n(&mSupervisor, supervisor, __ATOMIC_RELEASE);
+}
+
+void Drive::setVibrationAnalyzer(VibrationAnalyzer *analyzer) {
+	__atomic_store_n(&mVibration, analyzer, __ATOMIC_RELEASE);
+}
+
+void Drive::setNotchMode(NotchMode mode, float fullspeed) {
+	VibrationAnalyzer *vibration =
+			__atomic_load_n(&mVibration, __ATOMIC_ACQUIRE);
+	if (mode == NOTCH_PEAKS && (!vibration
+			|| vibration->getSampleRate() <= mUpdateRate))
+		THROW_EXCEPT(DriveException, "Notching vibration peaks needs a "
+				"VibrationAnalyzer sampling faster than the update rate");
+
+	// Applied by trackNotches()
+	mNotchFullSpeed = fullspeed;
+	mNotchMode = mode;
+}
+
+Drive::NotchMode Drive::getNotchMode() {
+	return mNotchMode;
+}
+
+void Drive::trackNotches() {
+	NotchMode mode = mNotchMode;
+	if (mode != mNotchApplied) {
+		mNotch->clear();
+		mNotchApplied = mode;
+		mNotchAnalyses = -1;
+	}
+
+	switch (mode) {
+		case NOTCH_MOTOR: {
+			float throttle;
+			__atomic_load(&mThrottle, &throttle, __ATOMIC_RELAXED);
+			mNotch->trackMotorSpeed(throttle, mNotchFullSpeed);
+			break;
+		}
+
+		case NOTCH_PEAKS: {
+			VibrationAnalyzer *vibration =
+					__atomic_load_n(&mVibration, __ATOMIC_ACQUIRE);
+			if (!vibration || vibration->getAnalyses() == mNotchAnalyses) {
+				mNotch->publish();
+				break;
+			}
+
+			// Don't wait on the analyzer (it runs at idle priority); if it
+			// is busy, try again next call
+			int analyses = vibration->getAnalyses();
+			for (int axis = 0; axis < 3; ++axis) {
+				VibrationPeak peaks[VIBRATION_PEAKS];
+				int count = vibration->tryGetPeaks(
+						(VibrationAnalyzer::Channel)
+						(VibrationAnalyzer::CHANNEL_GYRO_X + axis), peaks);
+				if (count < 0)
+					return;
+				mNotch->setPeaks(axis, peaks, count,
+						DRIVE_NOTCH_MIN_AMPLITUDE);
+			}
+			mNotchAnalyses = analyses;
+			mNotch->publish();
+			break;
+		}
+
+		default:
+			mNotch->publish();
+			break;
+	}
+}
+
+void Drive::setI2CEngine(I2CEngine *engine) {
+	if (mSensorRead->getCount() == 0) {
+		mAccelerometer->queueRead(mSensorRead);
+		mGyroscope->queueRead(mSensorRead);
+	}
+	__atomic_store_n(&mI2CEngine, engine, __ATOMIC_RELEASE);
+}
+
+void Drive::setPWMEngine(I2CEngine *engine) {
+	mPWM->setEngine(engine);
+}
+
+void Drive::setMagnetometer(Magnetometer *magnetometer) {
+	mMagValid = false;
+	mMagRead->clear();
+	if (magnetometer)
+		magnetometer->queueRead(mMagRead);
+	__atomic_store_n(&mMagnetometer, magnetometer, __ATOMIC_RELEASE);
+}
+
+void Drive::setBarometer(Barometer *barometer) {
+	mAltitude->reset();
+	mAltitudeHold->disengage();
+	__atomic_store_n(&mBarometer, barometer, __ATOMIC_RELEASE);
+}
+
+void Drive::setThrottleMode(ThrottleMode mode) {
+	// The altitude and hover throttle are captured by the next update
+	mAltitudeHold->disengage();
+	mThrottleMode = mode;
+}
+
+Drive::ThrottleMode Drive::getThrottleMode() {
+	return mThrottleMode;
+}
+
+void Drive::setPIDAltitude(float altitudep, float climbp, float climbi,
+		float climbd) {
+	mAltitudeHold->setPID(altitudep, climbp, climbi, climbd);
+}
+
+void Drive::setEstimator(Estimator estimator) {
+	mEKFStarted = false;
+	mEstimator = estimator;
+}
+
+Drive::Estimator Drive::getEstimator() {
+	return mEstimator;
+}
+
+float Drive::getAltitude() {
+	float altitude, climbrate;
+	getAltitudeEstimate(altitude, climbrate);
+	return altitude;
+}
+
+float Drive::getClimbRate() {
+	float altitude, climbrate;
+	getAltitudeEstimate(altitude, climbrate);
+	return climbrate;
 }
 
 float Drive::getRoll() {
@@ -276,56 +592,266 @@ float Drive::getYaw() {
 	return mYaw;
 }
 
-void Drive::setPIDAngle(float p, float i, float d) {
-	mPIDRollAngle->setPID(p, i, d);
-	mPIDPitchAngle->setPID(p, i, d);
-	mPIDYawAngle->setPID(p, i, d);
+Vector3<float> Drive::getRates() {
+	return mRates;
+}
+
+Vector3<float> Drive::getGyroBias() {
+	if (mEstimator != ESTIMATOR_EKF || !mEKFStarted)
+		return Vector3<float>(0.0f, 0.0f, 0.0f);
 
-	mPIDRollAngle->reset();
-	mPIDPitchAngle->reset();
-	mPIDYawAngle->reset();
+	// In the EKF's axes, as estimateEKF() takes it off
+	Vector3<float> bias = mEKF->getGyroBias();
+	return Vector3<float>(bias.y, bias.x, bias.z);
+}
+
+void Drive::setPIDAngle(float p, float i, float d) {
+	mScheduleEnabled = false;
+	mAngleGains[0] = p;
+	mAngleGains[1] = i;
+	mAngleGains[2] = d;
+
+	for (int axis = 0; axis < NUM_AXES; ++axis)
+		mPIDAngle->setPID(axis, p, i, d);
+	mPIDAngle->reset();
 }
 
 void Drive::setPIDRate(float p, float i, float d) {
-	mPIDRollRate->setPID(p, i, d);
-	mPIDPitchRate->setPID(p, i, d);
-	mPIDYawRate->setPID(p, i, d);
+	mScheduleEnabled = false;
+	mRateGains[0] = p;
+	mRateGains[1] = i;
+	mRateGains[2] = d;
+
+	for (int axis = 0; axis < NUM_AXES; ++axis)
+		mPIDRate->setPID(axis, p, i, d);
+	mPIDRate->reset();
+	if (mFixedLoop) {
+		mFixedLoop->setPID(p, i, d);
+		mFixedLoop->reset();
+	}
+}
+
+void Drive::saveGains() {
+	Config config;
+	for (int i = 0; i < 3; ++i) {
+		config.angleGains[i] = mAngleGains[i];
+		config.rateGains[i] = mRateGains[i];
+	}
+	updateConfig(config, CONFIG_GAINS);
+}
+
+void Drive::setGainSchedule(const GainSchedule &schedule) {
+	GainSchedule *copy = new GainSchedule(schedule);
+	try {
+		copy->build();
+	} catch (GainScheduleException &e) {
+		delete copy;
+		throw;
+	}
+
+	pthread_mutex_lock(&mScheduleLock);
+	GainSchedule *old = mSchedule;
+	mSchedule = copy;
+	mScheduleEnabled = true;
+	pthread_mutex_unlock(&mScheduleLock);
+
+	delete old;
+}
+
+void Drive::saveGainSchedule() {
+	Config config;
+	pthread_mutex_lock(&mScheduleLock);
+	int count = (mSchedule ? mSchedule->getBreakpointCount() : 0);
+	if (count > CONFIG_SCHEDULE_POINTS) {
+		pthread_mutex_unlock(&mScheduleLock);
+		THROW_EXCEPT(ConfigException,
+				"Gain schedule has too many breakpoints to save");
+	}
+	for (int i = 0; i < count; ++i)
+		config.schedule[i] = mSchedule->getBreakpoint(i);
+	config.scheduleCount = count;
+	pthread_mutex_unlock(&mScheduleLock);
 
-	mPIDRollRate->reset();
-	mPIDPitchRate->reset();
-	mPIDYawRate->reset();
+	updateConfig(config, CONFIG_SCHEDULE);
+}
+
+void Drive::setGainScheduling(bool enabled) {
+	if (enabled && mSchedule == 0)
+		return;
+
+	mScheduleEnabled = enabled;
+	if (!enabled)
+		setGains(mAngleGains, mRateGains);
+}
+
+bool Drive::isGainScheduling() {
+	return mScheduleEnabled;
+}
+
+void Drive::setBatteryVoltage(float volts) {
+	mBatteryVoltage = volts;
+}
+
+void Drive::startAutoTune(Axis axis, TuneLoop loop, float amplitude,
+		RelayTuner::Rule rule, bool apply) {
+	if (axis < 0 || axis >= NUM_AXES)
+		return;
+	if (mFixedLoop && loop == TUNE_RATE)
+		THROW_EXCEPT(DriveException,
+				"The integer Rate stage can't be auto-tuned");
+
+	float limit = (loop == TUNE_RATE ? PID_RATE_OUTPUT_LIMIT
+			: PID_ANGLE_OUTPUT_LIMIT);
+	amplitude = fabs(amplitude);
+	if (amplitude > limit)
+		amplitude = limit;
+
+	mTuneActive = false;
+	mTuneAxis = axis;
+	mTuneLoop = loop;
+	mTuneRule = rule;
+	mTuneApply = apply;
+	mTuner->start(amplitude, (loop == TUNE_RATE ? AUTOTUNE_RATE_HYSTERESIS
+			: AUTOTUNE_ANGLE_HYSTERESIS), AUTOTUNE_TIMEOUT);
+	mTuneActive = true;
+}
+
+void Drive::stopAutoTune() {
+	bool active = mTuneActive;
+	mTuneActive = false;
+	mTuner->stop();
+
+	// The lane's state is stale after being bypassed
+	if (active) {
+		if (mTuneLoop == TUNE_RATE)
+			mPIDRate->reset(mTuneAxis);
+		else
+			mPIDAngle->reset(mTuneAxis);
+	}
+}
+
+RelayTuner::State Drive::getAutoTuneState() {
+	return mTuner->getState();
+}
+
+bool Drive::getAutoTuneResult(float &p, float &i, float &d) {
+	return mTuner->getGains(mTuneRule, p, i, d);
 }
 
 void Drive::calibrate(unsigned int millis) {
-	Vector3<float> accel_total;
-	Vector3<float> gyro_total;
-	unsigned int elapsed = 0,
-	             num_iterations = 0;
+	if (!waitReady())
+		THROW_EXCEPT(DriveException,
+				"Startup failed: " + mStartup->getError());
 
-	accel_total.x = 0.0f; accel_total.y = 0.0f; accel_total.z = 0.0f;
-	gyro_total.x = 0.0f; gyro_total.y = 0.0f; gyro_total.z = 0.0f;
+	StillnessDetector still(CALIBRATION_WINDOW);
+	GyroBiasEstimator estimator;
+	Vector3<float>    level(0.0f, 0.0f, 0.0f);
+	unsigned int      elapsed = 0;
+	int               windows = 0,
+	                  sincewindow = 0;
 
+	updateTemperature();
 	while (elapsed < millis) {
-		accel_total += mAccelerometer->read();
-		gyro_total += mGyroscope->read();
+		Vector3<float> accel = mAccelerometer->read();
+		Vector3<float> gyro = mGyroscope->read();
+
+		// Use each still window once (windows don't overlap)
+		++sincewindow;
+		if (still.feed(accel, gyro) && sincewindow >= still.getWindow()) {
+			updateTemperature();
+			estimator.addStill(still.getGyroMean(), mGyroTemperature,
+					still.getWindow());
+			level += still.getAccelMean();
+			++windows;
+			sincewindow = 0;
+		}
+
+		usleep(10000);
+		elapsed += 10;
+	}
+
+	if (windows == 0)
+		THROW_EXCEPT(CalibrationException,
+				"Sensors were not still during calibration");
+
+	// The bias estimate starts over from these windows; tracking on the
+	// ground adds to it later
+	pthread_mutex_lock(&mGyroCalLock);
+	mGyroBias = estimator;
+	mGyroCal = estimator.fit();
+	pthread_mutex_unlock(&mGyroCalLock);
+
+	// Level the accelerometer, as an offset only: upright reads -1g on Z
+	if (!mAccelCal.fitted) {
+		mAccelCal = AccelCalibration();
+		mAccelCal.offset.x = -level.x / windows;
+		mAccelCal.offset.y = -level.y / windows;
+		mAccelCal.offset.z = -level.z / windows - 1.0f;
+	}
+
+	saveCalibration();
+}
+
+int Drive::calibratePosition(unsigned int millis) {
+	if (!waitReady())
+		THROW_EXCEPT(DriveException,
+				"Startup failed: " + mStartup->getError());
+
+	StillnessDetector still(CALIBRATION_WINDOW);
+	unsigned int elapsed = 0;
+
+	while (!still.feed(mAccelerometer->read(), mGyroscope->read())) {
+		if (elapsed >= millis)
+			THROW_EXCEPT(CalibrationException,
+					"Sensors were not still during calibration");
 		usleep(10000);
 		elapsed += 10;
-		++num_iterations;
 	}
 
-	mAccelOffset.x = accel_total.x / num_iterations;
-	mAccelOffset.y = accel_total.y / num_iterations;
-	mAccelOffset.z = accel_total.z / num_iterations + 1.0f;
-	mGyroOffset.x = gyro_total.x / num_iterations;
-	mGyroOffset.y = gyro_total.y / num_iterations;
-	mGyroOffset.z = gyro_total.z / num_iterations;
+	mAccelCalibrator.addPosition(still.getAccelMean());
+	if (mAccelCalibrator.isComplete()) {
+		mAccelCal = mAccelCalibrator.fit();
+		mAccelCalibrator.reset();
+		saveCalibration();
+		return 6;
+	}
+	return mAccelCalibrator.getNumPositions();
+}
+
+int Drive::calibrateMagnetometer(unsigned int millis) {
+	if (!mMagnetometer)
+		THROW_EXCEPT(DriveException, "No magnetometer to calibrate");
+	if (!waitReady())
+		THROW_EXCEPT(DriveException,
+				"Startup failed: " + mStartup->getError());
+
+	// A new reading every 1/75s
+	MagCalibrator calibrator;
+	for (unsigned int elapsed = 0; elapsed < millis; elapsed += 14) {
+		Vector3<float> raw = mMagnetometer->read();
+		if (!mMagnetometer->isSaturated())
+			calibrator.addSample(raw);
+		usleep(14000);
+	}
 
-	saveCalibration("calibration.ini");
+	mMagCal = calibrator.fit();
+
+	Config config;
+	config.mag = mMagCal;
+	updateConfig(config, CONFIG_MAGNETOMETER);
+	return calibrator.getSamples();
 }
 
 void Drive::update() {
 
-	updateSensors();
+	// The loop is alive, even if it has nothing to do yet
+	Supervisor *supervisor = __atomic_load_n(&mSupervisor, __ATOMIC_ACQUIRE);
+	if (supervisor)
+		supervisor->heartbeat();
+
+	// Nothing to control until startup has finished
+	if (!mStartup->isReady())
+		return;
 
 	// Determine elapsed time since last update()
 	struct timeval currenttime;
@@ -334,28 +860,75 @@ void Drive::update() {
 			+ (currenttime.tv_usec - mLastUpdate.tv_usec) / 1000000.0f;
 	mLastUpdate = currenttime;
 
-	mTargetYaw += mRotate * dtime;
+	updateSensors();
+
+	// In altitude hold, once flying, the throttle comes from the altitude
+	// controller (with the last update's estimate)
+	float throttle = mTranslate.z, altitude, climbrate;
+	if (mThrottleMode == THROTTLE_ALTITUDE_HOLD
+			&& getAltitudeEstimate(altitude, climbrate)
+			&& mFlight->getState() == FlightState::STATE_ARMED) {
+		if (!mAltitudeHold->isEngaged())
+			mAltitudeHold->engage(altitude, mThrottle);
+		throttle = mAltitudeHold->update(mTranslate.z, altitude, climbrate,
+				dtime);
+	} else
+		mAltitudeHold->disengage();
+
+	// Commands and watchdogs. mI2COk covers this update's sensor reads and
+	// the last update's motor writes.
+	FlightState::State state = mFlight->update(dtime, throttle, mI2COk);
+	throttle = mFlight->getThrottle();
+	__atomic_store(&mThrottle, &throttle, __ATOMIC_RELAXED);
+	mI2COk = true;
+
+	// In failsafe, level off and hold heading while descending
+	if (state == FlightState::STATE_FAILSAFE) {
+		mTargetRoll = 0.0f;
+		mTargetPitch = 0.0f;
+		mRotate = 0.0f;
+	}
+
+	if (mYawMode == YAW_HEADING_HOLD)
+		mTargetYaw = wrapAngle(mTargetYaw + mRotate * mMaxYawRate * dtime);
+
+	if (--mTemperatureCountdown <= 0) {
+		mTemperatureCountdown = mUpdateRate;
+		updateTemperature();
+	}
 
-	// Calculate average sensor readings over time
+	// Calculate average sensor readings over time (each already filtered)
 	Vector3<float> accel = averageAccelerometer();
 	Vector3<float> gyro = averageGyroscope();
+	trackGyroBias(accel, gyro);
 
 	// Adjust for calibration
-	accel.x -= mAccelOffset.x;
-	accel.y -= mAccelOffset.y;
-	accel.z -= mAccelOffset.z;
-	gyro.x -= mGyroOffset.x;
-	gyro.y -= mGyroOffset.y;
-	gyro.z -= mGyroOffset.z;
-
-	calculateOrientation(dtime, accel, gyro);
-	stabilize(gyro);
-
-	try {
-		for (int i = 0; i < 4; ++i)
-			mMotors[i]->update();
-	} catch (Exception &e) {
-		std::cout << "Motor update failure." << std::endl;
+	accel = mAccelCal.apply(accel);
+	gyro = mGyroCalApplied.apply(gyro, mGyroTemperature);
+
+	if (mEstimator == ESTIMATOR_EKF)
+		estimateEKF(dtime, accel, gyro);
+	else
+		calculateOrientation(dtime, accel, gyro);
+	updateAltitude(dtime, accel, __atomic_load_n(&mI2CEngine,
+			__ATOMIC_ACQUIRE));
+
+	// The Rate PIDs get the rates less the EKF's bias (taken off gyro by
+	// estimateEKF()), with the motor vibration notched out. The notches'
+	// coefficients come from trackNotches(), in another thread.
+	mRates = mNotch->process(gyro);
+
+	if (mFlight->isMotorsEnabled()) {
+		applyGainSchedule();
+		stabilize(mRates, dtime);
+	} else {
+		// Motors held stopped. Keep the PIDs clean for when they start.
+		mPIDAngle->reset();
+		mPIDRate->reset();
+		if (mFixedLoop)
+			mFixedLoop->reset();
+		float speeds[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		setMotorSpeeds(speeds);
 	}
 }
 
@@ -363,42 +936,271 @@ void Drive::update() {
 	Private member functions
 */
 
-void Drive::updateSensors() {
+void Drive::runStartup() {
+	// The config and warm-up stages run one after the other on purpose. Both
+	// together take a small part of DRIVE_PRIME_TIME, which is measured from
+	// construction, so running them in parallel would not make Drive ready
+	// any sooner. The warm-up also needs the config's filters and
+	// calibration once the buffers are full.
 
+	// Calibration, PID coefficients and gain schedule
 	try {
-		// Fix exception handling for production
-		mAccelValue[mAccelValueCurrent] = mAccelerometer->read();
+		loadConfig();
+	} catch (ConfigException &e) {
+		std::cout << "WARNING: Continuing without calibration" << std::endl;
+	}
 
-		++mAccelValueCurrent;
-		if (mAccelValueCurrent >= mSmoothing)
-			mAccelValueCurrent = 0;
+	mStartup->complete(StartupSequence::STAGE_CONFIG);
 
+	// Pre-populate mAccelValue and mGyroValue arrays, one sample per update
+	// period
+	updateTemperature();
+	try {
+		for (int i = 0; i < mSmoothing; ++i) {
+			mAccelValue[i] = mAccelerometer->read();
+			mGyroValue[i] = mGyroscope->read();
+			if (!mStartup->sleep(1000 / mUpdateRate))
+				return;
+		}
 	} catch (Exception &e) {
-		std::cout << " == ACCELEROMETER READ FAILURE ==" << std::endl;
-		// MUST DELETE ME!
-		// Probably just resort back to previous accelerometer reading, or don't
-		// update the array at all. (gyro and accel have separate counters, could
-		// take advantage)
-//		stop();
-//		char c;
-//		while (read(STDIN_FILENO, &c, 1) == 0)
-//			usleep(10000);
+		mStartup->fail(e.getDescription());
+		return;
 	}
+	updateMagnetometer(0);
+	mAccelLast = mAccelValue[mSmoothing - 1];
+	mGyroLast = mGyroValue[mSmoothing - 1];
+	resetFilter();
+
+	// Yaw starts at the magnetometer's heading, if there is one
+	calculateOrientation(0.0f, mAccelCal.apply(averageAccelerometer()),
+			mGyroCalApplied.apply(averageGyroscope(), mGyroTemperature));
+	mTargetYaw = mYaw;
+	mEKFStarted = false;
+	mStartup->complete(StartupSequence::STAGE_WARMUP);
+
+	// Hold the priming signal for the rest of DRIVE_PRIME_TIME
+	int remaining = DRIVE_PRIME_TIME - (int)(mStartup->getElapsed() * 1000.0f);
+	if (remaining > 0 && !mStartup->sleep(remaining))
+		return;
 
+	// Make sure the motors are resting to start
 	try {
-		// Fix exception handling for production
-		mGyroValue[mGyroValueCurrent] = mGyroscope->read();
+		stop();
+	} catch (Exception &e) {
+		mStartup->fail(e.getDescription());
+		return;
+	}
 
-		++mGyroValueCurrent;
-		if (mGyroValueCurrent >= mSmoothing)
-			mGyroValueCurrent = 0;
+	gettimeofday(&mLastUpdate, NULL);
+	mStartup->complete(StartupSequence::STAGE_PRIMING);
+}
+
+void Drive::updateSensors() {
+	I2CEngine *engine = __atomic_load_n(&mI2CEngine, __ATOMIC_ACQUIRE);
+	updateMagnetometer(engine);
+
+	if (engine) {
+		// Use the read submitted by the last update, then submit the next
+		switch (mSensorRead->getStatus()) {
+			case I2CTransaction::STATUS_PENDING:
+				// The bus has fallen behind; keep the old values
+				mI2COk = false;
+				return;
+
+			case I2CTransaction::STATUS_DONE: {
+				Vector3<float> accel = mAccelerometer->readQueued(),
+				               gyro = mGyroscope->readQueued();
+				if (mFixedLoop) {
+					mGyroSample->clear();
+					mGyroscope->readQueuedRaw(mGyroSample, rawSampleTime());
+				}
+				storeReadings(&accel, &gyro);
+				break;
+			}
+
+			case I2CTransaction::STATUS_FAILED:
+				mI2COk = false;
+				break;
+
+			default:
+				break;
+		}
+
+		if (!engine->submit(mSensorRead))
+			mI2COk = false;
+		return;
+	}
 
+	Vector3<float> accel, gyro;
+	bool accelok = true, gyrook = true;
+
+	try {
+		accel = mAccelerometer->read();
 	} catch (Exception &e) {
-		std::cout << " == GYROSCOPE READ FAILURE ==" << std::endl;
-//		stop();
-//		char c;
-//		while (read(STDIN_FILENO, &c, 1) == 0)
-//			usleep(10000);
+		accelok = false;
+		mI2COk = false;
+	}
+
+	try {
+		if (mFixedLoop) {
+			// One read, kept raw for the integer Rate stage as well
+			mGyroSample->clear();
+			mGyroscope->readRaw(mGyroSample);
+			float x, y, z;
+			Gyroscope::convertRaw(*mGyroSample, &x, &y, &z,
+					mGyroscope->getScale());
+			gyro = Vector3<float>(x, y, z);
+		} else
+			gyro = mGyroscope->read();
+	} catch (Exception &e) {
+		gyrook = false;
+		mI2COk = false;
+	}
+
+	if (accelok || gyrook)
+		storeReadings(accelok ? &accel : 0, gyrook ? &gyro : 0);
+}
+
+void Drive::updateMagnetometer(I2CEngine *engine) {
+	Magnetometer *magnetometer =
+			__atomic_load_n(&mMagnetometer, __ATOMIC_ACQUIRE);
+	if (!magnetometer)
+		return;
+
+	Vector3<float> field;
+	if (!engine) {
+		try {
+			field = magnetometer->read();
+		} catch (Exception &e) {
+			mMagValid = false;
+			return;
+		}
+	} else {
+		// Use the read submitted by the last update, then submit the next
+		switch (mMagRead->getStatus()) {
+			case I2CTransaction::STATUS_PENDING:
+				// Keep the last reading
+				return;
+
+			case I2CTransaction::STATUS_DONE:
+				field = magnetometer->readQueued();
+				break;
+
+			default:
+				mMagValid = false;
+				engine->submit(mMagRead);
+				return;
+		}
+		engine->submit(mMagRead);
+	}
+
+	mMagValid = !magnetometer->isSaturated();
+	mMagField = mMagCal.apply(field);
+}
+
+void Drive::updateAltitude(float dtime, Vector3<float> accel,
+		I2CEngine *engine) {
+	Barometer *barometer = __atomic_load_n(&mBarometer, __ATOMIC_ACQUIRE);
+	if (!barometer)
+		return;
+
+	// The EKF predicts the altitude itself, and only needs the readings
+	if (mEstimator == ESTIMATOR_EKF) {
+		if (barometer->update(dtime, engine))
+			mEKF->correctAltitude(barometer->getAltitude());
+		return;
+	}
+
+	// Vertical acceleration: accel along "up" (which reads -1g on Z when
+	// level), less gravity
+	float sinroll, cosroll, sinpitch, cospitch;
+	fastSinCos(mRoll * RADIANS_PER_DEGREE, sinroll, cosroll);
+	fastSinCos(mPitch * RADIANS_PER_DEGREE, sinpitch, cospitch);
+	Vector3<float> up(sinroll * cospitch, sinpitch, -cosroll * cospitch);
+	float vertical = accel.x * up.x + accel.y * up.y + accel.z * up.z;
+	mAltitude->predict((vertical - 1.0f) * ALTITUDE_GRAVITY, dtime);
+
+	if (barometer->update(dtime, engine))
+		mAltitude->correct(barometer->getAltitude());
+}
+
+void Drive::estimateEKF(float dtime, Vector3<float> accel,
+		Vector3<float> &gyro) {
+	// The EKF wants right-handed rates about the accelerometer's axes. As
+	// calculateOrientation() integrates them, roll turns about the
+	// accelerometer's Y axis at gyro.x, and pitch about its X at gyro.y.
+	Vector3<float> rates(gyro.y, gyro.x, gyro.z);
+
+	// Start from the current estimate (which has the magnetometer's heading)
+	if (!mEKFStarted) {
+		mEKF->initialize(accel, mYaw);
+		mEKFStarted = true;
+	} else
+		mEKF->predict(rates, accel, dtime);
+
+	mEKF->correctAccelerometer(accel);
+	if (mMagValid)
+		mEKF->correctHeading(Magnetometer::getHeading(mMagField,
+				mEKF->getUp()));
+
+	mRoll  = mEKF->getRoll();
+	mPitch = mEKF->getPitch();
+	mYaw   = mEKF->getYaw();
+
+	Vector3<float> bias = mEKF->getGyroBias();
+	gyro.x -= bias.y;
+	gyro.y -= bias.x;
+	gyro.z -= bias.z;
+}
+
+bool Drive::getAltitudeEstimate(float &altitude, float &climbrate) {
+	if (mEstimator == ESTIMATOR_EKF) {
+		altitude = mEKF->getAltitude();
+		climbrate = mEKF->getVelocity();
+		return mEKF->isAltitudeValid();
+	}
+	altitude = mAltitude->getAltitude();
+	climbrate = mAltitude->getVelocity();
+	return mAltitude->isValid();
+}
+
+void Drive::setMotorSpeeds(const float *speeds) {
+	try {
+		for (int i = 0; i < 4; ++i) {
+			mMotors[i]->setSpeed(speeds[i]);
+			mMotors[i]->update();
+		}
+		flushMotors();
+	} catch (Exception &e) {
+		mI2COk = false;
+	}
+}
+
+void Drive::setMotorCounts(const uint16_t *counts) {
+	try {
+		for (int i = 0; i < 4; ++i)
+			mPWM->setExactLoad(mMotors[i]->getChannel(), counts[i]);
+		flushMotors();
+	} catch (Exception &e) {
+		mI2COk = false;
+	}
+}
+
+void Drive::flushMotors() {
+	switch (mPWM->flush()) {
+		case PWM::FLUSH_SENT:
+			mPWMDeferred = 0;
+			break;
+
+		case PWM::FLUSH_DEFERRED:
+			if (++mPWMDeferred >= DRIVE_PWM_MAX_DEFERRED)
+				mI2COk = false;
+			break;
+
+		case PWM::FLUSH_FAILED:
+			mPWMDeferred = 0;
+			mI2COk = false;
+			break;
 	}
 }
 
@@ -416,11 +1218,11 @@ void Drive::calculateOrientation(float dtime, Vector3<float> accel,
 	if (orient.z > 180.0f)  orient.z -= 360.0f;
 	if (orient.z < -180.0f) orient.z += 360.0f;
 
-	float accelroll = atan2(accel.x, -accel.z) * 180.0 / PI;
-	float accelpitch = atan2(accel.y, -sign(accel.z)
-			* sqrt(accel.x * accel.x + accel.z * accel.z)) * 180.0 / PI;
+	float accelroll = fastAtan2Degrees(accel.x, -accel.z);
+	float accelpitch = fastAtan2Degrees(accel.y, -sign(accel.z)
+			* fastSqrt(accel.x * accel.x + accel.z * accel.z));
 
-	float accelmag = magnitude(accel);
+	float accelmag = fastSqrt(magnitudeSquared(accel));
 	float factor = 1.0f - sign(1.0f - accelmag) * (1.0f - accelmag);
 	if (factor < 0.0f)
 		factor = 0.0f;
@@ -428,65 +1230,155 @@ void Drive::calculateOrientation(float dtime, Vector3<float> accel,
 	mRoll  = orient.x * (1.0f - factor) + accelroll * factor;
 	mPitch = orient.y * (1.0f - factor) + accelpitch * factor;
 	mYaw   = orient.z;
+
+	// Pull yaw towards the magnetometer's heading, while the accelerometer
+	// gives a usable "up" for its tilt compensation
+	if (mMagValid && factor > 0.5f && fabs(mRoll) < DRIVE_MAG_MAX_TILT
+			&& fabs(mPitch) < DRIVE_MAG_MAX_TILT) {
+		float heading = Magnetometer::getHeading(mMagField, accel);
+		float weight = (dtime > 0.0f ?
+				dtime / (DRIVE_MAG_TIME_CONSTANT + dtime) : 1.0f);
+		mYaw = wrapAngle(mYaw + angleDifference(heading, mYaw) * weight);
+	}
 }
 
-void Drive::stabilize(Vector3<float> gyro) {
-	// Adjust Angle PID setpoints
-	mPIDRollAngle->setTarget(mTargetRoll);
-	mPIDPitchAngle->setTarget(mTargetPitch);
-	//mPIDYawAngle->setTarget(mTargetYaw);
+void Drive::stabilize(Vector3<float> gyro, float dtime) {
+	// In rate mode the target heading follows the frame, ready for heading
+	// hold
+	bool headinghold = (mYawMode == YAW_HEADING_HOLD);
+	if (!headinghold)
+		mTargetYaw = mYaw;
+
+	float angles[NUM_AXES]  = { mRoll, mPitch, mYaw },
+	      targets[NUM_AXES] = { mTargetRoll, mTargetPitch, mTargetYaw };
+	float errors[NUM_AXES], ratetargets[NUM_AXES];
+	mCascade->feedAngles(angles, targets, mRotate * mMaxYawRate, headinghold,
+			dtime, errors, ratetargets);
+
+	// While auto-tuning the Angle stage, the relay takes the place of the
+	// tuned axis' Angle PID
+	if (mTuneActive) {
+		if (fabs(mRoll) > AUTOTUNE_MAX_ANGLE
+				|| fabs(mPitch) > AUTOTUNE_MAX_ANGLE)
+			mTuner->abort();
+
+		if (mTuneLoop == TUNE_ANGLE)
+			ratetargets[mTuneAxis] = mTuner->feed(errors[mTuneAxis], dtime);
+	}
 
-	// Feed current angle to Angle PID controllers
-	mPIDRollAngle->feed(mRoll);
-	mPIDPitchAngle->feed(mPitch);
-	//mPIDYawAngle->feed(mYaw);
+	// The integer Rate stage replaces the float one, and the mix. Only the
+	// Angle stage can be auto-tuned with it.
+	if (mFixedLoop) {
+		if (mTuneActive && mTuner->getState() != RelayTuner::STATE_RUNNING)
+			finishAutoTune();
+		stabilizeFixed(ratetargets);
+		return;
+	}
 
-	// Adjust Rate PID setpoints based on Angle PID outputs
-	mPIDRollRate->setTarget(mPIDRollAngle->output());
-	mPIDPitchRate->setTarget(mPIDPitchAngle->output());
-	//mPIDYawRate->setTarget(mPIDYawAngle->output());
+	float corrections[NUM_AXES];
+	mCascade->feedRates(ratetargets, gyro, dtime, corrections);
 
-	// Feed angular rate to Angle PID controllers
-	mPIDRollRate->feed(gyro.x);
-	mPIDPitchRate->feed(gyro.y);
-	//mPIDYawRate->feed(gyro.z);
+	// While auto-tuning the Rate stage, the relay takes the place of the
+	// tuned axis' Rate PID, oscillating around a rate of 0
+	if (mTuneActive) {
+		if (mTuneLoop == TUNE_RATE) {
+			float rates[NUM_AXES] = { gyro.x, gyro.y, gyro.z };
+			corrections[mTuneAxis] = mTuner->feed(-rates[mTuneAxis], dtime);
+		}
+
+		if (mTuner->getState() != RelayTuner::STATE_RUNNING)
+			finishAutoTune();
+	}
 
 	// Assign motor values based on PID outputs
 	float motorspeeds[4];
-//	for (int i = 0; i < 4; ++i)
-//		motorspeeds[i] = mTranslate.z;
+	Cascade::mix(mThrottle, corrections, motorspeeds);
+	setMotorSpeeds(motorspeeds);
+}
 
-	// Temporary isolation of opposing motors
-	for (int i = 0; i < 4; ++i)
-		motorspeeds[i] = 0.0f;
-	motorspeeds[0] = mTranslate.z;
-	motorspeeds[2] = mTranslate.z;
+void Drive::stabilizeFixed(const float *ratetargets) {
+	// The bias the float path takes off: the calibration at the current
+	// temperature, and the EKF's estimate
+	GyroCalibration cal = mGyroCalApplied;
+	cal.bias += getGyroBias();
+	mFixedLoop->setGyroCalibration(cal, mGyroTemperature);
+
+	// In the loop's axes: X and Y swapped, as Gyroscope::read()
+	int16_t raw[NUM_AXES] = { mGyroRaw[1], mGyroRaw[0], mGyroRaw[2] };
+	int32_t targets[NUM_AXES];
+	for (int axis = 0; axis < NUM_AXES; ++axis)
+		targets[axis] = toQ16(ratetargets[axis]);
+
+	uint16_t counts[4];
+	mFixedLoop->update(raw, targets, toQ16(mThrottle), counts);
+	setMotorCounts(counts);
+}
 
-	double d_ends  = mPIDPitchRate->output() / 100.0f;
-	double d_sides = mPIDRollRate->output() / 100.0f;
-	//printf("%f | %f\n", mPIDPitchRate->output(), mPIDRollRate->output());
+void Drive::applyGainSchedule() {
+	if (!mScheduleEnabled || pthread_mutex_trylock(&mScheduleLock) != 0)
+		return;
 
-	motorspeeds[0] += d_ends - d_sides;
-	//motorspeeds[1] += d_ends + d_sides;
-	motorspeeds[2] += -d_ends + d_sides;
-	//motorspeeds[3] += -d_ends - d_sides;
+	GainSchedule::Gains gains = mSchedule->lookup(mThrottle,
+			mBatteryVoltage);
+	pthread_mutex_unlock(&mScheduleLock);
 
-	// Need to add in rotational motion on top of this!
+	setGains(gains.angle, gains.rate);
+}
+
+void Drive::setGains(const float *angle, const float *rate) {
+	// PIDBank keeps the integral already multiplied by I, so changing
+	// coefficients does not make the output jump
+	for (int axis = 0; axis < NUM_AXES; ++axis) {
+		mPIDAngle->setPID(axis, angle[0], angle[1], angle[2]);
+		mPIDRate->setPID(axis, rate[0], rate[1], rate[2]);
+	}
+	if (mFixedLoop)
+		mFixedLoop->setPID(rate[0], rate[1], rate[2]);
+}
 
+void Drive::finishAutoTune() {
+	mTuneActive = false;
+
+	PIDBank *bank = (mTuneLoop == TUNE_RATE ? mPIDRate : mPIDAngle);
+	float p, i, d;
+	if (mTuneApply && mTuner->getGains(mTuneRule, p, i, d)) {
+		// Otherwise the schedule would replace the tuned gains next update
+		mScheduleEnabled = false;
+		bank->setPID(mTuneAxis, p, i, d);
+	}
+
+	// The lane's state is stale after being bypassed
+	bank->reset(mTuneAxis);
+}
+
+void Drive::updateTemperature() {
 	try {
-		// Remove try block in production... or make it useful somehow for
-		// handling errors
-		for (int i = 0; i < 4; ++i) {
-			if (motorspeeds[i] < 0.0f)
-				motorspeeds[i] = 0.0f;
-			mMotors[i]->setSpeed(motorspeeds[i]);
-		}
+		mGyroTemperature = mGyroscope->readTemperature();
 	} catch (Exception &e) {
-		std::cout << "Motor set failure. " << motorspeeds[0] << ", "
-				<< motorspeeds[1] << ", " << motorspeeds[2] << ", "
-				<< motorspeeds[4] << std::endl;
-		throw e;
+		// Keep the last reading; the temperature changes slowly
+	}
+}
+
+void Drive::trackGyroBias(const Vector3<float> &accel,
+		const Vector3<float> &gyro) {
+	// calibrate() is replacing the calibration; keep applying the last one
+	if (pthread_mutex_trylock(&mGyroCalLock) != 0)
+		return;
+
+	if (mThrottle > 0.0f) {
+		mStill->reset();
+		mStillCountdown = mStill->getWindow();
 	}
+	// Use each still window once (windows don't overlap)
+	else if (mStill->feed(accel, gyro) && --mStillCountdown <= 0) {
+		mStillCountdown = mStill->getWindow();
+		mGyroBias.addStill(mStill->getGyroMean(), mGyroTemperature,
+				mStill->getWindow());
+		mGyroCal = mGyroBias.fit();
+	}
+
+	mGyroCalApplied = mGyroCal;
+	pthread_mutex_unlock(&mGyroCalLock);
 }
 
 Vector3<float> Drive::averageAccelerometer() {
@@ -511,46 +1403,141 @@ Vector3<float> Drive::averageGyroscope() {
 	return avg;
 }
 
-void Drive::loadCalibration(const std::string &filename) {
-	std::ifstream file(filename.c_str(), std::ios_base::in);
-	if (file.fail())
-		THROW_EXCEPT(CalibrationException,
-				"Calibration file (" + filename + ") could not be loaded");
-
-	char  key[20];
-	float value;
-	while (!file.eof()) {
-		file.getline(key, 20, '=');
-
-		if (!file.fail()) {
-			file >> value;
-			file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-
-			if (strcmp(key, "AccelX") == 0) mAccelOffset.x = value;
-			else if (strcmp(key, "AccelY") == 0) mAccelOffset.y = value;
-			else if (strcmp(key, "AccelZ") == 0) mAccelOffset.z = value;
-			else if (strcmp(key, "GyroX") == 0) mGyroOffset.x = value;
-			else if (strcmp(key, "GyroY") == 0) mGyroOffset.y = value;
-			else if (strcmp(key, "GyroZ") == 0) mGyroOffset.z = value;
+void Drive::storeReadings(const Vector3<float> *accel,
+		const Vector3<float> *gyro) {
+	if (accel)
+		mAccelLast = *accel;
+	if (gyro)
+		mGyroLast = *gyro;
+
+	float values[CONFIG_FILTER_CHANNELS] = {
+		mGyroLast.x, mGyroLast.y, mGyroLast.z,
+		mAccelLast.x, mAccelLast.y, mAccelLast.z
+	};
+	mFilter->process(values);
+
+	if (accel) {
+		mAccelValue[mAccelValueCurrent] = Vector3<float>(values[3], values[4],
+				values[5]);
+		if (++mAccelValueCurrent >= mSmoothing)
+			mAccelValueCurrent = 0;
+	}
+
+	if (gyro) {
+		mGyroValue[mGyroValueCurrent] = Vector3<float>(values[0], values[1],
+				values[2]);
+		if (++mGyroValueCurrent >= mSmoothing)
+			mGyroValueCurrent = 0;
+	}
+}
+
+void Drive::resetFilter() {
+	Vector3<float> gyro = averageGyroscope(),
+	               accel = averageAccelerometer();
+	float values[CONFIG_FILTER_CHANNELS] = {
+		gyro.x, gyro.y, gyro.z, accel.x, accel.y, accel.z
+	};
+	mFilter->reset(values);
+}
+
+void Drive::loadConfig() {
+	ConfigStore store(CONFIG_FILE);
+	Config config;
+	try {
+		config = store.load();
+	} catch (ConfigException &e) {
+		// First run after an upgrade: migrate the old calibration file
+		config = ConfigStore::importIni(CONFIG_LEGACY_FILE);
+		try {
+			store.save(config);
+		} catch (ConfigException &e) {
+			std::cout << "WARNING: " << e.getDescription() << std::endl;
 		}
 	}
+
+	if (config.sections & CONFIG_CALIBRATION) {
+		mAccelCal = config.accel;
+		pthread_mutex_lock(&mGyroCalLock);
+		mGyroCal = config.gyro;
+		mGyroCalApplied = config.gyro;
+		mGyroBias.seed(config.gyro, GYRO_SEED_SAMPLES);
+		pthread_mutex_unlock(&mGyroCalLock);
+	}
+	if (config.sections & CONFIG_MAGNETOMETER)
+		mMagCal = config.mag;
+	if (config.sections & CONFIG_GAINS) {
+		for (int i = 0; i < 3; ++i) {
+			mAngleGains[i] = config.angleGains[i];
+			mRateGains[i] = config.rateGains[i];
+		}
+		setGains(mAngleGains, mRateGains);
+	}
+	if (config.sections & CONFIG_FILTERS) {
+		for (int c = 0; c < CONFIG_FILTER_CHANNELS; ++c) {
+			try {
+				mFilter->setStages(c, config.filters[c], FILTER_MAX_STAGES);
+			} catch (FilterException &e) {
+				std::cout << "WARNING: Filters of channel " << c << ": "
+						<< e.getDescription() << std::endl;
+			}
+		}
+		mFilter->compile();
+	}
+	if ((config.sections & CONFIG_SCHEDULE) && config.scheduleCount > 0) {
+		GainSchedule schedule;
+		for (int i = 0; i < config.scheduleCount; ++i) {
+			const GainSchedule::Breakpoint &bp = config.schedule[i];
+			schedule.addBreakpoint(bp.throttle, bp.voltage, bp.gains);
+		}
+		setGainSchedule(schedule);
+	}
 }
 
-void Drive::saveCalibration(const std::string &filename) {
-	std::ofstream file(filename.c_str(),
-			std::ios_base::out | std::ios_base::trunc);
-	if (file.fail())
-		THROW_EXCEPT(CalibrationException,
-				"Calibration file (" + filename + ") could not be written");
+void Drive::updateConfig(const Config &config, uint32_t sections) {
+	ConfigStore store(CONFIG_FILE);
+	Config merged;
+	try {
+		merged = store.load();
+	} catch (ConfigException &e) { }
 
-	file << "AccelX=" << mAccelOffset.x << std::endl
-	     << "AccelY=" << mAccelOffset.y << std::endl
-	     << "AccelZ=" << mAccelOffset.z << std::endl
-	     << "GyroX=" << mGyroOffset.x << std::endl
-	     << "GyroY=" << mGyroOffset.y << std::endl
-	     << "GyroZ=" << mGyroOffset.z << std::endl;
+	if (sections & CONFIG_CALIBRATION) {
+		merged.accel = config.accel;
+		merged.gyro = config.gyro;
+	}
+	if (sections & CONFIG_GAINS) {
+		for (int i = 0; i < 3; ++i) {
+			merged.angleGains[i] = config.angleGains[i];
+			merged.rateGains[i] = config.rateGains[i];
+		}
+	}
+	if (sections & CONFIG_MOTORS) {
+		for (int i = 0; i < 4; ++i)
+			merged.motors[i] = config.motors[i];
+	}
+	if (sections & CONFIG_TIMING) {
+		merged.updateRate = config.updateRate;
+		merged.smoothing = config.smoothing;
+	}
+	if (sections & CONFIG_MAGNETOMETER)
+		merged.mag = config.mag;
+	if (sections & CONFIG_FILTERS)
+		memcpy(merged.filters, config.filters, sizeof(merged.filters));
+	if (sections & CONFIG_SCHEDULE) {
+		merged.scheduleCount = config.scheduleCount;
+		memcpy(merged.schedule, config.schedule, sizeof(merged.schedule));
+	}
+	merged.sections |= sections;
+
+	store.save(merged);
+}
 
-	file.close();
+void Drive::saveCalibration() {
+	Config config;
+	config.accel = mAccelCal;
+	pthread_mutex_lock(&mGyroCalLock);
+	config.gyro = mGyroCal;
+	pthread_mutex_unlock(&mGyroCalLock);
+	updateConfig(config, CONFIG_CALIBRATION);
 }
 
 /*
@@ -0,0 +1,124 @@
+/*
+	fft.cpp
+
+	RealFFT class - fast Fourier transform of real samples, radix-2
+*/
+
+#include <math.h>
+
+#include "fft.h"
+
+RealFFT::RealFFT(int size) {
+	if (size > FFT_MAX_SIZE)
+		size = FFT_MAX_SIZE;
+	mSize = FFT_MIN_SIZE;
+	while (mSize * 2 <= size)
+		mSize *= 2;
+	mHalf = mSize / 2;
+
+	int bits = 0;
+	while ((1 << bits) < mHalf)
+		++bits;
+	mReverse = new int[mHalf];
+	for (int i = 0; i < mHalf; ++i) {
+		int reversed = 0;
+		for (int b = 0; b < bits; ++b)
+			if (i & (1 << b))
+				reversed |= 1 << (bits - 1 - b);
+		mReverse[i] = reversed;
+	}
+
+	mRe = new float[mHalf];
+	mIm = new float[mHalf];
+
+	// Worked out in double, so that large sizes keep their accuracy
+	mTwiddleRe = new float[mHalf];
+	mTwiddleIm = new float[mHalf];
+	for (int h = 1; h < mHalf; h *= 2)
+		for (int k = 0; k < h; ++k) {
+			mTwiddleRe[h - 1 + k] = (float)cos(M_PI * k / h);
+			mTwiddleIm[h - 1 + k] = (float)-sin(M_PI * k / h);
+		}
+
+	mSplitRe = new float[mHalf / 2 + 1];
+	mSplitIm = new float[mHalf / 2 + 1];
+	for (int k = 0; k <= mHalf / 2; ++k) {
+		mSplitRe[k] = (float)cos(2.0 * M_PI * k / mSize);
+		mSplitIm[k] = (float)-sin(2.0 * M_PI * k / mSize);
+	}
+}
+
+RealFFT::~RealFFT() {
+	delete[] mReverse;
+	delete[] mRe;
+	delete[] mIm;
+	delete[] mTwiddleRe;
+	delete[] mTwiddleIm;
+	delete[] mSplitRe;
+	delete[] mSplitIm;
+}
+
+int RealFFT::getSize() {
+	return mSize;
+}
+
+void RealFFT::transform(float *data) {
+	float *re = mRe, *im = mIm;
+	int   half = mHalf;
+
+	// Even samples as the real parts, odd as the imaginary, in bit-reversed
+	// order
+	for (int n = 0; n < half; ++n) {
+		re[mReverse[n]] = data[2 * n];
+		im[mReverse[n]] = data[2 * n + 1];
+	}
+
+	// Decimation in time: each stage combines pairs of transforms of span h
+	// into transforms of span 2h
+	for (int h = 1; h < half; h *= 2) {
+		const float *wr = mTwiddleRe + h - 1, *wi = mTwiddleIm + h - 1;
+		for (int start = 0; start < half; start += 2 * h) {
+			float *ar = re + start, *ai = im + start,
+			      *br = ar + h,     *bi = ai + h;
+			for (int k = 0; k < h; ++k) {
+				float tr = wr[k] * br[k] - wi[k] * bi[k],
+				      ti = wr[k] * bi[k] + wi[k] * br[k];
+				br[k] = ar[k] - tr;
+				bi[k] = ai[k] - ti;
+				ar[k] += tr;
+				ai[k] += ti;
+			}
+		}
+	}
+
+	// Split Z, the transform of the packed samples, into the spectrum of
+	// the even (E) and odd (O) samples, and combine:
+	//     X[k]        = E[k] + W^k O[k]
+	//     X[half - k] = conj(E[k] - W^k O[k])
+	data[0] = re[0] + im[0];
+	data[1] = re[0] - im[0];
+	for (int k = 1; k <= half / 2; ++k) {
+		int   m = half - k;
+		float evenr = (re[k] + re[m]) * 0.5f,
+		      eveni = (im[k] - im[m]) * 0.5f,
+		      oddr  = (im[k] + im[m]) * 0.5f,
+		      oddi  = (re[m] - re[k]) * 0.5f;
+		float wor = mSplitRe[k] * oddr - mSplitIm[k] * oddi,
+		      woi = mSplitRe[k] * oddi + mSplitIm[k] * oddr;
+
+		data[2 * k] = evenr + wor;
+		data[2 * k + 1] = eveni + woi;
+		if (m != k) {
+			data[2 * m] = evenr - wor;
+			data[2 * m + 1] = woi - eveni;
+		}
+	}
+}
+
+void RealFFT::power(const float *data, float *power) {
+	power[0] = data[0] * data[0];
+	power[mHalf] = data[1] * data[1];
+	for (int k = 1; k < mHalf; ++k)
+		power[k] = data[2 * k] * data[2 * k]
+				+ data[2 * k + 1] * data[2 * k + 1];
+}
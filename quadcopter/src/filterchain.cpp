@@ -0,0 +1,359 @@
+/*
+	filterchain.cpp
+
+	FilterChain class - per-channel chains of filter stages for pre-filtering
+		the sensor readings, compiled into one flat array
+*/
+
+#include <string>
+#include <math.h>
+#include <string.h>
+
+#include "exception.h"
+#include "geometry.h"
+#include "biquad.h"
+#include "filterchain.h"
+
+// Vectors of data per step: first order low-pass (alpha, output), and
+// biquad (b0, b1, b2, a1, a2, z1, z2). A median keeps its window of
+// readings, oldest first.
+#define LOWPASS1_SIZE 2
+#define BIQUAD_SIZE   7
+
+// Most channels run together, one per lane of a vector
+#define STEP_LANES 4
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+/**
+	Sort a pair of vectors, per element, without branches
+*/
+static inline void order(v4sf &low, v4sf &high) {
+	v4sf swap = (low < high ? low : high);
+	high = (low < high ? high : low);
+	low = swap;
+}
+
+/**
+	Shift the newest reading into a median's window (oldest first) and
+	return the median of the window, per element. An odd-even transposition
+	sort of a copy; the constant window lets the compiler unroll it.
+*/
+template <int window>
+static inline v4sf median(v4sf *history, v4sf in) {
+	v4sf sorted[window];
+	for (int i = 0; i < window - 1; ++i)
+		sorted[i] = history[i] = history[i + 1];
+	sorted[window - 1] = history[window - 1] = in;
+
+	for (int pass = 0; pass < window; ++pass)
+		for (int i = pass % 2; i < window - 1; i += 2)
+			order(sorted[i], sorted[i + 1]);
+	return sorted[window / 2];
+}
+
+FilterStage::FilterStage() {
+	type = FILTER_NONE;
+	frequency = 0.0f;
+	param = 0.0f;
+}
+
+FilterStage::FilterStage(FilterType type, float frequency, float param) {
+	this->type = type;
+	this->frequency = frequency;
+	this->param = param;
+}
+
+FilterChain::FilterChain(float samplerate, int channels) {
+	mSampleRate = samplerate;
+	mChannels = (channels > 0 ? channels : 1);
+
+	mStages = new FilterStage[mChannels * FILTER_MAX_STAGES];
+	mCounts = new int[mChannels];
+	for (int c = 0; c < mChannels; ++c)
+		mCounts[c] = 0;
+
+	mSteps = 0;
+	mNumSteps = 0;
+	mData = 0;
+}
+
+FilterChain::~FilterChain() {
+	delete[] mStages;
+	delete[] mCounts;
+	delete[] mSteps;
+	delete[] mData;
+}
+
+int FilterChain::getChannels() {
+	return mChannels;
+}
+
+void FilterChain::setStages(int channel, const FilterStage *stages,
+		int count) {
+	if (channel < 0 || channel >= mChannels)
+		THROW_EXCEPT(FilterException, "No such filter channel");
+	if (count > FILTER_MAX_STAGES)
+		THROW_EXCEPT(FilterException, "Too many filter stages");
+
+	// Check them all before replacing any
+	for (int i = 0; i < count; ++i)
+		if (stages[i].type != FILTER_NONE)
+			validate(stages[i]);
+
+	FilterStage *set = mStages + channel * FILTER_MAX_STAGES;
+	mCounts[channel] = 0;
+	for (int i = 0; i < count; ++i)
+		if (stages[i].type != FILTER_NONE)
+			set[mCounts[channel]++] = stages[i];
+}
+
+int FilterChain::getStageCount(int channel) {
+	if (channel < 0 || channel >= mChannels)
+		return 0;
+	return mCounts[channel];
+}
+
+void FilterChain::compile() {
+	// Count the runs and their data first
+	int steps = 0, size = 0;
+	for (int level = 0; level < FILTER_MAX_STAGES; ++level)
+		for (int c = 0; c < mChannels; ) {
+			int lanes = runLength(level, c);
+			if (lanes > 0) {
+				++steps;
+				size += dataSize(stageAt(c, level));
+			}
+			c += (lanes > 0 ? lanes : 1);
+		}
+
+	delete[] mSteps;
+	delete[] mData;
+	mSteps = new Step[steps > 0 ? steps : 1];
+	mData = new v4sf[size > 0 ? size : 1];
+	mNumSteps = steps;
+
+	Step *step = mSteps;
+	v4sf *data = mData;
+	for (int level = 0; level < FILTER_MAX_STAGES; ++level)
+		for (int c = 0; c < mChannels; ) {
+			int lanes = runLength(level, c);
+			if (lanes == 0) {
+				++c;
+				continue;
+			}
+
+			const FilterStage &stage = stageAt(c, level);
+			step->type = stage.type;
+			step->channel = c;
+			step->lanes = lanes;
+			step->size = dataSize(stage);
+			for (int i = 0; i < step->size; ++i)
+				data[i] = (v4sf){ 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int lane = 0; lane < lanes; ++lane)
+				initialize(stageAt(c + lane, level), data, lane);
+			data += step->size;
+			++step;
+			c += lanes;
+		}
+}
+
+void FilterChain::process(float *values) {
+	v4sf *d = mData;
+	for (const Step *step = mSteps, *end = mSteps + mNumSteps; step != end;
+			d += step->size, ++step) {
+		float *v = values + step->channel;
+		int   lanes = step->lanes;
+
+		// Lanes past the run are zero, and stay so through every stage
+		v4sf in, out;
+		switch (lanes) {
+			case 1:  in = (v4sf){ v[0], 0.0f, 0.0f, 0.0f }; break;
+			case 2:  in = (v4sf){ v[0], v[1], 0.0f, 0.0f }; break;
+			case 3:  in = (v4sf){ v[0], v[1], v[2], 0.0f }; break;
+			default: memcpy(&in, v, sizeof(in)); break;
+		}
+
+		switch (step->type) {
+			case FILTER_LOWPASS1:
+				d[1] += d[0] * (in - d[1]);
+				out = d[1];
+				break;
+
+			case FILTER_LOWPASS2:
+			case FILTER_NOTCH:
+			case FILTER_BANDSTOP:
+				// As Biquad::process()
+				out = d[0] * in + d[5];
+				d[5] = d[1] * in - d[3] * out + d[6];
+				d[6] = d[2] * in - d[4] * out;
+				break;
+
+			case FILTER_MEDIAN:
+				switch (step->size) {
+					case 3:  out = median<3>(d, in); break;
+					case 5:  out = median<5>(d, in); break;
+					default: out = median<7>(d, in); break;
+				}
+				break;
+
+			default:
+				out = in;
+				break;
+		}
+
+		switch (lanes) {
+			case 3:  v[2] = out[2]; // Fall through
+			case 2:  v[1] = out[1]; // Fall through
+			case 1:  v[0] = out[0]; break;
+			default: memcpy(v, &out, sizeof(out)); break;
+		}
+	}
+}
+
+void FilterChain::reset(const float *values) {
+	// Each stage settles at what the previous one of the channel outputs
+	float *settled = new float[mChannels];
+	memcpy(settled, values, mChannels * sizeof(float));
+
+	v4sf *d = mData;
+	for (const Step *step = mSteps, *end = mSteps + mNumSteps; step != end;
+			d += step->size, ++step) {
+		for (int l = 0; l < step->lanes; ++l) {
+			float &value = settled[step->channel + l];
+
+			switch (step->type) {
+				case FILTER_LOWPASS1:
+					at(d[1], l) = value;
+					break;
+
+				case FILTER_LOWPASS2:
+				case FILTER_NOTCH:
+				case FILTER_BANDSTOP: {
+					// As Biquad::reset()
+					float b0 = at(d[0], l), b1 = at(d[1], l), b2 = at(d[2], l),
+					      a1 = at(d[3], l), a2 = at(d[4], l);
+					float out = value * (b0 + b1 + b2) / (1.0f + a1 + a2);
+					at(d[5], l) = out - b0 * value;
+					at(d[6], l) = b2 * value - a2 * out;
+					value = out;
+					break;
+				}
+
+				case FILTER_MEDIAN:
+					for (int i = 0; i < step->size; ++i)
+						at(d[i], l) = value;
+					break;
+			}
+		}
+	}
+	delete[] settled;
+}
+
+/*
+	Private member functions
+*/
+
+void FilterChain::validate(const FilterStage &stage) {
+	float nyquist = mSampleRate / 2.0f;
+	switch (stage.type) {
+		case FILTER_LOWPASS1:
+			if (!(stage.frequency > 0.0f && stage.frequency < nyquist))
+				THROW_EXCEPT(FilterException,
+						"Low-pass cutoff out of range");
+			break;
+
+		case FILTER_LOWPASS2:
+		case FILTER_NOTCH:
+			if (!(stage.frequency > 0.0f && stage.frequency < nyquist))
+				THROW_EXCEPT(FilterException,
+						"Filter frequency out of range");
+			if (!(stage.param > 0.0f))
+				THROW_EXCEPT(FilterException, "Filter q must be positive");
+			break;
+
+		case FILTER_BANDSTOP:
+			if (!(stage.frequency > 0.0f && stage.param > stage.frequency
+					&& stage.param < nyquist))
+				THROW_EXCEPT(FilterException,
+						"Band-stop edges out of range");
+			break;
+
+		case FILTER_MEDIAN: {
+			int window = (int)stage.param;
+			if (window != stage.param || window < 3
+					|| window > FILTER_MAX_MEDIAN || window % 2 == 0)
+				THROW_EXCEPT(FilterException, "Invalid median window");
+			break;
+		}
+
+		default:
+			THROW_EXCEPT(FilterException, "Unknown filter type");
+	}
+}
+
+int FilterChain::dataSize(const FilterStage &stage) {
+	switch (stage.type) {
+		case FILTER_LOWPASS1:
+			return LOWPASS1_SIZE;
+		case FILTER_MEDIAN:
+			return (int)stage.param;
+		default:
+			return BIQUAD_SIZE;
+	}
+}
+
+int FilterChain::runLength(int level, int channel) {
+	if (level >= mCounts[channel])
+		return 0;
+
+	const FilterStage &first = stageAt(channel, level);
+	int lanes = 1;
+	while (channel + lanes < mChannels && lanes < STEP_LANES
+			&& level < mCounts[channel + lanes]) {
+		const FilterStage &next = stageAt(channel + lanes, level);
+		if (next.type != first.type || (first.type == FILTER_MEDIAN
+				&& next.param != first.param))
+			break;
+		++lanes;
+	}
+	return lanes;
+}
+
+void FilterChain::initialize(const FilterStage &stage, v4sf *data,
+		int lane) {
+	Biquad biquad;
+	switch (stage.type) {
+		case FILTER_LOWPASS1:
+			// Pole matched to the analog filter's: -3dB at the cutoff for
+			// cutoffs well below the sample rate
+			at(data[0], lane) = 1.0f - exp(-2.0f * PI * stage.frequency / mSampleRate);
+			return;
+
+		case FILTER_LOWPASS2:
+			biquad.setLowPass(stage.frequency, mSampleRate, stage.param);
+			break;
+
+		case FILTER_NOTCH:
+			biquad.setNotch(stage.frequency, mSampleRate, stage.param);
+			break;
+
+		case FILTER_BANDSTOP: {
+			// The analog band-stop with these edges, after the frequency
+			// warping of the bilinear transform that Biquad uses: centred on
+			// the warped edges' geometric mean, with q from their distance.
+			// The -3dB points then land exactly on the edges.
+			float lower = tan(PI * stage.frequency / mSampleRate),
+			      upper = tan(PI * stage.param / mSampleRate),
+			      center = sqrt(lower * upper);
+			biquad.setNotch(atan(center) * mSampleRate / PI, mSampleRate,
+					center / (upper - lower));
+			break;
+		}
+
+		default:
+			return;
+	}
+	biquad.getCoefficients(at(data[0], lane), at(data[1], lane),
+			at(data[2], lane), at(data[3], lane), at(data[4], lane));
+}
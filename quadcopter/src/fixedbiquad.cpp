@@ -0,0 +1,49 @@
+/*
+	fixedbiquad.cpp
+
+	FixedBiquad class - Biquad in integer arithmetic
+*/
+
+#include <stdint.h>
+
+#include "fixedpoint.h"
+#include "biquad.h"
+#include "fixedbiquad.h"
+
+FixedBiquad::FixedBiquad() {
+	setPassThrough();
+	reset();
+}
+
+void FixedBiquad::set(Biquad &biquad) {
+	float b0, b1, b2, a1, a2;
+	biquad.getCoefficients(b0, b1, b2, a1, a2);
+	mB0 = toFixed(b0, BIQUAD_Q_SHIFT);
+	mB1 = toFixed(b1, BIQUAD_Q_SHIFT);
+	mB2 = toFixed(b2, BIQUAD_Q_SHIFT);
+	mA1 = toFixed(a1, BIQUAD_Q_SHIFT);
+	mA2 = toFixed(a2, BIQUAD_Q_SHIFT);
+}
+
+void FixedBiquad::setLowPass(float cutoff, float samplerate, float q) {
+	Biquad biquad;
+	biquad.setLowPass(cutoff, samplerate, q);
+	set(biquad);
+}
+
+void FixedBiquad::setPassThrough() {
+	Biquad biquad;
+	set(biquad);
+}
+
+void FixedBiquad::reset(int32_t value) {
+	// Steady state with constant input x and output y = gain * x, as
+	// Biquad::reset(), with gain = (b0 + b1 + b2) / (1 + a1 + a2)
+	int64_t num = (int64_t)mB0 + mB1 + mB2,
+	        den = ((int64_t)1 << BIQUAD_Q_SHIFT) + mA1 + mA2;
+	int32_t out = (den != 0 ? saturate32((int64_t)value * num / den) : 0);
+	mZ1 = saturate32((int64_t)out - roundShift((int64_t)mB0 * value,
+			BIQUAD_Q_SHIFT));
+	mZ2 = saturate32(roundShift((int64_t)mB2 * value - (int64_t)mA2 * out,
+			BIQUAD_Q_SHIFT));
+}
@@ -0,0 +1,88 @@
+/*
+	fixedpid.cpp
+
+	FixedPID class - PIDController in integer arithmetic, at a fixed rate
+*/
+
+#include <stdint.h>
+
+#include "fixedpoint.h"
+#include "fixedbiquad.h"
+#include "fixedpid.h"
+
+FixedPID::FixedPID(float samplerate) {
+	mSampleRate = samplerate;
+	mTarget = 0;
+	mOutputMin = INT32_MIN;
+	mOutputMax = INT32_MAX;
+	mIntegralLimit = INT32_MAX;
+	reset();
+}
+
+void FixedPID::setPID(float p, float i, float d) {
+	mP = FixedGain(p);
+	mIdt = FixedGain(i / mSampleRate);
+	mDdt = FixedGain(d * mSampleRate);
+}
+
+void FixedPID::setTarget(int32_t target) {
+	mTarget = target;
+}
+
+void FixedPID::setOutputLimits(float min, float max) {
+	mOutputMin = toQ16(min);
+	mOutputMax = toQ16(max);
+}
+
+void FixedPID::setIntegralLimit(float limit) {
+	mIntegralLimit = toQ16(limit);
+}
+
+void FixedPID::setDerivativeFilter(float cutoff) {
+	mDerivativeFilter.setLowPass(cutoff, mSampleRate);
+}
+
+int32_t FixedPID::feed(int32_t value) {
+	int32_t error = saturate32((int64_t)mTarget - value);
+
+	// Derivative on measurement. The filter is linear, so the change is
+	// filtered before it is scaled by D / dtime.
+	int32_t change = 0;
+	if (mHasLastInput)
+		change = saturate32((int64_t)mLastInput - value);
+	mLastInput = value;
+	mHasLastInput = true;
+	change = mDerivativeFilter.process(change);
+
+	int64_t nonintegral = (int64_t)mP.apply(error) + mDdt.apply(change);
+
+	// Integral, with conditional integration
+	int32_t step = mIdt.apply(error);
+	int32_t integral = clip32(saturate32((int64_t)mIntegralTerm + step),
+			-mIntegralLimit, mIntegralLimit);
+	int64_t unsaturated = nonintegral + integral;
+	int32_t saturated = clip32(saturate32(unsaturated), mOutputMin,
+			mOutputMax);
+
+	// Only integrate if it brings the output back towards the limits
+	if (saturated != unsaturated
+			&& (unsaturated > saturated ? step > 0 : step < 0))
+		integral = mIntegralTerm;
+	mIntegralTerm = integral;
+
+	mOutput = clip32(saturate32(nonintegral + mIntegralTerm), mOutputMin,
+			mOutputMax);
+	return mOutput;
+}
+
+int32_t FixedPID::output() {
+	return mOutput;
+}
+
+void FixedPID::reset() {
+	mIntegralTerm = 0;
+	mLastInput = 0;
+	mOutput = 0;
+	mHasLastInput = false;
+	mDerivativeFilter.reset();
+}
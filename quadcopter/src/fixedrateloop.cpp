@@ -0,0 +1,139 @@
+/*
+	fixedrateloop.cpp
+
+	FixedRateLoop class - the rate stage of the control loop in integer
+		arithmetic, from raw gyroscope counts to PWM counts.
+*/
+
+#include <stdint.h>
+
+#include "fixedpoint.h"
+#include "fixedbiquad.h"
+#include "fixedpid.h"
+#include "calibration.h"
+#include "fixedrateloop.h"
+
+// Largest PWM count (12 bits)
+#define PWM_MAX_COUNT 4095
+
+FixedRateLoop::FixedRateLoop(float samplerate) {
+	mSampleRate = samplerate;
+	for (int axis = 0; axis < FIXED_RATE_AXES; ++axis) {
+		mBias[axis] = 0;
+		mPID[axis] = new FixedPID(samplerate);
+		mRate[axis] = 0;
+		mCorrection[axis] = 0;
+	}
+	setGyroScale(1.0f);
+	mCorrectionScale = FixedGain(0.01f);
+	mMinCount = 0;
+	mCountSpan = PWM_MAX_COUNT << Q16_SHIFT;
+}
+
+FixedRateLoop::~FixedRateLoop() {
+	for (int axis = 0; axis < FIXED_RATE_AXES; ++axis)
+		delete mPID[axis];
+}
+
+void FixedRateLoop::setGyroScale(float dpsperlsb) {
+	mScale = FixedGain(dpsperlsb * Q16_ONE);
+}
+
+void FixedRateLoop::setGyroCalibration(const GyroCalibration &calibration,
+		float temperature) {
+	float dt = temperature - calibration.reftemp;
+	mBias[0] = toQ16(calibration.bias.x + calibration.slope.x * dt);
+	mBias[1] = toQ16(calibration.bias.y + calibration.slope.y * dt);
+	mBias[2] = toQ16(calibration.bias.z + calibration.slope.z * dt);
+}
+
+void FixedRateLoop::setGyroFilter(float cutoff) {
+	for (int axis = 0; axis < FIXED_RATE_AXES; ++axis) {
+		if (cutoff > 0.0f)
+			mFilter[axis].setLowPass(cutoff, mSampleRate);
+		else
+			mFilter[axis].setPassThrough();
+	}
+}
+
+void FixedRateLoop::setPID(int axis, float p, float i, float d) {
+	if (axis >= 0 && axis < FIXED_RATE_AXES)
+		mPID[axis]->setPID(p, i, d);
+}
+
+void FixedRateLoop::setPID(float p, float i, float d) {
+	for (int axis = 0; axis < FIXED_RATE_AXES; ++axis)
+		mPID[axis]->setPID(p, i, d);
+}
+
+void FixedRateLoop::setOutputLimits(float min, float max) {
+	for (int axis = 0; axis < FIXED_RATE_AXES; ++axis)
+		mPID[axis]->setOutputLimits(min, max);
+}
+
+void FixedRateLoop::setIntegralLimit(float limit) {
+	for (int axis = 0; axis < FIXED_RATE_AXES; ++axis)
+		mPID[axis]->setIntegralLimit(limit);
+}
+
+void FixedRateLoop::setDerivativeFilter(float cutoff) {
+	for (int axis = 0; axis < FIXED_RATE_AXES; ++axis)
+		mPID[axis]->setDerivativeFilter(cutoff);
+}
+
+void FixedRateLoop::setMotorRange(float min_hightime, float max_hightime,
+		float frequency) {
+	// As PWM::setHighTime(): count = hightime / cycle time * 4095
+	float cycletime = 1000.0f / frequency;
+	mMinCount = toQ16(min_hightime / cycletime * PWM_MAX_COUNT);
+	mCountSpan = toQ16((max_hightime - min_hightime) / cycletime
+			* PWM_MAX_COUNT);
+}
+
+void FixedRateLoop::update(const int16_t *raw, const int32_t *targets,
+		int32_t throttle, uint16_t *counts) {
+	for (int axis = 0; axis < FIXED_RATE_AXES; ++axis) {
+		int32_t rate = saturate32((int64_t)mScale.apply(raw[axis])
+				- mBias[axis]);
+		mRate[axis] = mFilter[axis].process(rate);
+
+		mPID[axis]->setTarget(targets[axis]);
+		mCorrection[axis] = mPID[axis]->feed(mRate[axis]);
+	}
+
+	// As Drive::stabilize(): pitch speeds up the front (ends), roll the
+	// sides, yaw one diagonal pair
+	int64_t ends  = mCorrectionScale.apply(mCorrection[1]),
+	        sides = mCorrectionScale.apply(mCorrection[0]),
+	        yaw   = mCorrectionScale.apply(mCorrection[2]);
+	int64_t speeds[4] = {
+		throttle + ends - sides + yaw,
+		throttle + ends + sides - yaw,
+		throttle - ends + sides + yaw,
+		throttle - ends - sides - yaw
+	};
+
+	for (int i = 0; i < 4; ++i) {
+		int32_t speed = (speeds[i] < 0 ? 0 : saturate32(speeds[i]));
+		int64_t count = ((int64_t)mMinCount
+				+ (((int64_t)mCountSpan * speed) >> Q16_SHIFT)) >> Q16_SHIFT;
+		counts[i] = (uint16_t)(count > PWM_MAX_COUNT ? PWM_MAX_COUNT : count);
+	}
+}
+
+int32_t FixedRateLoop::getRate(int axis) {
+	return mRate[axis];
+}
+
+int32_t FixedRateLoop::getCorrection(int axis) {
+	return mCorrection[axis];
+}
+
+void FixedRateLoop::reset() {
+	for (int axis = 0; axis < FIXED_RATE_AXES; ++axis) {
+		mFilter[axis].reset();
+		mPID[axis]->reset();
+		mRate[axis] = 0;
+		mCorrection[axis] = 0;
+	}
+}
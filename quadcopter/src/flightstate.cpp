@@ -0,0 +1,161 @@
+/*
+	flightstate.cpp
+
+	FlightState class - arming and failsafe state machine, stepped by the
+		control loop.
+*/
+
+#include "flightstate.h"
+
+FlightState::FlightState(int updaterate) {
+	mCommands = 0;
+	mPackets = 0;
+	mSeenPackets = 0;
+
+	mState = STATE_DISARMED;
+	mReason = REASON_NONE;
+
+	mOverrunTime = FLIGHT_OVERRUN_FACTOR / (updaterate > 0 ? updaterate : 1);
+	mPacketAge = 0.0f;
+	mI2CFailures = 0;
+	mOverruns = 0;
+	mArmingTime = 0.0f;
+	mThrottle = 0.0f;
+}
+
+void FlightState::arm() {
+	__atomic_or_fetch(&mCommands, COMMAND_ARM, __ATOMIC_RELEASE);
+}
+
+void FlightState::disarm() {
+	__atomic_or_fetch(&mCommands, COMMAND_DISARM, __ATOMIC_RELEASE);
+}
+
+void FlightState::kill() {
+	__atomic_or_fetch(&mCommands, COMMAND_KILL, __ATOMIC_RELEASE);
+}
+
+void FlightState::packetReceived() {
+	__atomic_add_fetch(&mPackets, 1, __ATOMIC_RELEASE);
+}
+
+FlightState::State FlightState::update(float dtime, float throttle,
+		bool i2cok) {
+	// Watchdog inputs
+	int packets = __atomic_load_n(&mPackets, __ATOMIC_ACQUIRE);
+	if (packets != mSeenPackets) {
+		mSeenPackets = packets;
+		mPacketAge = 0.0f;
+	} else
+		mPacketAge += dtime;
+
+	mI2CFailures = (i2cok ? 0 : mI2CFailures + 1);
+	mOverruns = (dtime > mOverrunTime ? mOverruns + 1 : 0);
+
+	if (throttle < 0.0f) throttle = 0.0f;
+	if (throttle > 1.0f) throttle = 1.0f;
+
+	// Commands, most drastic first. An arm() that arrives with a disarm()
+	// or kill() is dropped.
+	int commands = __atomic_exchange_n(&mCommands, 0, __ATOMIC_ACQUIRE);
+	if (commands & COMMAND_KILL)
+		enter(STATE_KILLED, REASON_COMMAND);
+	else if (commands & COMMAND_DISARM)
+		enter(STATE_DISARMED, REASON_COMMAND);
+	else if ((commands & COMMAND_ARM) && mState == STATE_DISARMED) {
+		Reason fault = checkWatchdogs();
+		if (fault != REASON_NONE)
+			__atomic_store_n(&mReason, fault, __ATOMIC_RELEASE);
+		else if (throttle > FLIGHT_ARM_MAX_THROTTLE)
+			__atomic_store_n(&mReason, REASON_THROTTLE_HIGH, __ATOMIC_RELEASE);
+		else {
+			mArmingTime = 0.0f;
+			enter(STATE_ARMING, REASON_COMMAND);
+		}
+	}
+
+	// Watchdogs
+	Reason fault = checkWatchdogs();
+	switch (mState) {
+		case STATE_ARMING:
+			mArmingTime += dtime;
+			if (fault != REASON_NONE)
+				enter(STATE_DISARMED, fault);
+			else if (throttle > FLIGHT_ARM_MAX_THROTTLE)
+				enter(STATE_DISARMED, REASON_THROTTLE_HIGH);
+			else if (mArmingTime >= FLIGHT_ARMING_TIME)
+				enter(STATE_ARMED, REASON_COMMAND);
+			break;
+
+		case STATE_ARMED:
+			if (mI2CFailures >= FLIGHT_I2C_KILL)
+				enter(STATE_KILLED, REASON_SENSOR_FAULT);
+			else if (fault != REASON_NONE) {
+				// Descend from the throttle the pilot last gave
+				mThrottle = throttle;
+				enter(STATE_FAILSAFE, fault);
+			}
+			break;
+
+		case STATE_FAILSAFE:
+			if (mI2CFailures >= FLIGHT_I2C_KILL)
+				enter(STATE_KILLED, REASON_SENSOR_FAULT);
+			else {
+				mThrottle -= FLIGHT_DESCENT_RATE * dtime;
+				if (mThrottle <= 0.0f)
+					enter(STATE_DISARMED, REASON_DESCENDED);
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	// Output
+	if (mState == STATE_ARMED)
+		mThrottle = throttle;
+	else if (mState != STATE_FAILSAFE)
+		mThrottle = 0.0f;
+
+	return mState;
+}
+
+FlightState::State FlightState::getState() {
+	return (State)__atomic_load_n(&mState, __ATOMIC_ACQUIRE);
+}
+
+FlightState::Reason FlightState::getReason() {
+	return (Reason)__atomic_load_n(&mReason, __ATOMIC_ACQUIRE);
+}
+
+bool FlightState::isMotorsEnabled() {
+	return mState == STATE_ARMED || mState == STATE_FAILSAFE;
+}
+
+float FlightState::getThrottle() {
+	return mThrottle;
+}
+
+float FlightState::getPacketAge() {
+	return mPacketAge;
+}
+
+/*
+	Private member functions
+*/
+
+void FlightState::enter(State state, Reason reason) {
+	__atomic_store_n(&mReason, reason, __ATOMIC_RELEASE);
+	__atomic_store_n(&mState, state, __ATOMIC_RELEASE);
+}
+
+FlightState::Reason FlightState::checkWatchdogs() {
+	if (mI2CFailures >= FLIGHT_I2C_FAILSAFE)
+		return REASON_SENSOR_FAULT;
+	if (mPacketAge > FLIGHT_LINK_TIMEOUT)
+		return REASON_LINK_LOST;
+	if (mOverruns >= FLIGHT_MAX_OVERRUNS)
+		return REASON_OVERRUN;
+	return REASON_NONE;
+}
+
@@ -0,0 +1,165 @@
+/*
+	gainschedule.cpp
+
+	GainSchedule class - table of PID coefficients keyed by throttle (and,
+		optionally, battery voltage), for gain scheduling.
+*/
+
+#include <string>
+#include <vector>
+
+#include "exception.h"
+#include "gainschedule.h"
+
+/**
+	Returns a + (b - a) * f for every coefficient
+*/
+static GainSchedule::Gains lerp(const GainSchedule::Gains &a,
+		const GainSchedule::Gains &b, float f) {
+	GainSchedule::Gains result;
+	for (int i = 0; i < 3; ++i) {
+		result.angle[i] = a.angle[i] + (b.angle[i] - a.angle[i]) * f;
+		result.rate[i] = a.rate[i] + (b.rate[i] - a.rate[i]) * f;
+	}
+	return result;
+}
+
+/**
+	Splits value, scaled to grid units, into a cell index in [0, points - 2]
+	and the fraction across that cell
+*/
+static inline int gridCell(float value, int points, float &fraction) {
+	if (value <= 0.0f) {
+		fraction = 0.0f;
+		return 0;
+	}
+	if (value >= points - 1) {
+		fraction = 1.0f;
+		return points - 2;
+	}
+	int cell = (int)value;
+	fraction = value - cell;
+	return cell;
+}
+
+GainSchedule::GainSchedule() {
+	mVoltagePoints = 1;
+	mVoltageMin = 0.0f;
+	mVoltageScale = 0.0f;
+	mBuilt = false;
+}
+
+void GainSchedule::addBreakpoint(float throttle, float voltage,
+		const Gains &gains) {
+	Breakpoint bp;
+	bp.throttle = throttle;
+	bp.voltage = voltage;
+	bp.gains = gains;
+
+	// Keep sorted by voltage, then throttle
+	std::vector<Breakpoint>::iterator it = mBreakpoints.begin();
+	while (it != mBreakpoints.end() && (it->voltage < voltage
+			|| (it->voltage == voltage && it->throttle <= throttle)))
+		++it;
+	mBreakpoints.insert(it, bp);
+}
+
+int GainSchedule::getBreakpointCount() {
+	return mBreakpoints.size();
+}
+
+const GainSchedule::Breakpoint &GainSchedule::getBreakpoint(int index) {
+	return mBreakpoints[index];
+}
+
+void GainSchedule::build() {
+	if (mBreakpoints.empty())
+		THROW_EXCEPT(GainScheduleException, "Gain schedule has no breakpoints");
+
+	// Breakpoints are sorted by voltage, so the ends give the range
+	float vmin = mBreakpoints.front().voltage,
+	      vmax = mBreakpoints.back().voltage;
+
+	mVoltagePoints = (vmax > vmin ? GAINSCHEDULE_VOLTAGE_POINTS : 1);
+	mVoltageMin = vmin;
+	mVoltageScale = (vmax > vmin ?
+			(GAINSCHEDULE_VOLTAGE_POINTS - 1) / (vmax - vmin) : 0.0f);
+
+	for (int v = 0; v < mVoltagePoints; ++v) {
+		float voltage = (mVoltagePoints > 1 ?
+				vmin + v * (vmax - vmin) / (mVoltagePoints - 1) : vmin);
+
+		// Find the voltages of the breakpoints either side
+		float below = vmin, above = vmax;
+		for (size_t i = 0; i < mBreakpoints.size(); ++i) {
+			float bv = mBreakpoints[i].voltage;
+			if (bv <= voltage && bv > below) below = bv;
+			if (bv >= voltage && bv < above) above = bv;
+		}
+
+		for (int t = 0; t < GAINSCHEDULE_THROTTLE_POINTS; ++t) {
+			float throttle = (float)t / (GAINSCHEDULE_THROTTLE_POINTS - 1);
+			Gains low = interpolateThrottle(below, throttle);
+			if (above > below) {
+				Gains high = interpolateThrottle(above, throttle);
+				mTable[v][t] = lerp(low, high,
+						(voltage - below) / (above - below));
+			} else
+				mTable[v][t] = low;
+		}
+	}
+
+	mBuilt = true;
+}
+
+bool GainSchedule::isEmpty() {
+	return !mBuilt;
+}
+
+GainSchedule::Gains GainSchedule::lookup(float throttle, float voltage) {
+	float tf;
+	int t = gridCell(throttle * (GAINSCHEDULE_THROTTLE_POINTS - 1),
+			GAINSCHEDULE_THROTTLE_POINTS, tf);
+
+	Gains result = lerp(mTable[0][t], mTable[0][t + 1], tf);
+	if (mVoltagePoints > 1) {
+		float vf;
+		int v = gridCell((voltage - mVoltageMin) * mVoltageScale,
+				mVoltagePoints, vf);
+
+		result = lerp(lerp(mTable[v][t], mTable[v][t + 1], tf),
+				lerp(mTable[v + 1][t], mTable[v + 1][t + 1], tf), vf);
+	}
+	return result;
+}
+
+/*
+	Private member functions
+*/
+
+GainSchedule::Gains GainSchedule::interpolateThrottle(float voltage,
+		float throttle) {
+	// Breakpoints at this voltage are contiguous and sorted by throttle
+	size_t first = 0;
+	while (mBreakpoints[first].voltage != voltage)
+		++first;
+	size_t last = first;
+	while (last + 1 < mBreakpoints.size()
+			&& mBreakpoints[last + 1].voltage == voltage)
+		++last;
+
+	if (throttle <= mBreakpoints[first].throttle)
+		return mBreakpoints[first].gains;
+	if (throttle >= mBreakpoints[last].throttle)
+		return mBreakpoints[last].gains;
+
+	size_t i = first;
+	while (mBreakpoints[i + 1].throttle < throttle)
+		++i;
+
+	const Breakpoint &a = mBreakpoints[i], &b = mBreakpoints[i + 1];
+	float span = b.throttle - a.throttle;
+	return lerp(a.gains, b.gains,
+			(span > 0.0f ? (throttle - a.throttle) / span : 0.0f));
+}
+
@@ -99,6 +99,11 @@ int gpio_setMode(unsigned int pin, GPIOMode mode) {
 				*fsel = (~(0x7 << offset) & current); 
 			}	break;
 
+			case GPIO_MODE_ALT0:{
+				uint32_t current = *fsel;
+				*fsel = (~(0x7 << offset) & current) | ((uint32_t)04 << offset);
+			}	break;
+
 			default:
 				generateError("gpio_setMode: Unknown GPIOMode requested\n");
 				return 0;
@@ -148,6 +153,7 @@ int gpio_read(unsigned int pin, int *value) {
 		uint32_t dummy = *lvloffset;
 		val = (val >> (pin % 32)) & 0x1;
 		*value = val;
+		return 1;
 	} else {
 		generateError("gpio_read: Bad pin number requested");
 		return 0;
@@ -9,7 +9,9 @@
 
 #include "exception.h"
 #include "i2c.h"
+#include "i2cengine.h"
 #include "geometry.h"
+#include "rawsamples.h"
 #include "gyroscope.h"
 
 // L3G4200D Register Addresses
@@ -19,6 +21,8 @@
 #define CTRL_REG4   0x23
 #define CTRL_REG5   0x24
 
+#define OUT_TEMP    0x26
+
 #define OUT_X_L     0x28
 #define OUT_X_H     0x29
 #define OUT_Y_L     0x2A
@@ -33,8 +37,11 @@ Gyroscope::Gyroscope(I2C *i2c, uint8_t slaveaddr, Range range,
 	mI2C = i2c;
 	mSlaveAddr = slaveaddr;
 	mRange = range;
+	mScale = scale(range);
 	mRate = rate;
 	mSleep = false;
+	mQueuedRegister = OUT_X_L | AUTO_INCR;
+	mQueuedValues[0] = mQueuedValues[1] = mQueuedValues[2] = 0;
 
 	setRange(mRange);
 	setSleepAndRate();
@@ -57,6 +64,7 @@ void Gyroscope::setSleep(bool sleep) {
 
 void Gyroscope::setRange(Range range) {
 	mRange = range;
+	mScale = scale(range);
 
 	char buffer[2];
 	buffer[0] = CTRL_REG4;
@@ -74,7 +82,6 @@ void Gyroscope::setSampleRate(SampleRate rate) {
 }
 
 Vector3<float> Gyroscope::read() {
-	Vector3<float> vector;
 	int16_t values[3];
 	char buffer = OUT_X_L | AUTO_INCR;
 
@@ -82,26 +89,75 @@ Vector3<float> Gyroscope::read() {
 	mI2C->enqueueRead(mSlaveAddr, values, 6);
 	mI2C->sendTransaction();
 
-	float factor;
-	switch (mRange) {
-		case RANGE_250DPS:
-			factor = 0.00875f;
-			break;
-		case RANGE_500DPS:
-			factor = 0.0175f;
-			break;
-		case RANGE_2000DPS:
-			factor = 0.07f;
-			break;
-	}
+	return convert(values);
+}
 
-	// Gyroscope axes are aligned differently than the accelerometer on GY80
-	// X and Y axes are swapped.
-	vector.y = factor * (int)values[0];
-	vector.x = factor * (int)values[1];
-	vector.z = factor * (int)values[2];
+float Gyroscope::readTemperature() {
+	char   reg = OUT_TEMP;
+	int8_t value;
 
-	return vector;
+	mI2C->enqueueWrite(mSlaveAddr, &reg, 1);
+	mI2C->enqueueRead(mSlaveAddr, &value, 1);
+	mI2C->sendTransaction();
+
+	// -1 LSB per degree C
+	return -(float)value;
+}
+
+void Gyroscope::queueRead(I2CTransaction *transaction) {
+	transaction->addWrite(mSlaveAddr, &mQueuedRegister, 1);
+	transaction->addRead(mSlaveAddr, mQueuedValues, 6);
+}
+
+void Gyroscope::queueRead(I2CTransaction *transaction, int16_t *values) {
+	transaction->addWrite(mSlaveAddr, &mQueuedRegister, 1);
+	transaction->addRead(mSlaveAddr, values, 6);
+}
+
+Vector3<float> Gyroscope::readQueued() {
+	return convert(mQueuedValues);
+}
+
+bool Gyroscope::readRaw(RawSamples *samples) {
+	if (samples->full())
+		return false;
+
+	int16_t values[3];
+	char buffer = OUT_X_L | AUTO_INCR;
+
+	uint64_t start = rawSampleTime();
+	mI2C->enqueueWrite(mSlaveAddr, &buffer, 1);
+	mI2C->enqueueRead(mSlaveAddr, values, 6);
+	mI2C->sendTransaction();
+	uint64_t end = rawSampleTime();
+
+	return samples->add(values, start + (end - start) / 2);
+}
+
+bool Gyroscope::readQueuedRaw(RawSamples *samples, uint64_t time) {
+	return samples->add(mQueuedValues, time);
+}
+
+void Gyroscope::convertRaw(const RawSamples &samples, float *x, float *y,
+		float *z, float scale) {
+	// X and Y swapped, as convert()
+	scaleRaw(samples.y, x, samples.count, scale);
+	scaleRaw(samples.x, y, samples.count, scale);
+	scaleRaw(samples.z, z, samples.count, scale);
+}
+
+float Gyroscope::getScale() {
+	return mScale;
+}
+
+void Gyroscope::convertRaw(const int16_t *values, Vector3<float> *out,
+		int count, float scale) {
+	// X and Y swapped, as convert()
+	for (int i = 0; i < count; ++i) {
+		out[i].x = values[3 * i + 1] * scale;
+		out[i].y = values[3 * i] * scale;
+		out[i].z = values[3 * i + 2] * scale;
+	}
 }
 
 void Gyroscope::setSleepAndRate() {
@@ -119,3 +175,9 @@ void Gyroscope::setSleepAndRate() {
 	mI2C->write(mSlaveAddr, buffer, 2);
 }
 
+Vector3<float> Gyroscope::convert(const int16_t *values) {
+	// Gyroscope axes are aligned differently than the accelerometer on GY80
+	// X and Y axes are swapped. The scale is resolved by setRange().
+	return Vector3<float>(values[1] * mScale, values[0] * mScale,
+			values[2] * mScale);
+}
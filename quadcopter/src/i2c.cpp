@@ -8,6 +8,7 @@
 #include <string>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -16,10 +17,15 @@
 #include <linux/i2c-dev.h>
 
 #include "exception.h"
+#include "i2cstats.h"
+#include "i2cbusclear.h"
 #include "i2c.h"
 
 I2C::I2C(const std::string &name) : mFilename(name) {
 	mLastSlaveAddr = 0x00;
+	mBusClear = 0;
+	mRetries = 0;
+	mBusClears = 0;
 
 	// Open device
 	mFd = open(mFilename.c_str(), O_RDWR);
@@ -31,43 +37,45 @@ I2C::I2C(const std::string &name) : mFilename(name) {
 	// state.
 	if (ioctl(mFd, I2C_SLAVE, mLastSlaveAddr) < 0)
 		THROW_EXCEPT(I2CException, "Could not set I2C slave\n");
+
+	mStats = new I2CStats();
 }
 
 I2C::~I2C() {
-	close(mFd);
+	if (mFd >= 0)
+		close(mFd);
+	delete mStats;
 }
 
 void I2C::write(uint8_t slaveaddr, const void *data, size_t length) {
-	if (slaveaddr != mLastSlaveAddr) {
-		if (ioctl(mFd, I2C_SLAVE, slaveaddr) < 0)
-			THROW_EXCEPT(I2CException, "Could not set I2C slave\n");
-		else
-			mLastSlaveAddr = slaveaddr;
+	int64_t start = I2CStats::getTime(), backoff = 0;
+	int     error;
+	for (int attempt = 0; ; ++attempt) {
+		error = attemptWrite(slaveaddr, data, length);
+		if (error == 0 || !retry(error, attempt, start, backoff, true))
+			break;
 	}
 
-	int bytes;
-	if ((bytes = ::write(mFd, data, length)) < length) {
-		int err = errno;
-		if (bytes >= 0)
-			THROW_EXCEPT(I2CException, "I2C write could not write all bytes");
-		else
-			THROW_EXCEPT(I2CException, "I2C write operation failed: "
-					+ std::string(strerror(err)));
-	}
+	if (error == -1)
+		THROW_EXCEPT(I2CException, "I2C write could not write all bytes");
+	else if (error != 0)
+		THROW_EXCEPT(I2CException, "I2C write operation failed: "
+				+ std::string(strerror(error)));
 }
 
 size_t I2C::read(uint8_t slaveaddr, void *buffer, size_t length) {
-	if (slaveaddr != mLastSlaveAddr) {
-		if (ioctl(mFd, I2C_SLAVE, slaveaddr) < 0)
-			THROW_EXCEPT(I2CException, "Could not set I2C slave\n");
-		else
-			mLastSlaveAddr = slaveaddr;
+	int64_t start = I2CStats::getTime(), backoff = 0;
+	int     error;
+	size_t  bytes = 0;
+	for (int attempt = 0; ; ++attempt) {
+		error = attemptRead(slaveaddr, buffer, length, &bytes);
+		if (error == 0 || !retry(error, attempt, start, backoff, true))
+			break;
 	}
 
-	size_t bytes;
-	if ((bytes = ::read(mFd, buffer, length)) == -1)
+	if (error != 0)
 		THROW_EXCEPT(I2CException, "I2C read operation failed: "
-				+ std::string(strerror(errno)));
+				+ std::string(strerror(error)));
 	return bytes;
 }
 
@@ -91,16 +99,172 @@ void I2C::enqueueRead(uint8_t slaveaddr, void *buffer, size_t length) {
 
 void I2C::sendTransaction() {
 	if (mQueue.size() > 0) {
-		struct i2c_rdwr_ioctl_data iodata;
-		iodata.msgs = &mQueue[0];
-		iodata.nmsgs = mQueue.size();
+		transfer(&mQueue[0], mQueue.size());
+		mQueue.clear();
+	}
+}
 
-		int iostatus;
-		if ((iostatus = ioctl(mFd, I2C_RDWR, &iodata)) < 0)
-			THROW_EXCEPT(I2CException, "I2C ioctl() failed: "
-					+ std::string(strerror(errno)));
+void I2C::transfer(struct i2c_msg *msgs, int count) {
+	int64_t start = I2CStats::getTime(), backoff = 0;
+	int     error;
+	for (int attempt = 0; ; ++attempt) {
+		error = attemptTransfer(msgs, count);
+		if (error == 0 || !retry(error, attempt, start, backoff, false))
+			break;
+	}
 
-		mQueue.clear();
+	if (error != 0)
+		THROW_EXCEPT(I2CException, "I2C ioctl() failed: "
+				+ std::string(strerror(error)));
+}
+
+I2CStats *I2C::getStats() {
+	return mStats;
+}
+
+void I2C::setRetryPolicy(const I2CRetryPolicy &policy) {
+	mPolicy = policy;
+}
+
+I2CRetryPolicy I2C::getRetryPolicy() {
+	return mPolicy;
+}
+
+void I2C::setBusClear(I2CBusClear *busclear) {
+	mBusClear = busclear;
+}
+
+long I2C::getRetries() {
+	return __atomic_load_n(&mRetries, __ATOMIC_RELAXED);
+}
+
+long I2C::getBusClears() {
+	return __atomic_load_n(&mBusClears, __ATOMIC_RELAXED);
+}
+
+I2CRetryPolicy::I2CRetryPolicy() {
+	retries = I2C_RETRY_COUNT;
+	backoff = I2C_RETRY_BACKOFF;
+	maxBackoff = I2C_RETRY_MAX_BACKOFF;
+	budget = I2C_RETRY_BUDGET;
+}
+
+/*
+	Protected member functions
+*/
+
+I2C::I2C() {
+	mFd = -1;
+	mLastSlaveAddr = I2C_NO_SLAVE;
+	mBusClear = 0;
+	mRetries = 0;
+	mBusClears = 0;
+	mStats = new I2CStats();
+}
+
+int I2C::rawWrite(uint8_t slaveaddr, const void *data, size_t length) {
+	int error = select(slaveaddr);
+	if (error != 0)
+		return error;
+
+	ssize_t bytes = ::write(mFd, data, length);
+	return (bytes >= (ssize_t)length ? 0 : (bytes >= 0 ? -1 : errno));
+}
+
+int I2C::rawRead(uint8_t slaveaddr, void *buffer, size_t length,
+		size_t *bytesread) {
+	int error = select(slaveaddr);
+	if (error != 0)
+		return error;
+
+	ssize_t bytes = ::read(mFd, buffer, length);
+	*bytesread = (bytes >= 0 ? bytes : 0);
+	return (bytes >= 0 ? 0 : errno);
+}
+
+int I2C::rawTransfer(struct i2c_msg *msgs, int count) {
+	struct i2c_rdwr_ioctl_data iodata;
+	iodata.msgs = msgs;
+	iodata.nmsgs = count;
+
+	return (ioctl(mFd, I2C_RDWR, &iodata) < 0 ? errno : 0);
+}
+
+/*
+	Private member functions
+*/
+
+int I2C::select(uint8_t slaveaddr) {
+	if (slaveaddr != mLastSlaveAddr) {
+		if (ioctl(mFd, I2C_SLAVE, slaveaddr) < 0)
+			return errno;
+		mLastSlaveAddr = slaveaddr;
+	}
+	return 0;
+}
+
+
+int I2C::attemptWrite(uint8_t slaveaddr, const void *data, size_t length) {
+	int64_t start = I2CStats::getTime();
+	int     error = rawWrite(slaveaddr, data, length);
+	mStats->record(slaveaddr, length, I2CStats::getTime() - start, error);
+	return error;
+}
+
+int I2C::attemptRead(uint8_t slaveaddr, void *buffer, size_t length,
+		size_t *bytesread) {
+	int64_t start = I2CStats::getTime();
+	int     error = rawRead(slaveaddr, buffer, length, bytesread);
+	mStats->record(slaveaddr, length, I2CStats::getTime() - start, error);
+	return error;
+}
+
+int I2C::attemptTransfer(struct i2c_msg *msgs, int count) {
+	int64_t start = I2CStats::getTime();
+	int     error = rawTransfer(msgs, count);
+	mStats->record(msgs, count, I2CStats::getTime() - start, error);
+	return error;
+}
+
+bool I2C::retry(int error, int attempt, int64_t start, int64_t &backoff,
+		bool reselect) {
+	if (attempt >= mPolicy.retries || !isRetryable(error))
+		return false;
+
+	backoff = (attempt == 0 ? mPolicy.backoff : backoff * 2);
+	if (backoff > mPolicy.maxBackoff)
+		backoff = mPolicy.maxBackoff;
+	if (I2CStats::getTime() - start + backoff > mPolicy.budget)
+		return false;
+
+	__atomic_add_fetch(&mRetries, 1, __ATOMIC_RELAXED);
+
+	// The slave address set in the driver can't be trusted after a failure
+	if (reselect)
+		mLastSlaveAddr = I2C_NO_SLAVE;
+
+	if (mBusClear && mBusClear->isStuck() && mBusClear->clear())
+		__atomic_add_fetch(&mBusClears, 1, __ATOMIC_RELAXED);
+
+	if (backoff > 0) {
+		struct timespec t = { (time_t)(backoff / 1000000),
+				(long)(backoff % 1000000) * 1000 };
+		nanosleep(&t, NULL);
+	}
+	return true;
+}
+
+bool I2C::isRetryable(int error) {
+	switch (error) {
+		case -1:        // Short transfer
+		case EREMOTEIO: // No acknowledge
+		case ETIMEDOUT:
+		case EIO:
+		case EAGAIN:    // Lost arbitration
+		case ENXIO:
+			return true;
+		default:
+			return false;
 	}
 }
 
@@ -0,0 +1,104 @@
+/*
+	i2cbusclear.cpp
+
+	I2CBusClear class - frees an I2C bus held by a slave, by clocking SCL
+		from GPIO.
+*/
+
+#include <time.h>
+
+#include "gpio.h"
+#include "i2cbusclear.h"
+
+I2CBusClear::I2CBusClear(int sda, int scl) {
+	mSDA = sda;
+	mSCL = scl;
+	mBusy = false;
+	mClears = 0;
+	mClocks = 0;
+}
+
+I2CBusClear::~I2CBusClear() { }
+
+bool I2CBusClear::isStuck() {
+	return !readSDA();
+}
+
+bool I2CBusClear::clear() {
+	if (__atomic_test_and_set(&mBusy, __ATOMIC_ACQUIRE))
+		return false;
+
+	bool free = !isStuck();
+	if (!free) {
+		__atomic_add_fetch(&mClears, 1, __ATOMIC_RELAXED);
+
+		// Clock out whatever the slave is sending, until it lets go
+		setSDA(true);
+		for (int i = 0; i < I2C_BUSCLEAR_CLOCKS && !readSDA(); ++i) {
+			setSCL(false);
+			delay();
+			setSCL(true);
+			delay();
+			__atomic_add_fetch(&mClocks, 1, __ATOMIC_RELAXED);
+		}
+
+		// Stop: SDA rises while SCL is high
+		setSCL(false);
+		delay();
+		setSDA(false);
+		delay();
+		setSCL(true);
+		delay();
+		setSDA(true);
+		delay();
+
+		free = readSDA();
+		restore();
+	}
+
+	__atomic_clear(&mBusy, __ATOMIC_RELEASE);
+	return free;
+}
+
+int I2CBusClear::getClears() {
+	return __atomic_load_n(&mClears, __ATOMIC_RELAXED);
+}
+
+int I2CBusClear::getClocks() {
+	return __atomic_load_n(&mClocks, __ATOMIC_RELAXED);
+}
+
+void I2CBusClear::setSDA(bool high) {
+	if (high)
+		gpio_setMode(mSDA, GPIO_MODE_IN);
+	else {
+		gpio_write(mSDA, LOW);
+		gpio_setMode(mSDA, GPIO_MODE_OUT);
+	}
+}
+
+void I2CBusClear::setSCL(bool high) {
+	if (high)
+		gpio_setMode(mSCL, GPIO_MODE_IN);
+	else {
+		gpio_write(mSCL, LOW);
+		gpio_setMode(mSCL, GPIO_MODE_OUT);
+	}
+}
+
+bool I2CBusClear::readSDA() {
+	int value = HIGH;
+	gpio_read(mSDA, &value);
+	return value == HIGH;
+}
+
+void I2CBusClear::restore() {
+	gpio_setMode(mSDA, GPIO_MODE_ALT0);
+	gpio_setMode(mSCL, GPIO_MODE_ALT0);
+}
+
+void I2CBusClear::delay() {
+	struct timespec t = { 0, I2C_BUSCLEAR_HALF_PERIOD * 1000 };
+	nanosleep(&t, NULL);
+}
+
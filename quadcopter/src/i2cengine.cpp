@@ -0,0 +1,278 @@
+/*
+	i2cengine.cpp
+
+	I2CTransaction class - a batch of I2C messages, sent as one transfer,
+		that completes asynchronously.
+	I2CEngine class - sends I2CTransactions from a dedicated bus thread, so
+		that the thread submitting them doesn't wait for the bus.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <linux/i2c.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cengine.h"
+
+/**
+	Entry point for the bus thread
+*/
+void *i2cEngineThreadEntry(void *arg) {
+	((I2CEngine *)arg)->run();
+	return NULL;
+}
+
+/*
+	I2CTransaction
+*/
+
+I2CTransaction::I2CTransaction() {
+	mCount = 0;
+	mCallback = 0;
+	mCallbackData = 0;
+	mStatus = STATUS_IDLE;
+}
+
+void I2CTransaction::addWrite(uint8_t slaveaddr, const void *buffer,
+		size_t length) {
+	add(slaveaddr, 0, (void *)buffer, length);
+}
+
+void I2CTransaction::addRead(uint8_t slaveaddr, void *buffer, size_t length) {
+	add(slaveaddr, I2C_M_RD, buffer, length);
+}
+
+void I2CTransaction::clear() {
+	if (getStatus() == STATUS_PENDING)
+		THROW_EXCEPT(I2CException, "Transaction is pending");
+	mCount = 0;
+}
+
+int I2CTransaction::getCount() {
+	return mCount;
+}
+
+void I2CTransaction::setCallback(Callback callback, void *data) {
+	mCallback = callback;
+	mCallbackData = data;
+}
+
+I2CTransaction::Status I2CTransaction::getStatus() {
+	return (Status)__atomic_load_n(&mStatus, __ATOMIC_ACQUIRE);
+}
+
+bool I2CTransaction::isComplete() {
+	Status status = getStatus();
+	return status == STATUS_DONE || status == STATUS_FAILED;
+}
+
+void I2CTransaction::add(uint8_t slaveaddr, uint16_t flags, void *buffer,
+		size_t length) {
+	if (getStatus() == STATUS_PENDING)
+		THROW_EXCEPT(I2CException, "Transaction is pending");
+	if (mCount >= I2C_TRANSACTION_MAX_MSGS)
+		THROW_EXCEPT(I2CException, "Too many messages in transaction");
+
+	struct i2c_msg &msg = mMsgs[mCount++];
+	msg.addr = slaveaddr;
+	msg.flags = flags;
+	msg.len = length;
+	msg.buf = (uint8_t *)buffer;
+}
+
+/*
+	I2CEngine
+*/
+
+I2CEngine::I2CEngine(I2C *i2c, int queuesize) {
+	mI2C = i2c;
+
+	size_t size = 1;
+	while (size < (size_t)queuesize)
+		size <<= 1;
+	mSlots = new Slot[size];
+	for (size_t i = 0; i < size; ++i) {
+		mSlots[i].sequence = i;
+		mSlots[i].transaction = 0;
+	}
+	mMask = size - 1;
+	mHead = 0;
+	mTail = 0;
+
+	mCompleted = 0;
+	mFailed = 0;
+
+	sem_init(&mWakeup, 0, 0);
+
+	pthread_condattr_t condattr;
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&mCond, &condattr);
+	pthread_condattr_destroy(&condattr);
+	pthread_mutex_init(&mMutex, NULL);
+
+	mStopping = false;
+	if (pthread_create(&mThread, NULL, i2cEngineThreadEntry, this) != 0) {
+		pthread_mutex_destroy(&mMutex);
+		pthread_cond_destroy(&mCond);
+		sem_destroy(&mWakeup);
+		delete[] mSlots;
+		THROW_EXCEPT(I2CException, "Could not start the I2C bus thread");
+	}
+	mRunning = true;
+}
+
+I2CEngine::~I2CEngine() {
+	shutdown();
+
+	pthread_mutex_destroy(&mMutex);
+	pthread_cond_destroy(&mCond);
+	sem_destroy(&mWakeup);
+	delete[] mSlots;
+}
+
+bool I2CEngine::submit(I2CTransaction *transaction) {
+	// Claim the transaction
+	int status = __atomic_load_n(&transaction->mStatus, __ATOMIC_ACQUIRE);
+	if (status == I2CTransaction::STATUS_PENDING
+			|| !__atomic_compare_exchange_n(&transaction->mStatus, &status,
+				I2CTransaction::STATUS_PENDING, false, __ATOMIC_ACQ_REL,
+				__ATOMIC_ACQUIRE))
+		return false;
+
+	// Claim a slot
+	Slot   *slot;
+	size_t pos = __atomic_load_n(&mHead, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &mSlots[pos & mMask];
+		size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		long   diff = (long)sequence - (long)pos;
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&mHead, &pos, pos + 1, true,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			// Full
+			__atomic_store_n(&transaction->mStatus, status, __ATOMIC_RELEASE);
+			return false;
+		} else
+			pos = __atomic_load_n(&mHead, __ATOMIC_RELAXED);
+	}
+
+	slot->transaction = transaction;
+	__atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+	sem_post(&mWakeup);
+	return true;
+}
+
+bool I2CEngine::wait(I2CTransaction *transaction, int millis) {
+	if (transaction->getStatus() == I2CTransaction::STATUS_IDLE)
+		return false;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += millis / 1000;
+	deadline.tv_nsec += (millis % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_nsec -= 1000000000L;
+		++deadline.tv_sec;
+	}
+
+	pthread_mutex_lock(&mMutex);
+	while (!transaction->isComplete()) {
+		if (millis <= 0)
+			pthread_cond_wait(&mCond, &mMutex);
+		else if (pthread_cond_timedwait(&mCond, &mMutex, &deadline)
+				== ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&mMutex);
+
+	return transaction->getStatus() == I2CTransaction::STATUS_DONE;
+}
+
+long I2CEngine::getCompleted() {
+	return __atomic_load_n(&mCompleted, __ATOMIC_ACQUIRE);
+}
+
+long I2CEngine::getFailed() {
+	return __atomic_load_n(&mFailed, __ATOMIC_ACQUIRE);
+}
+
+bool I2CEngine::transfer(struct i2c_msg *msgs, int count) {
+	if (!mI2C)
+		return false;
+
+	try {
+		mI2C->transfer(msgs, count);
+	} catch (I2CException &e) {
+		return false;
+	}
+	return true;
+}
+
+void I2CEngine::shutdown() {
+	if (!mRunning)
+		return;
+
+	__atomic_store_n(&mStopping, true, __ATOMIC_RELEASE);
+	sem_post(&mWakeup);
+	pthread_join(mThread, NULL);
+	mRunning = false;
+}
+
+/*
+	Private member functions
+*/
+
+void I2CEngine::run() {
+	for (;;) {
+		while (sem_wait(&mWakeup) == -1 && errno == EINTR)
+			;
+
+		I2CTransaction *transaction;
+		while ((transaction = take()) != 0) {
+			bool ok = transfer(transaction->mMsgs, transaction->mCount);
+
+			__atomic_add_fetch(&mCompleted, 1, __ATOMIC_RELEASE);
+			if (!ok)
+				__atomic_add_fetch(&mFailed, 1, __ATOMIC_RELEASE);
+
+			// Complete before the callback, so that it may resubmit
+			I2CTransaction::Callback callback = transaction->mCallback;
+			void *data = transaction->mCallbackData;
+			pthread_mutex_lock(&mMutex);
+			__atomic_store_n(&transaction->mStatus, (ok
+					? I2CTransaction::STATUS_DONE
+					: I2CTransaction::STATUS_FAILED), __ATOMIC_RELEASE);
+			pthread_cond_broadcast(&mCond);
+			pthread_mutex_unlock(&mMutex);
+
+			if (callback)
+				callback(transaction, data);
+		}
+
+		if (__atomic_load_n(&mStopping, __ATOMIC_ACQUIRE))
+			break;
+	}
+}
+
+I2CTransaction *I2CEngine::take() {
+	Slot   *slot = &mSlots[mTail & mMask];
+	size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+	if (sequence != mTail + 1)
+		return 0;
+
+	I2CTransaction *transaction = slot->transaction;
+	__atomic_store_n(&slot->sequence, mTail + mMask + 1, __ATOMIC_RELEASE);
+	++mTail;
+	return transaction;
+}
+
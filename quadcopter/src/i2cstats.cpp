@@ -0,0 +1,260 @@
+/*
+	i2cstats.cpp
+
+	I2CStats class - per-slave transaction counters, error counts and
+		latency histograms for an I2C bus, and an estimate of how busy the
+		bus is.
+	I2CSlaveStats, I2CStatsSnapshot - a copy of the counters, for reporting.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <ostream>
+#include <vector>
+
+#include <linux/i2c.h>
+
+#include "i2cstats.h"
+
+static const char *errorNames[I2CStats::NUM_ERRORS] = {
+	"remoteio", "timedout", "io", "nxio", "again", "short", "other"
+};
+
+/*
+	I2CStats
+*/
+
+I2CStats::I2CStats(int clock) {
+	memset(mSlaves, 0, sizeof(mSlaves));
+	mBusyTime = 0;
+	mWireTime = 0;
+	mClock = (clock > 0 ? clock : I2C_STATS_CLOCK);
+	mStart = getTime();
+}
+
+void I2CStats::setClock(int clock) {
+	if (clock > 0)
+		__atomic_store_n(&mClock, clock, __ATOMIC_RELAXED);
+}
+
+void I2CStats::record(uint8_t slaveaddr, size_t bytes, int64_t latency,
+		int error) {
+	struct i2c_msg msg;
+	msg.addr = slaveaddr;
+	msg.flags = 0;
+	msg.len = bytes;
+	msg.buf = 0;
+	record(&msg, 1, latency, error);
+}
+
+void I2CStats::record(const struct i2c_msg *msgs, int count, int64_t latency,
+		int error) {
+	// Start, then each message's bytes and address byte, then stop
+	int64_t total = 0;
+	for (int i = 0; i < count; ++i)
+		total += msgs[i].len + 1;
+	int64_t bits = total * 9 + count + 1;
+	int clock = __atomic_load_n(&mClock, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&mBusyTime, latency, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&mWireTime, bits * 1000000000LL / clock,
+			__ATOMIC_RELAXED);
+
+	// Each slave once, with its share of the bytes
+	for (int i = 0; i < count; ++i) {
+		bool seen = false;
+		for (int j = 0; j < i && !seen; ++j)
+			seen = (msgs[j].addr == msgs[i].addr);
+		if (seen)
+			continue;
+
+		int64_t bytes = 0, share = 0;
+		for (int j = i; j < count; ++j)
+			if (msgs[j].addr == msgs[i].addr) {
+				bytes += msgs[j].len;
+				share += msgs[j].len + 1;
+			}
+		add(msgs[i].addr, bytes, latency * share / total, error);
+	}
+}
+
+I2CStatsSnapshot I2CStats::snapshot() {
+	I2CStatsSnapshot snap;
+	snap.time = getTime();
+	snap.elapsed = snap.time - mStart;
+	snap.busyTime = __atomic_load_n(&mBusyTime, __ATOMIC_RELAXED);
+	snap.wireTime = __atomic_load_n(&mWireTime, __ATOMIC_RELAXED) / 1000;
+
+	for (int addr = 0; addr < I2C_STATS_SLAVES; ++addr) {
+		Counters &c = mSlaves[addr];
+		I2CSlaveStats s;
+		s.address = addr;
+		s.transactions = __atomic_load_n(&c.transactions, __ATOMIC_RELAXED);
+		if (s.transactions == 0)
+			continue;
+
+		s.bytes = __atomic_load_n(&c.bytes, __ATOMIC_RELAXED);
+		s.errors = __atomic_load_n(&c.errors, __ATOMIC_RELAXED);
+		for (int i = 0; i < NUM_ERRORS; ++i)
+			s.errorCounts[i] = __atomic_load_n(&c.errorCounts[i],
+					__ATOMIC_RELAXED);
+		for (int i = 0; i < I2C_STATS_BUCKETS; ++i)
+			s.histogram[i] = __atomic_load_n(&c.histogram[i],
+					__ATOMIC_RELAXED);
+		s.latencyTotal = __atomic_load_n(&c.latencyTotal, __ATOMIC_RELAXED);
+		s.latencyMax = __atomic_load_n(&c.latencyMax, __ATOMIC_RELAXED);
+		snap.slaves.push_back(s);
+	}
+
+	return snap;
+}
+
+int64_t I2CStats::getTime() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+I2CStats::Error I2CStats::classify(int error) {
+	switch (error) {
+		case -1:        return ERROR_SHORT;
+		case EREMOTEIO: return ERROR_REMOTEIO;
+		case ETIMEDOUT: return ERROR_TIMEDOUT;
+		case EIO:       return ERROR_IO;
+		case ENXIO:     return ERROR_NXIO;
+		case EAGAIN:    return ERROR_AGAIN;
+		default:        return ERROR_OTHER;
+	}
+}
+
+const char *I2CStats::getErrorName(int kind) {
+	return (kind >= 0 && kind < NUM_ERRORS ? errorNames[kind] : "?");
+}
+
+/*
+	Private member functions
+*/
+
+void I2CStats::add(uint8_t slaveaddr, size_t bytes, int64_t latency,
+		int error) {
+	Counters &c = mSlaves[slaveaddr % I2C_STATS_SLAVES];
+
+	__atomic_add_fetch(&c.transactions, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&c.bytes, bytes, __ATOMIC_RELAXED);
+	if (error != 0) {
+		__atomic_add_fetch(&c.errors, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&c.errorCounts[classify(error)], 1,
+				__ATOMIC_RELAXED);
+	}
+
+	int bucket = 0;
+	for (int64_t limit = I2C_STATS_BUCKET_BASE;
+			latency >= limit && bucket < I2C_STATS_BUCKETS - 1; limit *= 2)
+		++bucket;
+	__atomic_add_fetch(&c.histogram[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&c.latencyTotal, latency, __ATOMIC_RELAXED);
+
+	int64_t max = __atomic_load_n(&c.latencyMax, __ATOMIC_RELAXED);
+	while (latency > max && !__atomic_compare_exchange_n(&c.latencyMax, &max,
+			latency, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+	I2CSlaveStats
+*/
+
+float I2CSlaveStats::getMeanLatency() const {
+	return (transactions > 0 ? (float)latencyTotal / transactions : 0.0f);
+}
+
+float I2CSlaveStats::getErrorRate() const {
+	return (transactions > 0 ? (float)errors / transactions : 0.0f);
+}
+
+/*
+	I2CStatsSnapshot
+*/
+
+float I2CStatsSnapshot::getUtilization() const {
+	return (elapsed > 0 ? (float)busyTime / elapsed : 0.0f);
+}
+
+float I2CStatsSnapshot::getWireUtilization() const {
+	return (elapsed > 0 ? (float)wireTime / elapsed : 0.0f);
+}
+
+I2CStatsSnapshot I2CStatsSnapshot::since(const I2CStatsSnapshot &earlier)
+		const {
+	I2CStatsSnapshot diff = *this;
+	diff.elapsed = time - earlier.time;
+	diff.busyTime -= earlier.busyTime;
+	diff.wireTime -= earlier.wireTime;
+
+	std::vector<I2CSlaveStats> slaves;
+	for (size_t i = 0; i < diff.slaves.size(); ++i) {
+		I2CSlaveStats &s = diff.slaves[i];
+		for (size_t j = 0; j < earlier.slaves.size(); ++j) {
+			const I2CSlaveStats &e = earlier.slaves[j];
+			if (e.address != s.address)
+				continue;
+
+			s.transactions -= e.transactions;
+			s.bytes -= e.bytes;
+			s.errors -= e.errors;
+			for (int k = 0; k < I2CStats::NUM_ERRORS; ++k)
+				s.errorCounts[k] -= e.errorCounts[k];
+			for (int k = 0; k < I2C_STATS_BUCKETS; ++k)
+				s.histogram[k] -= e.histogram[k];
+			s.latencyTotal -= e.latencyTotal;
+		}
+		if (s.transactions > 0)
+			slaves.push_back(s);
+	}
+	diff.slaves = slaves;
+
+	return diff;
+}
+
+void I2CStatsSnapshot::print(std::ostream &out) const {
+	char line[256];
+
+	sprintf(line, "I2C over %.1fs: busy %.1f%%, wire %.1f%%",
+			elapsed / 1000000.0f, getUtilization() * 100.0f,
+			getWireUtilization() * 100.0f);
+	out << line << std::endl;
+
+	for (size_t i = 0; i < slaves.size(); ++i) {
+		const I2CSlaveStats &s = slaves[i];
+		sprintf(line, "  0x%02X: %lld transactions, %lld bytes, "
+				"mean %.0fus, max %lldus, %lld errors",
+				s.address, (long long)s.transactions, (long long)s.bytes,
+				s.getMeanLatency(), (long long)s.latencyMax,
+				(long long)s.errors);
+		out << line;
+		for (int k = 0; k < I2CStats::NUM_ERRORS; ++k)
+			if (s.errorCounts[k] > 0)
+				out << " " << I2CStats::getErrorName(k) << "="
+						<< s.errorCounts[k];
+		out << std::endl;
+
+		// Histogram, labelled by each bucket's upper bound
+		out << "        ";
+		int64_t limit = I2C_STATS_BUCKET_BASE;
+		for (int k = 0; k < I2C_STATS_BUCKETS; ++k, limit *= 2)
+			if (s.histogram[k] > 0) {
+				if (k < I2C_STATS_BUCKETS - 1)
+					sprintf(line, " <%lldus:%lld", (long long)limit,
+							(long long)s.histogram[k]);
+				else
+					sprintf(line, " more:%lld", (long long)s.histogram[k]);
+				out << line;
+			}
+		out << std::endl;
+	}
+}
+
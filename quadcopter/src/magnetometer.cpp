@@ -0,0 +1,179 @@
+/*
+	magnetometer.cpp
+
+	Magnetometer class - interface for the HMC5883L (on GY80 board)
+*/
+
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cengine.h"
+#include "geometry.h"
+#include "fastmath.h"
+#include "magnetometer.h"
+
+// HMC5883L Register Addresses
+#define CONFIG_A    0x00
+#define CONFIG_B    0x01
+#define MODE        0x02
+
+#define DATA_X_H    0x03
+#define DATA_X_L    0x04
+#define DATA_Z_H    0x05
+#define DATA_Z_L    0x06
+#define DATA_Y_H    0x07
+#define DATA_Y_L    0x08
+
+#define STATUS      0x09
+
+// MODE values
+#define MODE_CONTINUOUS 0x00
+#define MODE_IDLE       0x02
+
+Magnetometer::Magnetometer(I2C *i2c, uint8_t slaveaddr, Gain gain,
+		SampleRate rate) {
+	mI2C = i2c;
+	mSlaveAddr = slaveaddr;
+	mGain = gain;
+	mRate = rate;
+	mSleep = false;
+	mSaturated = false;
+	mQueuedRegister = DATA_X_H;
+	for (int i = 0; i < 6; ++i)
+		mQueuedValues[i] = 0;
+
+	setGain(mGain);
+	setSampleRate(mRate);
+	setSleep(false);
+}
+
+Magnetometer::~Magnetometer() {
+	try {
+		setSleep(true);
+	} catch (...)
+		{ /* Don't care... just make sure destructor finishes */ }
+}
+
+void Magnetometer::setSleep(bool sleep) {
+	mSleep = sleep;
+
+	char buffer[2];
+	buffer[0] = MODE;
+	buffer[1] = (mSleep ? MODE_IDLE : MODE_CONTINUOUS);
+	mI2C->write(mSlaveAddr, buffer, 2);
+
+	// First measurement is ready 6ms after entering continuous mode
+	if (!mSleep)
+		usleep(6000);
+}
+
+void Magnetometer::setGain(Gain gain) {
+	mGain = gain;
+
+	char buffer[2];
+	buffer[0] = CONFIG_B;
+	buffer[1] = mGain << 5; // 0b***00000 : 000 = 0.88Ga thru 111 = 8.1Ga
+	mI2C->write(mSlaveAddr, buffer, 2);
+}
+
+void Magnetometer::setSampleRate(SampleRate rate) {
+	mRate = rate;
+
+	char buffer[2];
+	buffer[0] = CONFIG_A;
+	buffer[1] = mRate << 2;
+			// 0b0**&&&00 :
+			// ** = samples averaged (00 = 1; more don't fit in 75Hz)
+			// &&& = output rate, 000 = 0.75Hz thru 110 = 75Hz
+			// Normal measurement (bits 0-1)
+	mI2C->write(mSlaveAddr, buffer, 2);
+}
+
+Vector3<float> Magnetometer::read() {
+	uint8_t values[6];
+	char buffer = DATA_X_H;
+
+	mI2C->enqueueWrite(mSlaveAddr, &buffer, 1);
+	mI2C->enqueueRead(mSlaveAddr, values, 6);
+	mI2C->sendTransaction();
+
+	return convert(values);
+}
+
+void Magnetometer::queueRead(I2CTransaction *transaction) {
+	mQueuedRegister = DATA_X_H;
+	transaction->addWrite(mSlaveAddr, &mQueuedRegister, 1);
+	transaction->addRead(mSlaveAddr, mQueuedValues, 6);
+}
+
+Vector3<float> Magnetometer::readQueued() {
+	return convert(mQueuedValues);
+}
+
+bool Magnetometer::isSaturated() {
+	return mSaturated;
+}
+
+float Magnetometer::getHeading(const Vector3<float> &field,
+		const Vector3<float> &accel) {
+	// Horizontal axes: north (the X axis with its vertical part removed)
+	// and east = down x north. Both have the same length, so the heading
+	// needs no normalization. With u = "up" (accel / |accel|):
+	//     north = X - (X.u) u,  east = -u x north
+	float g = accel.x * accel.x + accel.y * accel.y + accel.z * accel.z;
+	if (g <= 0.0f)
+		return 0.0f;
+
+	Vector3<float> u = accel;
+	float inv = fastInvSqrt(g);
+	u.x *= inv;
+	u.y *= inv;
+	u.z *= inv;
+
+	Vector3<float> north(1.0f - u.x * u.x, -u.x * u.y, -u.x * u.z);
+	Vector3<float> east(u.z * north.y - u.y * north.z,
+	                    u.x * north.z - u.z * north.x,
+	                    u.y * north.x - u.x * north.y);
+
+	float fn = field.x * north.x + field.y * north.y + field.z * north.z,
+	      fe = field.x * east.x + field.y * east.y + field.z * east.z;
+
+	// The field turns the opposite way to the quadcopter
+	return wrapAngle(-fastAtan2Degrees(fe, fn));
+}
+
+/*
+	Private member functions
+*/
+
+Vector3<float> Magnetometer::convert(const uint8_t *values) {
+	// From HMC5883L doc, p. 13
+	// Described as LSB/gauss. Number of discrete values per gauss
+	static const float factors[8] = {
+		1370.0f, 1090.0f, 820.0f, 660.0f, 440.0f, 390.0f, 330.0f, 230.0f
+	};
+	float factor = factors[mGain];
+
+	int16_t raw[3];
+	for (int i = 0; i < 3; ++i)
+		raw[i] = (int16_t)((values[i * 2] << 8) | values[i * 2 + 1]);
+
+	mSaturated = false;
+	for (int i = 0; i < 3; ++i) {
+		if (raw[i] == MAGNETOMETER_OVERFLOW) {
+			mSaturated = true;
+			raw[i] = -2048;
+		}
+	}
+
+	// Output registers are in the order X, Z, Y
+	Vector3<float> vector;
+	vector.x = (float)raw[0] / factor;
+	vector.y = (float)raw[2] / factor;
+	vector.z = (float)raw[1] / factor;
+
+	return vector;
+}
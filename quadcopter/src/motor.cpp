@@ -41,6 +41,10 @@ float Motor::getSpeed() {
 	return mSpeed;
 }
 
+int Motor::getChannel() {
+	return mChannel;
+}
+
 void Motor::update() {
 	mPWM->update(mChannel);
 }
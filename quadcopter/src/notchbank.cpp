@@ -0,0 +1,137 @@
+/*
+	notchbank.cpp
+
+	NotchBank class - notch filters on the three gyroscope axes, whose
+		centres follow the motor vibration
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "geometry.h"
+#include "biquad.h"
+#include "vibrationanalyzer.h"
+#include "notchbank.h"
+
+NotchBank::NotchBank(float samplerate, float q) {
+	mSampleRate = samplerate;
+	mQ = q;
+
+	// Pass-throughs, with no state. The fourth element of each vector is
+	// unused.
+	memset(mSections, 0, sizeof(mSections));
+	memset(mStaged, 0, sizeof(mStaged));
+	clear();
+	memcpy(mPending, mStaged, sizeof(mPending));
+	mPendingReady = 0;
+	takePending();
+	mRetunes = 0;
+	mUnpublished = false;
+}
+
+void NotchBank::reset(const Vector3<float> &value) {
+	// Every section has a gain of 1 at 0Hz, so each is settled with the
+	// reading at both its input and output (see Biquad::reset())
+	v4sf in = { value.x, value.y, value.z, 0.0f };
+	for (int s = 0; s < NOTCH_SECTIONS; ++s) {
+		Section &sec = mSections[s];
+		sec.z1 = in - sec.b0 * in;
+		sec.z2 = sec.b2 * in - sec.a2 * in;
+	}
+}
+
+void NotchBank::setNotch(int section, int axis, float center) {
+	if (section < 0 || section >= NOTCH_SECTIONS || axis < 0 || axis >= 3)
+		return;
+
+	Biquad biquad;
+	if (center >= NOTCH_MIN_FREQUENCY
+			&& center <= mSampleRate * NOTCH_MAX_RATIO)
+		biquad.setNotch(center, mSampleRate, mQ);
+	else
+		center = 0.0f;
+
+	Coefficients &staged = mStaged[section];
+	biquad.getCoefficients(at(staged.b0, axis), at(staged.b1, axis),
+			at(staged.b2, axis), at(staged.a1, axis), at(staged.a2, axis));
+	mCenters[section][axis] = center;
+	mUnpublished = true;
+}
+
+void NotchBank::setPeaks(int axis, const VibrationPeak *peaks, int count,
+		float minamplitude) {
+	for (int s = 0; s < NOTCH_SECTIONS; ++s) {
+		if (s < count && peaks[s].amplitude >= minamplitude)
+			setNotch(s, axis, fold(peaks[s].frequency));
+		else
+			setNotch(s, axis, 0.0f);
+	}
+}
+
+void NotchBank::clear() {
+	for (int s = 0; s < NOTCH_SECTIONS; ++s)
+		for (int axis = 0; axis < 3; ++axis)
+			setNotch(s, axis, 0.0f);
+	mLastFundamental = -1.0f;
+}
+
+bool NotchBank::trackMotorSpeed(float speed, float fullspeed) {
+	float fundamental = speed * fullspeed;
+	if (fabs(fundamental - mLastFundamental) < NOTCH_RETUNE_STEP)
+		return publish();
+	mLastFundamental = fundamental;
+
+	for (int s = 0; s < NOTCH_SECTIONS; ++s) {
+		float frequency = fold(fundamental * (s + 1));
+		for (int axis = 0; axis < 3; ++axis)
+			setNotch(s, axis, frequency);
+	}
+	return publish();
+}
+
+bool NotchBank::publish() {
+	if (!mUnpublished)
+		return true;
+	if (__atomic_load_n(&mPendingReady, __ATOMIC_ACQUIRE))
+		return false;
+
+	memcpy(mPending, mStaged, sizeof(mPending));
+	__atomic_store_n(&mPendingReady, 1, __ATOMIC_RELEASE);
+	mUnpublished = false;
+	return true;
+}
+
+float NotchBank::getCenter(int section, int axis) {
+	if (section < 0 || section >= NOTCH_SECTIONS || axis < 0 || axis >= 3)
+		return 0.0f;
+	return mCenters[section][axis];
+}
+
+int NotchBank::getRetunes() {
+	return mRetunes;
+}
+
+/*
+	Private member functions
+*/
+
+float NotchBank::fold(float frequency) {
+	frequency = fmod(frequency, mSampleRate);
+	if (frequency > mSampleRate / 2.0f)
+		frequency = mSampleRate - frequency;
+	return frequency;
+}
+
+void NotchBank::takePending() {
+	for (int s = 0; s < NOTCH_SECTIONS; ++s) {
+		Section &sec = mSections[s];
+		const Coefficients &pending = mPending[s];
+		sec.b0 = pending.b0;
+		sec.b1 = pending.b1;
+		sec.b2 = pending.b2;
+		sec.a1 = pending.a1;
+		sec.a2 = pending.a2;
+	}
+	__atomic_store_n(&mPendingReady, 0, __ATOMIC_RELEASE);
+	++mRetunes;
+}
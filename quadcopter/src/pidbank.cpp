@@ -0,0 +1,237 @@
+/*
+	pidbank.cpp
+
+	PIDBank class - a set of independent PID controllers that are all fed at
+		the same time, with the same time step.
+*/
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include "biquad.h"
+#include "pidcontroller.h"
+#include "pidbank.h"
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+/**
+	Returns value clipped to the range [min, max], per element
+*/
+static inline v4sf clip(v4sf value, v4sf min, v4sf max) {
+	value = (value < min ? min : value);
+	return (value > max ? max : value);
+}
+
+PIDBank::PIDBank(int lanes) {
+	mLanes = (lanes > 0 ? lanes : 1);
+	mNumBlocks = (mLanes + 3) / 4;
+
+	mBlocks = new Block[mNumBlocks];
+	mTrackingParam = new float[mLanes];
+
+	// Zero everything, including the padding lanes past mLanes
+	memset(mBlocks, 0, mNumBlocks * sizeof(Block));
+
+	// Same defaults as PIDController
+	for (int i = 0; i < mNumBlocks * 4; ++i) {
+		at(&Block::weightp, i) = 1.0f;
+		at(&Block::outputmin, i) = -FLT_MAX;
+		at(&Block::outputmax, i) = FLT_MAX;
+		at(&Block::integrallimit, i) = FLT_MAX;
+		at(&Block::b0, i) = 1.0f;
+	}
+	for (int i = 0; i < mLanes; ++i) {
+		mTrackingParam[i] = 0.0f;
+		updateTracking(i);
+	}
+}
+
+PIDBank::~PIDBank() {
+	delete[] mBlocks;
+	delete[] mTrackingParam;
+}
+
+int PIDBank::getLanes() {
+	return mLanes;
+}
+
+void PIDBank::feed(const float *values, float dtime) {
+	if (dtime <= 0.0f)
+		return;
+
+	const v4sf zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const v4sf dt = zero + dtime;
+	const v4sf invdt = zero + 1.0f / dtime;
+	const v4si ones = { -1, -1, -1, -1 };
+
+	// See PIDController::feed() for the scalar version of this
+	for (int b = 0; b < mNumBlocks; ++b) {
+		Block &blk = mBlocks[b];
+
+		// Load the inputs for this block. The last block may be partial, in
+		// which case the padding lanes are fed 0. Its inputs are inserted
+		// into a register one by one rather than copied through memory, as
+		// a narrow store followed by a wide load stalls the pipeline.
+		const float *in = values + b * 4;
+		v4sf value = zero;
+		switch (mLanes - b * 4) {
+			case 3: value[2] = in[2]; // Fall through
+			case 2: value[1] = in[1]; // Fall through
+			case 1: value[0] = in[0]; break;
+			default: memcpy(&value, in, sizeof(value)); break;
+		}
+
+		v4sf target = blk.target;
+		v4sf error = target - value;
+
+		// Proportional, with setpoint weighting
+		v4sf p = blk.weightp * target - value;
+
+		// Derivative, with setpoint weighting. None on the first feed.
+		v4sf dinput = blk.weightd * target - value;
+		v4sf d = (dinput - blk.lastinput) * invdt;
+		d = (blk.haslastinput ? d : zero);
+		blk.lastinput = dinput;
+		blk.haslastinput = ones;
+
+		// Derivative filter (pass-through coefficients when disabled)
+		v4sf filtered = blk.b0 * d + blk.z1;
+		blk.z1 = blk.b1 * d - blk.a1 * filtered + blk.z2;
+		blk.z2 = blk.b2 * d - blk.a2 * filtered;
+		d = filtered;
+
+		v4sf nonintegral = (blk.proportional * p) + (blk.derivative * d)
+				+ (blk.feedforward * target);
+
+		// Integral, with both anti-windup methods computed and the
+		// configured one selected per lane. Neither changes the integral
+		// when the output is not saturated.
+		v4sf previous = blk.integralterm;
+		v4sf integral = clip(previous + blk.integral * error * dt,
+				-blk.integrallimit, blk.integrallimit);
+		v4sf unsaturated = nonintegral + integral;
+		v4sf saturated = clip(unsaturated, blk.outputmin, blk.outputmax);
+
+		v4sf clamped = ((unsaturated - saturated) * (blk.integral * error)
+				> zero ? previous : integral);
+		v4sf backcalc = clip(integral
+				+ blk.tracking * (saturated - unsaturated) * dt,
+				-blk.integrallimit, blk.integrallimit);
+		blk.integralterm = (blk.backcalc ? backcalc : clamped);
+
+		blk.output = clip(nonintegral + blk.integralterm, blk.outputmin,
+				blk.outputmax);
+	}
+}
+
+void PIDBank::setTarget(int lane, float target) {
+	if (lane >= 0 && lane < mLanes)
+		at(&Block::target, lane) = target;
+}
+
+void PIDBank::setPID(int lane, float p, float i, float d) {
+	if (lane >= 0 && lane < mLanes) {
+		at(&Block::proportional, lane) = p;
+		at(&Block::integral, lane) = i;
+		at(&Block::derivative, lane) = d;
+		updateTracking(lane);
+	}
+}
+
+void PIDBank::setFeedForward(int lane, float ff) {
+	if (lane >= 0 && lane < mLanes)
+		at(&Block::feedforward, lane) = ff;
+}
+
+void PIDBank::setSetpointWeights(int lane, float b, float c) {
+	if (lane >= 0 && lane < mLanes) {
+		at(&Block::weightp, lane) = b;
+		at(&Block::weightd, lane) = c;
+	}
+}
+
+void PIDBank::setOutputLimits(int lane, float min, float max) {
+	if (lane >= 0 && lane < mLanes) {
+		at(&Block::outputmin, lane) = min;
+		at(&Block::outputmax, lane) = max;
+
+		float &out = at(&Block::output, lane);
+		if (out < min) out = min;
+		if (out > max) out = max;
+	}
+}
+
+void PIDBank::setIntegralLimit(int lane, float limit) {
+	if (lane >= 0 && lane < mLanes) {
+		if (limit < 0.0f)
+			limit = -limit;
+		at(&Block::integrallimit, lane) = limit;
+
+		float &integral = at(&Block::integralterm, lane);
+		if (integral < -limit) integral = -limit;
+		if (integral > limit)  integral = limit;
+	}
+}
+
+void PIDBank::setAntiWindup(int lane, PIDController::AntiWindup mode,
+		float tracking) {
+	if (lane >= 0 && lane < mLanes) {
+		at(&Block::backcalc, lane) =
+				(mode == PIDController::ANTIWINDUP_BACKCALC ? -1 : 0);
+		mTrackingParam[lane] = tracking;
+		updateTracking(lane);
+	}
+}
+
+void PIDBank::setDerivativeFilter(int lane, float cutoff, float samplerate) {
+	if (lane >= 0 && lane < mLanes) {
+		Biquad filter;
+		if (cutoff > 0.0f && samplerate > 0.0f)
+			filter.setLowPass(cutoff, samplerate);
+
+		filter.getCoefficients(at(&Block::b0, lane), at(&Block::b1, lane),
+				at(&Block::b2, lane), at(&Block::a1, lane),
+				at(&Block::a2, lane));
+		at(&Block::z1, lane) = 0.0f;
+		at(&Block::z2, lane) = 0.0f;
+	}
+}
+
+void PIDBank::reset(int lane) {
+	if (lane >= 0 && lane < mLanes) {
+		at(&Block::integralterm, lane) = 0.0f;
+		at(&Block::lastinput, lane) = 0.0f;
+		at(&Block::z1, lane) = 0.0f;
+		at(&Block::z2, lane) = 0.0f;
+		at(&Block::output, lane) = 0.0f;
+		at(&Block::haslastinput, lane) = 0;
+	}
+}
+
+void PIDBank::reset() {
+	for (int i = 0; i < mLanes; ++i)
+		reset(i);
+}
+
+/*
+	Private member functions
+*/
+
+void PIDBank::updateTracking(int lane) {
+	// Same as the automatic tracking gain in PIDController::feed()
+	float tracking = mTrackingParam[lane];
+	if (tracking <= 0.0f) {
+		float p = at(&Block::proportional, lane),
+		      i = at(&Block::integral, lane),
+		      d = at(&Block::derivative, lane);
+		if (d > 0.0f && i > 0.0f)
+			tracking = sqrtf(i / d);
+		else if (p != 0.0f)
+			tracking = i / p;
+		else
+			tracking = 1.0f;
+	}
+	at(&Block::tracking, lane) = tracking;
+}
+
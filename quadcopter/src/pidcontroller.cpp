@@ -1,23 +1,41 @@
 /*
 	pidcontroller.cpp
 
-	PIDController class - accepts a single input feed and gives output 
+	PIDController class - accepts a single input feed and gives output
 */
 
 #include <stddef.h>
+#include <float.h>
+#include <math.h>
 #include <sys/time.h>
-#include <list>
 
+#include "biquad.h"
 #include "pidcontroller.h"
 
+/**
+	Returns value clipped to the range [min, max]
+*/
+static inline float clip(float value, float min, float max) {
+	if (value < min) return min;
+	if (value > max) return max;
+	return value;
+}
+
 PIDController::PIDController(float target, float proportional, float integral,
-		float derivative, size_t accum_size)
+		float derivative)
 		: mTarget(target), mProportional(proportional), mIntegral(integral),
-		  mDerivative(derivative), mAccumulatorSize(accum_size) {
-	mOutput = 0.0f;
-	mTimeCurrent = 0.0f;
-	mSumError = 0.0f;
-	gettimeofday(&mLastUpdate, NULL);
+		  mDerivative(derivative) {
+	mFeedForward = 0.0f;
+	mWeightP = 1.0f;
+	mWeightD = 0.0f;
+	mOutputMin = -FLT_MAX;
+	mOutputMax = FLT_MAX;
+	mIntegralLimit = FLT_MAX;
+	mAntiWindup = ANTIWINDUP_CLAMP;
+	mTracking = 0.0f;
+	mFilterDerivative = false;
+
+	reset();
 }
 
 void PIDController::feed(float value) {
@@ -26,34 +44,64 @@ void PIDController::feed(float value) {
 
 	float dtime = current.tv_sec - mLastUpdate.tv_sec
 			+ (float)(current.tv_usec - mLastUpdate.tv_usec) / 1000000.0f;
-	mTimeCurrent += dtime;
 	mLastUpdate = current;
 
-	mAccumulator.push_back(Event(value, mTimeCurrent));
-	while (mAccumulator.size() > mAccumulatorSize)
-		mAccumulator.pop_front();
+	feed(value, dtime);
+}
+
+void PIDController::feed(float value, float dtime) {
+	if (dtime <= 0.0f)
+		return;
 
-	// Proportional error
-	float p = mTarget - value;
+	float error = mTarget - value;
 
-	// Integral error
-	mSumError += (mTarget - value) * dtime;
-	float i = mSumError;
+	// Proportional, with setpoint weighting
+	float p = mWeightP * mTarget - value;
 
-	// Derivative of process value
-	// Average slope of past Process Values
+	// Derivative, with setpoint weighting (on measurement by default). No
+	// derivative on the first feed, as there is nothing to compare to.
+	float dinput = mWeightD * mTarget - value;
 	float d = 0.0f;
-	if (mAccumulator.size() > 0) {
-		float preverror = mAccumulator.front().error,
-		      prevtime = mAccumulator.front().time;
-
-		std::list<Event>::iterator it = mAccumulator.begin();
-		for (++it; it != mAccumulator.end(); ++it)
-			d += (it->error - preverror) / (it->time - prevtime);
-		d /= mAccumulator.size();
+	if (mHasLastInput)
+		d = (dinput - mLastInput) / dtime;
+	mLastInput = dinput;
+	mHasLastInput = true;
+	if (mFilterDerivative)
+		d = mDerivativeFilter.process(d);
+
+	float nonintegral = (mProportional * p) + (mDerivative * d)
+			+ (mFeedForward * mTarget);
+
+	// Integral
+	float integral = clip(mIntegralTerm + mIntegral * error * dtime,
+			-mIntegralLimit, mIntegralLimit);
+	float unsaturated = nonintegral + integral;
+	float saturated = clip(unsaturated, mOutputMin, mOutputMax);
+
+	if (saturated != unsaturated) {
+		if (mAntiWindup == ANTIWINDUP_CLAMP) {
+			// Only integrate if it brings the output back towards the limits
+			if ((unsaturated - saturated) * (mIntegral * error) > 0.0f)
+				integral = mIntegralTerm;
+		} else {
+			// Automatic tracking time is sqrt(Ti * Td) (Astrom & Hagglund),
+			// or Ti without a derivative term
+			float tracking = mTracking;
+			if (tracking <= 0.0f) {
+				if (mDerivative > 0.0f && mIntegral > 0.0f)
+					tracking = sqrtf(mIntegral / mDerivative);
+				else if (mProportional != 0.0f)
+					tracking = mIntegral / mProportional;
+				else
+					tracking = 1.0f;
+			}
+			integral += tracking * (saturated - unsaturated) * dtime;
+			integral = clip(integral, -mIntegralLimit, mIntegralLimit);
+		}
 	}
+	mIntegralTerm = integral;
 
-	mOutput = (mProportional * p) + (mIntegral * i) - (mDerivative * d);
+	mOutput = clip(nonintegral + mIntegralTerm, mOutputMin, mOutputMax);
 }
 
 float PIDController::output() {
@@ -82,11 +130,48 @@ void PIDController::setPID(float p, float i, float d) {
 	mDerivative = d;
 }
 
+void PIDController::setFeedForward(float ff) {
+	mFeedForward = ff;
+}
+
+void PIDController::setSetpointWeights(float b, float c) {
+	mWeightP = b;
+	mWeightD = c;
+}
+
+void PIDController::setOutputLimits(float min, float max) {
+	mOutputMin = min;
+	mOutputMax = max;
+	mOutput = clip(mOutput, mOutputMin, mOutputMax);
+}
+
+void PIDController::setIntegralLimit(float limit) {
+	mIntegralLimit = (limit < 0.0f ? -limit : limit);
+	mIntegralTerm = clip(mIntegralTerm, -mIntegralLimit, mIntegralLimit);
+}
+
+void PIDController::setAntiWindup(AntiWindup mode, float tracking) {
+	mAntiWindup = mode;
+	mTracking = tracking;
+}
+
+void PIDController::setDerivativeFilter(float cutoff, float samplerate) {
+	if (cutoff > 0.0f && samplerate > 0.0f) {
+		mDerivativeFilter.setLowPass(cutoff, samplerate);
+		mFilterDerivative = true;
+	} else {
+		mDerivativeFilter.setPassThrough();
+		mFilterDerivative = false;
+	}
+	mDerivativeFilter.reset();
+}
+
 void PIDController::reset() {
-	mAccumulator.clear();
-	mSumError = 0.0f;
+	mIntegralTerm = 0.0f;
+	mLastInput = 0.0f;
+	mHasLastInput = false;
+	mDerivativeFilter.reset();
 	mOutput = 0.0f;
-	mTimeCurrent = 0.0f;
 	gettimeofday(&mLastUpdate, NULL);
 }
 
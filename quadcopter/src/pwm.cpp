@@ -10,6 +10,7 @@
 
 #include "exception.h"
 #include "i2c.h"
+#include "i2cengine.h"
 #include "pwm.h"
 
 // PCA9685 Register Addresses
@@ -64,6 +65,11 @@ PWM::PWM(I2C *i2c, uint8_t slaveaddr) {
 		mCounter[i] = 0;
 	}
 
+	mEngine = 0;
+	mOutput = new I2CTransaction();
+	mDirty = 0;
+	mSent = 0;
+
 	setFrequency(mFrequency);
 }
 
@@ -73,6 +79,11 @@ PWM::~PWM() {
 	// outputting its PWM signals. Then the motors see no signal and start
 	// beeping.
 //	setSleep(true);
+
+	// The engine may still be sending the last loads
+	if (mEngine)
+		mEngine->wait(mOutput, 100);
+	delete mOutput;
 }
 
 void PWM::setFrequency(unsigned int hertz) {
@@ -109,6 +120,10 @@ void PWM::setFrequency(unsigned int hertz) {
 	resetFrame();
 }
 
+unsigned int PWM::getFrequency() {
+	return mFrequency;
+}
+
 void PWM::setLoad(unsigned int channel, float factor) {
 	if (channel > 15)
 		THROW_EXCEPT(PWMException, "Invalid PWM channel given");
@@ -135,20 +150,77 @@ void PWM::setExactLoad(unsigned int channel, uint16_t count) {
 
 	mCount[channel] = count;
 
-	// Clip value to boundaries
-	if (count > 4095)
-		count = 4095;
-
-	char buffer[5];
-	buffer[0] = LED0_ON_L + channel * 4;
-	buffer[1] = 0x00; // LEDx_ON_L
-	buffer[2] = 0x00; // LEDx_ON_H
-	buffer[3] = (char)(count & 0x00FF); // LEDx_OFF_L
-	buffer[4] = (char)((count & 0x0F00) >> 8); // LEDx_OFF_H
+	if (mEngine) {
+		mDirty |= 1 << channel;
+		return;
+	}
 
+	uint8_t buffer[5];
+	getLoadFrame(channel, count, buffer);
 	mI2C->write(mSlaveAddr, buffer, 5);
 }
 
+void PWM::setEngine(I2CEngine *engine) {
+	if (mEngine)
+		mEngine->wait(mOutput, 100);
+	mEngine = engine;
+
+	if (!mEngine) {
+		// Anything queued, or lost with a failed flush, is sent now
+		uint16_t queued = mDirty;
+		if (mOutput->getStatus() == I2CTransaction::STATUS_FAILED
+				|| mOutput->getStatus() == I2CTransaction::STATUS_PENDING)
+			queued |= mSent;
+		mDirty = 0;
+		mSent = 0;
+		for (unsigned int i = 0; i < 16; ++i)
+			if (queued & (1 << i))
+				setExactLoad(i, mCount[i]);
+	}
+}
+
+PWM::FlushResult PWM::flush() {
+	if (!mEngine)
+		return FLUSH_SENT;
+
+	FlushResult result = FLUSH_SENT;
+	switch (mOutput->getStatus()) {
+		case I2CTransaction::STATUS_PENDING:
+			// The bus has fallen behind; send these with the next flush
+			return FLUSH_DEFERRED;
+
+		case I2CTransaction::STATUS_FAILED:
+			mDirty |= mSent;
+			mSent = 0;
+			result = FLUSH_FAILED;
+			break;
+
+		default:
+			break;
+	}
+
+	if (mDirty == 0)
+		return result;
+
+	// mOutput isn't pending, so its frames are free to be rewritten
+	mOutput->clear();
+	for (unsigned int i = 0; i < 16; ++i) {
+		if (mDirty & (1 << i)) {
+			getLoadFrame(i, mCount[i], mFrames[i]);
+			mOutput->addWrite(mSlaveAddr, mFrames[i], 5);
+		}
+	}
+
+	mSent = mDirty;
+	mDirty = 0;
+	if (!mEngine->submit(mOutput)) {
+		mDirty = mSent;
+		mSent = 0;
+		return FLUSH_FAILED;
+	}
+	return result;
+}
+
 void PWM::update(unsigned int channel) {
 	if (channel > 15)
 		THROW_EXCEPT(PWMException, "Invalid PWM channel given");
@@ -223,6 +295,16 @@ void PWM::setSleep(bool enabled) {
 	resetFrame();
 }
 
+void PWM::getAllOffFrame(uint8_t *buffer) {
+	// ALL_LED_ON = 0, ALL_LED_OFF = full off (bit 4 of the high byte), which
+	// overrides any on time
+	buffer[0] = ALL_LED_ON_L;
+	buffer[1] = 0x00;
+	buffer[2] = 0x00;
+	buffer[3] = 0x00;
+	buffer[4] = 0x10;
+}
+
 /*
 	Private member functions
 */
@@ -232,3 +314,16 @@ void PWM::resetFrame() {
 	mFrameLength = 8 * 1000000 / mFrequency; // 8 intermediate values
 }
 
+void PWM::getLoadFrame(unsigned int channel, uint16_t count,
+		uint8_t *buffer) {
+	// Clip value to boundaries
+	if (count > 4095)
+		count = 4095;
+
+	buffer[0] = LED0_ON_L + channel * 4;
+	buffer[1] = 0x00; // LEDx_ON_L
+	buffer[2] = 0x00; // LEDx_ON_H
+	buffer[3] = (uint8_t)(count & 0x00FF); // LEDx_OFF_L
+	buffer[4] = (uint8_t)((count & 0x0F00) >> 8); // LEDx_OFF_H
+}
+
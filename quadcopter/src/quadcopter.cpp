@@ -3,26 +3,88 @@
 
 	This is the starting point for the resident program on the RaspberryPi. It
 	is meant to start during boot time.
+
+	Usage: quadcopter [sensorbus [pwmbus]]
+
+	The sensors and the PCA9685 may be on separate I2C buses (e.g. the PWM
+	driver on an i2c-gpio bus), each with its own I2CEngine, so that motor
+	writes and sensor reads happen at the same time. Both default to
+	SENSOR_BUS.
 */
 
 #include <iostream>
 #include <string.h>
+#include <string>
 
 #include <unistd.h>
 #include <termios.h>
 
 #include "exception.h"
+#include "gpio.h"
 #include "i2c.h"
+#include "i2cbusclear.h"
+#include "i2cstats.h"
+#include "i2cengine.h"
 #include "pwm.h"
 #include "geometry.h"
 #include "accelerometer.h"
+#include "magnetometer.h"
+#include "barometer.h"
+#include "configstore.h"
+#include "flightstate.h"
 #include "drive.h"
+#include "supervisor.h"
+#include "vibrationanalyzer.h"
+#include "vibrationsampler.h"
 
 #include "radiouart.h"
 #include "radioconnection.h"
 #include "packet.h"
 #include "packetmotion.h"
 #include "packetdiagnostic.h"
+#include "packetvibration.h"
+
+// Seconds between printing I2C statistics
+#define STATS_INTERVAL 10
+
+// Seconds between sending the vibration peaks
+#define VIBRATION_INTERVAL 2
+
+// Rate (Hz) the sensors output new data at, and the vibration analyzer
+// samples them at. The control loop reads them at the (slower) update rate.
+#define SENSOR_RATE 400
+
+// Default bus, and the one whose pins I2CBusClear drives
+#define SENSOR_BUS "/dev/i2c-1"
+
+/**
+	Returns a description of why a flight state was entered
+*/
+static const char *reasonName(FlightState::Reason reason) {
+	switch (reason) {
+		case FlightState::REASON_COMMAND:       return "command";
+		case FlightState::REASON_LINK_LOST:     return "radio link lost";
+		case FlightState::REASON_SENSOR_FAULT:  return "sensor fault";
+		case FlightState::REASON_OVERRUN:       return "update overrun";
+		case FlightState::REASON_THROTTLE_HIGH: return "throttle not down";
+		case FlightState::REASON_DESCENDED:     return "failsafe descent done";
+		default:                                return "none";
+	}
+}
+
+/**
+	Returns the name of a flight state
+*/
+static const char *stateName(FlightState::State state) {
+	switch (state) {
+		case FlightState::STATE_DISARMED: return "disarmed";
+		case FlightState::STATE_ARMING:   return "arming";
+		case FlightState::STATE_ARMED:    return "armed";
+		case FlightState::STATE_FAILSAFE: return "failsafe";
+		case FlightState::STATE_KILLED:   return "killed";
+		default:                          return "unknown";
+	}
+}
 
 int main(int argc, char **argv) {
 
@@ -43,36 +105,141 @@ int main(int argc, char **argv) {
 		RadioUART radio(57600, Radio::PARITY_EVEN);
 		RadioConnection connection(&radio);
 
-		I2C i2c("/dev/i2c-1");
-		PWM pwm(&i2c, 0x40);
+		std::string sensorbus = (argc > 1 ? argv[1] : SENSOR_BUS),
+		            pwmbus = (argc > 2 ? argv[2] : sensorbus.c_str());
+
+		// Frees the bus if a sensor is left holding SDA (needs /dev/mem)
+		I2CBusClear busclear;
+
+		// One I2C interface and bus thread for each device group. On the
+		// same bus their transfers are simply serialized by the kernel.
+		I2C i2c(sensorbus),
+		    pwmi2c(pwmbus);
+		I2CEngine engine(&i2c),
+		          pwmengine(&pwmi2c);
+
+		if (gpio_init()) {
+			if (sensorbus == SENSOR_BUS)
+				i2c.setBusClear(&busclear);
+			if (pwmbus == SENSOR_BUS)
+				pwmi2c.setBusClear(&busclear);
+		}
+
+		PWM pwm(&pwmi2c, 0x40);
 		pwm.setFrequency(50);
 		Accelerometer accel(&i2c, 0x53, Accelerometer::RANGE_2G,
-				Accelerometer::SRATE_100HZ);
+				Accelerometer::SRATE_400HZ);
 		Gyroscope gyro(&i2c, 0x69, Gyroscope::RANGE_250DPS,
-				Gyroscope::SRATE_100HZ);
+				Gyroscope::SRATE_400HZ);
+		Magnetometer mag(&i2c, 0x1E);
+		Barometer baro(&i2c, 0x77);
+
+		// Motor channels and timing may be overridden in the config file
+		int motors[4] = { 0, 2, 5, 7 },
+		    updaterate = 100,
+		    smoothing = 3;
+		try {
+			Config config = ConfigStore(CONFIG_FILE).load();
+			if (config.sections & CONFIG_MOTORS)
+				memcpy(motors, config.motors, sizeof(motors));
+			if (config.sections & CONFIG_TIMING) {
+				updaterate = config.updateRate;
+				smoothing = config.smoothing;
+			}
+		} catch (ConfigException &e) { }
 
+		// The analyzer sees the vibration through readings of its own at
+		// SENSOR_RATE (the update rate would only show its aliases)
+		VibrationAnalyzer vibration(SENSOR_RATE);
+		VibrationSampler sampler(&engine, &accel, &gyro, &vibration,
+				SENSOR_RATE);
+
+		// Turns the motors off and lets the hardware watchdog reset the
+		// system if the update loop stops. Declared before drive, so that it
+		// outlives drive's update thread, which heartbeats it until ~Drive()
+		// stops the thread.
+		std::string watchdog = SUPERVISOR_WATCHDOG;
+		if (access(watchdog.c_str(), W_OK) != 0) {
+			std::cout << "No " << watchdog << ", supervising without it"
+					<< std::endl;
+			watchdog = "";
+		}
+		Supervisor supervisor(watchdog, pwmbus, 0x40, updaterate);
+
+		Drive drive(&pwm, &accel, &gyro, motors[0], motors[1], motors[2],
+				motors[3], updaterate, smoothing);
+		drive.setMagnetometer(&mag);
+		drive.setBarometer(&baro);
+		drive.setVibrationAnalyzer(&vibration);
+
+		// The motors prime and the sensors warm up while waiting for the
+		// radio
 		std::cout << "Waiting for connection..." << std::endl;
 		connection.connect();
 		std::cout << "Connected!" << std::endl;
 
-		Drive drive(&pwm, &accel, &gyro, 0, 2, 5, 7, 100);
+		if (!drive.waitReady())
+			THROW_EXCEPT(DriveException, "Drive failed to start");
+		std::cout << "Ready after " << drive.getStartupTime() << "s"
+				<< std::endl;
+
+		drive.setSupervisor(&supervisor);
+		drive.setI2CEngine(&engine);
+		drive.setPWMEngine(&pwmengine);
+		drive.startTimer();
+		supervisor.start();
+		vibration.start();
+		sampler.start();
+
+		// Notch the vibration the analyzer finds out of the rates fed to
+		// the Rate PIDs, unless the loop runs too fast for it to help
+		try {
+			drive.setNotchMode(Drive::NOTCH_PEAKS);
+		} catch (DriveException &e) {
+			std::cout << "WARNING: " << e.getDescription() << std::endl;
+		}
 
 		char   c;
 		bool   running = true;
 		Packet *pkt = 0;
 
+		// I2C statistics are printed every STATS_INTERVAL seconds
+		I2CStatsSnapshot stats = i2c.getStats()->snapshot(),
+		                 pwmstats = pwmi2c.getStats()->snapshot();
+
+		// Vibration peaks are sent every VIBRATION_INTERVAL seconds, once
+		// there are new ones
+		int64_t vibrationtime = I2CStats::getTime();
+		int     analyses = 0;
+
+		// Flight state changes are printed, with their reason (which also
+		// tells why an arm() was refused)
+		FlightState::State  flightstate = drive.getFlightState();
+		FlightState::Reason flightreason = drive.getFlightReason();
+
 		while (running && read(STDIN_FILENO, &c, 1) == 0) {
 
 			// Read any available packets
 			while ((pkt = connection.receive()) != 0) {
+				drive.packetReceived();
 				switch (pkt->getHeader()) {
 					case PKT_MOTION: {
 						PacketMotion *p = (PacketMotion *)pkt;
+						float throttle = (float)p->getZ() / 255.0f;
 						if (p->getRot())
 							running = false;
 						else
-							drive.move(Vector3<float>(0.0f, 0.0f,
-									(float)p->getZ() / 255.0f));
+							drive.move(Vector3<float>(0.0f, 0.0f, throttle));
+
+						// Packets arriving with the throttle down arm the
+						// motors whenever they are disarmed: at first, after
+						// a refused arm, and after a failsafe descent. Losing
+						// the link while armed makes the quadcopter descend.
+						// Killed stays killed.
+						if (running && throttle <= FLIGHT_ARM_MAX_THROTTLE
+								&& drive.getFlightState()
+								== FlightState::STATE_DISARMED)
+							drive.arm();
 					} break;
 				}
 				delete pkt;
@@ -81,8 +248,57 @@ int main(int argc, char **argv) {
 
 			// drive.update(); // Not in new synchronous-timed update API
 			usleep(50000);
+
+			FlightState::State  state = drive.getFlightState();
+			FlightState::Reason reason = drive.getFlightReason();
+			if (state != flightstate || reason != flightreason) {
+				std::cout << "Flight state: " << stateName(state) << " ("
+						<< reasonName(reason) << ")" << std::endl;
+				flightstate = state;
+				flightreason = reason;
+			}
+
+			// Work out the notches here, rather than in the update thread
+			drive.trackNotches();
+
+			if (I2CStats::getTime() - stats.time
+					>= STATS_INTERVAL * 1000000LL) {
+				I2CStatsSnapshot current = i2c.getStats()->snapshot(),
+				                 pwmcurrent = pwmi2c.getStats()->snapshot();
+				std::cout << "Sensors (" << sensorbus << "):" << std::endl;
+				current.since(stats).print(std::cout);
+				std::cout << "PWM (" << pwmbus << "):" << std::endl;
+				pwmcurrent.since(pwmstats).print(std::cout);
+				stats = current;
+				pwmstats = pwmcurrent;
+			}
+
+			if (I2CStats::getTime() - vibrationtime
+					>= VIBRATION_INTERVAL * 1000000LL
+					&& vibration.getAnalyses() != analyses) {
+				analyses = vibration.getAnalyses();
+				vibrationtime = I2CStats::getTime();
+				for (int c = 0; c < VIBRATION_CHANNELS; ++c) {
+					VibrationPeak peaks[VIBRATION_PEAKS];
+					int count = vibration.getPeaks(
+							(VibrationAnalyzer::Channel)c, peaks);
+					PacketVibration packet(c);
+					for (int i = 0; i < count && i < PKT_VIBRATION_PEAKS; ++i)
+						packet.setPeak(i, peaks[i].frequency,
+								peaks[i].amplitude);
+					connection.send(&packet);
+				}
+			}
 		}
 
+		// Stop the supervisor (disarming the watchdog) while the update
+		// thread still heartbeats it, so that it doesn't trip on the way
+		// down, then detach it and stop the update thread
+		supervisor.stop();
+		drive.setSupervisor(0);
+		drive.stopTimer();
+		sampler.stop();
+
 	} catch (Exception &e) {
 		std::cout << "EXCEPTION: " << e.getDescription() << std::endl;
 		return -1;
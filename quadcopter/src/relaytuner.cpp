@@ -0,0 +1,162 @@
+/*
+	relaytuner.cpp
+
+	RelayTuner class - finds PID gains for a loop by relay feedback
+		(Astrom-Hagglund auto-tuning).
+*/
+
+#include <math.h>
+
+#include "geometry.h"
+#include "relaytuner.h"
+
+RelayTuner::RelayTuner() {
+	mAmplitude = 0.0f;
+	mHysteresis = 0.0f;
+	mTimeout = 0.0f;
+	stop();
+}
+
+void RelayTuner::start(float amplitude, float hysteresis, float timeout) {
+	stop();
+
+	mAmplitude = fabs(amplitude);
+	mHysteresis = fabs(hysteresis);
+	mTimeout = timeout;
+	mState = STATE_RUNNING;
+}
+
+void RelayTuner::stop() {
+	mState = STATE_IDLE;
+	mTime = 0.0f;
+	mOutput = 0.0f;
+	mCycleStart = 0.0f;
+	mCycleMin = 0.0f;
+	mCycleMax = 0.0f;
+	mUpSwitches = 0;
+	mNumCycles = 0;
+	mUltimateGain = 0.0f;
+	mUltimatePeriod = 0.0f;
+}
+
+void RelayTuner::abort() {
+	if (mState == STATE_RUNNING) {
+		mState = STATE_FAILED;
+		mOutput = 0.0f;
+	}
+}
+
+float RelayTuner::feed(float error, float dtime) {
+	if (mState != STATE_RUNNING || dtime <= 0.0f)
+		return (mState == STATE_RUNNING ? mOutput : 0.0f);
+
+	mTime += dtime;
+	if (mTime > mTimeout) {
+		abort();
+		return 0.0f;
+	}
+
+	// The first feed decides which way the relay starts
+	if (mOutput == 0.0f)
+		mOutput = (error >= 0.0f ? mAmplitude : -mAmplitude);
+
+	if (error < mCycleMin) mCycleMin = error;
+	if (error > mCycleMax) mCycleMax = error;
+
+	if (mOutput > 0.0f && error < -mHysteresis)
+		mOutput = -mAmplitude;
+	else if (mOutput < 0.0f && error > mHysteresis) {
+		// Upward switch: one full cycle since the last one. The cycle before
+		// the first upward switch is only the initial transient.
+		mOutput = mAmplitude;
+		if (++mUpSwitches > 1)
+			endCycle(mTime - mCycleStart, (mCycleMax - mCycleMin) / 2.0f);
+
+		mCycleStart = mTime;
+		mCycleMin = error;
+		mCycleMax = error;
+	}
+
+	return (mState == STATE_RUNNING ? mOutput : 0.0f);
+}
+
+RelayTuner::State RelayTuner::getState() {
+	return mState;
+}
+
+float RelayTuner::getUltimateGain() {
+	return mUltimateGain;
+}
+
+float RelayTuner::getUltimatePeriod() {
+	return mUltimatePeriod;
+}
+
+bool RelayTuner::getGains(Rule rule, float &p, float &i, float &d) {
+	if (mState != STATE_DONE)
+		return false;
+
+	float kp, ti, td;
+	switch (rule) {
+		case RULE_ZIEGLER_NICHOLS:
+			kp = 0.6f * mUltimateGain;
+			ti = mUltimatePeriod / 2.0f;
+			td = mUltimatePeriod / 8.0f;
+			break;
+
+		case RULE_TYREUS_LUYBEN:
+		default:
+			kp = mUltimateGain / 2.2f;
+			ti = mUltimatePeriod * 2.2f;
+			td = mUltimatePeriod / 6.3f;
+			break;
+	}
+
+	p = kp;
+	i = kp / ti;
+	d = kp * td;
+	return true;
+}
+
+/*
+	Private member functions
+*/
+
+void RelayTuner::endCycle(float period, float amplitude) {
+	mPeriods[mNumCycles % RELAYTUNER_CYCLES] = period;
+	mAmplitudes[mNumCycles % RELAYTUNER_CYCLES] = amplitude;
+	++mNumCycles;
+
+	if (mNumCycles < RELAYTUNER_CYCLES)
+		return;
+
+	float minperiod = mPeriods[0], maxperiod = mPeriods[0], sumperiod = 0.0f,
+	      minamp = mAmplitudes[0], maxamp = mAmplitudes[0], sumamp = 0.0f;
+	for (int i = 0; i < RELAYTUNER_CYCLES; ++i) {
+		if (mPeriods[i] < minperiod)    minperiod = mPeriods[i];
+		if (mPeriods[i] > maxperiod)    maxperiod = mPeriods[i];
+		if (mAmplitudes[i] < minamp)    minamp = mAmplitudes[i];
+		if (mAmplitudes[i] > maxamp)    maxamp = mAmplitudes[i];
+		sumperiod += mPeriods[i];
+		sumamp += mAmplitudes[i];
+	}
+	float period_avg = sumperiod / RELAYTUNER_CYCLES,
+	      amp_avg = sumamp / RELAYTUNER_CYCLES;
+
+	if (maxperiod - minperiod > RELAYTUNER_TOLERANCE * period_avg
+			|| maxamp - minamp > RELAYTUNER_TOLERANCE * amp_avg)
+		return;
+
+	// Describing function of a relay with hysteresis: the oscillation sits
+	// where the loop gain at the ultimate frequency is 1/N(a), with
+	// |N(a)| = 4d / (pi a). The hysteresis shifts the phase slightly; using
+	// sqrt(a^2 - e^2) instead of a corrects the gain for it.
+	float effective = amp_avg * amp_avg - mHysteresis * mHysteresis;
+	effective = (effective > 0.0f ? sqrtf(effective) : amp_avg);
+
+	mUltimateGain = 4.0f * mAmplitude / (PI * effective);
+	mUltimatePeriod = period_avg;
+	mState = STATE_DONE;
+	mOutput = 0.0f;
+}
+
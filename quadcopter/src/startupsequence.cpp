@@ -0,0 +1,210 @@
+/*
+	startupsequence.cpp
+
+	StartupSequence class - tracks the stages that must finish before the
+	quadcopter is ready to fly, and lets other threads wait for (or be told
+	of) readiness.
+*/
+
+#include <errno.h>
+#include <string>
+#include <time.h>
+#include <pthread.h>
+
+#include "startupsequence.h"
+
+#define ALL_STAGES ((1 << NUM_STAGES) - 1)
+
+StartupSequence::StartupSequence() {
+	pthread_mutex_init(&mLock, NULL);
+
+	// Time out waits on the monotonic clock, so that setting the system
+	// time (e.g. by NTP, once the network comes up) doesn't disturb them
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&mChanged, &attr);
+	pthread_condattr_destroy(&attr);
+
+	mComplete = 0;
+	mState = STATE_STARTING;
+	mReady = false;
+	mCancelled = false;
+
+	clock_gettime(CLOCK_MONOTONIC, &mStart);
+	for (int i = 0; i < NUM_STAGES; ++i)
+		mStageTime[i] = -1.0f;
+	mReadyTime = -1.0f;
+
+	mCallback = 0;
+	mCallbackData = 0;
+}
+
+StartupSequence::~StartupSequence() {
+	pthread_cond_destroy(&mChanged);
+	pthread_mutex_destroy(&mLock);
+}
+
+void StartupSequence::complete(Stage stage) {
+	Callback callback = 0;
+
+	pthread_mutex_lock(&mLock);
+	if (mState == STATE_STARTING && !(mComplete & (1 << stage))) {
+		mComplete |= (1 << stage);
+		mStageTime[stage] = getElapsed();
+		if (mComplete == ALL_STAGES) {
+			mReadyTime = mStageTime[stage];
+			callback = finish(STATE_READY);
+		}
+		pthread_cond_broadcast(&mChanged);
+	}
+	void *data = mCallbackData;
+	pthread_mutex_unlock(&mLock);
+
+	if (callback)
+		callback(true, data);
+}
+
+void StartupSequence::fail(const std::string &reason) {
+	Callback callback = 0;
+
+	pthread_mutex_lock(&mLock);
+	if (mState == STATE_STARTING) {
+		mError = reason;
+		callback = finish(STATE_FAILED);
+		pthread_cond_broadcast(&mChanged);
+	}
+	void *data = mCallbackData;
+	pthread_mutex_unlock(&mLock);
+
+	if (callback)
+		callback(false, data);
+}
+
+bool StartupSequence::isComplete(Stage stage) {
+	pthread_mutex_lock(&mLock);
+	bool result = (mComplete & (1 << stage)) != 0;
+	pthread_mutex_unlock(&mLock);
+	return result;
+}
+
+StartupSequence::State StartupSequence::getState() {
+	pthread_mutex_lock(&mLock);
+	State result = mState;
+	pthread_mutex_unlock(&mLock);
+	return result;
+}
+
+bool StartupSequence::isReady() {
+	return __atomic_load_n(&mReady, __ATOMIC_ACQUIRE);
+}
+
+bool StartupSequence::wait(unsigned int millis) {
+	struct timespec until = deadline(millis);
+
+	pthread_mutex_lock(&mLock);
+	while (mState == STATE_STARTING) {
+		if (millis == 0)
+			pthread_cond_wait(&mChanged, &mLock);
+		else if (pthread_cond_timedwait(&mChanged, &mLock, &until)
+				== ETIMEDOUT)
+			break;
+	}
+	bool result = (mState == STATE_READY);
+	pthread_mutex_unlock(&mLock);
+	return result;
+}
+
+bool StartupSequence::sleep(unsigned int millis) {
+	struct timespec until = deadline(millis);
+
+	pthread_mutex_lock(&mLock);
+	while (!mCancelled
+			&& pthread_cond_timedwait(&mChanged, &mLock, &until) != ETIMEDOUT)
+		;
+	bool result = !mCancelled;
+	pthread_mutex_unlock(&mLock);
+	return result;
+}
+
+void StartupSequence::cancel() {
+	pthread_mutex_lock(&mLock);
+	mCancelled = true;
+	pthread_cond_broadcast(&mChanged);
+	pthread_mutex_unlock(&mLock);
+}
+
+bool StartupSequence::isCancelled() {
+	pthread_mutex_lock(&mLock);
+	bool result = mCancelled;
+	pthread_mutex_unlock(&mLock);
+	return result;
+}
+
+void StartupSequence::setCallback(Callback callback, void *data) {
+	pthread_mutex_lock(&mLock);
+	State state = mState;
+	if (state == STATE_STARTING) {
+		mCallback = callback;
+		mCallbackData = data;
+	}
+	pthread_mutex_unlock(&mLock);
+
+	if (state != STATE_STARTING && callback)
+		callback(state == STATE_READY, data);
+}
+
+float StartupSequence::getElapsed() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - mStart.tv_sec)
+			+ (now.tv_nsec - mStart.tv_nsec) / 1000000000.0f;
+}
+
+float StartupSequence::getStageTime(Stage stage) {
+	pthread_mutex_lock(&mLock);
+	float result = mStageTime[stage];
+	pthread_mutex_unlock(&mLock);
+	return result;
+}
+
+float StartupSequence::getReadyTime() {
+	pthread_mutex_lock(&mLock);
+	float result = mReadyTime;
+	pthread_mutex_unlock(&mLock);
+	return result;
+}
+
+std::string StartupSequence::getError() {
+	pthread_mutex_lock(&mLock);
+	std::string result = mError;
+	pthread_mutex_unlock(&mLock);
+	return result;
+}
+
+/*
+	Private member functions
+*/
+
+struct timespec StartupSequence::deadline(unsigned int millis) {
+	struct timespec until;
+	clock_gettime(CLOCK_MONOTONIC, &until);
+	until.tv_sec += millis / 1000;
+	until.tv_nsec += (millis % 1000) * 1000000L;
+	if (until.tv_nsec >= 1000000000L) {
+		until.tv_nsec -= 1000000000L;
+		++until.tv_sec;
+	}
+	return until;
+}
+
+StartupSequence::Callback StartupSequence::finish(State state) {
+	mState = state;
+	if (state == STATE_READY)
+		__atomic_store_n(&mReady, true, __ATOMIC_RELEASE);
+
+	Callback callback = mCallback;
+	mCallback = 0;
+	return callback;
+}
+
@@ -0,0 +1,217 @@
+/*
+	supervisor.cpp
+
+	Supervisor class - watches the control loop's heartbeat, keeps the
+		hardware watchdog petted while it is alive, and turns the motors off
+		if it stops.
+*/
+
+#include <stdint.h>
+#include <string>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <linux/watchdog.h>
+
+#include "exception.h"
+#include "pwm.h"
+#include "supervisor.h"
+
+/**
+	Entry point for the supervisor thread
+*/
+void *supervisorThreadEntry(void *arg) {
+	((Supervisor *)arg)->run();
+	return NULL;
+}
+
+/**
+	Returns a + nanos
+*/
+static struct timespec addTime(struct timespec a, long nanos) {
+	a.tv_nsec += nanos;
+	while (a.tv_nsec >= 1000000000L) {
+		a.tv_nsec -= 1000000000L;
+		++a.tv_sec;
+	}
+	return a;
+}
+
+/**
+	Returns a - b in seconds
+*/
+static float timeDifference(const struct timespec &a,
+		const struct timespec &b) {
+	return (a.tv_sec - b.tv_sec) + (a.tv_nsec - b.tv_nsec) / 1000000000.0f;
+}
+
+Supervisor::Supervisor(const std::string &watchdog,
+		const std::string &i2cdevice, uint8_t pwmaddr, int updaterate,
+		int missedticks) {
+	mPeriod = 1000000000L / (updaterate > 0 ? updaterate : 1);
+	mMissedTicks = (missedticks > 0 ? missedticks : 1);
+
+	mRunning = false;
+	mHeartbeats = 0;
+	mStopping = false;
+	mTripped = false;
+	mFrameSent = false;
+	mFrameAttempts = 0;
+	mReactionTime = -1.0f;
+
+	PWM::getAllOffFrame(mFrame);
+	mFrameMsg.addr = pwmaddr;
+	mFrameMsg.flags = 0;
+	mFrameMsg.len = PWM_ALLOFF_FRAME_SIZE;
+	mFrameMsg.buf = mFrame;
+	mFrameTransfer.msgs = &mFrameMsg;
+	mFrameTransfer.nmsgs = 1;
+
+	mI2CFd = -1;
+	if (!i2cdevice.empty()) {
+		mI2CFd = open(i2cdevice.c_str(), O_RDWR);
+		if (mI2CFd < 0)
+			THROW_EXCEPT(SupervisorException, "Could not open " + i2cdevice);
+	}
+
+	// Opening the device starts the watchdog. The timeout can't be set on
+	// every device; the default is then used.
+	mWatchdogFd = -1;
+	if (!watchdog.empty()) {
+		mWatchdogFd = open(watchdog.c_str(), O_WRONLY);
+		if (mWatchdogFd < 0) {
+			if (mI2CFd >= 0)
+				close(mI2CFd);
+			THROW_EXCEPT(SupervisorException, "Could not open " + watchdog);
+		}
+
+		int timeout = SUPERVISOR_WATCHDOG_TIMEOUT;
+		ioctl(mWatchdogFd, WDIOC_SETTIMEOUT, &timeout);
+	}
+}
+
+Supervisor::~Supervisor() {
+	stop();
+
+	if (mWatchdogFd >= 0)
+		close(mWatchdogFd);
+	if (mI2CFd >= 0)
+		close(mI2CFd);
+}
+
+void Supervisor::start() {
+	if (mRunning)
+		return;
+
+	__atomic_store_n(&mStopping, false, __ATOMIC_RELEASE);
+	if (pthread_create(&mThread, NULL, supervisorThreadEntry, this) != 0)
+		THROW_EXCEPT(SupervisorException,
+				"Could not start the supervisor thread");
+	mRunning = true;
+
+	// Run ahead of the control loop if allowed to (needs privileges)
+	struct sched_param param;
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	pthread_setschedparam(mThread, SCHED_FIFO, &param);
+}
+
+void Supervisor::stop() {
+	if (!mRunning)
+		return;
+
+	__atomic_store_n(&mStopping, true, __ATOMIC_RELEASE);
+	pthread_join(mThread, NULL);
+	mRunning = false;
+
+	// Disarm the watchdog, unless the system is meant to be reset
+	if (mWatchdogFd >= 0 && !isTripped()) {
+		if (::write(mWatchdogFd, "V", 1) != 1) { }
+		close(mWatchdogFd);
+		mWatchdogFd = -1;
+	}
+}
+
+void Supervisor::heartbeat() {
+	__atomic_add_fetch(&mHeartbeats, 1, __ATOMIC_RELEASE);
+}
+
+bool Supervisor::isTripped() {
+	return __atomic_load_n(&mTripped, __ATOMIC_ACQUIRE);
+}
+
+bool Supervisor::isFrameSent() {
+	return __atomic_load_n(&mFrameSent, __ATOMIC_ACQUIRE);
+}
+
+int Supervisor::getFrameAttempts() {
+	return __atomic_load_n(&mFrameAttempts, __ATOMIC_ACQUIRE);
+}
+
+float Supervisor::getReactionTime() {
+	float reaction;
+	__atomic_load(&mReactionTime, &reaction, __ATOMIC_ACQUIRE);
+	return reaction;
+}
+
+/*
+	Private member functions
+*/
+
+void Supervisor::run() {
+	struct timespec next, now, lastbeat;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	lastbeat = next;
+
+	int  seen = __atomic_load_n(&mHeartbeats, __ATOMIC_ACQUIRE);
+	bool alive = false; // Any heartbeat seen yet
+	float deadline = mMissedTicks * (mPeriod / 1000000000.0f);
+
+	while (!__atomic_load_n(&mStopping, __ATOMIC_ACQUIRE)) {
+		next = addTime(next, mPeriod);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)
+				== EINTR)
+			;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		int beats = __atomic_load_n(&mHeartbeats, __ATOMIC_ACQUIRE);
+		if (beats != seen) {
+			seen = beats;
+			lastbeat = now;
+			alive = true;
+		}
+
+		if (!isTripped() && alive
+				&& timeDifference(now, lastbeat) > deadline) {
+			float reaction = timeDifference(now, lastbeat);
+			__atomic_store(&mReactionTime, &reaction, __ATOMIC_RELEASE);
+			__atomic_store_n(&mTripped, true, __ATOMIC_RELEASE);
+		}
+
+		if (isTripped()) {
+			if (!isFrameSent() && sendFrame())
+				__atomic_store_n(&mFrameSent, true, __ATOMIC_RELEASE);
+		} else
+			pet();
+	}
+}
+
+void Supervisor::pet() {
+	if (mWatchdogFd >= 0 && ::write(mWatchdogFd, "\0", 1) != 1) {
+		// Nothing to do; the watchdog resets the system if petting keeps
+		// failing
+	}
+}
+
+bool Supervisor::sendFrame() {
+	__atomic_add_fetch(&mFrameAttempts, 1, __ATOMIC_RELEASE);
+	return mI2CFd >= 0 && ioctl(mI2CFd, I2C_RDWR, &mFrameTransfer) >= 0;
+}
+
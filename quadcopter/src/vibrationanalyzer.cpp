@@ -0,0 +1,349 @@
+/*
+	vibrationanalyzer.cpp
+
+	VibrationAnalyzer class - spectrum of the gyroscope and accelerometer
+		readings, to find the motor and propeller vibration in them
+*/
+
+#include <string>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "exception.h"
+#include "geometry.h"
+#include "fft.h"
+#include "vibrationanalyzer.h"
+
+// Longest and shortest sleep of the thread when no spectrum is due, in
+// nanoseconds
+#define MAX_IDLE 50000000L
+#define MIN_IDLE 1000000L
+
+/**
+	Entry point for the analyzer thread
+*/
+void *vibrationThreadEntry(void *arg) {
+	((VibrationAnalyzer *)arg)->run();
+	return NULL;
+}
+
+/**
+	Returns the Hann window's response to a sine offset bins from a bin's
+	centre, relative to its response at the centre
+*/
+static float hannResponse(float offset) {
+	if (fabs(offset) < 1e-4f)
+		return 1.0f;
+	float x = M_PI * offset;
+	return fabs(sin(x) / x / (1.0f - offset * offset));
+}
+
+VibrationAnalyzer::VibrationAnalyzer(float samplerate, int size,
+		float minfrequency) {
+	mSampleRate = samplerate;
+	mMaxGap = (uint64_t)(VIBRATION_MAX_GAP * 1e9 / samplerate);
+	mFFT = new RealFFT(size);
+	mSize = mFFT->getSize();
+	mMinFrequency = minfrequency;
+
+	mTap = new Reading[VIBRATION_TAP_SIZE];
+	mTapHead = 0;
+	mTapTail = 0;
+	mDropped = 0;
+
+	mWindow = new float[mSize];
+	for (int i = 0; i < mSize; ++i)
+		mWindow[i] = 0.5f - 0.5f * cos(2.0 * M_PI * i / mSize);
+	mWork = new float[mSize];
+	mPower = new float[mSize / 2 + 1];
+
+	for (int c = 0; c < VIBRATION_CHANNELS; ++c) {
+		mHistory[c] = new float[mSize];
+		mAmplitude[c] = new float[mSize / 2 + 1];
+		mSpectrum[c] = new float[mSize / 2 + 1];
+		memset(mSpectrum[c], 0, (mSize / 2 + 1) * sizeof(float));
+		mPeakCount[c] = 0;
+	}
+	mHistoryTime = new uint64_t[mSize];
+	mHistoryPos = 0;
+	mHistoryCount = 0;
+	mFresh = 0;
+	mGaps = 0;
+
+	pthread_mutex_init(&mLock, NULL);
+	mAnalyses = 0;
+	mMeasuredRate = samplerate;
+
+	mRunning = false;
+	mStopping = false;
+}
+
+VibrationAnalyzer::~VibrationAnalyzer() {
+	stop();
+
+	pthread_mutex_destroy(&mLock);
+	for (int c = 0; c < VIBRATION_CHANNELS; ++c) {
+		delete[] mHistory[c];
+		delete[] mAmplitude[c];
+		delete[] mSpectrum[c];
+	}
+	delete[] mHistoryTime;
+	delete[] mPower;
+	delete[] mWork;
+	delete[] mWindow;
+	delete[] mTap;
+	delete mFFT;
+}
+
+void VibrationAnalyzer::tap(const Vector3<float> &gyro,
+		const Vector3<float> &accel, uint64_t time) {
+	unsigned head = __atomic_load_n(&mTapHead, __ATOMIC_RELAXED),
+	         tail = __atomic_load_n(&mTapTail, __ATOMIC_ACQUIRE);
+	if (head - tail >= VIBRATION_TAP_SIZE) {
+		__atomic_add_fetch(&mDropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	Reading &reading = mTap[head & (VIBRATION_TAP_SIZE - 1)];
+	reading.values[CHANNEL_GYRO_X] = gyro.x;
+	reading.values[CHANNEL_GYRO_Y] = gyro.y;
+	reading.values[CHANNEL_GYRO_Z] = gyro.z;
+	reading.values[CHANNEL_ACCEL_X] = accel.x;
+	reading.values[CHANNEL_ACCEL_Y] = accel.y;
+	reading.values[CHANNEL_ACCEL_Z] = accel.z;
+	reading.time = time;
+	__atomic_store_n(&mTapHead, head + 1, __ATOMIC_RELEASE);
+}
+
+void VibrationAnalyzer::start() {
+	if (mRunning)
+		return;
+
+	__atomic_store_n(&mStopping, false, __ATOMIC_RELEASE);
+	if (pthread_create(&mThread, NULL, vibrationThreadEntry, this) != 0)
+		THROW_EXCEPT(VibrationException,
+				"Could not start the vibration analyzer thread");
+	mRunning = true;
+
+	// Only run when nothing else wants the processor
+	struct sched_param param;
+	param.sched_priority = 0;
+	pthread_setschedparam(mThread, SCHED_IDLE, &param);
+}
+
+void VibrationAnalyzer::stop() {
+	if (!mRunning)
+		return;
+
+	__atomic_store_n(&mStopping, true, __ATOMIC_RELEASE);
+	pthread_join(mThread, NULL);
+	mRunning = false;
+}
+
+bool VibrationAnalyzer::analyze() {
+	unsigned tail = __atomic_load_n(&mTapTail, __ATOMIC_RELAXED),
+	         head = __atomic_load_n(&mTapHead, __ATOMIC_ACQUIRE);
+
+	bool due = false;
+	while (tail != head && !due) {
+		const Reading &reading = mTap[tail & (VIBRATION_TAP_SIZE - 1)];
+
+		// After a gap (or time going backwards), start the window again
+		if (mHistoryCount > 0) {
+			uint64_t last = mHistoryTime[(mHistoryPos + mSize - 1)
+					& (mSize - 1)];
+			if (reading.time <= last || reading.time - last > mMaxGap) {
+				mHistoryCount = 0;
+				mFresh = 0;
+				__atomic_add_fetch(&mGaps, 1, __ATOMIC_RELAXED);
+			}
+		}
+
+		for (int c = 0; c < VIBRATION_CHANNELS; ++c)
+			mHistory[c][mHistoryPos] = reading.values[c];
+		mHistoryTime[mHistoryPos] = reading.time;
+		++tail;
+
+		if (++mHistoryPos >= mSize)
+			mHistoryPos = 0;
+		if (mHistoryCount < mSize)
+			++mHistoryCount;
+		++mFresh;
+		due = (mHistoryCount >= mSize && mFresh >= mSize / 2);
+	}
+	__atomic_store_n(&mTapTail, tail, __ATOMIC_RELEASE);
+
+	if (!due)
+		return false;
+	mFresh = 0;
+
+	// The rate the window was actually taken at (mHistoryPos is now the
+	// oldest reading)
+	uint64_t span = mHistoryTime[(mHistoryPos + mSize - 1) & (mSize - 1)]
+			- mHistoryTime[mHistoryPos];
+	float rate = (mSize - 1) * 1e9f / span;
+
+	VibrationPeak peaks[VIBRATION_CHANNELS][VIBRATION_PEAKS];
+	int           counts[VIBRATION_CHANNELS];
+	for (int c = 0; c < VIBRATION_CHANNELS; ++c)
+		counts[c] = analyzeChannel(c, peaks[c], rate / mSize);
+
+	pthread_mutex_lock(&mLock);
+	for (int c = 0; c < VIBRATION_CHANNELS; ++c) {
+		memcpy(mSpectrum[c], mAmplitude[c], (mSize / 2 + 1) * sizeof(float));
+		memcpy(mPeaks[c], peaks[c], sizeof(peaks[c]));
+		mPeakCount[c] = counts[c];
+	}
+	mMeasuredRate = rate;
+	++mAnalyses;
+	pthread_mutex_unlock(&mLock);
+	return true;
+}
+
+int VibrationAnalyzer::getPeaks(Channel channel, VibrationPeak *peaks) {
+	pthread_mutex_lock(&mLock);
+	int count = mPeakCount[channel];
+	memcpy(peaks, mPeaks[channel], count * sizeof(VibrationPeak));
+	pthread_mutex_unlock(&mLock);
+	return count;
+}
+
+int VibrationAnalyzer::tryGetPeaks(Channel channel, VibrationPeak *peaks) {
+	if (pthread_mutex_trylock(&mLock) != 0)
+		return -1;
+	int count = mPeakCount[channel];
+	memcpy(peaks, mPeaks[channel], count * sizeof(VibrationPeak));
+	pthread_mutex_unlock(&mLock);
+	return count;
+}
+
+void VibrationAnalyzer::getSpectrum(Channel channel, float *amplitudes) {
+	pthread_mutex_lock(&mLock);
+	memcpy(amplitudes, mSpectrum[channel], (mSize / 2 + 1) * sizeof(float));
+	pthread_mutex_unlock(&mLock);
+}
+
+int VibrationAnalyzer::getSize() {
+	return mSize;
+}
+
+float VibrationAnalyzer::getResolution() {
+	return getSampleRate() / mSize;
+}
+
+float VibrationAnalyzer::getSampleRate() {
+	pthread_mutex_lock(&mLock);
+	float rate = mMeasuredRate;
+	pthread_mutex_unlock(&mLock);
+	return rate;
+}
+
+int VibrationAnalyzer::getAnalyses() {
+	pthread_mutex_lock(&mLock);
+	int analyses = mAnalyses;
+	pthread_mutex_unlock(&mLock);
+	return analyses;
+}
+
+int VibrationAnalyzer::getDropped() {
+	return __atomic_load_n(&mDropped, __ATOMIC_RELAXED);
+}
+
+int VibrationAnalyzer::getGaps() {
+	return __atomic_load_n(&mGaps, __ATOMIC_RELAXED);
+}
+
+/*
+	Private member functions
+*/
+
+void VibrationAnalyzer::run() {
+	// Sleep for a quarter of the time a spectrum's readings take to arrive
+	long idle = (long)(mSize / 2 / mSampleRate * 1e9f / 4.0f);
+	if (idle > MAX_IDLE)
+		idle = MAX_IDLE;
+	if (idle < MIN_IDLE)
+		idle = MIN_IDLE;
+
+	while (!__atomic_load_n(&mStopping, __ATOMIC_ACQUIRE)) {
+		if (analyze())
+			continue;
+
+		struct timespec wait;
+		wait.tv_sec = 0;
+		wait.tv_nsec = idle;
+		while (nanosleep(&wait, &wait) == -1 && errno == EINTR)
+			;
+	}
+}
+
+int VibrationAnalyzer::analyzeChannel(int channel, VibrationPeak *peaks,
+		float resolution) {
+	// Oldest reading first, without the mean (gravity, or a steady turn)
+	const float *history = mHistory[channel];
+	float mean = 0.0f;
+	for (int i = 0; i < mSize; ++i)
+		mean += history[i];
+	mean /= mSize;
+
+	int split = mSize - mHistoryPos;
+	for (int i = 0; i < split; ++i)
+		mWork[i] = (history[mHistoryPos + i] - mean) * mWindow[i];
+	for (int i = split; i < mSize; ++i)
+		mWork[i] = (history[i - split] - mean) * mWindow[i];
+
+	mFFT->transform(mWork);
+	mFFT->power(mWork, mPower);
+
+	// A sine of amplitude A gives |X| = A * size / 4 through the window
+	float *amplitude = mAmplitude[channel];
+	float scale = 4.0f / mSize;
+	for (int k = 0; k <= mSize / 2; ++k)
+		amplitude[k] = sqrt(mPower[k]) * scale;
+
+	int minbin = (int)ceil(mMinFrequency / resolution);
+	if (minbin < 1)
+		minbin = 1;
+
+	int count = 0;
+	for (int k = minbin; k < mSize / 2; ++k) {
+		if (!(amplitude[k] > amplitude[k - 1]
+				&& amplitude[k] >= amplitude[k + 1]))
+			continue;
+
+		// A Hann-windowed sine's peak is close to a Gaussian, so a parabola
+		// through the log amplitudes finds its centre
+		float a = log(amplitude[k - 1] + 1e-20f),
+		      b = log(amplitude[k] + 1e-20f),
+		      c = log(amplitude[k + 1] + 1e-20f);
+		float curvature = a - 2.0f * b + c,
+		      offset = (curvature < 0.0f ? 0.5f * (a - c) / curvature : 0.0f);
+		if (offset > 0.5f)
+			offset = 0.5f;
+		if (offset < -0.5f)
+			offset = -0.5f;
+
+		VibrationPeak peak;
+		peak.frequency = (k + offset) * resolution;
+		peak.amplitude = amplitude[k] / hannResponse(offset);
+
+		// Keep the strongest, in order
+		int at = count;
+		while (at > 0 && peaks[at - 1].amplitude < peak.amplitude)
+			--at;
+		if (at >= VIBRATION_PEAKS)
+			continue;
+		int last = (count < VIBRATION_PEAKS ? count : VIBRATION_PEAKS - 1);
+		for (int i = last; i > at; --i)
+			peaks[i] = peaks[i - 1];
+		peaks[at] = peak;
+		if (count < VIBRATION_PEAKS)
+			++count;
+	}
+	return count;
+}
@@ -0,0 +1,183 @@
+/*
+	vibrationsampler.cpp
+
+	VibrationSampler class - reads the gyroscope and accelerometer at their
+		output data rate for a VibrationAnalyzer
+*/
+
+#include <string>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "exception.h"
+#include "geometry.h"
+#include "i2cengine.h"
+#include "accelerometer.h"
+#include "gyroscope.h"
+#include "rawsamples.h"
+#include "vibrationanalyzer.h"
+#include "vibrationsampler.h"
+
+// Longest wait for the last read's completion when stopping, in
+// milliseconds
+#define STOP_TIMEOUT 100
+
+/**
+	Entry point for the sampler thread
+*/
+void *vibrationSamplerThreadEntry(void *arg) {
+	((VibrationSampler *)arg)->run();
+	return NULL;
+}
+
+/**
+	Returns a + nanos
+*/
+static struct timespec addTime(struct timespec a, long nanos) {
+	a.tv_nsec += nanos;
+	while (a.tv_nsec >= 1000000000L) {
+		a.tv_nsec -= 1000000000L;
+		++a.tv_sec;
+	}
+	return a;
+}
+
+VibrationSampler::VibrationSampler(I2CEngine *engine, Accelerometer *accel,
+		Gyroscope *gyro, VibrationAnalyzer *analyzer, float samplerate)
+		: mAccelSamples(mAccelRaw[0], mAccelRaw[1], mAccelRaw[2], mTimes,
+		                VIBRATION_SAMPLER_BATCH),
+		  mGyroSamples(mGyroRaw[0], mGyroRaw[1], mGyroRaw[2], mTimes,
+		               VIBRATION_SAMPLER_BATCH) {
+	mEngine = engine;
+	mAnalyzer = analyzer;
+	mPeriod = (long)(1e9f / (samplerate > 0.0f ? samplerate : 1.0f));
+
+	mAccelScale = accel->getScale();
+	mGyroScale = gyro->getScale();
+	mAccelValues[0] = mAccelValues[1] = mAccelValues[2] = 0;
+	mGyroValues[0] = mGyroValues[1] = mGyroValues[2] = 0;
+
+	mRead = new I2CTransaction();
+	accel->queueRead(mRead, mAccelValues);
+	gyro->queueRead(mRead, mGyroValues);
+	mRead->setCallback(readComplete, this);
+
+	mRunning = false;
+	mStopping = false;
+	mSubmitted = 0;
+	mHandled = 0;
+	mSamples = 0;
+	mMissed = 0;
+	mFailed = 0;
+}
+
+VibrationSampler::~VibrationSampler() {
+	stop();
+	delete mRead;
+}
+
+void VibrationSampler::start() {
+	if (mRunning)
+		return;
+
+	__atomic_store_n(&mStopping, false, __ATOMIC_RELEASE);
+	if (pthread_create(&mThread, NULL, vibrationSamplerThreadEntry, this)
+			!= 0)
+		THROW_EXCEPT(VibrationSamplerException,
+				"Could not start the vibration sampler thread");
+	mRunning = true;
+
+	// Wake on time if allowed to (needs privileges), behind the supervisor
+	struct sched_param param;
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	pthread_setschedparam(mThread, SCHED_FIFO, &param);
+}
+
+void VibrationSampler::stop() {
+	if (!mRunning)
+		return;
+
+	__atomic_store_n(&mStopping, true, __ATOMIC_RELEASE);
+	pthread_join(mThread, NULL);
+	mRunning = false;
+
+	// The bus thread may still be in the callback of the last read
+	long submitted = __atomic_load_n(&mSubmitted, __ATOMIC_ACQUIRE);
+	for (int wait = 0; wait < STOP_TIMEOUT
+			&& __atomic_load_n(&mHandled, __ATOMIC_ACQUIRE) != submitted;
+			++wait)
+		usleep(1000);
+}
+
+long VibrationSampler::getSamples() {
+	return __atomic_load_n(&mSamples, __ATOMIC_RELAXED);
+}
+
+long VibrationSampler::getMissed() {
+	return __atomic_load_n(&mMissed, __ATOMIC_RELAXED);
+}
+
+long VibrationSampler::getFailed() {
+	return __atomic_load_n(&mFailed, __ATOMIC_RELAXED);
+}
+
+/*
+	Private member functions
+*/
+
+void VibrationSampler::run() {
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (!__atomic_load_n(&mStopping, __ATOMIC_ACQUIRE)) {
+		next = addTime(next, mPeriod);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)
+				== EINTR)
+			;
+
+		// Counted before the submit, as the read may complete before it
+		// returns
+		__atomic_add_fetch(&mSubmitted, 1, __ATOMIC_RELEASE);
+		if (!mEngine->submit(mRead)) {
+			__atomic_sub_fetch(&mSubmitted, 1, __ATOMIC_RELEASE);
+			__atomic_add_fetch(&mMissed, 1, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void VibrationSampler::readComplete(I2CTransaction *transaction,
+		void *data) {
+	VibrationSampler *sampler = (VibrationSampler *)data;
+
+	if (transaction->getStatus() == I2CTransaction::STATUS_DONE) {
+		uint64_t time = rawSampleTime();
+		sampler->mAccelSamples.add(sampler->mAccelValues, time);
+		sampler->mGyroSamples.add(sampler->mGyroValues, time);
+		if (sampler->mGyroSamples.full())
+			sampler->flush();
+		__atomic_add_fetch(&sampler->mSamples, 1, __ATOMIC_RELAXED);
+	} else
+		__atomic_add_fetch(&sampler->mFailed, 1, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&sampler->mHandled, 1, __ATOMIC_RELEASE);
+}
+
+void VibrationSampler::flush() {
+	int count = mGyroSamples.count;
+	Accelerometer::convertRaw(mAccelSamples, mAccel[0], mAccel[1],
+			mAccel[2], mAccelScale);
+	Gyroscope::convertRaw(mGyroSamples, mGyro[0], mGyro[1], mGyro[2],
+			mGyroScale);
+
+	for (int i = 0; i < count; ++i)
+		mAnalyzer->tap(Vector3<float>(mGyro[0][i], mGyro[1][i], mGyro[2][i]),
+				Vector3<float>(mAccel[0][i], mAccel[1][i], mAccel[2][i]),
+				mTimes[i]);
+
+	mAccelSamples.clear();
+	mGyroSamples.clear();
+}
@@ -0,0 +1,134 @@
+/*
+	bench_ekf.cpp
+
+	Benchmark of the AttitudeEKF: each step on its own, and a worst-case
+	control tick (prediction and every correction) against the budget of a
+	400Hz loop, 2.5ms. Also the 9x9 covariance product on fixed-size
+	Matrix templates against the same loops with run-time dimensions on
+	heap arrays.
+
+	Build and run with "make bench" (release libraries). Returns non-zero
+	if a tick doesn't fit EKF_BUDGET.
+*/
+
+#include <stdio.h>
+#include <math.h>
+
+#include "geometry.h"
+#include "matrix.h"
+#include "attitudeekf.h"
+
+#include "benchmark.h"
+
+#define ITERATIONS 20000
+#define NUM_INPUTS 1024       // Number of distinct inputs to cycle through
+#define EKF_BUDGET 2500000.0  // ns: one update period at 400Hz
+#define DT         0.0025f
+
+/*
+	C = A B^T with run-time dimensions
+*/
+static void multiplyDynamic(const float *a, const float *b, float *c, int n) {
+	for (int r = 0; r < n; ++r)
+		for (int k = 0; k < n; ++k) {
+			float sum = 0.0f;
+			for (int i = 0; i < n; ++i)
+				sum += a[r * n + i] * b[k * n + i];
+			c[r * n + k] = sum;
+		}
+}
+
+int main(int argc, char **argv) {
+	// Rotating slowly, so the filter stays in a realistic state
+	static Vector3<float> gyros[NUM_INPUTS], accels[NUM_INPUTS];
+	static float          headings[NUM_INPUTS], altitudes[NUM_INPUTS];
+	for (int n = 0; n < NUM_INPUTS; ++n) {
+		float t = n * DT;
+		gyros[n] = Vector3<float>(20.0f * sin(t), 10.0f * cos(t), 5.0f);
+		accels[n] = Vector3<float>(0.1f * sin(t), 0.05f * cos(t), -0.99f);
+		headings[n] = wrapAngle(5.0f * t);
+		altitudes[n] = 100.0f + 0.1f * sin(t * 3.0f);
+	}
+	int tick = 0;
+
+	AttitudeEKF ekf;
+	ekf.correctAltitude(100.0f);
+
+	printf("AttitudeEKF (%d states)\n", EKF_STATES);
+
+	benchmark("predict(gyro, accel, dt)", ITERATIONS, [&]() {
+		int n = ++tick % NUM_INPUTS;
+		ekf.predict(gyros[n], accels[n], DT);
+		benchSink = ekf.getAltitude();
+	});
+	benchmark("correctAccelerometer(accel)", ITERATIONS, [&]() {
+		int n = ++tick % NUM_INPUTS;
+		ekf.correctAccelerometer(accels[n]);
+		benchSink = ekf.getAltitude();
+	});
+	benchmark("correctHeading(heading)", ITERATIONS, [&]() {
+		int n = ++tick % NUM_INPUTS;
+		ekf.correctHeading(headings[n]);
+		benchSink = ekf.getAltitude();
+	});
+	benchmark("correctAltitude(altitude)", ITERATIONS, [&]() {
+		int n = ++tick % NUM_INPUTS;
+		ekf.correctAltitude(altitudes[n]);
+		benchSink = ekf.getAltitude();
+	});
+	double full = benchmark("tick: predict + all corrections", ITERATIONS,
+			[&]() {
+		int n = ++tick % NUM_INPUTS;
+		ekf.predict(gyros[n], accels[n], DT);
+		ekf.correctAccelerometer(accels[n]);
+		ekf.correctHeading(headings[n]);
+		ekf.correctAltitude(altitudes[n]);
+		benchSink = ekf.getRoll() + ekf.getPitch() + ekf.getYaw();
+	});
+	printf("  %-48s %10.2f %%\n", "of the 400Hz budget (2.5ms)",
+			100.0 * full / EKF_BUDGET);
+
+	printf("\nCovariance product F P F^T (%dx%d)\n", EKF_STATES, EKF_STATES);
+
+	AttitudeEKF::Covariance f(1.0f), p = ekf.getCovariance();
+	for (int r = 0; r < EKF_STATES; ++r)
+		for (int c = 0; c < EKF_STATES; ++c)
+			f(r, c) += 0.001f * ((r * 7 + c * 3) % 5);
+
+	double fixed = benchmark("Matrix<float, 9, 9>", ITERATIONS, [&]() {
+		p = multiplyTransposed(f * p, f);
+		p *= 0.5f;
+		benchSink = p(EKF_STATES - 1, EKF_STATES - 1);
+	});
+
+	// Read through a volatile, so the compiler can't specialize for it
+	static volatile int dimension = EKF_STATES;
+	int   n = dimension;
+	float *fd = new float[n * n],
+	      *pd = new float[n * n],
+	      *fp = new float[n * n];
+	for (int r = 0; r < n; ++r)
+		for (int c = 0; c < n; ++c) {
+			fd[r * n + c] = f(r, c);
+			pd[r * n + c] = ekf.getCovariance()(r, c);
+		}
+	double dynamic = benchmark("run-time dimensions, heap", ITERATIONS,
+			[&]() {
+		multiplyDynamic(fd, pd, fp, n);  // F P^T = F P (symmetric)
+		multiplyDynamic(fp, fd, pd, n);  // (F P) F^T
+		for (int i = 0; i < n * n; ++i)
+			pd[i] *= 0.5f;
+		benchSink = pd[n * n - 1];
+	});
+	delete[] fd;
+	delete[] pd;
+	delete[] fp;
+
+	printf("  %-48s %10.1fx\n", "speedup", dynamic / fixed);
+
+	if (full > EKF_BUDGET) {
+		printf("\nOVER BUDGET\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,140 @@
+/*
+	bench_fastmath.cpp
+
+	Benchmark of fastmath.h's kernels against the libm calls they replace,
+	and of the accelerometer angles as Drive::calculateOrientation() worked
+	them out before (double atan2, sqrt, magnitude()) and now.
+
+	Build and run with "make bench" (release libraries).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "geometry.h"
+#include "fastmath.h"
+
+#include "benchmark.h"
+
+#define ITERATIONS 20000
+#define BATCH      256  // Inputs per call
+
+static float xs[BATCH], ys[BATCH], angles[BATCH], positives[BATCH];
+static Vector3<float> accels[BATCH];
+
+static float uniform(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void compare(double libm, double fast) {
+	printf("  %-48s %10.2fx\n", "speedup", libm / fast);
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	for (int i = 0; i < BATCH; ++i) {
+		xs[i] = uniform(-1.0f, 1.0f);
+		ys[i] = uniform(-1.0f, 1.0f);
+		angles[i] = uniform(-3.2f, 3.2f);
+		positives[i] = uniform(0.01f, 4.0f);
+		accels[i] = Vector3<float>(uniform(-0.3f, 0.3f), uniform(-0.3f, 0.3f),
+				uniform(-1.1f, -0.9f));
+	}
+
+	printf("Per batch of %d:\n", BATCH);
+	double libm, fast;
+
+	benchmark("atan2 (double)", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i)
+			sum += atan2(ys[i], xs[i]) * 180.0 / PI;
+		benchSink = sum;
+	});
+	libm = benchmark("atan2f", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i)
+			sum += atan2f(ys[i], xs[i]) * DEGREES_PER_RADIAN;
+		benchSink = sum;
+	});
+	fast = benchmark("fastAtan2Degrees", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i)
+			sum += fastAtan2Degrees(ys[i], xs[i]);
+		benchSink = sum;
+	});
+	compare(libm, fast);
+
+	libm = benchmark("1 / sqrtf", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i)
+			sum += 1.0f / sqrtf(positives[i]);
+		benchSink = sum;
+	});
+	fast = benchmark("fastInvSqrt", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i)
+			sum += fastInvSqrt(positives[i]);
+		benchSink = sum;
+	});
+	compare(libm, fast);
+
+	libm = benchmark("sqrtf", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i)
+			sum += sqrtf(positives[i]);
+		benchSink = sum;
+	});
+	fast = benchmark("fastSqrt", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i)
+			sum += fastSqrt(positives[i]);
+		benchSink = sum;
+	});
+	compare(libm, fast);
+
+	libm = benchmark("sin, cos (double)", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i)
+			sum += sin(angles[i]) * cos(angles[i]);
+		benchSink = sum;
+	});
+	fast = benchmark("fastSinCos", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i) {
+			float s, c;
+			fastSinCos(angles[i], s, c);
+			sum += s * c;
+		}
+		benchSink = sum;
+	});
+	compare(libm, fast);
+
+	printf("\nAccelerometer roll, pitch and magnitude, per batch of %d:\n",
+			BATCH);
+	libm = benchmark("libm, double (as before)", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i) {
+			const Vector3<float> &a = accels[i];
+			float roll = atan2(a.x, -a.z) * 180.0 / PI;
+			float pitch = atan2(a.y, -sign(a.z)
+					* sqrt(a.x * a.x + a.z * a.z)) * 180.0 / PI;
+			sum += roll + pitch + magnitude(a);
+		}
+		benchSink = sum;
+	});
+	fast = benchmark("fastmath.h", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i) {
+			const Vector3<float> &a = accels[i];
+			float roll = fastAtan2Degrees(a.x, -a.z);
+			float pitch = fastAtan2Degrees(a.y, -sign(a.z)
+					* fastSqrt(a.x * a.x + a.z * a.z));
+			sum += roll + pitch + fastSqrt(magnitudeSquared(a));
+		}
+		benchSink = sum;
+	});
+	compare(libm, fast);
+
+	return 0;
+}
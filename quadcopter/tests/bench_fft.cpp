@@ -0,0 +1,146 @@
+/*
+	bench_fft.cpp
+
+	Benchmark of RealFFT against a textbook complex radix-2 FFT of the same
+	real samples (interleaved, twiddles from a single table, zero imaginary
+	parts), and of the VibrationAnalyzer: what tap() costs the sampler
+	(in the bus thread), and what a spectrum of all channels costs its
+	thread.
+
+	Build and run with "make bench" (release libraries).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "geometry.h"
+#include "fft.h"
+#include "vibrationanalyzer.h"
+
+#include "benchmark.h"
+
+#define ITERATIONS 20000
+
+static float uniform(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void compare(double before, double after) {
+	printf("  %-48s %10.2fx\n", "speedup", before / after);
+}
+
+/*
+	In-place complex FFT of size points (interleaved), with twiddles
+	e^(-2 pi i k / size) for k < size / 2
+*/
+static void complexFFT(float *data, int size, const float *twiddles) {
+	for (int i = 1, j = 0; i < size; ++i) {
+		int bit = size >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			float re = data[2 * i], im = data[2 * i + 1];
+			data[2 * i] = data[2 * j];
+			data[2 * i + 1] = data[2 * j + 1];
+			data[2 * j] = re;
+			data[2 * j + 1] = im;
+		}
+	}
+	for (int h = 1; h < size; h *= 2) {
+		int stride = size / (2 * h);
+		for (int start = 0; start < size; start += 2 * h)
+			for (int k = 0; k < h; ++k) {
+				float wr = twiddles[2 * k * stride],
+				      wi = twiddles[2 * k * stride + 1];
+				float *a = &data[2 * (start + k)], *b = &data[2 * (start + k + h)];
+				float tr = wr * b[0] - wi * b[1], ti = wr * b[1] + wi * b[0];
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
+			}
+	}
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	double before, after;
+
+	int sizes[] = { 256, 1024 };
+	for (int s = 0; s < 2; ++s) {
+		int size = sizes[s];
+		float *samples = new float[size], *data = new float[2 * size],
+		      *twiddles = new float[size];
+		for (int n = 0; n < size; ++n)
+			samples[n] = uniform(-1.0f, 1.0f);
+		for (int k = 0; k < size / 2; ++k) {
+			twiddles[2 * k] = cos(2.0 * M_PI * k / size);
+			twiddles[2 * k + 1] = -sin(2.0 * M_PI * k / size);
+		}
+		RealFFT fft(size);
+
+		printf("%d real samples:\n", size);
+		before = benchmark("complex FFT, zero imaginary parts", ITERATIONS,
+				[&]() {
+			for (int n = 0; n < size; ++n) {
+				data[2 * n] = samples[n];
+				data[2 * n + 1] = 0.0f;
+			}
+			complexFFT(data, size, twiddles);
+			benchSink = data[2];
+		});
+		after = benchmark("RealFFT::transform", ITERATIONS, [&]() {
+			for (int n = 0; n < size; ++n)
+				data[n] = samples[n];
+			fft.transform(data);
+			benchSink = data[2];
+		});
+		compare(before, after);
+
+		delete[] samples;
+		delete[] data;
+		delete[] twiddles;
+	}
+
+	printf("VibrationAnalyzer (256 readings per spectrum):\n");
+	{
+		VibrationAnalyzer analyzer(400.0f, 256);
+		Vector3<float> gyro(1.0f, 2.0f, 3.0f), accel(0.0f, 0.0f, -1.0f);
+		uint64_t time = 0;  // 400Hz, in ns
+
+		// Timed in runs that fit in the tap, drained outside the timing
+		uint64_t elapsed = 0;
+		long taps = 0;
+		for (int run = 0; run < ITERATIONS / 10; ++run) {
+			uint64_t start = benchNow();
+			for (int i = 0; i < VIBRATION_TAP_SIZE; ++i) {
+				gyro.x = i;
+				analyzer.tap(gyro, accel, time += 2500000);
+			}
+			elapsed += benchNow() - start;
+			taps += VIBRATION_TAP_SIZE;
+			while (analyzer.analyze())
+				;
+		}
+		printf("  %-48s %10.1f ns\n", "tap(), per reading (sampler)",
+				(double)elapsed / taps);
+		printf("  %-48s %10d\n", "readings dropped", analyzer.getDropped());
+
+		int analyses = 0;
+		benchmark("analyze(), per spectrum of 6 channels", ITERATIONS / 10,
+				[&]() {
+			for (int i = 0; i < 128; ++i) {
+				gyro.x = uniform(-1.0f, 1.0f);
+				analyzer.tap(gyro, accel, time += 2500000);
+			}
+			while (analyzer.analyze())
+				++analyses;
+			benchSink = analyses;
+		});
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+	bench_filterchain.cpp
+
+	Benchmark of FilterChain::process() per stage type, each on all six
+	sensor channels (CONFIG_FILTER_CHANNELS), and of a typical chain against
+	the same stages as separate Biquad objects.
+
+	Build and run with "make bench" (release libraries).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "geometry.h"
+#include "biquad.h"
+#include "filterchain.h"
+#include "configstore.h"
+
+#include "benchmark.h"
+
+#define ITERATIONS 10000000
+#define RATE       400.0f
+#define CHANNELS   CONFIG_FILTER_CHANNELS
+
+static void compare(double before, double after) {
+	printf("  %-48s %10.2fx\n", "speedup", before / after);
+}
+
+/*
+	Time process() of a chain with the given stages on every channel
+*/
+static double benchStages(const char *name, const FilterStage *stages,
+		int count) {
+	FilterChain chain(RATE, CHANNELS);
+	for (int c = 0; c < CHANNELS; ++c)
+		chain.setStages(c, stages, count);
+	chain.compile();
+
+	float values[CHANNELS];
+	int   i = 0;
+	return benchmark(name, ITERATIONS, [&]() {
+		for (int c = 0; c < CHANNELS; ++c)
+			values[c] = (float)((i + c) & 255);
+		++i;
+		chain.process(values);
+		benchSink = values[0] + values[CHANNELS - 1];
+	});
+}
+
+int main(int argc, char **argv) {
+	printf("One stage on %d channels:\n", CHANNELS);
+	FilterStage lowpass1(FILTER_LOWPASS1, 30.0f),
+	            lowpass2(FILTER_LOWPASS2, 30.0f, 0.7071f),
+	            notch(FILTER_NOTCH, 87.3f, 3.0f),
+	            bandstop(FILTER_BANDSTOP, 80.0f, 120.0f),
+	            median3(FILTER_MEDIAN, 0.0f, 3.0f),
+	            median5(FILTER_MEDIAN, 0.0f, 5.0f),
+	            median7(FILTER_MEDIAN, 0.0f, 7.0f);
+	benchStages("none", 0, 0);
+	benchStages("1st order low-pass", &lowpass1, 1);
+	benchStages("2nd order low-pass", &lowpass2, 1);
+	benchStages("notch", &notch, 1);
+	benchStages("band-stop", &bandstop, 1);
+	benchStages("median of 3", &median3, 1);
+	benchStages("median of 5", &median5, 1);
+	benchStages("median of 7", &median7, 1);
+
+	printf("Median of 3, notch and low-pass on %d channels:\n", CHANNELS);
+	{
+		Biquad notches[CHANNELS], lowpasses[CHANNELS];
+		float  history[CHANNELS][3] = { { 0.0f } };
+		for (int c = 0; c < CHANNELS; ++c) {
+			notches[c].setNotch(87.3f, RATE, 3.0f);
+			lowpasses[c].setLowPass(30.0f, RATE, 0.7071f);
+		}
+
+		float values[CHANNELS];
+		int   i = 0;
+		double before = benchmark("separate objects", ITERATIONS, [&]() {
+			for (int c = 0; c < CHANNELS; ++c) {
+				float *h = history[c];
+				h[0] = h[1];
+				h[1] = h[2];
+				h[2] = (float)((i + c) & 255);
+				float a = h[0], b = h[1], m = h[2];
+				float median = (a > b ? (b > m ? b : (a > m ? m : a))
+						: (a > m ? a : (b > m ? m : b)));
+				values[c] = lowpasses[c].process(notches[c].process(median));
+			}
+			++i;
+			benchSink = values[0] + values[CHANNELS - 1];
+		});
+
+		FilterStage stages[3] = { median3, notch, lowpass2 };
+		double after = benchStages("FilterChain", stages, 3);
+		compare(before, after);
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
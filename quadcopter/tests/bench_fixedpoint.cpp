@@ -0,0 +1,175 @@
+/*
+	bench_fixedpoint.cpp
+
+	Benchmark of the integer control path against the float one: a biquad
+	low-pass, a Rate PID, and the whole rate stage from raw gyroscope counts
+	to PWM counts (GyroCalibration, Biquad and PIDController per axis, then
+	Drive's mixer and the Motor/PWM count conversion, against
+	FixedRateLoop::update()).
+
+	Build and run with "make bench" (release libraries).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "fixedpoint.h"
+#include "fixedbiquad.h"
+#include "fixedpid.h"
+#include "fixedrateloop.h"
+#include "biquad.h"
+#include "pidcontroller.h"
+#include "calibration.h"
+
+#include "benchmark.h"
+
+#define ITERATIONS 20000
+#define BATCH      256  // Samples per call
+#define RATE       400.0f
+
+static float values[BATCH];
+static int32_t qvalues[BATCH];
+static int16_t raws[BATCH][3];
+
+static float uniform(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void compare(double floating, double fixed) {
+	printf("  %-48s %10.2fx\n", "float / fixed", floating / fixed);
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	for (int i = 0; i < BATCH; ++i) {
+		values[i] = 100.0f * sin(i * 0.1f) + uniform(-20.0f, 20.0f);
+		qvalues[i] = toQ16(values[i]);
+		for (int axis = 0; axis < 3; ++axis)
+			raws[i][axis] = (int16_t)uniform(-3000.0f, 3000.0f);
+	}
+
+	printf("Per batch of %d samples:\n", BATCH);
+	double floating, fixed;
+
+	Biquad biquad;
+	FixedBiquad fixedbiquad;
+	biquad.setLowPass(50.0f, RATE);
+	fixedbiquad.setLowPass(50.0f, RATE);
+	floating = benchmark("Biquad low-pass", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i)
+			sum += biquad.process(values[i]);
+		benchSink = sum;
+	});
+	fixed = benchmark("FixedBiquad low-pass", ITERATIONS, [&]() {
+		int32_t sum = 0;
+		for (int i = 0; i < BATCH; ++i)
+			sum += fixedbiquad.process(qvalues[i]);
+		benchSink = sum;
+	});
+	compare(floating, fixed);
+
+	PIDController pid(0.0f, 0.8f, 1.5f, 0.01f);
+	pid.setOutputLimits(-50.0f, 50.0f);
+	pid.setIntegralLimit(20.0f);
+	pid.setDerivativeFilter(100.0f, RATE);
+	FixedPID fixedpid(RATE);
+	fixedpid.setPID(0.8f, 1.5f, 0.01f);
+	fixedpid.setOutputLimits(-50.0f, 50.0f);
+	fixedpid.setIntegralLimit(20.0f);
+	fixedpid.setDerivativeFilter(100.0f);
+	floating = benchmark("PIDController::feed", ITERATIONS, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < BATCH; ++i) {
+			pid.feed(values[i], 1.0f / RATE);
+			sum += pid.output();
+		}
+		benchSink = sum;
+	});
+	fixed = benchmark("FixedPID::feed", ITERATIONS, [&]() {
+		int32_t sum = 0;
+		for (int i = 0; i < BATCH; ++i)
+			sum += fixedpid.feed(qvalues[i]);
+		benchSink = sum;
+	});
+	compare(floating, fixed);
+
+	// The rate stage
+	const float SCALE = 0.07f, MIN_HIGH = 1.27f, MAX_HIGH = 1.9f,
+	            FREQUENCY = 400.0f;
+	GyroCalibration cal;
+	cal.bias = Vector3<float>(1.5f, -2.0f, 0.7f);
+	cal.slope = Vector3<float>(0.02f, 0.01f, -0.03f);
+	cal.reftemp = 25.0f;
+
+	Biquad filters[3];
+	PIDController *pids[3];
+	FixedRateLoop loop(RATE);
+	for (int axis = 0; axis < 3; ++axis) {
+		filters[axis].setLowPass(50.0f, RATE);
+		pids[axis] = new PIDController(0.0f, 0.8f, 1.5f, 0.01f);
+		pids[axis]->setOutputLimits(-50.0f, 50.0f);
+		pids[axis]->setIntegralLimit(20.0f);
+		pids[axis]->setDerivativeFilter(100.0f, RATE);
+	}
+	loop.setGyroScale(SCALE);
+	loop.setGyroCalibration(cal, 31.0f);
+	loop.setGyroFilter(50.0f);
+	loop.setPID(0.8f, 1.5f, 0.01f);
+	loop.setOutputLimits(-50.0f, 50.0f);
+	loop.setIntegralLimit(20.0f);
+	loop.setDerivativeFilter(100.0f);
+	loop.setMotorRange(MIN_HIGH, MAX_HIGH, FREQUENCY);
+
+	floating = benchmark("rate stage, float", ITERATIONS, [&]() {
+		float targets[3] = { 20.0f, -10.0f, 5.0f }, throttle = 0.5f;
+		float corrections[3];
+		uint32_t sum = 0;
+		for (int i = 0; i < BATCH; ++i) {
+			Vector3<float> gyro = cal.apply(Vector3<float>(raws[i][0] * SCALE,
+					raws[i][1] * SCALE, raws[i][2] * SCALE), 31.0f);
+			float measured[3] = { gyro.x, gyro.y, gyro.z };
+			for (int axis = 0; axis < 3; ++axis) {
+				pids[axis]->setTarget(targets[axis]);
+				pids[axis]->feed(filters[axis].process(measured[axis]),
+						1.0f / RATE);
+				corrections[axis] = pids[axis]->output();
+			}
+			double ends = corrections[1] / 100.0f,
+			       sides = corrections[0] / 100.0f,
+			       yaw = corrections[2] / 100.0f;
+			float speeds[4] = {
+				(float)(throttle + ends - sides + yaw),
+				(float)(throttle + ends + sides - yaw),
+				(float)(throttle - ends + sides + yaw),
+				(float)(throttle - ends - sides - yaw)
+			};
+			for (int m = 0; m < 4; ++m) {
+				float speed = (speeds[m] < 0.0f ? 0.0f : speeds[m]);
+				float hightime = MIN_HIGH + (MAX_HIGH - MIN_HIGH) * speed;
+				float count = hightime / (1000.0f / FREQUENCY) * 4095.0f;
+				sum += (uint16_t)(count > 4095.0f ? 4095.0f : count);
+			}
+		}
+		benchSink = sum;
+	});
+	fixed = benchmark("FixedRateLoop::update", ITERATIONS, [&]() {
+		int32_t targets[3] = { toQ16(20.0f), toQ16(-10.0f), toQ16(5.0f) };
+		uint16_t counts[4];
+		uint32_t sum = 0;
+		for (int i = 0; i < BATCH; ++i) {
+			loop.update(raws[i], targets, Q16_ONE / 2, counts);
+			sum += counts[0] + counts[1] + counts[2] + counts[3];
+		}
+		benchSink = sum;
+	});
+	compare(floating, fixed);
+
+	for (int axis = 0; axis < 3; ++axis)
+		delete pids[axis];
+
+	printf("\nDone!\n");
+	return 0;
+}
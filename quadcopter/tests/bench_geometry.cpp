@@ -0,0 +1,94 @@
+/*
+	bench_geometry.cpp
+
+	Benchmark of geometry.h on batches of vectors (as a filter or mixer
+	works on a block of samples): Vector3<float> against Vector4f (SSE or
+	NEON where available), and rotating by a Quaternion against its
+	Matrix3.
+
+	Build and run with "make bench" (release libraries).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "geometry.h"
+
+#include "benchmark.h"
+
+#define ITERATIONS 20000
+#define BATCH      256  // Vectors per call
+
+static Vector3<float> a3[BATCH], b3[BATCH], out3[BATCH];
+static Vector4f       a4[BATCH], b4[BATCH], out4[BATCH];
+
+static float uniform(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void compare(const char *what, double scalar, double simd) {
+	printf("  %-48s %10.2fx\n", what, scalar / simd);
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	for (int i = 0; i < BATCH; ++i) {
+		a3[i] = Vector3<float>(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1));
+		b3[i] = Vector3<float>(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1));
+		a4[i] = Vector4f(a3[i]);
+		b4[i] = Vector4f(b3[i]);
+	}
+	Quaternion<float> q = normalize(Quaternion<float>(0.9f, 0.1f, -0.3f,
+			0.2f));
+
+#if defined(GEOMETRY_SSE)
+	printf("Vector4f path: SSE\n");
+#elif defined(GEOMETRY_NEON)
+	printf("Vector4f path: NEON\n");
+#else
+	printf("Vector4f path: portable\n");
+#endif
+	printf("Per batch of %d vectors:\n", BATCH);
+
+	double s, v;
+
+	s = benchmark("normalize, Vector3<float>", ITERATIONS, [&]() {
+		for (int i = 0; i < BATCH; ++i)
+			out3[i] = normalize(a3[i]);
+		benchSink = out3[BATCH - 1].x;
+	});
+	v = benchmark("normalize, Vector4f", ITERATIONS, [&]() {
+		for (int i = 0; i < BATCH; ++i)
+			out4[i] = normalize(a4[i]);
+		benchSink = out4[BATCH - 1].x;
+	});
+	compare("speedup", s, v);
+
+	s = benchmark("a x b + (a . b) a, Vector3<float>", ITERATIONS, [&]() {
+		for (int i = 0; i < BATCH; ++i)
+			out3[i] = cross(a3[i], b3[i]) + a3[i] * dot(a3[i], b3[i]);
+		benchSink = out3[BATCH - 1].x;
+	});
+	v = benchmark("a x b + (a . b) a, Vector4f", ITERATIONS, [&]() {
+		for (int i = 0; i < BATCH; ++i)
+			out4[i] = cross(a4[i], b4[i]) + a4[i] * dot(a4[i], b4[i]);
+		benchSink = out4[BATCH - 1].x;
+	});
+	compare("speedup", s, v);
+
+	s = benchmark("Quaternion::rotate", ITERATIONS, [&]() {
+		Quaternion<float> r = q;
+		for (int i = 0; i < BATCH; ++i)
+			out3[i] = r.rotate(a3[i]);
+		benchSink = out3[BATCH - 1].x;
+	});
+	v = benchmark("Quaternion::toMatrix, then Matrix3 *", ITERATIONS, [&]() {
+		Matrix3<float> r = q.toMatrix();
+		for (int i = 0; i < BATCH; ++i)
+			out3[i] = r * a3[i];
+		benchSink = out3[BATCH - 1].x;
+	});
+	compare("matrix speedup", s, v);
+
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+	bench_notchbank.cpp
+
+	Benchmark of NotchBank::process(), three notches on each of the three
+	axes at once, against the same notches as nine scalar Biquads; and of
+	retuning the bank to a new motor speed, which the update thread does
+	with NOTCH_MOTOR.
+
+	Build and run with "make bench" (release libraries).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "geometry.h"
+#include "biquad.h"
+#include "notchbank.h"
+
+#include "benchmark.h"
+
+#define ITERATIONS 10000000
+#define RATE       400.0f
+
+static void compare(double before, double after) {
+	printf("  %-48s %10.2fx\n", "speedup", before / after);
+}
+
+int main(int argc, char **argv) {
+	float centers[NOTCH_SECTIONS] = { 87.3f, 143.9f, 60.0f };
+
+	Biquad scalar[3][NOTCH_SECTIONS];
+	NotchBank bank(RATE);
+	for (int axis = 0; axis < 3; ++axis)
+		for (int s = 0; s < NOTCH_SECTIONS; ++s) {
+			scalar[axis][s].setNotch(centers[s], RATE, NOTCH_DEFAULT_Q);
+			bank.setNotch(s, axis, centers[s]);
+		}
+	bank.publish();
+
+	Vector3<float> gyro(1.0f, 2.0f, 3.0f);
+	int i = 0;
+
+	printf("%d notches on 3 axes:\n", NOTCH_SECTIONS);
+	double before = benchmark("scalar Biquads", ITERATIONS, [&]() {
+		gyro.x = (float)(i++ & 255);
+		float in[3] = { gyro.x, gyro.y, gyro.z };
+		for (int axis = 0; axis < 3; ++axis)
+			for (int s = 0; s < NOTCH_SECTIONS; ++s)
+				in[axis] = scalar[axis][s].process(in[axis]);
+		benchSink = in[0] + in[1] + in[2];
+	});
+	double after = benchmark("NotchBank::process", ITERATIONS, [&]() {
+		gyro.x = (float)(i++ & 255);
+		Vector3<float> out = bank.process(gyro);
+		benchSink = out.x + out.y + out.z;
+	});
+	compare(before, after);
+
+	printf("Retuning:\n");
+	{
+		float speed = 0.5f;
+		benchmark("trackMotorSpeed() and process", ITERATIONS / 100, [&]() {
+			speed = (speed > 0.9f ? 0.5f : speed + 0.01f);
+			bank.trackMotorSpeed(speed, 250.0f);
+			Vector3<float> out = bank.process(gyro);
+			benchSink = out.x;
+		});
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
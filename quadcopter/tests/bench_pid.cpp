@@ -0,0 +1,118 @@
+/*
+	bench_pid.cpp
+
+	Benchmark of one control tick's worth of PID evaluation: the six
+	controllers in Drive (angle and rate for roll, pitch and yaw), and larger
+	numbers of axes.
+
+	Build and run with "make bench" (release libraries).
+*/
+
+#include <stdio.h>
+
+#include "pidcontroller.h"
+#include "pidbank.h"
+
+#include "benchmark.h"
+
+#define ITERATIONS 200000
+#define MAX_AXES   32
+#define NUM_INPUTS 1024 // Number of distinct input vectors to cycle through
+
+static PIDController *makeController() {
+	PIDController *pid = new PIDController(1.0f, 1.2f, 0.5f, 0.05f);
+	pid->setOutputLimits(-50.0f, 50.0f);
+	pid->setIntegralLimit(20.0f);
+	pid->setDerivativeFilter(25.0f, 100.0f);
+	return pid;
+}
+
+static PIDBank *makeBank(int lanes) {
+	PIDBank *bank = new PIDBank(lanes);
+	for (int i = 0; i < lanes; ++i) {
+		bank->setTarget(i, 1.0f);
+		bank->setPID(i, 1.2f, 0.5f, 0.05f);
+		bank->setOutputLimits(i, -50.0f, 50.0f);
+		bank->setIntegralLimit(i, 20.0f);
+		bank->setDerivativeFilter(i, 25.0f, 100.0f);
+	}
+	return bank;
+}
+
+int main(int argc, char **argv) {
+	PIDController *single[MAX_AXES];
+	for (int i = 0; i < MAX_AXES; ++i)
+		single[i] = makeController();
+
+	// Varying inputs, so that filter states stay in a realistic range (a
+	// constant input lets them decay into slow denormals)
+	static float inputs[NUM_INPUTS][MAX_AXES];
+	for (int n = 0; n < NUM_INPUTS; ++n)
+		for (int i = 0; i < MAX_AXES; ++i)
+			inputs[n][i] = (float)((n * 7919 + i * 104729) % 2000) / 100.0f
+					- 10.0f;
+	int tick = 0;
+	float *values = inputs[0];
+
+	printf("Drive tick (6 controllers: 2 stages x 3 axes)\n");
+
+	double clock = benchmark("6 x PIDController::feed(value) [clock]",
+			ITERATIONS, [&]() {
+		values = inputs[++tick % NUM_INPUTS];
+		for (int i = 0; i < 6; ++i)
+			single[i]->feed(values[i]);
+		benchSink = single[5]->output();
+	});
+
+	double separate = benchmark("6 x PIDController::feed(value, dt)",
+			ITERATIONS, [&]() {
+		values = inputs[++tick % NUM_INPUTS];
+		for (int i = 0; i < 6; ++i)
+			single[i]->feed(values[i], 0.01f);
+		benchSink = single[5]->output();
+	});
+
+	PIDBank *angle = makeBank(3), *rate = makeBank(3);
+	double banked = benchmark("2 x PIDBank(3)::feed(values, dt)",
+			ITERATIONS, [&]() {
+		values = inputs[++tick % NUM_INPUTS];
+		angle->feed(values, 0.01f);
+		rate->feed(values + 3, 0.01f);
+		benchSink = rate->output(2);
+	});
+	delete angle;
+	delete rate;
+
+	printf("  speedup vs. clock-per-controller: %.1fx, vs. scalar: %.1fx\n",
+			clock / banked, separate / banked);
+
+	printf("\nScaling with number of axes\n");
+	for (int n = 4; n <= MAX_AXES; n *= 2) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "%2d x PIDController::feed(value, dt)", n);
+		double s = benchmark(name, ITERATIONS, [&]() {
+			values = inputs[++tick % NUM_INPUTS];
+			for (int i = 0; i < n; ++i)
+				single[i]->feed(values[i], 0.01f);
+			benchSink = single[n - 1]->output();
+		});
+
+		PIDBank *bank = makeBank(n);
+		snprintf(name, sizeof(name), "PIDBank(%d)::feed(values, dt)", n);
+		double b = benchmark(name, ITERATIONS, [&]() {
+			values = inputs[++tick % NUM_INPUTS];
+			bank->feed(values, 0.01f);
+			benchSink = bank->output(n - 1);
+		});
+		delete bank;
+
+		printf("  %-48s %10.1fx\n", "speedup", s / b);
+	}
+
+	for (int i = 0; i < MAX_AXES; ++i)
+		delete single[i];
+
+	return 0;
+}
+
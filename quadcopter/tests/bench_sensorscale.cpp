@@ -0,0 +1,144 @@
+/*
+	bench_sensorscale.cpp
+
+	Benchmark of the accelerometer's raw-to-g conversion: the per-read range
+	lookup and divide it did before, the scale resolved by setRange(), the
+	range fixed at compile time (convertRaw<R>), and the bulk convertRaw()
+	over a FIFO-sized batch. The gyroscope's is the same, less the divide.
+	Then a log of RawSamples converted in one pass, against the same counts
+	as triplets.
+
+	Build and run with "make bench" (release libraries).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "geometry.h"
+#include "accelerometer.h"
+#include "rawsamples.h"
+
+#include "benchmark.h"
+
+#define ITERATIONS 200000
+#define BATCH      32  // Samples per call, as the ADXL345's FIFO
+
+static int16_t raws[3 * BATCH];
+static Vector3<float> out[BATCH];
+
+#define LOG 256  // Raw samples per conversion pass
+
+static Vector3<float> logged[LOG];
+static float loggedx[LOG], loggedy[LOG], loggedz[LOG];
+
+/*
+	The conversion as it was, looking up the range and dividing on every
+	read. Not inlined, as a read() isn't.
+*/
+static Vector3<float> __attribute__((noinline)) lookup(
+		Accelerometer::Range range, const int16_t *values) {
+	float factor = 256.0f;
+	switch (range) {
+		case Accelerometer::RANGE_2G:
+			factor = 256.0f;
+			break;
+		case Accelerometer::RANGE_4G:
+			factor = 128.0f;
+			break;
+		case Accelerometer::RANGE_8G:
+			factor = 64.0f;
+			break;
+		case Accelerometer::RANGE_16G:
+			factor = 32.0f;
+			break;
+	}
+	return Vector3<float>((float)values[0] / factor,
+			(float)values[1] / factor, (float)values[2] / factor);
+}
+
+/*
+	As convert() is now, with the scale resolved by setRange()
+*/
+static Vector3<float> __attribute__((noinline)) resolved(float scale,
+		const int16_t *values) {
+	return Vector3<float>(values[0] * scale, values[1] * scale,
+			values[2] * scale);
+}
+
+/*
+	With the range fixed at compile time
+*/
+static Vector3<float> __attribute__((noinline)) fixed(const int16_t *values) {
+	return Accelerometer::convertRaw<Accelerometer::RANGE_8G>(values);
+}
+
+static void compare(double before, double after) {
+	printf("  %-48s %10.2fx\n", "speedup", before / after);
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	for (int i = 0; i < 3 * BATCH; ++i)
+		raws[i] = (int16_t)(rand() % 65536 - 32768);
+
+	printf("Accelerometer, per batch of %d samples:\n", BATCH);
+	double before, after;
+	Accelerometer::Range range = Accelerometer::RANGE_8G;
+
+	before = benchmark("per-read lookup and divide", ITERATIONS, [&]() {
+		for (int i = 0; i < BATCH; ++i)
+			out[i] = lookup(range, &raws[3 * i]);
+		benchSink = out[BATCH - 1].x;
+	});
+	after = benchmark("resolved scale, per sample", ITERATIONS, [&]() {
+		float scale = Accelerometer::scale(range);
+		for (int i = 0; i < BATCH; ++i)
+			out[i] = resolved(scale, &raws[3 * i]);
+		benchSink = out[BATCH - 1].x;
+	});
+	compare(before, after);
+	after = benchmark("convertRaw<RANGE_8G>, per sample", ITERATIONS, [&]() {
+		for (int i = 0; i < BATCH; ++i)
+			out[i] = fixed(&raws[3 * i]);
+		benchSink = out[BATCH - 1].x;
+	});
+	compare(before, after);
+	after = benchmark("bulk convertRaw", ITERATIONS, [&]() {
+		Accelerometer::convertRaw(raws, out, BATCH,
+				Accelerometer::scale(range));
+		benchSink = out[BATCH - 1].x;
+	});
+	compare(before, after);
+
+	// Raw samples (structure of arrays), converted in a separate pass
+	int16_t  xs[LOG], ys[LOG], zs[LOG], triplets[3 * LOG];
+	uint64_t times[LOG];
+	RawSamples samples(xs, ys, zs, times, LOG);
+	for (int i = 0; i < LOG; ++i) {
+		int16_t raw[3] = { raws[(3 * i) % (3 * BATCH)],
+				raws[(3 * i + 1) % (3 * BATCH)],
+				raws[(3 * i + 2) % (3 * BATCH)] };
+		samples.add(raw, i);
+		for (int j = 0; j < 3; ++j)
+			triplets[3 * i + j] = raw[j];
+	}
+
+	printf("Per log of %d samples:\n", LOG);
+	before = benchmark("bulk convertRaw, triplets to Vector3", ITERATIONS / 8,
+			[&]() {
+		Accelerometer::convertRaw(triplets, logged, LOG,
+				Accelerometer::scale(range));
+		benchSink = logged[LOG - 1].x;
+	});
+	after = benchmark("convertRaw, RawSamples to arrays", ITERATIONS / 8,
+			[&]() {
+		Accelerometer::convertRaw(samples, loggedx, loggedy, loggedz,
+				Accelerometer::scale(range));
+		benchSink = loggedz[LOG - 1];
+	});
+	compare(before, after);
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+	benchmark.h
+
+	Minimal benchmark harness for the bench_*.cpp programs. These are built
+	against the release (-O3) libraries with "make bench", unlike the tests.
+
+	Usage:
+		double ns = benchmark("name", iterations, callable);
+
+	callable is called iterations times (after a short warm-up), and the
+	average time per call in nanoseconds is printed and returned. Results
+	should be written somewhere observable (e.g. benchSink) so that the
+	compiler does not optimize the work away.
+*/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// Write results here to keep them from being optimized away
+static volatile float benchSink;
+
+/**
+	Returns a monotonic timestamp in nanoseconds
+*/
+static inline uint64_t benchNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+template<typename F>
+double benchmark(const char *name, long iterations, F fn) {
+	for (long i = 0; i < iterations / 10 + 1; ++i)
+		fn();
+
+	uint64_t start = benchNow();
+	for (long i = 0; i < iterations; ++i)
+		fn();
+	uint64_t elapsed = benchNow() - start;
+
+	double ns = (double)elapsed / iterations;
+	printf("  %-48s %10.1f ns\n", name, ns);
+	return ns;
+}
+
+#endif
+
@@ -2,14 +2,18 @@
 	calibrate.cpp
 
 	Calibrates the sensors through Drive::calibrate(), saving the values to
-	calibration.ini.
+	the config file (quadcopter.cfg, see ConfigStore).
+
+	Run with the argument "positions" to do the six-position accelerometer
+	calibration first (Drive::calibratePosition()), which also corrects the
+	accelerometer's scale and misalignment.
 
 	NOTE: the calibration values are probably dependent on the range specified
 	for the sensors. Change the program to match the ranges that you are using
 	for each sensor.
 
 	Any program that wishes to use the outputted calibration should run with
-	this file alongside it.
+	the config file alongside it.
 */
 
 #include <string>
@@ -40,7 +44,24 @@ int main(int argc, char **argv) {
 				Gyroscope::SRATE_100HZ);
 
 		Drive drive(&pwm, &accel, &gyro, 15, 15, 15, 15, 100);
-		
+
+		if (argc > 1 && std::string(argv[1]) == "positions") {
+			int positions = 0;
+			while (positions < 6) {
+				std::cout << "Hold still with one side facing straight down "
+						<< "and press ENTER (" << positions << "/6 done)"
+						<< std::endl;
+				std::cin.get();
+				try {
+					positions = drive.calibratePosition();
+				} catch (CalibrationException &e) {
+					std::cout << "Not still, try again" << std::endl;
+				}
+			}
+			std::cout << "Place upright and press ENTER" << std::endl;
+			std::cin.get();
+		}
+
 		std::cout << "Calibrating for 2 seconds. Keep sensors still!"
 				<< std::endl
 				<< "  Accelerometer : Range=2G" << std::endl
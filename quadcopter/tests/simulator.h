@@ -0,0 +1,579 @@
+/*
+	simulator.h
+
+	Simple simulated plants for exercising the control system without the
+	quadcopter hardware. Everything here is header-only so that any test
+	program can include it without changes to the Makefile.
+
+	SimAxis models rotation of the frame about a single axis: a first-order
+	motor lag feeding a rigid body with aerodynamic damping. It is crude, but
+	it has the features that matter for tuning (actuator lag, inertia and a
+	finite sample rate), and it is deterministic.
+
+	SimVertical models the quadcopter's altitude under the throttle: thrust
+	after the same first-order motor lag, balancing gravity at the hover
+	throttle, with aerodynamic damping.
+
+	StepResponse records a signal and reports the usual step response
+	figures (settling time, overshoot) against a target value.
+
+	SimI2C is an I2C bus of register-mapped slaves, as the sensors on the
+	quadcopter are: a write sets the register pointer (and writes any
+	further bytes), a read returns registers from the pointer on, both
+	auto-incrementing. Failures can be injected.
+
+	SimAccelerometer and SimGyroscope are an ADXL345 and an L3G4200D on a
+	SimI2C bus: set() puts a reading into their output registers, as the
+	drivers would read it back (in the accelerometer's axes).
+
+	SimMagnetometer is an HMC5883L on a SimI2C bus: set() puts a field into
+	its output registers as the chip would read it, after hard and soft iron
+	distortion.
+
+	SimBarometer is a BMP085 on a SimI2C bus: step() runs the conversion
+	last started through its control register, and when it has had its
+	time, puts the raw reading of temperature or pressure into the result
+	registers (found by inverting the datasheet's compensation), and clears
+	the start of conversion bit. Its calibration is the datasheet's example.
+
+	SimWatchdog stands in for /dev/watchdog: a FIFO that a thread reads
+	pets from, which "fires" (as the hardware would reset the system) if no
+	pet comes within its timeout, unless disarmed first with the magic
+	close character 'V'.
+*/
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <linux/i2c.h>
+
+#include "geometry.h"
+#include "i2c.h"
+
+struct SimAxis {
+	float angle;   // degrees, wrapped to [-180, 180)
+	float rate;    // degrees/second
+
+	float gain;    // degrees/second^2 per unit of command (motor speed delta)
+	float damping; // 1/second, drag opposing rotation
+	float lag;     // seconds, time constant of motor response
+	float effort;  // command after motor lag
+
+	SimAxis(float g = 400.0f, float damp = 1.0f, float motorlag = 0.05f)
+			: angle(0.0f), rate(0.0f), gain(g), damping(damp), lag(motorlag),
+			  effort(0.0f)
+		{ }
+
+	/**
+		Advance the simulation by dtime seconds with the given command, which
+		is in the same units as the differential motor speeds in
+		Drive::stabilize() (i.e. PID output / 100).
+
+		disturbance is an external acceleration, in degrees/second^2.
+	*/
+	void step(float command, float dtime, float disturbance = 0.0f) {
+		effort += (command - effort) * (dtime / (lag + dtime));
+		rate += (gain * effort - damping * rate + disturbance) * dtime;
+		angle = wrapAngle(angle + rate * dtime);
+	}
+};
+
+struct SimVertical {
+	float altitude; // metres
+	float velocity; // m/s, positive up
+	float accel;    // m/s^2, as of the last step
+
+	float hover;    // throttle whose thrust balances gravity
+	float damping;  // 1/second, drag opposing the climb rate
+	float lag;      // seconds, time constant of motor response
+	float effort;   // throttle after motor lag
+
+	SimVertical(float h = 0.0f, float hov = 0.55f, float damp = 0.3f,
+			float motorlag = 0.05f)
+			: altitude(h), velocity(0.0f), accel(0.0f), hover(hov),
+			  damping(damp), lag(motorlag), effort(hov)
+		{ }
+
+	/**
+		Advance the simulation by dtime seconds with the given throttle
+	*/
+	void step(float throttle, float dtime) {
+		effort += (throttle - effort) * (dtime / (lag + dtime));
+		accel = 9.80665f * (effort / hover - 1.0f) - damping * velocity;
+		velocity += accel * dtime;
+		altitude += velocity * dtime;
+	}
+};
+
+struct StepResponse {
+	float target;
+	float band;      // Settled when within +/- band of target
+	float start;     // Initial value, to measure overshoot direction
+
+	float settled;   // Time at which the signal last entered the band
+	bool  inband;
+	float peak;      // Largest excursion past target (in direction of step)
+
+	StepResponse(float tgt, float initial, float tolerance)
+			: target(tgt), band(tolerance), start(initial), settled(0.0f),
+			  inband(false), peak(0.0f)
+		{ }
+
+	/**
+		Record value at the given time. Angles should be passed through
+		angleDifference() first if they can wrap.
+	*/
+	void record(float time, float value) {
+		float error = value - target;
+		if (fabs(error) <= band) {
+			if (!inband)
+				settled = time;
+			inband = true;
+		} else
+			inband = false;
+
+		float past = (target >= start ? error : -error);
+		if (past > peak)
+			peak = past;
+	}
+
+	/**
+		Returns the settling time, or a negative number if the signal was not
+		within the band at the end of the recording.
+	*/
+	float settlingTime() {
+		return (inband ? settled : -1.0f);
+	}
+
+	/**
+		Returns the overshoot as a fraction of the step size.
+	*/
+	float overshoot() {
+		float size = fabs(target - start);
+		return (size > 0.0f ? peak / size : 0.0f);
+	}
+};
+
+class SimI2C : public I2C {
+	public:
+		uint8_t registers[128][256];
+		bool    present[128];
+		uint8_t pointer[128];
+		uint8_t pointerMask[128]; // Register address bits, per slave
+		int     failures;         // Operations left to fail
+		int     failError;
+		int     attempts;         // Operations tried, failed or not
+		int     byteTime;         // Microseconds each byte holds the bus
+
+		SimI2C() : I2C(), failures(0), failError(0), attempts(0),
+				byteTime(0) {
+			memset(registers, 0, sizeof(registers));
+			memset(present, 0, sizeof(present));
+			memset(pointer, 0, sizeof(pointer));
+			memset(pointerMask, 0xFF, sizeof(pointerMask));
+		}
+
+		void addSlave(uint8_t addr, uint8_t mask = 0xFF) {
+			present[addr] = true;
+			pointerMask[addr] = mask;
+		}
+
+		/**
+			Make the next count operations fail with error (an errno)
+		*/
+		void failNext(int count, int error) {
+			failures = count;
+			failError = error;
+		}
+
+	protected:
+		/**
+			Called after a byte is written to a register, for slaves that
+			act on writes (e.g. starting a conversion)
+		*/
+		virtual void onWrite(uint8_t addr, uint8_t reg, uint8_t value) { }
+
+		/**
+			Returns a failure to inject, or 0
+		*/
+		virtual int fault(uint8_t addr) {
+			++attempts;
+			if (failures > 0) {
+				--failures;
+				return failError;
+			}
+			return (present[addr & 0x7F] ? 0 : EREMOTEIO);
+		}
+
+		int rawWrite(uint8_t addr, const void *data, size_t length) {
+			hold(length + 1);
+			int error = fault(addr);
+			if (error == 0)
+				writeRegisters(addr, (const uint8_t *)data, length);
+			return error;
+		}
+
+		int rawRead(uint8_t addr, void *buffer, size_t length,
+				size_t *bytesread) {
+			hold(length + 1);
+			int error = fault(addr);
+			if (error == 0)
+				readRegisters(addr, (uint8_t *)buffer, length);
+			*bytesread = (error == 0 ? length : 0);
+			return error;
+		}
+
+		int rawTransfer(struct i2c_msg *msgs, int count) {
+			size_t bytes = 0;
+			for (int i = 0; i < count; ++i)
+				bytes += msgs[i].len + 1;
+			hold(bytes);
+			int error = fault(msgs[0].addr);
+			for (int i = 1; i < count && error == 0; ++i)
+				if (!present[msgs[i].addr & 0x7F])
+					error = EREMOTEIO;
+			for (int i = 0; i < count && error == 0; ++i) {
+				if (msgs[i].flags & I2C_M_RD)
+					readRegisters(msgs[i].addr, msgs[i].buf, msgs[i].len);
+				else
+					writeRegisters(msgs[i].addr, msgs[i].buf, msgs[i].len);
+			}
+			return error;
+		}
+
+	private:
+		void hold(size_t bytes) {
+			if (byteTime > 0)
+				usleep(bytes * byteTime);
+		}
+
+		void writeRegisters(uint8_t addr, const uint8_t *data, size_t length) {
+			addr &= 0x7F;
+			if (length == 0)
+				return;
+			pointer[addr] = data[0];
+			for (size_t i = 1; i < length; ++i) {
+				uint8_t reg = pointer[addr] & pointerMask[addr];
+				registers[addr][reg] = data[i];
+				onWrite(addr, reg, data[i]);
+				++pointer[addr];
+			}
+		}
+
+		void readRegisters(uint8_t addr, uint8_t *buffer, size_t length) {
+			addr &= 0x7F;
+			for (size_t i = 0; i < length; ++i) {
+				buffer[i] = registers[addr][pointer[addr] & pointerMask[addr]];
+				++pointer[addr];
+			}
+		}
+};
+
+/*
+	Put x, y and z as little-endian counts into registers from reg on
+*/
+static inline void simSetCounts(SimI2C *bus, uint8_t addr, uint8_t reg,
+		float x, float y, float z) {
+	float axes[3] = { x, y, z };
+	for (int i = 0; i < 3; ++i) {
+		long value = lround(axes[i]);
+		if (value < -32768) value = -32768;
+		if (value > 32767)  value = 32767;
+		bus->registers[addr][reg + i * 2] = (uint8_t)(value & 0xFF);
+		bus->registers[addr][reg + i * 2 + 1] = (uint8_t)((value >> 8) & 0xFF);
+	}
+}
+
+struct SimAccelerometer {
+	SimI2C  *bus;
+	uint8_t addr;
+	float   scale;  // g per LSB (Accelerometer::scale())
+
+	SimAccelerometer(SimI2C *i2c, uint8_t address = 0x53,
+			float gperlsb = 1.0f / 256.0f)
+			: bus(i2c), addr(address), scale(gperlsb) {
+		bus->addSlave(addr);
+	}
+
+	/**
+		Set the acceleration (g) that the next reading returns
+	*/
+	void set(const Vector3<float> &accel) {
+		// Data registers 0x32-0x37
+		simSetCounts(bus, addr, 0x32, accel.x / scale, accel.y / scale,
+				accel.z / scale);
+	}
+};
+
+struct SimGyroscope {
+	SimI2C  *bus;
+	uint8_t addr;
+	float   scale;  // dps per LSB (Gyroscope::scale())
+
+	SimGyroscope(SimI2C *i2c, uint8_t address = 0x69,
+			float dpsperlsb = 0.00875f)
+			: bus(i2c), addr(address), scale(dpsperlsb) {
+		// The top bit of the register address asks for auto-increment
+		bus->addSlave(addr, 0x7F);
+	}
+
+	/**
+		Set the rates (dps, in the accelerometer's axes as Gyroscope::read()
+		returns them) that the next reading returns
+	*/
+	void set(const Vector3<float> &rates) {
+		// Output registers 0x28-0x2D, with X and Y swapped
+		simSetCounts(bus, addr, 0x28, rates.y / scale, rates.x / scale,
+				rates.z / scale);
+	}
+};
+
+struct SimMagnetometer {
+	SimI2C         *bus;
+	uint8_t        addr;
+	Matrix3<float> softIron;
+	Vector3<float> hardIron; // gauss
+
+	SimMagnetometer(SimI2C *i2c, uint8_t address = 0x1E)
+			: bus(i2c), addr(address), softIron(1.0f),
+			  hardIron(0.0f, 0.0f, 0.0f) {
+		bus->addSlave(addr);
+		bus->registers[addr][0x01] = 0x20; // Default gain, 1.3Ga
+		bus->registers[addr][0x0A] = 'H';  // Identification
+		bus->registers[addr][0x0B] = '4';
+		bus->registers[addr][0x0C] = '3';
+	}
+
+	/**
+		Set the field (gauss, in the accelerometer's axes) that the next
+		reading returns, at the gain last written to configuration
+		register B. An axis out of range reads -4096, as on the chip.
+	*/
+	void set(const Vector3<float> &field) {
+		static const float factors[8] = {
+			1370.0f, 1090.0f, 820.0f, 660.0f, 440.0f, 390.0f, 330.0f, 230.0f
+		};
+		float factor = factors[bus->registers[addr][0x01] >> 5];
+
+		Vector3<float> raw = softIron * field;
+		raw += hardIron;
+
+		// Output registers 3-8: X, Z, Y, big-endian
+		float axes[3] = { raw.x, raw.z, raw.y };
+		for (int i = 0; i < 3; ++i) {
+			long value = lround(axes[i] * factor);
+			if (value < -2048 || value > 2047)
+				value = -4096;
+			bus->registers[addr][0x03 + i * 2] = (uint8_t)((value >> 8) & 0xFF);
+			bus->registers[addr][0x04 + i * 2] = (uint8_t)(value & 0xFF);
+		}
+	}
+};
+
+struct SimBarometer {
+	SimI2C  *bus;
+	uint8_t addr;
+	float   temperature;   // degrees C
+	float   pressure;      // Pa
+	long    rawTemperature, // If not negative, read instead of temperature
+	        rawPressure;    // and pressure (at the conversion's oversampling)
+	float   elapsed;       // Seconds into the running conversion
+	long    conversions;   // Completed
+
+	// Calibration: AC1-AC6, B1, B2, MB, MC, MD
+	int32_t cal[11];
+
+	SimBarometer(SimI2C *i2c, uint8_t address = 0x77)
+			: bus(i2c), addr(address), temperature(15.0f),
+			  pressure(101325.0f), rawTemperature(-1), rawPressure(-1),
+			  elapsed(0.0f), conversions(0) {
+		static const int32_t example[11] = {
+			408, -72, -14383, 32741, 32757, 23153, 6190, 4, -32768, -8711, 2868
+		};
+		bus->addSlave(addr);
+		for (int i = 0; i < 11; ++i) {
+			cal[i] = example[i];
+			bus->registers[addr][0xAA + i * 2] = (uint8_t)((cal[i] >> 8) & 0xFF);
+			bus->registers[addr][0xAB + i * 2] = (uint8_t)(cal[i] & 0xFF);
+		}
+	}
+
+	/**
+		Advance time by dtime seconds
+	*/
+	void step(float dtime) {
+		static const float times[4] = { 0.0045f, 0.0075f, 0.0135f, 0.0255f };
+		uint8_t &control = bus->registers[addr][0xF4];
+		if (!(control & 0x20)) {
+			elapsed = 0.0f;
+			return;
+		}
+
+		bool temp = (control == 0x2E);
+		int  oss = control >> 6;
+		elapsed += dtime;
+		if (elapsed + 1e-6f < (temp ? 0.0045f : times[oss]))
+			return;
+
+		uint8_t *result = &bus->registers[addr][0xF6];
+		long ut = (rawTemperature >= 0 ? rawTemperature : findTemperature());
+		if (temp) {
+			result[0] = (uint8_t)(ut >> 8);
+			result[1] = (uint8_t)(ut & 0xFF);
+			result[2] = 0;
+		} else {
+			long up = (rawPressure >= 0 ? rawPressure
+					: findPressure(b5(ut), oss)) << (8 - oss);
+			result[0] = (uint8_t)((up >> 16) & 0xFF);
+			result[1] = (uint8_t)((up >> 8) & 0xFF);
+			result[2] = (uint8_t)(up & 0xFF);
+		}
+		control &= ~0x20;
+		elapsed = 0.0f;
+		++conversions;
+	}
+
+	/*
+		The datasheet's compensation, and searches through it for the raw
+		readings of temperature and pressure (both are increasing)
+	*/
+	int32_t b5(int32_t ut) {
+		int32_t x1 = ((ut - cal[5]) * cal[4]) >> 15;
+		return x1 + (cal[9] << 11) / (x1 + cal[10]);
+	}
+
+	int32_t compensate(int32_t up, int32_t b5, int oss) {
+		int32_t b6 = b5 - 4000;
+		int32_t x3 = ((cal[7] * ((b6 * b6) >> 12)) >> 11) + ((cal[1] * b6) >> 11);
+		int32_t b3 = (((cal[0] * 4 + x3) << oss) + 2) / 4;
+		x3 = (((cal[2] * b6) >> 13) + ((cal[6] * ((b6 * b6) >> 12)) >> 16) + 2)
+				>> 2;
+		uint32_t b4 = ((uint32_t)cal[3] * (uint32_t)(x3 + 32768)) >> 15;
+		uint32_t b7 = ((uint32_t)up - b3) * (uint32_t)(50000 >> oss);
+		int32_t p = (b7 < 0x80000000 ? (b7 * 2) / b4 : (b7 / b4) * 2);
+		int32_t x1 = (((p >> 8) * (p >> 8)) * 3038) >> 16;
+		return p + ((x1 + ((-7357 * p) >> 16) + 3791) >> 4);
+	}
+
+	long findTemperature() {
+		long lo = 0, hi = 65535, target = lround(temperature * 10.0f);
+		while (lo < hi) {
+			long mid = (lo + hi) / 2;
+			if (((b5(mid) + 8) >> 4) < target)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	long findPressure(int32_t b5, int oss) {
+		long lo = 0, hi = (1L << (16 + oss)) - 1, target = lround(pressure);
+		while (lo < hi) {
+			long mid = (lo + hi) / 2;
+			if (compensate(mid, b5, oss) < target)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+};
+
+struct SimWatchdog {
+	std::string path;
+	float       timeout;   // seconds
+	int         fd;
+	pthread_t   thread;
+
+	// Written by the reader thread, accessed atomically
+	int   pets;
+	bool  stopping;
+	bool  fired;
+	bool  disarmed;        // Closed after 'V'
+	float lastpet;         // seconds since construction, -1 if none
+
+	struct timespec begin;
+
+	/**
+		Creates the FIFO and starts reading from it. The watchdog isn't
+		running until the device is opened for writing (and a first pet).
+	*/
+	SimWatchdog(float seconds) : timeout(seconds), pets(0), stopping(false),
+			fired(false), disarmed(false), lastpet(-1.0f) {
+		char name[64];
+		sprintf(name, "/tmp/simwatchdog.%d.%p", (int)getpid(), (void *)this);
+		path = name;
+		unlink(path.c_str());
+		mkfifo(path.c_str(), 0600);
+		fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		pthread_create(&thread, NULL, entry, this);
+	}
+
+	~SimWatchdog() {
+		__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+		pthread_join(thread, NULL);
+		close(fd);
+		unlink(path.c_str());
+	}
+
+	int getPets() { return __atomic_load_n(&pets, __ATOMIC_ACQUIRE); }
+	bool hasFired() { return __atomic_load_n(&fired, __ATOMIC_ACQUIRE); }
+	bool isDisarmed() { return __atomic_load_n(&disarmed, __ATOMIC_ACQUIRE); }
+
+	float now() {
+		struct timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return (t.tv_sec - begin.tv_sec)
+				+ (t.tv_nsec - begin.tv_nsec) / 1000000000.0f;
+	}
+
+	static void *entry(void *arg) {
+		((SimWatchdog *)arg)->run();
+		return NULL;
+	}
+
+	void run() {
+		bool magic = false;
+		while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+			struct pollfd p;
+			p.fd = fd;
+			p.events = POLLIN;
+			poll(&p, 1, 1);
+
+			char buf[16];
+			ssize_t got = read(fd, buf, sizeof(buf));
+			if (got > 0) {
+				for (ssize_t i = 0; i < got; ++i)
+					magic = (buf[i] == 'V');
+				__atomic_add_fetch(&pets, 1, __ATOMIC_RELEASE);
+				lastpet = now(); // Only read by this thread
+			} else {
+				// Writer closed; the hardware stops only after the magic
+				if (got == 0 && magic && !hasFired())
+					__atomic_store_n(&disarmed, true, __ATOMIC_RELEASE);
+				usleep(1000);
+			}
+
+			if (lastpet >= 0.0f && !isDisarmed() && !hasFired()
+					&& now() - lastpet > timeout)
+				__atomic_store_n(&fired, true, __ATOMIC_RELEASE);
+		}
+	}
+};
+
+#endif
+
@@ -0,0 +1,278 @@
+/*
+	test_autotune.cpp
+
+	Simulated test of relay auto-tuning. Tunes the Rate and then the Angle
+	stage of the same cascade as Drive::stabilize() on a simulated axis (with
+	Drive's sensor averaging), the way Drive::startAutoTune() does:
+
+	- The relay's estimate of the ultimate gain and period is compared with
+	  the values found by brute force (raising a P-only gain until the
+	  simulated loop oscillates).
+	- The resulting gains are checked by step responses of each stage.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <math.h>
+
+#include "geometry.h"
+#include "pidcontroller.h"
+#include "relaytuner.h"
+
+#include "simulator.h"
+
+#define RATE      100   // Control loop rate (Hz)
+#define SMOOTHING 3     // Frames of gyro averaging, as in Drive
+
+/*
+	Simulated axis as seen by Drive: the gyro reading is averaged over the
+	last SMOOTHING frames.
+*/
+struct SensedAxis {
+	SimAxis plant;
+	float   history[SMOOTHING];
+	int     current;
+
+	SensedAxis() : current(0) {
+		for (int i = 0; i < SMOOTHING; ++i)
+			history[i] = 0.0f;
+	}
+
+	float gyro() {
+		history[current] = plant.rate;
+		current = (current + 1) % SMOOTHING;
+
+		float sum = 0.0f;
+		for (int i = 0; i < SMOOTHING; ++i)
+			sum += history[i];
+		return sum / SMOOTHING;
+	}
+
+	// command is a Rate PID output (motor speed difference x100)
+	void step(float command, float dtime) {
+		plant.step(command / 100.0f, dtime);
+	}
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+/*
+	Run a P-only rate loop with gain kp from a small initial rate. Returns the
+	ratio of the oscillation's size over the last second to that over the
+	second before (> 1 : growing), and sets period to the mean period.
+*/
+static float proportionalGrowth(float kp, float &period) {
+	const float dtime = 1.0f / RATE;
+	SensedAxis axis;
+	axis.plant.rate = 5.0f;
+
+	float early = 0.0f, late = 0.0f, last = 0.0f, firstcross = -1.0f,
+	      lastcross = 0.0f;
+	int crossings = 0;
+
+	for (int i = 0; i < 4 * RATE; ++i) {
+		float gyro = axis.gyro();
+		axis.step(-kp * gyro, dtime);
+
+		if (i >= 2 * RATE && i < 3 * RATE && fabs(gyro) > early)
+			early = fabs(gyro);
+		if (i >= 3 * RATE && fabs(gyro) > late)
+			late = fabs(gyro);
+
+		// Upward zero crossings, interpolated
+		if (i >= RATE && last < 0.0f && gyro >= 0.0f) {
+			float t = (i - 1 + last / (last - gyro)) * dtime;
+			if (firstcross < 0.0f)
+				firstcross = t;
+			else
+				++crossings;
+			lastcross = t;
+		}
+		last = gyro;
+	}
+
+	period = (crossings > 0 ? (lastcross - firstcross) / crossings : 0.0f);
+	return (early > 0.0f ? late / early : 0.0f);
+}
+
+/*
+	Run the relay tuner on the rate loop. Returns the time taken in seconds,
+	or a negative number if it did not finish.
+*/
+static float tuneRate(RelayTuner &tuner, float amplitude) {
+	const float dtime = 1.0f / RATE;
+	SensedAxis axis;
+
+	tuner.start(amplitude, 0.2f);
+	for (int i = 0; i < 20 * RATE; ++i) {
+		float command = tuner.feed(0.0f - axis.gyro(), dtime);
+		if (tuner.getState() != RelayTuner::STATE_RUNNING)
+			return (tuner.getState() == RelayTuner::STATE_DONE ?
+					i * dtime : -1.0f);
+		axis.step(command, dtime);
+	}
+	return -1.0f;
+}
+
+/*
+	Step the rate target and record the response
+*/
+static void rateStep(float p, float i, float d, StepResponse &resp) {
+	const float dtime = 1.0f / RATE;
+	SensedAxis axis;
+	PIDController pid(resp.target, p, i, d);
+	pid.setOutputLimits(-50.0f, 50.0f);
+	pid.setIntegralLimit(20.0f);
+	pid.setDerivativeFilter(RATE * 0.25f, RATE);
+
+	for (int n = 0; n < 3 * RATE; ++n) {
+		pid.feed(axis.gyro(), dtime);
+		axis.step(pid.output(), dtime);
+		resp.record(n * dtime, axis.plant.rate);
+	}
+}
+
+/*
+	Angle stage, with the rate loop closed by a tuned Rate PID. If tuner is
+	running, it drives the rate target; otherwise an Angle PID with the
+	given gains does, stepping to resp.target. Returns the time taken to
+	tune, or a negative number if tuning did not finish.
+*/
+static float angleLoop(RelayTuner &tuner, float ratep, float ratei,
+		float rated, float p, float i, float d, StepResponse *resp) {
+	const float dtime = 1.0f / RATE;
+	SensedAxis axis;
+	PIDController rate(0.0f, ratep, ratei, rated);
+	rate.setOutputLimits(-50.0f, 50.0f);
+	rate.setIntegralLimit(20.0f);
+	rate.setDerivativeFilter(RATE * 0.25f, RATE);
+
+	PIDController angle(resp ? resp->target : 0.0f, p, i, d);
+	angle.setOutputLimits(-180.0f, 180.0f);
+	angle.setIntegralLimit(60.0f);
+	angle.setDerivativeFilter(RATE * 0.25f, RATE);
+
+	for (int n = 0; n < 20 * RATE; ++n) {
+		float gyro = axis.gyro();
+
+		if (resp) {
+			angle.feed(axis.plant.angle, dtime);
+			rate.setTarget(angle.output());
+			resp->record(n * dtime, axis.plant.angle);
+			if (n >= 6 * RATE)
+				break;
+		} else {
+			rate.setTarget(tuner.feed(0.0f - axis.plant.angle, dtime));
+			if (tuner.getState() != RelayTuner::STATE_RUNNING)
+				return (tuner.getState() == RelayTuner::STATE_DONE ?
+						n * dtime : -1.0f);
+		}
+
+		rate.feed(gyro, dtime);
+		axis.step(rate.output(), dtime);
+	}
+	return -1.0f;
+}
+
+int main(int argc, char **argv) {
+	printf("Ultimate gain of the rate loop, by brute force\n");
+	float low = 0.0f, high = 100.0f, period = 0.0f;
+	for (int i = 0; i < 20; ++i) {
+		float mid = (low + high) / 2.0f;
+		if (proportionalGrowth(mid, period) > 1.0f)
+			high = mid;
+		else
+			low = mid;
+	}
+	float ku_ref = (low + high) / 2.0f;
+	proportionalGrowth(ku_ref, period);
+	float tu_ref = period;
+	printf("  Ku = %.2f, Tu = %.3f s\n", ku_ref, tu_ref);
+
+	printf("\nRate stage\n");
+	RelayTuner tuner;
+	float took = tuneRate(tuner, 20.0f);
+	float ku = tuner.getUltimateGain(), tu = tuner.getUltimatePeriod();
+	printf("  relay: Ku = %.2f, Tu = %.3f s after %.2f s\n", ku, tu, took);
+	check(took > 0.0f && took < 3.0f, "finishes within 3 s");
+	check(fabs(ku - ku_ref) < 0.25f * ku_ref, "Ku within 25% of brute force");
+	check(fabs(tu - tu_ref) < 0.15f * tu_ref, "Tu within 15% of brute force");
+
+	float ratep, ratei, rated;
+	check(tuner.getGains(RelayTuner::RULE_TYREUS_LUYBEN, ratep, ratei, rated),
+			"gains available");
+	printf("  Tyreus-Luyben: P = %.3f, I = %.3f, D = %.4f\n",
+			ratep, ratei, rated);
+
+	StepResponse tl(60.0f, 0.0f, 3.0f);
+	rateStep(ratep, ratei, rated, tl);
+	printf("  60 dps step: settled %.2f s, overshoot %.0f%%\n",
+			tl.settlingTime(), tl.overshoot() * 100.0f);
+	check(tl.settlingTime() >= 0.0f && tl.settlingTime() < 1.0f,
+			"tuned rate step settles within 1 s");
+	check(tl.overshoot() < 0.3f, "tuned rate step overshoot < 30%");
+
+	float znp, zni, znd;
+	tuner.getGains(RelayTuner::RULE_ZIEGLER_NICHOLS, znp, zni, znd);
+	printf("  Ziegler-Nichols: P = %.3f, I = %.3f, D = %.4f\n", znp, zni, znd);
+	StepResponse zn(60.0f, 0.0f, 3.0f);
+	rateStep(znp, zni, znd, zn);
+	printf("  60 dps step: settled %.2f s, overshoot %.0f%%\n",
+			zn.settlingTime(), zn.overshoot() * 100.0f);
+	check(zn.overshoot() > tl.overshoot(),
+			"Ziegler-Nichols overshoots more than Tyreus-Luyben");
+
+	printf("\nAngle stage (rate loop closed with the gains above)\n");
+	tuner.start(30.0f, 0.5f);
+	took = angleLoop(tuner, ratep, ratei, rated, 0.0f, 0.0f, 0.0f, 0);
+	printf("  relay: Ku = %.2f, Tu = %.3f s after %.2f s\n",
+			tuner.getUltimateGain(), tuner.getUltimatePeriod(), took);
+	check(took > 0.0f && took < 5.0f, "finishes within 5 s");
+
+	float anglep, anglei, angled;
+	check(tuner.getGains(RelayTuner::RULE_TYREUS_LUYBEN, anglep, anglei,
+			angled), "gains available");
+	printf("  Tyreus-Luyben: P = %.3f, I = %.3f, D = %.4f\n",
+			anglep, anglei, angled);
+
+	StepResponse as(20.0f, 0.0f, 2.0f);
+	angleLoop(tuner, ratep, ratei, rated, anglep, anglei, angled, &as);
+	printf("  20 degree step: settled %.2f s, overshoot %.0f%%\n",
+			as.settlingTime(), as.overshoot() * 100.0f);
+	check(as.settlingTime() >= 0.0f && as.settlingTime() < 4.0f,
+			"tuned angle step settles within 4 s");
+	check(as.overshoot() < 0.3f, "tuned angle step overshoot < 30%");
+
+	printf("\nFailure handling\n");
+	tuner.start(10.0f, 1.0f, 2.0f);
+	for (int i = 0; i < 3 * RATE; ++i)
+		tuner.feed(5.0f, 1.0f / RATE); // Plant that never responds
+	check(tuner.getState() == RelayTuner::STATE_FAILED,
+			"no oscillation times out");
+	check(tuner.feed(5.0f, 1.0f / RATE) == 0.0f, "output 0 once failed");
+	float p = -1.0f, i = -1.0f, d = -1.0f;
+	check(!tuner.getGains(RelayTuner::RULE_TYREUS_LUYBEN, p, i, d)
+			&& p == -1.0f, "no gains once failed");
+
+	tuner.start(10.0f, 1.0f);
+	tuner.abort();
+	check(tuner.getState() == RelayTuner::STATE_FAILED, "abort");
+	tuner.stop();
+	check(tuner.getState() == RelayTuner::STATE_IDLE, "stop");
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
+
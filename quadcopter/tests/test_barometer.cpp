@@ -0,0 +1,252 @@
+/*
+	test_barometer.cpp
+
+	Tests the Barometer (BMP085) driver against a simulated chip
+	(SimBarometer): the datasheet's compensation example, the conversion
+	state machine (never reading a result early, never more than one
+	transaction per update), synchronously and through an I2CEngine, and
+	recovery from failed transactions. Then the AltitudeEstimator against a
+	climb measured by a noisy barometer and a biased accelerometer, and
+	altitude hold (AltitudeHold) closing the loop around a simulated
+	quadcopter (SimVertical) through all of them.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cengine.h"
+#include "barometer.h"
+#include "altitudeestimator.h"
+#include "altitudehold.h"
+#include "simulator.h"
+
+#define BARO_ADDR 0x77
+#define DT        0.01f
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static float uniform(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+// Pressure at an altitude, the inverse of Barometer::pressureToAltitude()
+static float altitudeToPressure(float altitude) {
+	return BAROMETER_SEA_LEVEL * pow(1.0f - altitude / 44330.0f, 5.255f);
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+
+	printf("Driver:\n");
+	{
+		// BMP085 doc, p. 13
+		SimI2C       bus;
+		SimBarometer chip(&bus, BARO_ADDR);
+		chip.rawTemperature = 27898;
+		chip.rawPressure = 23843;
+		Barometer baro(&bus, BARO_ADDR, Barometer::OSS_ULTRA_LOW_POWER);
+		check(bus.registers[BARO_ADDR][0xF4] == 0x2E,
+				"temperature conversion started");
+
+		for (int i = 0; i < 10 && baro.getSamples() == 0; ++i) {
+			chip.step(0.005f);
+			baro.update(0.005f);
+		}
+		check(baro.getTemperature() == 15.0f && baro.getPressure() == 69964.0f,
+				"datasheet example: 15.0C, 69964Pa");
+	}
+	{
+		SimI2C       bus;
+		SimBarometer chip(&bus, BARO_ADDR);
+		chip.temperature = 21.3f;
+		chip.pressure = altitudeToPressure(120.0f);
+		Barometer baro(&bus, BARO_ADDR);
+
+		int  early = 0, most = 0;
+		for (int i = 0; i < 1000; ++i) {
+			chip.step(DT);
+			bool running = bus.registers[BARO_ADDR][0xF4] & 0x20;
+			int  before = bus.attempts;
+			baro.update(DT);
+			if (running && bus.attempts != before)
+				++early;
+			if (bus.attempts - before > most)
+				most = bus.attempts - before;
+		}
+		check(early == 0, "no result read before the conversion is done");
+		check(most == 1, "at most one transaction per update");
+
+		// 25.5ms pressures take 3 updates; a temperature 1 in every 11
+		long expected = (long)(1000 * BAROMETER_TEMP_INTERVAL
+				/ (3.0f * BAROMETER_TEMP_INTERVAL + 1.0f));
+		check(labs(baro.getSamples() - expected) <= 2,
+				"a pressure every 3 updates at 100Hz");
+		check(fabs(baro.getTemperature() - 21.3f) < 0.05f, "temperature");
+		check(fabs(baro.getAltitude() - 120.0f) < 0.1f, "altitude");
+
+		chip.temperature = 30.0f;
+		for (int i = 0; i < 40; ++i) {
+			chip.step(DT);
+			baro.update(DT);
+		}
+		check(fabs(baro.getTemperature() - 30.0f) < 0.05f
+				&& fabs(baro.getAltitude() - 120.0f) < 0.1f,
+				"temperature followed, pressure compensated");
+
+		// Failures: the conversion is started again, and readings resume
+		bus.failNext(1000, EIO);
+		for (int i = 0; i < 5; ++i) {
+			chip.step(DT);
+			baro.update(DT);
+		}
+		bus.failNext(0, 0);
+		long errors = baro.getErrors(), samples = baro.getSamples();
+		chip.pressure = altitudeToPressure(80.0f);
+		for (int i = 0; i < 100; ++i) {
+			chip.step(DT);
+			baro.update(DT);
+		}
+		check(errors > 0 && baro.getSamples() > samples + 25
+				&& fabs(baro.getAltitude() - 80.0f) < 0.1f,
+				"recovers from failed transactions");
+	}
+	{
+		SimI2C       bus;
+		SimBarometer chip(&bus, BARO_ADDR);
+		chip.pressure = altitudeToPressure(35.0f);
+		I2CEngine    engine(&bus);
+		Barometer    baro(&bus, BARO_ADDR);
+
+		for (int i = 0; i < 300; ++i) {
+			chip.step(DT);
+			baro.update(DT, &engine);
+			usleep(500); // Time for the engine to send it
+		}
+		check(baro.getSamples() >= 90 && baro.getErrors() == 0
+				&& fabs(baro.getAltitude() - 35.0f) < 0.1f,
+				"through an I2CEngine");
+	}
+
+	printf("Estimator:\n");
+	{
+		// Still for 10s (on the ground), climbing at 1m/s for 5s, then
+		// hovering. The
+		// barometer reads every 3 updates with +/-0.6m of noise; the
+		// accelerometer has a bias of 0.3m/s^2 and noise of its own.
+		AltitudeEstimator estimator;
+		float altitude = 10.0f, velocity = 0.0f;
+		float sumerror = 0.0f, sumnoise = 0.0f, worstclimb = 0.0f;
+		int   count = 0;
+		for (int i = 0; i < 4000; ++i) {
+			float t = i * DT,
+			      accel = 0.0f;
+			if (t >= 10.0f && t < 10.5f)
+				accel = 2.0f;
+			else if (t >= 14.5f && t < 15.0f)
+				accel = -2.0f;
+			velocity += accel * DT;
+			altitude += velocity * DT;
+
+			estimator.predict(accel + 0.3f + uniform(-0.5f, 0.5f), DT);
+			if (i % 3 == 0) {
+				float noise = uniform(-0.6f, 0.6f);
+				estimator.correct(altitude + noise);
+				if (t > 10.0f) {
+					sumnoise += noise * noise;
+					sumerror += (estimator.getAltitude() - altitude)
+							* (estimator.getAltitude() - altitude);
+					++count;
+				}
+			}
+			if (t > 12.0f && t < 14.5f)
+				worstclimb = fmax(worstclimb,
+						fabs(estimator.getVelocity() - 1.0f));
+		}
+		check(sqrt(sumerror / count) < 0.5f * sqrt(sumnoise / count),
+				"altitude error under half the barometer's noise");
+		check(worstclimb < 0.25f, "climb rate within 0.25m/s");
+		check(fabs(estimator.getBias() - 0.3f) < 0.05f
+				&& fabs(estimator.getAltitude() - altitude) < 0.3f,
+				"accelerometer bias learnt");
+	}
+
+	printf("Altitude hold:\n");
+	{
+		// The quadcopter flies at 50m; the hold is engaged with a hover
+		// throttle 0.05 short of the true one
+		SimI2C            bus;
+		SimBarometer      chip(&bus, BARO_ADDR);
+		SimVertical       quad(50.0f, 0.55f);
+		AltitudeEstimator estimator;
+		AltitudeHold      hold;
+
+		chip.pressure = altitudeToPressure(quad.altitude);
+		Barometer baro(&bus, BARO_ADDR);
+		for (int i = 0; i < 10; ++i) {
+			chip.step(DT);
+			if (baro.update(DT))
+				estimator.correct(baro.getAltitude());
+		}
+
+		float stick = 0.5f, throttle = 0.5f, worst = 0.0f;
+		hold.engage(estimator.getAltitude(), 0.5f);
+		for (int i = 0; i < 4500; ++i) {
+			float t = i * DT;
+			if (t >= 15.0f && t < 18.0f)
+				stick = 1.0f;
+			else
+				stick = 0.5f;
+
+			throttle = hold.update(stick, estimator.getAltitude(),
+					estimator.getVelocity(), DT);
+			quad.step(throttle, DT);
+
+			// Pressure noise of about +/-0.5m
+			chip.pressure = altitudeToPressure(quad.altitude)
+					+ uniform(-6.0f, 6.0f);
+			chip.step(DT);
+			estimator.predict(quad.accel + 0.2f + uniform(-0.5f, 0.5f), DT);
+			if (baro.update(DT))
+				estimator.correct(baro.getAltitude());
+
+			if (t >= 10.0f && t < 15.0f)
+				worst = fmax(worst, fabs(quad.altitude - 50.0f));
+			if (i == 1500 - 1) {
+				check(worst < 0.5f, "holds altitude despite the hover error");
+				worst = 0.0f;
+			}
+			if (t >= 17.0f && t < 18.0f)
+				worst = fmax(worst, fabs(quad.velocity - 1.0f));
+			if (i == 1800 - 1) {
+				check(worst < 0.15f, "full stick climbs at 1m/s");
+				worst = 0.0f;
+			}
+			if (t >= 35.0f)
+				worst = fmax(worst, fabs(quad.altitude - hold.getTargetAltitude()));
+		}
+		check(fabs(hold.getTargetAltitude() - 53.0f) < 0.5f && worst < 0.5f,
+				"holds the new altitude");
+		check(fabs(throttle - 0.55f) < 0.02f, "hover throttle found");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,260 @@
+/*
+	test_calibration.cpp
+
+	Tests the calibration engine on synthetic sensor data: an accelerometer
+	with offset, per-axis scale and misaligned axes, and a gyroscope whose
+	bias drifts with temperature, both with noise and with the sensor being
+	moved between the still periods. Also that a bias estimate seeded from
+	a temperature model keeps it when more still windows come in.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "geometry.h"
+#include "calibration.h"
+
+#define WINDOW 50
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+// Roughly normal noise with the given standard deviation
+static float noise(float sigma) {
+	float sum = 0.0f;
+	for (int i = 0; i < 12; ++i)
+		sum += rand() / (float)RAND_MAX;
+	return (sum - 6.0f) * sigma;
+}
+
+/*
+	Synthetic accelerometer: raw = S * g + b
+*/
+struct SimAccel {
+	Matrix3<float> s;
+	Vector3<float> b;
+
+	SimAccel() : s(1.0f), b(0.04f, -0.03f, 0.06f) {
+		s.m[0][0] = 1.05f;  s.m[0][1] = 0.02f;  s.m[0][2] = -0.01f;
+		s.m[1][0] = -0.015f; s.m[1][1] = 0.96f; s.m[1][2] = 0.03f;
+		s.m[2][0] = 0.01f;  s.m[2][1] = -0.02f; s.m[2][2] = 1.02f;
+	}
+
+	Vector3<float> read(const Vector3<float> &g, float sigma) {
+		Vector3<float> raw = s * g;
+		return Vector3<float>(raw.x + b.x + noise(sigma),
+		                      raw.y + b.y + noise(sigma),
+		                      raw.z + b.z + noise(sigma));
+	}
+};
+
+static Vector3<float> gravity(float roll, float pitch) {
+	float r = roll * PI / 180.0f, p = pitch * PI / 180.0f;
+	return Vector3<float>(sinf(r) * cosf(p), sinf(p), -cosf(r) * cosf(p));
+}
+
+/*
+	Feed the detector until it finds a still window, as
+	Drive::calibratePosition() does. Moves the sensor first for a while.
+*/
+static bool capture(StillnessDetector &still, SimAccel &accel,
+		const Vector3<float> &g, Vector3<float> &mean) {
+	still.reset();
+	for (int i = 0; i < 100; ++i) {
+		// Being turned over: changing orientation and large rates
+		Vector3<float> moving = gravity(i * 3.0f, i * 1.5f);
+		still.feed(accel.read(moving, 0.004f),
+				Vector3<float>(40.0f + noise(5.0f), noise(20.0f), 5.0f));
+	}
+	for (int i = 0; i < 200; ++i) {
+		if (still.feed(accel.read(g, 0.004f), Vector3<float>(noise(0.1f),
+				noise(0.1f), noise(0.1f)))) {
+			mean = still.getAccelMean();
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char **argv) {
+	srand(42);
+
+	printf("Matrix3\n");
+	Matrix3<float> m(2.0f);
+	m.m[0][1] = 1.0f;
+	Vector3<float> v = m * Vector3<float>(1.0f, 2.0f, 3.0f);
+	check(v.x == 4.0f && v.y == 4.0f && v.z == 6.0f, "matrix * vector");
+
+	printf("\nStillness detection\n");
+	StillnessDetector still(WINDOW);
+	bool early = false;
+	for (int i = 0; i < WINDOW - 1; ++i)
+		early |= still.feed(Vector3<float>(0.0f, 0.0f, -1.0f),
+				Vector3<float>(0.0f, 0.0f, 0.0f));
+	check(!early, "not still until the window is full");
+	check(still.feed(Vector3<float>(0.0f, 0.0f, -1.0f),
+			Vector3<float>(0.0f, 0.0f, 0.0f)), "still once full");
+
+	bool moving = false;
+	still.reset();
+	for (int i = 0; i < WINDOW; ++i)
+		moving |= still.feed(Vector3<float>(0.0f, 0.0f, -1.0f),
+				Vector3<float>(noise(3.0f), 0.0f, 0.0f));
+	check(!moving, "gyro noise of 3 dps is not still");
+
+	moving = false;
+	still.reset();
+	for (int i = 0; i < WINDOW; ++i)
+		moving |= still.feed(gravity(i * 0.5f, 0.0f),
+				Vector3<float>(0.0f, 0.0f, 0.0f));
+	check(!moving, "tilting is not still");
+
+	printf("\nSix-position accelerometer fit\n");
+	SimAccel accel;
+	AccelCalibrator calibrator;
+	const Vector3<float> faces[6] = {
+		Vector3<float>(0.0f, 0.0f, -1.0f), Vector3<float>(0.0f, 0.0f, 1.0f),
+		Vector3<float>(1.0f, 0.0f, 0.0f),  Vector3<float>(-1.0f, 0.0f, 0.0f),
+		Vector3<float>(0.0f, 1.0f, 0.0f),  Vector3<float>(0.0f, -1.0f, 0.0f)
+	};
+
+	bool captured = true, threw = false;
+	for (int f = 0; f < 6; ++f) {
+		Vector3<float> mean;
+		captured &= capture(still, accel, faces[f], mean);
+		calibrator.addPosition(mean);
+
+		if (f == 4) {
+			try {
+				calibrator.fit();
+			} catch (CalibrationException &e) {
+				threw = true;
+			}
+		}
+	}
+	check(captured, "each position captured after moving");
+	check(threw, "fit needs all six positions");
+	check(calibrator.isComplete(), "all six positions recognized");
+
+	AccelCalibration cal = calibrator.fit();
+	float worst = 0.0f, worstraw = 0.0f;
+	for (int roll = -60; roll <= 60; roll += 15) {
+		for (int pitch = -60; pitch <= 60; pitch += 15) {
+			Vector3<float> g = gravity(roll, pitch);
+			Vector3<float> raw = accel.read(g, 0.0f);
+			Vector3<float> fixed = cal.apply(raw);
+
+			Vector3<float> err(fixed.x - g.x, fixed.y - g.y, fixed.z - g.z);
+			if (magnitude(err) > worst)
+				worst = magnitude(err);
+
+			// What an offset-only calibration (level) would give
+			Vector3<float> level = accel.read(faces[0], 0.0f);
+			Vector3<float> off(raw.x - level.x - g.x, raw.y - level.y - g.y,
+					raw.z - level.z - 1.0f - g.z);
+			if (magnitude(off) > worstraw)
+				worstraw = magnitude(off);
+		}
+	}
+	printf("  worst error within 60 degrees: %.4f g (offset only: %.4f g)\n",
+			worst, worstraw);
+	check(worst < 0.005f, "error within 60 degrees < 0.005 g");
+	check(worst < worstraw / 5.0f, "5x better than offset only");
+
+	printf("\nGyroscope bias\n");
+	// Bias is 1.5, -0.8, 0.3 dps at 20 degrees, drifting 0.05 dps/degree
+	GyroBiasEstimator estimator;
+	StillnessDetector gstill(WINDOW);
+	int sincewindow = 0;
+	for (int minute = 0; minute < 10; ++minute) {
+		float temp = 20.0f + minute * 0.8f;
+		float drift = 0.05f * (temp - 20.0f);
+
+		for (int i = 0; i < 6000; ++i) {
+			// Picked up and put down every 20 s
+			bool handled = (i % 2000) < 300;
+			Vector3<float> rate(1.5f + drift + noise(0.15f),
+					-0.8f + drift + noise(0.15f), 0.3f + drift + noise(0.15f));
+			if (handled) {
+				rate.x += 30.0f * sinf(i * 0.05f);
+				rate.z += 10.0f;
+			}
+
+			++sincewindow;
+			if (gstill.feed(Vector3<float>(0.0f, 0.0f, -1.0f), rate)
+					&& sincewindow >= WINDOW) {
+				estimator.addStill(gstill.getGyroMean(), temp, WINDOW);
+				sincewindow = 0;
+			}
+		}
+	}
+
+	GyroCalibration gcal = estimator.fit();
+	Vector3<float> at20 = gcal.apply(Vector3<float>(1.5f, -0.8f, 0.3f), 20.0f);
+	Vector3<float> at27 = gcal.apply(Vector3<float>(1.85f, -0.45f, 0.65f),
+			27.0f);
+	printf("  slope %.4f %.4f %.4f dps/degree\n", gcal.slope.x, gcal.slope.y,
+			gcal.slope.z);
+	printf("  residual at 20: %.4f %.4f %.4f, at 27: %.4f %.4f %.4f\n",
+			at20.x, at20.y, at20.z, at27.x, at27.y, at27.z);
+	check(estimator.getSamples() > 0, "still windows found between handling");
+	check(fabs(gcal.slope.x - 0.05f) < 0.005f
+			&& fabs(gcal.slope.z - 0.05f) < 0.005f, "temperature slope fitted");
+	check(magnitude(at20) < 0.02f && magnitude(at27) < 0.02f,
+			"bias removed to within 0.02 dps");
+
+	GyroBiasEstimator constant;
+	constant.addStill(Vector3<float>(1.0f, 2.0f, 3.0f), 20.0f, 50);
+	constant.addStill(Vector3<float>(1.2f, 2.2f, 3.2f), 21.0f, 50);
+	GyroCalibration ccal = constant.fit();
+	check(ccal.slope.x == 0.0f && fabs(ccal.bias.x - 1.1f) < 1e-5f,
+			"constant bias over a small temperature span");
+
+	// Seeded from the fitted model, one still window at a single
+	// temperature shifts the bias but keeps the slope
+	GyroBiasEstimator seeded;
+	seeded.seed(gcal, 500);
+	GyroCalibration same = seeded.fit();
+	check(fabs(same.slope.x - gcal.slope.x) < 1e-5f
+			&& magnitude(same.apply(Vector3<float>(1.5f, -0.8f, 0.3f), 20.0f)
+				- at20) < 1e-4f, "seeded fit gives back the model");
+	// The model's bias at 23 degrees, plus 0.1 dps
+	Vector3<float> shifted(1.75f, -0.55f, 0.55f);
+	seeded.addStill(shifted, 23.0f, 50);
+	GyroCalibration refit = seeded.fit();
+	check(fabs(refit.slope.x - gcal.slope.x) < 0.01f
+			&& fabs(refit.slope.z - gcal.slope.z) < 0.01f,
+			"one window after seeding keeps the slope");
+	check(fabs(refit.apply(shifted, 23.0f).x) < 0.095f,
+			"and moves the bias toward it");
+
+	seeded.seed(ccal, 100);
+	GyroCalibration cseed = seeded.fit();
+	check(cseed.slope.x == 0.0f && fabs(cseed.bias.x - ccal.bias.x) < 1e-5f,
+			"seeded constant stays constant");
+
+	threw = false;
+	try {
+		GyroBiasEstimator empty;
+		empty.fit();
+	} catch (CalibrationException &e) {
+		threw = true;
+	}
+	check(threw, "no still readings throws");
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,410 @@
+/*
+	test_configstore.cpp
+
+	Tests ConfigStore: round trip of every section, rejection of corrupt,
+	truncated and foreign files, atomic replacement, files from a newer
+	version with a longer payload and from older versions with shorter
+	ones, a gain schedule too long to store, and import of the legacy INI calibration.
+	Also times loading the binary file against parsing the INI file.
+
+	Works in a temporary directory; does not need any hardware. Returns
+	non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <fstream>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "configstore.h"
+
+#define LOAD_ITERATIONS 2000
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static bool exists(const std::string &filename) {
+	struct stat st;
+	return stat(filename.c_str(), &st) == 0;
+}
+
+static std::string readFile(const std::string &filename) {
+	std::ifstream file(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+	return std::string((std::istreambuf_iterator<char>(file)),
+			std::istreambuf_iterator<char>());
+}
+
+static void writeFile(const std::string &filename, const std::string &data) {
+	std::ofstream file(filename.c_str(),
+			std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	file.write(data.data(), data.size());
+}
+
+// Returns true if loading the file throws ConfigException
+static bool loadThrows(const std::string &filename) {
+	try {
+		ConfigStore(filename).load();
+	} catch (ConfigException &e) {
+		return true;
+	}
+	return false;
+}
+
+// CRC-32 (IEEE), bit by bit, to check the store's table-driven one against
+static uint32_t crc32(const unsigned char *data, size_t length) {
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < length; ++i) {
+		crc ^= data[i];
+		for (int k = 0; k < 8; ++k)
+			crc = (crc & 1 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1);
+	}
+	return crc ^ 0xFFFFFFFFu;
+}
+
+static double elapsed(const struct timeval &start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+}
+
+static Config sampleConfig() {
+	Config config;
+	config.sections = CONFIG_CALIBRATION | CONFIG_GAINS | CONFIG_MOTORS
+			| CONFIG_TIMING | CONFIG_MAGNETOMETER | CONFIG_FILTERS
+			| CONFIG_SCHEDULE;
+	for (int r = 0; r < 3; ++r)
+		for (int c = 0; c < 3; ++c)
+			config.accel.matrix.m[r][c] = (r == c ? 1.0f : 0.0f) + 0.01f * (r * 3 + c);
+	config.accel.offset = Vector3<float>(0.04f, -0.03f, 0.06f);
+	config.accel.fitted = true;
+	config.gyro.bias = Vector3<float>(1.5f, -2.25f, 0.125f);
+	config.gyro.slope = Vector3<float>(0.05f, -0.01f, 0.02f);
+	config.gyro.reftemp = 23.5f;
+	float angle[3] = { 2.0f, 0.5f, 0.01f },
+	      rate[3] = { 1.2f, 0.4f, 0.02f };
+	memcpy(config.angleGains, angle, sizeof(angle));
+	memcpy(config.rateGains, rate, sizeof(rate));
+	int motors[4] = { 0, 2, 5, 7 };
+	memcpy(config.motors, motors, sizeof(motors));
+	config.updateRate = 100;
+	config.smoothing = 3;
+	for (int i = 0; i < 3; ++i)
+		config.mag.matrix.m[i][i] = 0.9f + 0.1f * i;
+	config.mag.offset = Vector3<float>(0.125f, -0.05f, 0.3f);
+	config.filters[0][0] = FilterStage(FILTER_NOTCH, 87.5f, 3.0f);
+	config.filters[0][1] = FilterStage(FILTER_LOWPASS2, 40.0f, 0.7071f);
+	config.filters[5][3] = FilterStage(FILTER_MEDIAN, 0.0f, 3.0f);
+	config.scheduleCount = 2;
+	for (int i = 0; i < 2; ++i) {
+		GainSchedule::Breakpoint &bp = config.schedule[i];
+		bp.throttle = 0.25f + 0.5f * i;
+		bp.voltage = 11.1f;
+		for (int k = 0; k < 3; ++k) {
+			bp.gains.angle[k] = angle[k] * (1.0f + i);
+			bp.gains.rate[k] = rate[k] * (1.0f - 0.25f * i);
+		}
+	}
+	return config;
+}
+
+static bool sameConfig(const Config &a, const Config &b) {
+	for (int r = 0; r < 3; ++r)
+		for (int c = 0; c < 3; ++c)
+			if (a.accel.matrix.m[r][c] != b.accel.matrix.m[r][c])
+				return false;
+	for (int i = 0; i < 3; ++i)
+		if (a.angleGains[i] != b.angleGains[i]
+				|| a.rateGains[i] != b.rateGains[i])
+			return false;
+	for (int i = 0; i < 4; ++i)
+		if (a.motors[i] != b.motors[i])
+			return false;
+	for (int r = 0; r < 3; ++r)
+		for (int c = 0; c < 3; ++c)
+			if (a.mag.matrix.m[r][c] != b.mag.matrix.m[r][c])
+				return false;
+	for (int c = 0; c < CONFIG_FILTER_CHANNELS; ++c)
+		for (int i = 0; i < FILTER_MAX_STAGES; ++i)
+			if (a.filters[c][i].type != b.filters[c][i].type
+					|| a.filters[c][i].frequency != b.filters[c][i].frequency
+					|| a.filters[c][i].param != b.filters[c][i].param)
+				return false;
+	for (int i = 0; i < CONFIG_SCHEDULE_POINTS; ++i) {
+		const GainSchedule::Breakpoint &p = a.schedule[i], &q = b.schedule[i];
+		if (p.throttle != q.throttle || p.voltage != q.voltage)
+			return false;
+		for (int k = 0; k < 3; ++k)
+			if (p.gains.angle[k] != q.gains.angle[k]
+					|| p.gains.rate[k] != q.gains.rate[k])
+				return false;
+	}
+	return a.sections == b.sections
+			&& a.scheduleCount == b.scheduleCount
+			&& a.mag.offset.x == b.mag.offset.x
+			&& a.mag.offset.y == b.mag.offset.y
+			&& a.mag.offset.z == b.mag.offset.z
+			&& a.accel.offset.x == b.accel.offset.x
+			&& a.accel.offset.y == b.accel.offset.y
+			&& a.accel.offset.z == b.accel.offset.z
+			&& a.accel.fitted == b.accel.fitted
+			&& a.gyro.bias.x == b.gyro.bias.x
+			&& a.gyro.bias.y == b.gyro.bias.y
+			&& a.gyro.bias.z == b.gyro.bias.z
+			&& a.gyro.slope.x == b.gyro.slope.x
+			&& a.gyro.slope.y == b.gyro.slope.y
+			&& a.gyro.slope.z == b.gyro.slope.z
+			&& a.gyro.reftemp == b.gyro.reftemp
+			&& a.updateRate == b.updateRate
+			&& a.smoothing == b.smoothing;
+}
+
+int main(int argc, char **argv) {
+	char dirtemplate[] = "/tmp/test_configstore.XXXXXX";
+	if (mkdtemp(dirtemplate) == NULL) {
+		printf("Could not create a temporary directory\n");
+		return 1;
+	}
+	std::string dir = dirtemplate,
+	            cfgfile = dir + "/quadcopter.cfg",
+	            inifile = dir + "/calibration.ini";
+
+	printf("Round trip:\n");
+
+	Config saved = sampleConfig();
+	ConfigStore store(cfgfile);
+	store.save(saved);
+	Config loaded = store.load();
+	check(sameConfig(saved, loaded), "all sections read back exactly");
+	check(!exists(cfgfile + ".tmp"), "no temporary file left behind");
+
+	std::string image = readFile(cfgfile);
+	check(image.size() == 16 + 984 && image.compare(0, 4, "QCFG") == 0,
+			"header and payload size");
+
+	Config empty;
+	store.save(empty);
+	check(store.load().sections == 0, "empty config has no sections");
+
+	Config crowded = saved;
+	crowded.scheduleCount = CONFIG_SCHEDULE_POINTS + 1;
+	bool threw = false;
+	try {
+		store.save(crowded);
+	} catch (ConfigException &e) {
+		threw = true;
+	}
+	check(threw && store.load().sections == 0,
+			"too many breakpoints not saved");
+
+	printf("Invalid files:\n");
+
+	check(loadThrows(dir + "/missing.cfg"), "missing file throws");
+
+	std::string corrupt = image;
+	corrupt[16 + 40] ^= 0x10;
+	writeFile(cfgfile, corrupt);
+	check(loadThrows(cfgfile), "flipped payload bit throws");
+
+	writeFile(cfgfile, image.substr(0, image.size() - 4));
+	check(loadThrows(cfgfile), "truncated payload throws");
+
+	writeFile(cfgfile, image.substr(0, 10));
+	check(loadThrows(cfgfile), "truncated header throws");
+
+	std::string foreign = image;
+	foreign[0] = 'X';
+	writeFile(cfgfile, foreign);
+	check(loadThrows(cfgfile), "wrong magic throws");
+
+	printf("Versions:\n");
+
+	// A newer version, with fields appended to the payload
+	std::string newer = image + std::string(8, '\x55');
+	uint32_t length = newer.size() - 16,
+	         crc = crc32((const unsigned char *)newer.data() + 16, length);
+	newer[4] = 2;
+	memcpy(&newer[8], &length, 4);
+	memcpy(&newer[12], &crc, 4);
+	writeFile(cfgfile, newer);
+	check(!loadThrows(cfgfile)
+			&& sameConfig(saved, ConfigStore(cfgfile).load()),
+			"newer version with a longer payload is read");
+
+	// The first version, without the magnetometer fields
+	std::string older = image.substr(0, 16 + 132);
+	length = older.size() - 16;
+	crc = crc32((const unsigned char *)older.data() + 16, length);
+	memcpy(&older[8], &length, 4);
+	memcpy(&older[12], &crc, 4);
+	writeFile(cfgfile, older);
+	Config olderconfig;
+	check(!loadThrows(cfgfile)
+			&& (olderconfig = ConfigStore(cfgfile).load()).sections
+				== (saved.sections & ~(CONFIG_MAGNETOMETER | CONFIG_FILTERS
+					| CONFIG_SCHEDULE))
+			&& olderconfig.smoothing == saved.smoothing
+			&& olderconfig.mag.matrix.m[0][0] == 1.0f,
+			"first version's payload read, without magnetometer");
+
+	// The second version, with the magnetometer but without the filters
+	older = image.substr(0, 16 + 180);
+	length = older.size() - 16;
+	crc = crc32((const unsigned char *)older.data() + 16, length);
+	memcpy(&older[8], &length, 4);
+	memcpy(&older[12], &crc, 4);
+	writeFile(cfgfile, older);
+	check(!loadThrows(cfgfile)
+			&& (olderconfig = ConfigStore(cfgfile).load()).sections
+				== (saved.sections & ~(CONFIG_FILTERS | CONFIG_SCHEDULE))
+			&& olderconfig.mag.offset.z == saved.mag.offset.z
+			&& olderconfig.filters[0][0].type == FILTER_NONE,
+			"second version's payload read, without filters");
+
+	// The third version, with the filters but without the gain schedule
+	older = image.substr(0, 16 + 468);
+	length = older.size() - 16;
+	crc = crc32((const unsigned char *)older.data() + 16, length);
+	memcpy(&older[8], &length, 4);
+	memcpy(&older[12], &crc, 4);
+	writeFile(cfgfile, older);
+	check(!loadThrows(cfgfile)
+			&& (olderconfig = ConfigStore(cfgfile).load()).sections
+				== (saved.sections & ~CONFIG_SCHEDULE)
+			&& olderconfig.filters[5][3].type == FILTER_MEDIAN
+			&& olderconfig.scheduleCount == 0,
+			"third version's payload read, without gain schedule");
+
+	// A breakpoint count beyond the fixed array
+	std::string overfull = image;
+	uint32_t count = CONFIG_SCHEDULE_POINTS + 1;
+	memcpy(&overfull[16 + 468], &count, 4);
+	length = overfull.size() - 16;
+	crc = crc32((const unsigned char *)overfull.data() + 16, length);
+	memcpy(&overfull[12], &crc, 4);
+	writeFile(cfgfile, overfull);
+	check(loadThrows(cfgfile), "too many breakpoints throws");
+
+	writeFile(cfgfile, image + std::string(8, '\0'));
+	check(sameConfig(saved, ConfigStore(cfgfile).load()),
+			"trailing data after the payload ignored");
+
+	printf("Atomic save:\n");
+
+	writeFile(cfgfile, image);
+	ConfigStore bad(dir + "/nodir/quadcopter.cfg");
+	threw = false;
+	try {
+		bad.save(empty);
+	} catch (ConfigException &e) {
+		threw = true;
+	}
+	check(threw, "unwritable location throws");
+
+	// Make the temporary name a directory, so the save fails before the
+	// rename. The old file must be left as it was.
+	mkdir((cfgfile + ".tmp").c_str(), 0755);
+	threw = false;
+	try {
+		store.save(empty);
+	} catch (ConfigException &e) {
+		threw = true;
+	}
+	rmdir((cfgfile + ".tmp").c_str());
+	check(threw && readFile(cfgfile) == image, "failed save keeps the old file");
+
+	printf("Legacy import:\n");
+
+	writeFile(inifile, "AccelX=0.1\nAccelY=-0.2\nAccelZ=0.3\n"
+			"GyroX=1.5\nGyroY=-2\nGyroZ=0.25\n");
+	Config legacy = ConfigStore::importIni(inifile);
+	check(legacy.sections == CONFIG_CALIBRATION, "only the calibration section");
+	check(legacy.accel.offset.x == -0.1f && legacy.accel.offset.y == 0.2f
+			&& legacy.accel.offset.z == -0.3f, "legacy offsets negated");
+	check(legacy.accel.matrix.m[0][0] == 1.0f && !legacy.accel.fitted,
+			"legacy matrix is identity");
+	check(legacy.gyro.bias.x == 1.5f && legacy.gyro.bias.y == -2.0f
+			&& legacy.gyro.bias.z == 0.25f, "gyro bias");
+
+	std::string ini;
+	char line[128];
+	for (int r = 0; r < 3; ++r)
+		for (int c = 0; c < 3; ++c) {
+			sprintf(line, "AccelM%d%d=%.9g\n", r, c, saved.accel.matrix.m[r][c]);
+			ini += line;
+		}
+	sprintf(line, "AccelOffX=%.9g\nAccelOffY=%.9g\nAccelOffZ=%.9g\n",
+			saved.accel.offset.x, saved.accel.offset.y, saved.accel.offset.z);
+	ini += line;
+	ini += "AccelFitted=1\nSomeFutureKeyThatIsLongerThanTwentyChars=5\n";
+	sprintf(line, "GyroX=%.9g\nGyroY=%.9g\nGyroZ=%.9g\n",
+			saved.gyro.bias.x, saved.gyro.bias.y, saved.gyro.bias.z);
+	ini += line;
+	sprintf(line, "GyroSlopeX=%.9g\nGyroSlopeY=%.9g\nGyroSlopeZ=%.9g\n",
+			saved.gyro.slope.x, saved.gyro.slope.y, saved.gyro.slope.z);
+	ini += line;
+	sprintf(line, "GyroRefTemp=%.9g", saved.gyro.reftemp); // No newline
+	ini += line;
+	writeFile(inifile, ini);
+
+	Config full = ConfigStore::importIni(inifile);
+	Config expected = saved;
+	expected.sections = CONFIG_CALIBRATION;
+	memcpy(expected.angleGains, full.angleGains, sizeof(full.angleGains));
+	memcpy(expected.rateGains, full.rateGains, sizeof(full.rateGains));
+	memcpy(expected.motors, full.motors, sizeof(full.motors));
+	expected.updateRate = full.updateRate;
+	expected.smoothing = full.smoothing;
+	expected.mag = full.mag;
+	memcpy(expected.filters, full.filters, sizeof(full.filters));
+	expected.scheduleCount = full.scheduleCount;
+	memcpy(expected.schedule, full.schedule, sizeof(full.schedule));
+	check(sameConfig(expected, full), "full calibration imported");
+
+	threw = false;
+	try {
+		ConfigStore::importIni(dir + "/missing.ini");
+	} catch (ConfigException &e) {
+		threw = true;
+	}
+	check(threw, "missing INI file throws");
+
+	printf("Load time (%d loads):\n", LOAD_ITERATIONS);
+
+	store.save(saved);
+	struct timeval start;
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < LOAD_ITERATIONS; ++i)
+		loaded = store.load();
+	double binary = elapsed(start);
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < LOAD_ITERATIONS; ++i)
+		loaded = ConfigStore::importIni(inifile);
+	double text = elapsed(start);
+
+	printf("  binary %.2f us, INI %.2f us\n", binary * 1e6 / LOAD_ITERATIONS,
+			text * 1e6 / LOAD_ITERATIONS);
+
+	unlink(cfgfile.c_str());
+	unlink(inifile.c_str());
+	rmdir(dir.c_str());
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+	test_driveloop.cpp
+
+	Tests Drive::update() end to end against simulated sensors and PWM on a
+	SimI2C bus: that the configured filters run on each reading, before the
+	smoothing averages them, and that the configured gain schedule is set. With the EKF estimating, a gyroscope offset that the
+	calibration doesn't know about is picked up as the EKF's bias, and the
+	rates fed to the Rate PIDs have it taken off. Then that notching the
+	vibration peaks is refused without an analyzer sampling faster than the
+	updates. Then, armed, that a roll rate reaches the motors' PWM counts
+	through the Rate PIDs and the mix, in either build of the Rate stage
+	(float, or integer with FIXED_RATE_LOOP).
+
+	Runs in a temporary directory, so that Drive only finds the
+	configuration written here (and writes none). Takes a few seconds for the Drive's startup.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "exception.h"
+#include "pwm.h"
+#include "accelerometer.h"
+#include "gyroscope.h"
+#include "configstore.h"
+#include "filterchain.h"
+#include "drive.h"
+#include "vibrationanalyzer.h"
+#include "simulator.h"
+
+#define PWM_ADDR   0x40
+#define ACCEL_ADDR 0x53
+#define GYRO_ADDR  0x69
+
+#define UPDATE_RATE 100
+
+// Drive's motor range (ms), and the PWM's frequency (its default)
+#define MOTOR_MIN_HIGHTIME 1.26f
+#define MOTOR_MAX_HIGHTIME 1.6f
+#define PWM_FREQUENCY      20.0f
+
+static int failures = 0;
+
+static SimI2C *pwmbus;
+
+/**
+	Returns the PWM count last written to channel
+*/
+static int pwmCount(int channel) {
+	return pwmbus->registers[PWM_ADDR][0x08 + channel * 4]
+			| (pwmbus->registers[PWM_ADDR][0x09 + channel * 4] << 8);
+}
+
+/**
+	Returns the PWM count Motor gives speed
+*/
+static int motorCount(float speed) {
+	float hightime = MOTOR_MIN_HIGHTIME
+			+ (MOTOR_MAX_HIGHTIME - MOTOR_MIN_HIGHTIME) * speed;
+	return (int)(hightime * PWM_FREQUENCY / 1000.0f * 4095.0f);
+}
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+int main(int argc, char **argv) {
+	char dir[] = "/tmp/test_driveloopXXXXXX";
+	if (!mkdtemp(dir) || chdir(dir) != 0) {
+		printf("Could not make a temporary directory\n");
+		return 1;
+	}
+
+	try {
+		SimI2C bus;
+		bus.addSlave(PWM_ADDR);
+		pwmbus = &bus;
+		SimAccelerometer simaccel(&bus, ACCEL_ADDR);
+		SimGyroscope simgyro(&bus, GYRO_ADDR);
+		simaccel.set(Vector3<float>(0.0f, 0.0f, 1.0f));
+		simgyro.set(Vector3<float>(0.0f, 0.0f, 0.0f));
+
+		PWM pwm(&bus, PWM_ADDR);
+		Accelerometer accel(&bus, ACCEL_ADDR);
+		Gyroscope gyro(&bus, GYRO_ADDR);
+
+		printf("Filters run on each reading\n");
+		{
+			// A median of 3 on the gyroscope's pitch, and a smoothing of 3.
+			// Also a one-breakpoint gain schedule.
+			Config config;
+			config.sections = CONFIG_FILTERS | CONFIG_SCHEDULE;
+			config.filters[1][0] = FilterStage(FILTER_MEDIAN, 0.0f, 3.0f);
+			config.scheduleCount = 1;
+			config.schedule[0].throttle = 0.5f;
+			config.schedule[0].gains.rate[0] = 1.0f;
+			ConfigStore(CONFIG_FILE).save(config);
+
+			Drive drive(&pwm, &accel, &gyro, 0, 1, 2, 3, UPDATE_RATE, 3);
+			check(drive.waitReady(10000), "startup finishes");
+
+			// The median takes a single spike out of the readings, so the
+			// average never sees it. Applied to the average instead, it
+			// would let through a third of the spike.
+			float worst = 0.0f;
+			for (int i = 0; i < 10; ++i) {
+				simgyro.set(Vector3<float>(0.0f, (i == 3 ? 30.0f : 0.0f),
+						0.0f));
+				drive.update();
+				if (fabs(drive.getRates().y) > worst)
+					worst = fabs(drive.getRates().y);
+				usleep(1000000 / UPDATE_RATE);
+			}
+			printf("  largest rate %.2f dps\n", worst);
+			check(worst < 0.5f, "spike taken out before the smoothing");
+
+			printf("Gain schedule from the config file\n");
+			check(drive.isGainScheduling(), "schedule set and scheduling on");
+		}
+		unlink(CONFIG_FILE);
+
+		printf("EKF bias reaches the rate loop\n");
+		Drive drive(&pwm, &accel, &gyro, 0, 1, 2, 3, UPDATE_RATE, 1);
+		check(drive.waitReady(10000), "startup finishes");
+		check(!drive.isGainScheduling(), "no schedule without a config file");
+		drive.setEstimator(Drive::ESTIMATOR_EKF);
+
+		// Level and still, but for an offset of about 2 dps on pitch
+		// (roll and pitch biases are observable from the accelerometer;
+		// yaw's isn't). It wavers, so that the stillness calibration never
+		// sees a still window to take it off first.
+		Vector3<float> reading;
+		for (int i = 0; i < 6 * UPDATE_RATE; ++i) {
+			reading = Vector3<float>(0.0f, (i & 1) ? 3.0f : 1.0f, 0.0f);
+			simgyro.set(reading);
+			drive.update();
+			usleep(1000000 / UPDATE_RATE);
+		}
+
+		// The rates are the reading less the bias (the notch is off)
+		Vector3<float> bias = drive.getGyroBias();
+		Vector3<float> rates = drive.getRates();
+		check(fabs(bias.y) > 0.5f, "EKF has estimated a pitch bias");
+		check(fabs(rates.x - (reading.x - bias.x)) < 0.05f
+				&& fabs(rates.y - (reading.y - bias.y)) < 0.05f
+				&& fabs(rates.z - (reading.z - bias.z)) < 0.05f,
+				"rates fed to the PIDs have the bias taken off");
+
+		drive.setEstimator(Drive::ESTIMATOR_COMPLEMENTARY);
+		simgyro.set(reading);
+		drive.update();
+		bias = drive.getGyroBias();
+		rates = drive.getRates();
+		check(bias.x == 0.0f && bias.y == 0.0f && bias.z == 0.0f,
+				"no bias without the EKF");
+		check(fabs(rates.y - reading.y) < 0.05f,
+				"rates are the reading without the EKF");
+
+		printf("Notch modes\n");
+		bool refused = false;
+		try {
+			drive.setNotchMode(Drive::NOTCH_PEAKS);
+		} catch (DriveException &e) {
+			refused = true;
+		}
+		check(refused, "NOTCH_PEAKS refused without an analyzer");
+
+		VibrationAnalyzer slow(UPDATE_RATE), fast(4 * UPDATE_RATE);
+		drive.setVibrationAnalyzer(&slow);
+		refused = false;
+		try {
+			drive.setNotchMode(Drive::NOTCH_PEAKS);
+		} catch (DriveException &e) {
+			refused = true;
+		}
+		check(refused && drive.getNotchMode() == Drive::NOTCH_OFF,
+				"and with one at the update rate");
+
+		drive.setVibrationAnalyzer(&fast);
+		drive.setNotchMode(Drive::NOTCH_PEAKS);
+		check(drive.getNotchMode() == Drive::NOTCH_PEAKS,
+				"taken with one sampling faster");
+		drive.setVibrationAnalyzer(0);
+
+		printf("Rate loop to the motors\n");
+		drive.setPIDAngle(0.0f, 0.0f, 0.0f);
+		drive.setPIDRate(1.0f, 0.0f, 0.0f);
+		drive.move(Vector3<float>(0.0f, 0.0f, 0.0f));
+		simgyro.set(Vector3<float>(0.0f, 0.0f, 0.0f));
+		drive.arm();
+		for (int i = 0; i < 2 * UPDATE_RATE; ++i) {
+			drive.packetReceived();
+			drive.update();
+			usleep(1000000 / UPDATE_RATE);
+		}
+		check(drive.getFlightState() == FlightState::STATE_ARMED, "armed");
+
+		// Rolling right at 20 dps: the Rate PID corrects by -20, so the
+		// left motors (0, 3) speed up by 0.2 and the right ones slow down
+		drive.move(Vector3<float>(0.0f, 0.0f, 0.5f));
+		simgyro.set(Vector3<float>(20.0f, 0.0f, 0.0f));
+		for (int i = 0; i < UPDATE_RATE / 10; ++i) {
+			drive.packetReceived();
+			drive.update();
+			usleep(1000000 / UPDATE_RATE);
+		}
+		int left = motorCount(0.7f), right = motorCount(0.3f);
+		printf("  counts %d %d %d %d, expected %d %d %d %d\n",
+				pwmCount(0), pwmCount(1), pwmCount(2), pwmCount(3),
+				left, right, right, left);
+		check(abs(pwmCount(0) - left) <= 1 && abs(pwmCount(3) - left) <= 1
+				&& abs(pwmCount(1) - right) <= 1
+				&& abs(pwmCount(2) - right) <= 1,
+				"motor counts follow the roll rate");
+		drive.disarm();
+		drive.update();
+	} catch (Exception &e) {
+		printf("Exception: %s\n", e.getDescription().c_str());
+		++failures;
+	}
+
+	if (chdir("/") == 0)
+		rmdir(dir);
+
+	printf("\nDone!\n");
+	return failures ? 1 : 0;
+}
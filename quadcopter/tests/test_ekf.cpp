@@ -0,0 +1,246 @@
+/*
+	test_ekf.cpp
+
+	Tests the fixed-size Matrix templates, then the AttitudeEKF against a
+	simulated quadcopter: held tilted with a biased, noisy gyroscope (the
+	attitude, heading and all three biases are found), tumbling through
+	large rotations (the attitude is tracked where the gyroscope alone
+	drifts), and climbing with a noisy barometer (velocity and altitude).
+
+	Headings are made with Magnetometer::getHeading() from a simulated
+	field, and roll and pitch compared with Drive's formulas, so the filter
+	is checked against the conventions of the rest of the system.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "geometry.h"
+#include "matrix.h"
+#include "attitudeekf.h"
+#include "altitudeestimator.h"
+#include "magnetometer.h"
+
+#define DT 0.0025f // 400Hz
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static float uniform(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+/*
+	The true attitude rotates the quadcopter's axes into the world's (X
+	north, Z down)
+*/
+typedef Quaternion<double> Attitude;
+
+// Rotation by degrees about a (unit) axis
+static Attitude about(double degrees, double ax, double ay, double az) {
+	return Attitude::fromAxisAngle(Vector3<double>(ax, ay, az), degrees);
+}
+
+// Turn by body rates (deg/s) for dtime seconds
+static void turn(Attitude &attitude, const Vector3<float> &rates,
+		float dtime) {
+	attitude = attitude * Attitude::fromRotationVector(Vector3<double>(
+			rates.x * dtime, rates.y * dtime, rates.z * dtime));
+}
+
+// A world vector in the quadcopter's axes
+static Vector3<float> toBody(const Attitude &attitude,
+		const Vector3<float> &v) {
+	Vector3<double> r = attitude.conjugate().rotate(
+			Vector3<double>(v.x, v.y, v.z));
+	return Vector3<float>(r.x, r.y, r.z);
+}
+
+// The Earth's field (gauss) and "up" as the accelerometer reads it
+static const Vector3<float> EARTH(0.2f, 0.0f, 0.4f),
+                            UP(0.0f, 0.0f, -1.0f);
+
+static Vector3<float> noisy(const Vector3<float> &v, float noise) {
+	return Vector3<float>(v.x + uniform(-noise, noise),
+			v.y + uniform(-noise, noise), v.z + uniform(-noise, noise));
+}
+
+static bool near(const Vector3<float> &a, const Vector3<float> &b,
+		float tolerance) {
+	return fabs(a.x - b.x) <= tolerance && fabs(a.y - b.y) <= tolerance
+			&& fabs(a.z - b.z) <= tolerance;
+}
+
+// Angle in degrees between two vectors
+static float angleBetween(const Vector3<float> &a, const Vector3<float> &b) {
+	float d = dot(a, b) / (magnitude(a) * magnitude(b));
+	return acos(fmin(1.0f, fmax(-1.0f, d))) * 180.0 / PI;
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+
+	printf("Matrix:\n");
+	{
+		Matrix<float, 2, 3> a;
+		Matrix<float, 3, 2> b;
+		for (int r = 0; r < 2; ++r)
+			for (int c = 0; c < 3; ++c) {
+				a(r, c) = r * 3 + c + 1;   // 1 2 3 / 4 5 6
+				b(c, r) = (c + 1) * (r + 1); // 1 2 / 2 4 / 3 6
+			}
+		Matrix<float, 2, 2> ab = a * b;
+		check(ab(0, 0) == 14 && ab(0, 1) == 28 && ab(1, 0) == 32
+				&& ab(1, 1) == 64, "multiply");
+
+		Matrix<float, 2, 2> abt = multiplyTransposed(a, b.transpose());
+		bool same = true;
+		for (int r = 0; r < 2; ++r)
+			for (int c = 0; c < 2; ++c)
+				same = same && abt(r, c) == ab(r, c);
+		check(same, "multiplyTransposed, transpose");
+
+		Matrix<float, 3, 3> i(1.0f);
+		Matrix<float, 2, 3> ai = a * i, sum = a + a * 2.0f - a;
+		same = true;
+		for (int r = 0; r < 2; ++r)
+			for (int c = 0; c < 3; ++c)
+				same = same && ai(r, c) == a(r, c)
+						&& sum(r, c) == 2.0f * a(r, c);
+		check(same, "identity, add, subtract, scale");
+
+		Matrix<float, 3, 3> s(0.0f);
+		s(0, 2) = 1.0f;
+		s(2, 0) = 3.0f;
+		symmetrize(s);
+		check(s(0, 2) == 2.0f && s(2, 0) == 2.0f, "symmetrize");
+	}
+
+	printf("Held tilted:\n");
+	{
+		// Rolled 20 degrees and pitched -10, at heading 70
+		Attitude truth = about(70.0, 0, 0, 1) * about(-10.0, 1, 0, 0)
+				* about(20.0, 0, 1, 0);
+		Vector3<float> bias(0.8f, -0.5f, 0.3f);
+		Vector3<float> up = toBody(truth, UP), field = toBody(truth, EARTH);
+
+		AttitudeEKF ekf;
+		for (int i = 0; i < 40 * 400; ++i) {
+			Vector3<float> accel = noisy(up, 0.02f);
+			ekf.predict(noisy(bias, 0.5f), accel, DT);
+			ekf.correctAccelerometer(accel);
+			if (i % 5 == 0)
+				ekf.correctHeading(Magnetometer::getHeading(
+						noisy(field, 0.005f), accel));
+		}
+
+		float roll = atan2(up.x, -up.z) * 180.0 / PI,
+		      pitch = atan2(up.y, -sign(up.z)
+		              * sqrt(up.x * up.x + up.z * up.z)) * 180.0 / PI;
+		check(fabs(ekf.getRoll() - roll) < 0.5f
+				&& fabs(ekf.getPitch() - pitch) < 0.5f,
+				"roll and pitch as Drive's");
+		check(fabs(angleDifference(ekf.getYaw(),
+				Magnetometer::getHeading(field, up))) < 1.0f,
+				"yaw at the heading");
+		check(near(ekf.getGyroBias(), bias, 0.1f), "gyroscope bias on all axes");
+		check(!ekf.correctAccelerometer(up * 1.3f),
+				"accelerating: not used");
+	}
+
+	printf("Tumbling:\n");
+	{
+		Attitude truth, gyroonly;
+		Vector3<float> bias(1.0f, -0.7f, 0.5f);
+		AttitudeEKF ekf;
+		float worstup = 0.0f, worstyaw = 0.0f, gyroup = 0.0f;
+		for (int i = 0; i < 60 * 400; ++i) {
+			float t = i * DT;
+			Vector3<float> rates(90.0f * sin(t * 1.3f),
+					70.0f * sin(t * 0.7f + 1.0f), 120.0f * sin(t * 0.4f));
+			turn(truth, rates, DT);
+
+			Vector3<float> up = toBody(truth, UP),
+			               gyro = noisy(Vector3<float>(rates.x + bias.x,
+			                       rates.y + bias.y, rates.z + bias.z), 0.5f),
+			               accel = noisy(up, 0.02f);
+			turn(gyroonly, gyro, DT);
+			ekf.predict(gyro, accel, DT);
+			ekf.correctAccelerometer(accel);
+			if (i % 5 == 0)
+				ekf.correctHeading(Magnetometer::getHeading(
+						noisy(toBody(truth, EARTH), 0.005f), up));
+
+			if (t > 20.0f) {
+				worstup = fmax(worstup, angleBetween(ekf.getUp(), up));
+				if (fabs(ekf.getPitch()) < 60.0f)
+					worstyaw = fmax(worstyaw, fabs(angleDifference(
+							ekf.getYaw(), Magnetometer::getHeading(
+								toBody(truth, EARTH), up))));
+				gyroup = fmax(gyroup, angleBetween(toBody(gyroonly, UP), up));
+			}
+		}
+		check(worstup < 2.0f, "up within 2 degrees");
+		check(worstyaw < 3.0f, "heading within 3 degrees");
+		check(gyroup > 10.0f, "(gyroscope alone drifts over 10)");
+		check(near(ekf.getGyroBias(), bias, 0.15f),
+				"gyroscope bias while turning");
+	}
+
+	printf("Climbing:\n");
+	{
+		// Level, on the ground for 5s, then 1m/s up for 4.5s; the barometer
+		// reads at 40Hz with +/-0.6m of noise
+		Attitude truth = about(30.0, 0, 0, 1);
+		AttitudeEKF ekf;
+		float altitude = 100.0f, velocity = 0.0f, worstv = 0.0f,
+		      sumerror = 0.0f, sumnoise = 0.0f;
+		int   count = 0;
+		for (int i = 0; i < 15 * 400; ++i) {
+			float t = i * DT, a = 0.0f;
+			if (t >= 5.0f && t < 5.5f)
+				a = 2.0f;
+			else if (t >= 9.5f && t < 10.0f)
+				a = -2.0f;
+			velocity += a * DT;
+			altitude += velocity * DT;
+
+			Vector3<float> accel = noisy(toBody(truth, UP)
+					* (1.0f + a / ALTITUDE_GRAVITY), 0.02f);
+			ekf.predict(noisy(Vector3<float>(0.0f, 0.0f, 0.0f), 0.5f), accel,
+					DT);
+			ekf.correctAccelerometer(accel);
+			if (i % 10 == 0) {
+				float noise = uniform(-0.6f, 0.6f);
+				ekf.correctAltitude(altitude + noise);
+				if (t > 5.0f) {
+					sumnoise += noise * noise;
+					sumerror += (ekf.getAltitude() - altitude)
+							* (ekf.getAltitude() - altitude);
+					++count;
+				}
+			}
+			if (t > 6.5f && t < 9.5f)
+				worstv = fmax(worstv, fabs(ekf.getVelocity() - 1.0f));
+		}
+		check(worstv < 0.2f, "climb rate within 0.2m/s");
+		check(sqrt(sumerror / count) < 0.5f * sqrt(sumnoise / count),
+				"altitude error under half the barometer's noise");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
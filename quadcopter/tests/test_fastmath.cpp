@@ -0,0 +1,102 @@
+/*
+	test_fastmath.cpp
+
+	Sweeps fastmath.h's approximations against libm (in double) and checks
+	the worst errors against the documented bounds. Prints each worst
+	error.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <math.h>
+
+#include "fastmath.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+int main(int argc, char **argv) {
+	printf("fastAtan2:\n");
+	{
+		// Every direction (and the axes and diagonals exactly), at radii
+		// from tiny to huge
+		double worst = 0.0;
+		for (int i = 0; i <= 72000; ++i) {
+			double angle = -M_PI + i * (2.0 * M_PI / 72000);
+			for (double radius = 1e-20; radius < 1e20; radius *= 1000.0) {
+				float y = radius * sin(angle), x = radius * cos(angle);
+				double error = fabs(fastAtan2(y, x) - atan2((double)y, x));
+				if (error > M_PI)
+					error = fabs(error - 2.0 * M_PI);  // -pi and pi
+				if (error > worst)
+					worst = error;
+			}
+		}
+		printf("  worst error %g rad (%g degrees)\n", worst,
+				worst * 180.0 / M_PI);
+		check(worst <= FAST_ATAN2_MAX_ERROR, "within FAST_ATAN2_MAX_ERROR");
+		check(fastAtan2(0.0f, 0.0f) == 0.0f && fastAtan2(0.0f, 1.0f) == 0.0f,
+				"(0, 0) and the positive X axis give 0");
+		check(fabs(fastAtan2(0.0f, -1.0f) - M_PI) <= FAST_ATAN2_MAX_ERROR
+				&& fabs(fastAtan2(-1.0f, 0.0f) + M_PI / 2)
+				<= FAST_ATAN2_MAX_ERROR, "negative axes");
+		check(fabs(fastAtan2Degrees(1.0f, 1.0f) - 45.0f) < 1e-3f,
+				"degrees");
+	}
+
+	printf("fastInvSqrt, fastSqrt:\n");
+	{
+		double worstinv = 0.0, worstsqrt = 0.0;
+		for (double x = 1e-30; x < 1e30; x *= 1.001) {
+			float f = x;
+			double inv = 1.0 / sqrt((double)f), root = sqrt((double)f);
+			worstinv = fmax(worstinv, fabs(fastInvSqrt(f) - inv) / inv);
+			worstsqrt = fmax(worstsqrt, fabs(fastSqrt(f) - root) / root);
+		}
+		printf("  worst relative errors %g, %g\n", worstinv, worstsqrt);
+		check(worstinv <= FAST_INVSQRT_MAX_ERROR,
+				"fastInvSqrt within FAST_INVSQRT_MAX_ERROR");
+		check(worstsqrt <= 1e-7, "fastSqrt exact (to float rounding)");
+		check(fastSqrt(0.0f) == 0.0f && fastSqrt(-1.0f) == 0.0f,
+				"fastSqrt of 0 and negatives is 0");
+	}
+
+	printf("fastSinCos:\n");
+	{
+		double worst = 0.0, worstlarge = 0.0;
+		for (int i = 0; i <= 1000000; ++i) {
+			float angle = -4.0 * M_PI + i * (8.0 * M_PI / 1000000), s, c;
+			fastSinCos(angle, s, c);
+			worst = fmax(worst, fmax(fabs(s - sin((double)angle)),
+					fabs(c - cos((double)angle))));
+		}
+		for (int i = 0; i <= 100000; ++i) {
+			float angle = -1000.0 + i * 0.02, s, c;
+			fastSinCos(angle, s, c);
+			worstlarge = fmax(worstlarge, fmax(fabs(s - sin((double)angle)),
+					fabs(c - cos((double)angle))));
+		}
+		printf("  worst error %g (within 4 pi), %g (within 1000)\n", worst,
+				worstlarge);
+		check(worst <= FAST_SINCOS_MAX_ERROR && worstlarge
+				<= FAST_SINCOS_MAX_ERROR, "within FAST_SINCOS_MAX_ERROR");
+
+		float s, c;
+		fastSinCos(0.0f, s, c);
+		check(s == 0.0f && c == 1.0f, "exact at 0");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,252 @@
+/*
+	test_filterchain.cpp
+
+	Tests FilterChain: the frequency response of each linear stage type
+	(low-pass cutoffs and roll-off, notch and band-stop rejection and pass
+	bands), the median stage's spike rejection, a compiled chain against
+	the same stages as separate Biquads, independence of the channels,
+	reset(), and rejection of invalid stages.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "geometry.h"
+#include "biquad.h"
+#include "filterchain.h"
+
+#define RATE 400.0f
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static bool near(float value, float expected, float tolerance) {
+	return fabs(value - expected) <= tolerance;
+}
+
+/*
+	Gain in dB of a single stage, on channel 0 of a one-channel chain, to a
+	unit sine of the given frequency once settled. From the RMS of the
+	output, as the samples seldom fall on its peaks.
+*/
+static float gain(const FilterStage &stage, float frequency) {
+	FilterChain chain(RATE, 1);
+	chain.setStages(0, &stage, 1);
+	chain.compile();
+
+	double power = 0.0;
+	for (int i = 0; i < 8000; ++i) {
+		float value = sin(2.0f * M_PI * frequency * i / RATE);
+		chain.process(&value);
+		if (i >= 4000)
+			power += value * value;
+	}
+	return 10.0f * log10(power / 4000 * 2.0);
+}
+
+/*
+	Returns true if setStages() throws for the given stage
+*/
+static bool rejects(const FilterStage &stage) {
+	FilterChain chain(RATE, 1);
+	try {
+		chain.setStages(0, &stage, 1);
+	} catch (FilterException &e) {
+		return true;
+	}
+	return false;
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+
+	printf("Frequency response:\n");
+	{
+		FilterStage lowpass1(FILTER_LOWPASS1, 10.0f);
+		float cutoff = gain(lowpass1, 10.0f), decade = gain(lowpass1, 100.0f);
+		printf("  1st order low-pass: %.2fdB at cutoff, %.2fdB a decade up\n",
+				cutoff, decade);
+		check(near(gain(lowpass1, 0.5f), 0.0f, 0.1f), "1st order passes low");
+		check(near(cutoff, -3.0f, 0.3f), "1st order -3dB at cutoff");
+		check(near(decade, -20.0f, 2.0f), "1st order -20dB/decade");
+
+		FilterStage lowpass2(FILTER_LOWPASS2, 10.0f, 0.7071f);
+		cutoff = gain(lowpass2, 10.0f);
+		decade = gain(lowpass2, 100.0f);
+		printf("  2nd order low-pass: %.2fdB at cutoff, %.2fdB a decade up\n",
+				cutoff, decade);
+		check(near(gain(lowpass2, 0.5f), 0.0f, 0.1f), "2nd order passes low");
+		check(near(cutoff, -3.0f, 0.3f), "2nd order -3dB at cutoff");
+		check(decade < -40.0f, "2nd order -40dB/decade or more");
+
+		FilterStage notch(FILTER_NOTCH, 60.0f, 4.0f);
+		float centre = gain(notch, 60.0f);
+		printf("  notch: %.1fdB at centre\n", centre);
+		check(centre < -40.0f, "notch removes the centre");
+		check(near(gain(notch, 5.0f), 0.0f, 0.1f)
+				&& near(gain(notch, 150.0f), 0.0f, 0.3f),
+				"notch passes away from the centre");
+
+		FilterStage bandstop(FILTER_BANDSTOP, 40.0f, 80.0f);
+		float lower = gain(bandstop, 40.0f), upper = gain(bandstop, 80.0f),
+		      middle = gain(bandstop, 57.58f);
+		printf("  band-stop: %.2fdB, %.1fdB, %.2fdB at 40, 57.6, 80Hz\n",
+				lower, middle, upper);
+		check(middle < -40.0f, "band-stop removes the middle");
+		check(near(lower, -3.0f, 0.1f) && near(upper, -3.0f, 0.1f),
+				"band-stop -3dB at its edges");
+		check(near(gain(bandstop, 5.0f), 0.0f, 0.1f)
+				&& near(gain(bandstop, 180.0f), 0.0f, 0.3f),
+				"band-stop passes outside the band");
+	}
+
+	printf("Median:\n");
+	{
+		FilterChain chain(RATE, 1);
+		FilterStage median(FILTER_MEDIAN, 0.0f, 5.0f);
+		chain.setStages(0, &median, 1);
+		chain.compile();
+		float zero = 0.0f;
+		chain.reset(&zero);
+
+		// Single and double spikes on a slow ramp are removed; a step
+		// passes through, half a window late
+		bool spikes = true;
+		for (int i = 0; i < 50; ++i) {
+			float value = i * 0.1f;
+			if (i == 20 || i == 30 || i == 31)
+				value += 100.0f;
+			chain.process(&value);
+			spikes = spikes && value < 5.0f;
+		}
+		check(spikes, "removes spikes shorter than half the window");
+
+		float in = 10.0f, out[4];
+		for (int i = 0; i < 4; ++i) {
+			float value = in;
+			chain.process(&value);
+			out[i] = value;
+		}
+		check(out[0] < 10.0f && out[1] < 10.0f && out[2] == 10.0f
+				&& out[3] == 10.0f, "passes a step, 2 readings late");
+	}
+
+	printf("Chain:\n");
+	{
+		// Two channels with different stages, a third without any
+		FilterChain chain(RATE, 3);
+		FilterStage first[FILTER_MAX_STAGES] = {
+			FilterStage(FILTER_NOTCH, 87.3f, 3.0f),
+			FilterStage(),
+			FilterStage(FILTER_LOWPASS2, 40.0f, 0.7071f),
+			FilterStage(FILTER_BANDSTOP, 120.0f, 150.0f)
+		};
+		FilterStage second[1] = { FilterStage(FILTER_LOWPASS2, 20.0f, 1.0f) };
+		chain.setStages(0, first, FILTER_MAX_STAGES);
+		chain.setStages(1, second, 1);
+		check(chain.getStageCount(0) == 3 && chain.getStageCount(1) == 1
+				&& chain.getStageCount(2) == 0, "empty slots left out");
+		chain.compile();
+
+		Biquad notch, lowpass, bandstop, other;
+		notch.setNotch(87.3f, RATE, 3.0f);
+		lowpass.setLowPass(40.0f, RATE, 0.7071f);
+		float lower = tan(M_PI * 120.0f / RATE),
+		      upper = tan(M_PI * 150.0f / RATE),
+		      centre = sqrt(lower * upper);
+		bandstop.setNotch(atan(centre) * RATE / M_PI, RATE,
+				centre / (upper - lower));
+		other.setLowPass(20.0f, RATE, 1.0f);
+
+		float worst = 0.0f;
+		bool  untouched = true;
+		for (int i = 0; i < 2000; ++i) {
+			float in[3];
+			for (int c = 0; c < 3; ++c)
+				in[c] = (rand() / (float)RAND_MAX - 0.5f) * 100.0f;
+			float values[3] = { in[0], in[1], in[2] };
+			chain.process(values);
+
+			float expected = bandstop.process(lowpass.process(
+					notch.process(in[0])));
+			worst = fmax(worst, fabs(values[0] - expected));
+			worst = fmax(worst, fabs(values[1] - other.process(in[1])));
+			untouched = untouched && values[2] == in[2];
+		}
+		check(worst < 1e-3f, "matches the same stages as Biquads");
+		check(untouched, "a channel without stages is untouched");
+
+		float settle[3] = { 5.0f, -2.0f, 1.0f }, values[3];
+		chain.reset(settle);
+		for (int i = 0; i < 3; ++i)
+			values[i] = settle[i];
+		chain.process(values);
+		check(near(values[0], 5.0f, 1e-4f) && near(values[1], -2.0f, 1e-4f)
+				&& values[2] == 1.0f, "reset() settles every stage");
+
+		// Not until compiled again
+		chain.setStages(1, first, 1);
+		check(chain.getStageCount(1) == 1, "stages replaced");
+	}
+
+	printf("Invalid stages:\n");
+	{
+		check(rejects(FilterStage(FILTER_LOWPASS1, 0.0f))
+				&& rejects(FilterStage(FILTER_LOWPASS2, RATE / 2.0f, 0.7f))
+				&& rejects(FilterStage(FILTER_NOTCH, 50.0f, 0.0f)),
+				"frequencies and q out of range");
+		check(rejects(FilterStage(FILTER_BANDSTOP, 80.0f, 40.0f))
+				&& rejects(FilterStage(FILTER_BANDSTOP, 40.0f, 250.0f)),
+				"band edges out of order or range");
+		check(rejects(FilterStage(FILTER_MEDIAN, 0.0f, 4.0f))
+				&& rejects(FilterStage(FILTER_MEDIAN, 0.0f, 1.0f))
+				&& rejects(FilterStage(FILTER_MEDIAN, 0.0f, 9.0f))
+				&& rejects(FilterStage((FilterType)42, 10.0f)),
+				"bad median windows and types");
+		check(!rejects(FilterStage()), "empty slot accepted");
+
+		FilterChain chain(RATE, 2);
+		FilterStage good(FILTER_LOWPASS1, 10.0f), stages[2] = {
+			FilterStage(FILTER_LOWPASS1, 10.0f), FilterStage(FILTER_NOTCH,
+					50.0f, -1.0f)
+		};
+		chain.setStages(0, &good, 1);
+		bool threw = false;
+		try {
+			chain.setStages(0, stages, 2);
+		} catch (FilterException &e) {
+			threw = true;
+		}
+		check(threw && chain.getStageCount(0) == 1,
+				"a bad stage leaves the channel unchanged");
+
+		FilterStage many[FILTER_MAX_STAGES + 1];
+		threw = false;
+		try {
+			chain.setStages(5, &good, 1);
+		} catch (FilterException &e) {
+			threw = true;
+		}
+		try {
+			chain.setStages(1, many, FILTER_MAX_STAGES + 1);
+			threw = false;
+		} catch (FilterException &e) { }
+		check(threw, "bad channels and too many stages");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,239 @@
+/*
+	test_fixedpoint.cpp
+
+	Tests the integer control path against the float one: the fixed-point
+	formats and FixedGain, FixedBiquad against Biquad, FixedPID against
+	PIDController (through saturation and anti-windup), and FixedRateLoop
+	against the float chain Drive runs (calibration, filter, Rate PIDs,
+	mixer, Motor and PWM counts) on a simulated quadcopter.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "fixedpoint.h"
+#include "fixedbiquad.h"
+#include "fixedpid.h"
+#include "fixedrateloop.h"
+#include "biquad.h"
+#include "pidcontroller.h"
+#include "calibration.h"
+
+#define RATE 400.0f
+#define DT   (1.0f / RATE)
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static float uniform(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+
+	printf("Formats:\n");
+	{
+		bool ok = true;
+		for (int i = 0; i < 1000; ++i) {
+			float v = uniform(-30000.0f, 30000.0f);
+			ok = ok && fabs(fromQ16(toQ16(v)) - v) <= 0.5f / Q16_ONE
+					+ fabs(v) * 1e-7f;
+		}
+		check(ok, "Q16 round trip");
+		check(toQ16(1e6f) == INT32_MAX && toQ16(-1e6f) == INT32_MIN
+				&& saturate32((int64_t)1 << 40) == INT32_MAX,
+				"saturates instead of wrapping");
+
+		double worst = 0.0;
+		for (float g = 1e-7f; g < 1e7f; g *= 1.7f)
+			for (int sign = -1; sign <= 1; sign += 2) {
+				FixedGain gain(sign * g);
+				worst = fmax(worst, fabs(gain.toFloat() - sign * g) / g);
+			}
+		check(worst < 1e-7, "FixedGain keeps every size precise");
+
+		FixedGain half(0.5f), third(1.0f / 3.0f);
+		check(half.apply(101) == 51 && half.apply(-101) == -50
+				&& third.apply(toQ16(3.0f)) == Q16_ONE
+				&& FixedGain(0.0f).apply(12345) == 0, "FixedGain rounding");
+	}
+
+	printf("FixedBiquad:\n");
+	{
+		Biquad reference;
+		FixedBiquad filter;
+		reference.setLowPass(30.0f, RATE);
+		filter.setLowPass(30.0f, RATE);
+
+		float worst = 0.0f;
+		for (int i = 0; i < 4000; ++i) {
+			float in = 200.0f * sin(i * 0.05f) + uniform(-50.0f, 50.0f);
+			float expected = reference.process(in);
+			worst = fmax(worst, fabs(fromQ16(filter.process(toQ16(in)))
+					- expected));
+		}
+		printf("  worst difference %g dps\n", worst);
+		check(worst < 0.001f, "low-pass matches Biquad");
+
+		reference.reset(100.0f);
+		filter.reset(toQ16(100.0f));
+		check(fabs(fromQ16(filter.process(toQ16(100.0f))) - 100.0f) < 0.001f,
+				"reset settles at the value");
+
+		FixedBiquad through;
+		check(through.process(123456) == 123456, "pass-through by default");
+	}
+
+	printf("FixedPID:\n");
+	{
+		PIDController reference(0.0f, 0.6f, 2.0f, 0.02f);
+		reference.setOutputLimits(-50.0f, 50.0f);
+		reference.setIntegralLimit(20.0f);
+		reference.setDerivativeFilter(100.0f, RATE);
+
+		FixedPID pid(RATE);
+		pid.setPID(0.6f, 2.0f, 0.02f);
+		pid.setOutputLimits(-50.0f, 50.0f);
+		pid.setIntegralLimit(20.0f);
+		pid.setDerivativeFilter(100.0f);
+
+		// Targets that step far enough to saturate, and a wandering value
+		float value = 0.0f, worst = 0.0f;
+		bool saturated = false;
+		for (int i = 0; i < 8000; ++i) {
+			float target = ((i / 1000) % 2 ? 150.0f : -40.0f);
+			value += (reference.output() * 2.0f - value * 0.5f) * DT
+					+ uniform(-1.0f, 1.0f);
+			reference.setTarget(target);
+			reference.feed(value, DT);
+			pid.setTarget(toQ16(target));
+			pid.feed(toQ16(value));
+
+			saturated = saturated || fabs(reference.output()) >= 50.0f;
+			worst = fmax(worst, fabs(fromQ16(pid.output())
+					- reference.output()));
+		}
+		printf("  worst difference %g (of +/-50)\n", worst);
+		check(saturated, "(output saturated along the way)");
+		check(worst < 0.01f, "matches PIDController, through anti-windup");
+	}
+
+	printf("FixedRateLoop:\n");
+	{
+		// Drive's rate stage in float: L3G4200D at 2000dps, its calibration,
+		// a 50Hz gyroscope filter and Rate PIDs, then the mixer, Motor and
+		// PWM::setHighTime()
+		const float SCALE = 0.07f, MIN_HIGH = 1.27f, MAX_HIGH = 1.9f,
+		            FREQUENCY = 400.0f;
+		GyroCalibration cal;
+		cal.bias = Vector3<float>(1.5f, -2.0f, 0.7f);
+		cal.slope = Vector3<float>(0.02f, 0.01f, -0.03f);
+		cal.reftemp = 25.0f;
+		const float TEMPERATURE = 31.0f;
+
+		Biquad filters[3];
+		PIDController *pids[3];
+		FixedRateLoop loop(RATE);
+		for (int axis = 0; axis < 3; ++axis) {
+			filters[axis].setLowPass(50.0f, RATE);
+			pids[axis] = new PIDController(0.0f, 0.8f, 1.5f, 0.01f);
+			pids[axis]->setOutputLimits(-50.0f, 50.0f);
+			pids[axis]->setIntegralLimit(20.0f);
+			pids[axis]->setDerivativeFilter(100.0f, RATE);
+		}
+		loop.setGyroScale(SCALE);
+		loop.setGyroCalibration(cal, TEMPERATURE);
+		loop.setGyroFilter(50.0f);
+		loop.setPID(0.8f, 1.5f, 0.01f);
+		loop.setOutputLimits(-50.0f, 50.0f);
+		loop.setIntegralLimit(20.0f);
+		loop.setDerivativeFilter(100.0f);
+		loop.setMotorRange(MIN_HIGH, MAX_HIGH, FREQUENCY);
+
+		// A frame whose rates follow the float corrections, with vibration
+		float rates[3] = { 0.0f, 0.0f, 0.0f }, corrections[3];
+		int worst = 0, exact = 0, total = 0;
+		for (int i = 0; i < 8000; ++i) {
+			float t = i * DT;
+			float targets[3] = { 60.0f * sin(t * 2.0f), 90.0f * sin(t * 1.3f),
+			                     ((i / 1500) % 2 ? 120.0f : -30.0f) };
+			float throttle = 0.5f + 0.3f * sin(t * 0.5f);
+
+			int16_t raw[3];
+			Vector3<float> bias = cal.apply(Vector3<float>(0, 0, 0),
+					TEMPERATURE);
+			float truth[3] = { rates[0] - bias.x, rates[1] - bias.y,
+			                   rates[2] - bias.z };
+			for (int axis = 0; axis < 3; ++axis)
+				raw[axis] = (int16_t)lrint((truth[axis]
+						+ 20.0f * sin(t * 900.0f + axis)) / SCALE);
+
+			// Float
+			Vector3<float> gyro = cal.apply(Vector3<float>(raw[0] * SCALE,
+					raw[1] * SCALE, raw[2] * SCALE), TEMPERATURE);
+			float measured[3] = { gyro.x, gyro.y, gyro.z };
+			for (int axis = 0; axis < 3; ++axis) {
+				pids[axis]->setTarget(targets[axis]);
+				pids[axis]->feed(filters[axis].process(measured[axis]), DT);
+				corrections[axis] = pids[axis]->output();
+			}
+			double d_ends = corrections[1] / 100.0f,
+			       d_sides = corrections[0] / 100.0f,
+			       d_yaw = corrections[2] / 100.0f;
+			float speeds[4] = {
+				(float)(throttle + d_ends - d_sides + d_yaw),
+				(float)(throttle + d_ends + d_sides - d_yaw),
+				(float)(throttle - d_ends + d_sides + d_yaw),
+				(float)(throttle - d_ends - d_sides - d_yaw)
+			};
+			uint16_t expected[4];
+			for (int m = 0; m < 4; ++m) {
+				float speed = (speeds[m] < 0.0f ? 0.0f : speeds[m]);
+				float hightime = MIN_HIGH + (MAX_HIGH - MIN_HIGH) * speed;
+				float count = hightime / (1000.0f / FREQUENCY) * 4095.0f;
+				expected[m] = (uint16_t)(count > 4095.0f ? 4095.0f : count);
+			}
+
+			// Fixed
+			int32_t qtargets[3] = { toQ16(targets[0]), toQ16(targets[1]),
+			                        toQ16(targets[2]) };
+			uint16_t counts[4];
+			loop.update(raw, qtargets, toQ16(throttle), counts);
+
+			for (int m = 0; m < 4; ++m) {
+				int difference = abs((int)counts[m] - (int)expected[m]);
+				worst = (difference > worst ? difference : worst);
+				exact += (difference == 0);
+				++total;
+			}
+
+			for (int axis = 0; axis < 3; ++axis)
+				rates[axis] += (corrections[axis] * 40.0f - rates[axis] * 2.0f)
+						* DT;
+		}
+		printf("  worst difference %d count(s), %.1f%% exact\n", worst,
+				100.0f * exact / total);
+		check(worst <= 1, "PWM counts within 1 of the float path");
+
+		for (int axis = 0; axis < 3; ++axis)
+			delete pids[axis];
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
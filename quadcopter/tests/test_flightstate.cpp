@@ -0,0 +1,323 @@
+/*
+	test_flightstate.cpp
+
+	Tests the arming/failsafe state machine (FlightState) in simulation: a
+	100Hz control loop, with the radio sending a packet every 20ms until the
+	link is cut, and I2C failures and loop overruns injected on demand.
+
+	Checks every transition, and that each watchdog reacts within one update
+	period of its threshold.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "flightstate.h"
+
+#define RATE      100
+#define PERIOD    (1.0f / RATE)
+#define PACKET_MS 20
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+/*
+	Simulated control loop around a FlightState
+*/
+struct Sim {
+	FlightState flight;
+	float       time;     // seconds
+	float       throttle; // Pilot's throttle
+	bool        link;     // Packets are arriving
+	int         ms;       // Whole milliseconds simulated, for packet timing
+
+	Sim() : flight(RATE), time(0.0f), throttle(0.0f), link(true), ms(0) { }
+
+	FlightState::State step(bool i2cok = true, float dtime = PERIOD) {
+		int steps = (int)(dtime * 1000.0f + 0.5f);
+		for (int i = 0; i < steps; ++i) {
+			++ms;
+			if (link && ms % PACKET_MS == 0)
+				flight.packetReceived();
+		}
+		time += dtime;
+		return flight.update(dtime, throttle, i2cok);
+	}
+
+	// Step until the state changes or seconds pass. Returns the time taken.
+	float runUntilChange(float seconds, bool i2cok = true) {
+		FlightState::State start = flight.getState();
+		float begin = time;
+		while (time - begin < seconds && step(i2cok) == start)
+			;
+		return time - begin;
+	}
+
+	// Disarmed to armed
+	bool arm() {
+		flight.arm();
+		step();
+		runUntilChange(FLIGHT_ARMING_TIME + 1.0f);
+		return flight.getState() == FlightState::STATE_ARMED;
+	}
+};
+
+struct PacketThread {
+	FlightState *flight;
+	int         count;
+};
+
+static void *sendPackets(void *arg) {
+	PacketThread *pt = (PacketThread *)arg;
+	for (int i = 0; i < pt->count; ++i)
+		pt->flight->packetReceived();
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	printf("Arming:\n");
+	{
+		Sim sim;
+		sim.step();
+		check(sim.flight.getState() == FlightState::STATE_DISARMED
+				&& !sim.flight.isMotorsEnabled()
+				&& sim.flight.getThrottle() == 0.0f, "starts disarmed");
+
+		sim.throttle = 0.5f;
+		sim.flight.arm();
+		sim.step();
+		check(sim.flight.getState() == FlightState::STATE_DISARMED
+				&& sim.flight.getReason() == FlightState::REASON_THROTTLE_HIGH,
+				"arm refused with throttle up");
+
+		sim.throttle = 0.0f;
+		sim.link = false;
+		sim.runUntilChange(FLIGHT_LINK_TIMEOUT + 0.1f);
+		sim.flight.arm();
+		sim.step();
+		check(sim.flight.getState() == FlightState::STATE_DISARMED
+				&& sim.flight.getReason() == FlightState::REASON_LINK_LOST,
+				"arm refused without link");
+
+		sim.link = true;
+		sim.step();
+		sim.flight.arm();
+		sim.step();
+		check(sim.flight.getState() == FlightState::STATE_ARMING
+				&& !sim.flight.isMotorsEnabled(), "arming, motors still off");
+		float taken = PERIOD + sim.runUntilChange(FLIGHT_ARMING_TIME + 1.0f);
+		check(sim.flight.getState() == FlightState::STATE_ARMED
+				&& fabs(taken - FLIGHT_ARMING_TIME) <= PERIOD * 1.5f,
+				"armed after FLIGHT_ARMING_TIME");
+
+		sim.throttle = 0.6f;
+		sim.step();
+		check(sim.flight.isMotorsEnabled()
+				&& sim.flight.getThrottle() == 0.6f, "throttle passed through");
+		sim.throttle = 1.5f;
+		sim.step();
+		check(sim.flight.getThrottle() == 1.0f, "throttle clamped");
+
+		Sim raised;
+		raised.step();
+		raised.flight.arm();
+		raised.step();
+		raised.step();
+		raised.throttle = 0.3f;
+		raised.step();
+		check(raised.flight.getState() == FlightState::STATE_DISARMED
+				&& raised.flight.getReason()
+					== FlightState::REASON_THROTTLE_HIGH,
+				"throttle up while arming disarms");
+
+		Sim faulty;
+		faulty.step();
+		faulty.flight.arm();
+		faulty.step();
+		for (int i = 0; i < FLIGHT_I2C_FAILSAFE; ++i)
+			faulty.step(false);
+		check(faulty.flight.getState() == FlightState::STATE_DISARMED
+				&& faulty.flight.getReason()
+					== FlightState::REASON_SENSOR_FAULT,
+				"sensor fault while arming disarms");
+	}
+
+	printf("Link loss:\n");
+	{
+		Sim sim;
+		sim.arm();
+		sim.throttle = 0.5f;
+		sim.runUntilChange(2.0f);
+
+		sim.link = false;
+		float taken = sim.runUntilChange(5.0f);
+		check(sim.flight.getState() == FlightState::STATE_FAILSAFE
+				&& sim.flight.getReason() == FlightState::REASON_LINK_LOST,
+				"failsafe on link loss");
+		// The last packet may have come up to PACKET_MS before the cut
+		check(taken <= FLIGHT_LINK_TIMEOUT + PERIOD
+				&& taken >= FLIGHT_LINK_TIMEOUT - PACKET_MS / 1000.0f,
+				"within one period of FLIGHT_LINK_TIMEOUT");
+
+		sim.throttle = 0.9f;
+		sim.link = true;
+		sim.step();
+		float first = sim.flight.getThrottle();
+		sim.step();
+		check(first < 0.5f && first > 0.49f, "descends from the last throttle");
+		check(sim.flight.getState() == FlightState::STATE_FAILSAFE
+				&& fabs(first - sim.flight.getThrottle()
+					- FLIGHT_DESCENT_RATE * PERIOD) < 1e-5f,
+				"pilot and link ignored while descending");
+
+		sim.flight.arm();
+		taken = sim.runUntilChange(10.0f);
+		check(sim.flight.getState() == FlightState::STATE_DISARMED
+				&& sim.flight.getReason() == FlightState::REASON_DESCENDED
+				&& fabs(taken - first / FLIGHT_DESCENT_RATE) < 2 * PERIOD,
+				"disarmed when descent finishes, arm ignored");
+		check(sim.flight.getThrottle() == 0.0f, "throttle 0 after descent");
+
+		Sim recover;
+		recover.arm();
+		recover.throttle = 0.4f;
+		recover.link = false;
+		recover.runUntilChange(FLIGHT_LINK_TIMEOUT - 0.1f);
+		recover.link = true;
+		recover.runUntilChange(1.0f);
+		check(recover.flight.getState() == FlightState::STATE_ARMED,
+				"short dropout tolerated");
+
+		Sim disarm;
+		disarm.arm();
+		disarm.throttle = 0.4f;
+		disarm.link = false;
+		disarm.runUntilChange(2.0f);
+		disarm.flight.disarm();
+		disarm.step();
+		check(disarm.flight.getState() == FlightState::STATE_DISARMED
+				&& disarm.flight.getReason() == FlightState::REASON_COMMAND,
+				"disarm obeyed in failsafe");
+	}
+
+	printf("I2C failures:\n");
+	{
+		Sim sim;
+		sim.arm();
+		sim.throttle = 0.5f;
+		for (int i = 0; i < FLIGHT_I2C_FAILSAFE - 1; ++i)
+			sim.step(false);
+		sim.step(true);
+		for (int i = 0; i < FLIGHT_I2C_FAILSAFE - 1; ++i)
+			sim.step(false);
+		check(sim.flight.getState() == FlightState::STATE_ARMED,
+				"intermittent failures tolerated");
+
+		sim.step(false);
+		check(sim.flight.getState() == FlightState::STATE_FAILSAFE
+				&& sim.flight.getReason() == FlightState::REASON_SENSOR_FAULT,
+				"failsafe on the FLIGHT_I2C_FAILSAFE'th failure");
+
+		int updates = FLIGHT_I2C_FAILSAFE;
+		while (sim.step(false) == FlightState::STATE_FAILSAFE)
+			++updates;
+		++updates;
+		check(sim.flight.getState() == FlightState::STATE_KILLED
+				&& updates == FLIGHT_I2C_KILL && !sim.flight.isMotorsEnabled(),
+				"killed on the FLIGHT_I2C_KILL'th failure");
+
+		sim.flight.arm();
+		sim.step();
+		check(sim.flight.getState() == FlightState::STATE_KILLED,
+				"arm ignored when killed");
+		sim.flight.disarm();
+		sim.step();
+		check(sim.flight.getState() == FlightState::STATE_DISARMED,
+				"disarm clears kill");
+	}
+
+	printf("Loop overruns:\n");
+	{
+		Sim sim;
+		sim.arm();
+		sim.throttle = 0.5f;
+		for (int i = 0; i < FLIGHT_MAX_OVERRUNS - 1; ++i)
+			sim.step(true, PERIOD * (FLIGHT_OVERRUN_FACTOR + 1.0f));
+		sim.step();
+		check(sim.flight.getState() == FlightState::STATE_ARMED,
+				"isolated overruns tolerated");
+
+		for (int i = 0; i < FLIGHT_MAX_OVERRUNS - 1; ++i)
+			sim.step(true, PERIOD * (FLIGHT_OVERRUN_FACTOR + 1.0f));
+		check(sim.flight.getState() == FlightState::STATE_ARMED,
+				"armed before FLIGHT_MAX_OVERRUNS");
+		sim.step(true, PERIOD * (FLIGHT_OVERRUN_FACTOR + 1.0f));
+		check(sim.flight.getState() == FlightState::STATE_FAILSAFE
+				&& sim.flight.getReason() == FlightState::REASON_OVERRUN,
+				"failsafe on FLIGHT_MAX_OVERRUNS'th overrun");
+	}
+
+	printf("Commands:\n");
+	{
+		Sim sim;
+		sim.arm();
+		sim.throttle = 0.7f;
+		sim.step();
+		sim.flight.kill();
+		sim.step();
+		check(sim.flight.getState() == FlightState::STATE_KILLED
+				&& sim.flight.getThrottle() == 0.0f
+				&& sim.flight.getReason() == FlightState::REASON_COMMAND,
+				"kill stops the motors at the next update");
+
+		Sim both;
+		both.step();
+		both.flight.arm();
+		both.flight.disarm();
+		both.step();
+		check(both.flight.getState() == FlightState::STATE_DISARMED,
+				"disarm wins over arm");
+
+		Sim disarmed;
+		disarmed.arm();
+		disarmed.flight.disarm();
+		disarmed.step();
+		check(disarmed.flight.getState() == FlightState::STATE_DISARMED
+				&& !disarmed.flight.isMotorsEnabled(), "disarm when armed");
+
+		// Packets counted from other threads while the loop runs
+		Sim threaded;
+		threaded.link = false;
+		PacketThread pt[2];
+		pthread_t    threads[2];
+		for (int i = 0; i < 2; ++i) {
+			pt[i].flight = &threaded.flight;
+			pt[i].count = 100000;
+			pthread_create(&threads[i], NULL, sendPackets, &pt[i]);
+		}
+		for (int i = 0; i < 2; ++i)
+			pthread_join(threads[i], NULL);
+		threaded.step();
+		check(threaded.flight.getPacketAge() == 0.0f,
+				"packets from other threads seen");
+		threaded.step();
+		check(threaded.flight.getPacketAge() == PERIOD,
+				"packet age grows without packets");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,172 @@
+/*
+	test_gainschedule.cpp
+
+	Tests GainSchedule: interpolation by throttle and by battery voltage,
+	holding values outside the breakpoints, reading the breakpoints back
+	(as Drive does to save them) and building a copy, and that
+	changing coefficients on a running PIDBank (as Drive does every update
+	while scheduling) keeps the integral terms.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <new>
+
+#include "gainschedule.h"
+#include "pidbank.h"
+
+static int failures = 0;
+static int allocations = 0;
+
+void *operator new(size_t size) {
+	++allocations;
+	void *p = malloc(size);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) throw() {
+	free(p);
+}
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static bool near(float a, float b) {
+	return fabs(a - b) < 1e-4f;
+}
+
+// Gains with every coefficient derived from one value, to make checks easy
+static GainSchedule::Gains makeGains(float base) {
+	GainSchedule::Gains g;
+	for (int i = 0; i < 3; ++i) {
+		g.angle[i] = base + i;
+		g.rate[i] = base * 10.0f + i;
+	}
+	return g;
+}
+
+static bool matches(const GainSchedule::Gains &g, float base) {
+	GainSchedule::Gains want = makeGains(base);
+	for (int i = 0; i < 3; ++i)
+		if (!near(g.angle[i], want.angle[i]) || !near(g.rate[i], want.rate[i]))
+			return false;
+	return true;
+}
+
+int main(int argc, char **argv) {
+	printf("Throttle only\n");
+	GainSchedule one;
+	check(one.isEmpty(), "empty until built");
+
+	// Added out of order, at grid points (multiples of 1/32)
+	one.addBreakpoint(0.75f, 0.0f, makeGains(3.0f));
+	one.addBreakpoint(0.25f, 0.0f, makeGains(1.0f));
+	one.addBreakpoint(0.5f, 0.0f, makeGains(2.0f));
+	one.build();
+	check(!one.isEmpty(), "built");
+
+	check(matches(one.lookup(0.25f, 0.0f), 1.0f), "at breakpoint");
+	check(matches(one.lookup(0.5f, 12.0f), 2.0f), "voltage ignored");
+	check(matches(one.lookup(0.375f, 0.0f), 1.5f), "halfway between");
+	check(matches(one.lookup(0.6f, 0.0f), 2.4f), "between grid points");
+	check(matches(one.lookup(0.0f, 0.0f), 1.0f), "held below first");
+	check(matches(one.lookup(-1.0f, 0.0f), 1.0f), "clipped below 0");
+	check(matches(one.lookup(1.0f, 0.0f), 3.0f), "held above last");
+	check(matches(one.lookup(2.0f, 0.0f), 3.0f), "clipped above 1");
+
+	printf("\nThrottle and voltage\n");
+	GainSchedule two;
+	two.addBreakpoint(0.0f, 12.0f, makeGains(1.0f));
+	two.addBreakpoint(1.0f, 12.0f, makeGains(3.0f));
+	two.addBreakpoint(0.0f, 10.0f, makeGains(2.0f));
+	two.addBreakpoint(1.0f, 10.0f, makeGains(6.0f));
+	two.build();
+
+	check(matches(two.lookup(0.0f, 12.0f), 1.0f), "corner");
+	check(matches(two.lookup(1.0f, 10.0f), 6.0f), "opposite corner");
+	check(matches(two.lookup(0.5f, 12.0f), 2.0f), "along throttle");
+	check(matches(two.lookup(0.0f, 11.0f), 1.5f), "along voltage");
+	check(matches(two.lookup(0.5f, 11.0f), 3.0f), "bilinear");
+	check(matches(two.lookup(0.5f, 9.0f), 4.0f), "held below lowest voltage");
+	check(matches(two.lookup(0.5f, 0.0f), 4.0f), "voltage not set (0)");
+
+	allocations = 0;
+	float sum = 0.0f;
+	for (int i = 0; i < 1000; ++i)
+		sum += two.lookup(i / 1000.0f, 10.0f + i / 500.0f).rate[0];
+	check(allocations == 0 && sum > 0.0f, "lookup does not allocate");
+
+	printf("\nBreakpoints\n");
+	GainSchedule added;
+	added.addBreakpoint(0.75f, 12.0f, makeGains(3.0f));
+	added.addBreakpoint(0.5f, 10.0f, makeGains(7.0f));
+	added.addBreakpoint(0.25f, 12.0f, makeGains(1.0f));
+	check(added.getBreakpointCount() == 3
+			&& added.getBreakpoint(0).voltage == 10.0f
+			&& added.getBreakpoint(1).throttle == 0.25f
+			&& added.getBreakpoint(2).throttle == 0.75f
+			&& matches(added.getBreakpoint(2).gains, 3.0f),
+			"sorted by voltage, then throttle");
+
+	GainSchedule copy(added);
+	copy.build();
+	check(matches(copy.lookup(0.5f, 12.0f), 2.0f)
+			&& matches(copy.lookup(0.9f, 10.0f), 7.0f),
+			"copy builds to the same lookup");
+
+	bool threw = false;
+	try {
+		GainSchedule none;
+		none.build();
+	} catch (GainScheduleException &e) {
+		threw = true;
+	}
+	check(threw, "no breakpoints throws");
+
+	printf("\nSwitching gains on a running PIDBank\n");
+	PIDBank bank(3);
+	float values[3] = { 1.0f, -2.0f, 0.5f };
+	for (int lane = 0; lane < 3; ++lane)
+		bank.setPID(lane, 1.0f, 0.5f, 0.0f);
+	for (int i = 0; i < 100; ++i)
+		bank.feed(values, 0.01f);
+
+	float integral[3];
+	for (int lane = 0; lane < 3; ++lane)
+		integral[lane] = bank.getIntegral(lane);
+
+	// Drive sets scheduled coefficients every update. The integral
+	// contribution must carry over unchanged, so the next output is the new
+	// P term plus the kept integral plus one step at the new I.
+	bool same = true, bumpless = true;
+	for (int lane = 0; lane < 3; ++lane) {
+		bank.setPID(lane, 1.5f, 3.0f, 0.0f);
+		if (!near(bank.getIntegral(lane), integral[lane]))
+			same = false;
+	}
+	bank.feed(values, 0.01f);
+	for (int lane = 0; lane < 3; ++lane) {
+		float expected = 1.5f * -values[lane] + integral[lane]
+				+ 3.0f * -values[lane] * 0.01f;
+		if (fabs(bank.output(lane) - expected) > 1e-4f)
+			bumpless = false;
+	}
+	check(same, "integral kept when gains change");
+	check(bumpless, "output continues from the kept integral");
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
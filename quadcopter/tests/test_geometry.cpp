@@ -0,0 +1,275 @@
+/*
+	test_geometry.cpp
+
+	Tests geometry.h: Vector2 and Vector3 operators and products, Matrix3,
+	Quaternion rotations (against matrices and each other), and Vector4f's
+	SIMD operations against Vector3<float> on random vectors.
+
+	test_geometry_portable.cpp runs the same checks with GEOMETRY_NO_SIMD,
+	so both of Vector4f's paths are covered.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "geometry.h"
+
+#define RANDOM_TRIALS 1000
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static float uniform(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static Vector3<float> randomVector(float range) {
+	return Vector3<float>(uniform(-range, range), uniform(-range, range),
+			uniform(-range, range));
+}
+
+template<typename T>
+static bool near(T a, T b, T tolerance) {
+	return fabs(a - b) <= tolerance;
+}
+
+template<typename T>
+static bool near(const Vector3<T> &a, const Vector3<T> &b, T tolerance) {
+	return near(a.x, b.x, tolerance) && near(a.y, b.y, tolerance)
+			&& near(a.z, b.z, tolerance);
+}
+
+static bool near(const Vector4f &a, const Vector3<float> &b,
+		float tolerance) {
+	return near(a.xyz(), b, tolerance) && a.w == 0.0f;
+}
+
+static bool near(const Matrix3<double> &a, const Matrix3<double> &b,
+		double tolerance) {
+	for (int r = 0; r < 3; ++r)
+		for (int c = 0; c < 3; ++c)
+			if (!near(a.m[r][c], b.m[r][c], tolerance))
+				return false;
+	return true;
+}
+
+#if __cplusplus >= 201103L
+// Folded at compile time: these fail the build, not the test
+static_assert(dot(Vector3<int>(1, 2, 3), Vector3<int>(4, 5, 6)) == 32,
+		"constexpr dot");
+static_assert(cross(Vector3<int>(1, 0, 0), Vector3<int>(0, 1, 0))
+		== Vector3<int>(0, 0, 1), "constexpr cross");
+static_assert((Vector2<int>(1, 2) * 3 - Vector2<int>(1, 1)) / 2
+		== Vector2<int>(1, 2), "constexpr Vector2 operators");
+static_assert(sizeof(Vector4f) == 16 && __alignof__(Vector4f) == 16,
+		"Vector4f layout");
+#endif
+
+int main(int argc, char **argv) {
+	srand(1);
+
+#if defined(GEOMETRY_SSE)
+	printf("Vector4f path: SSE\n");
+#elif defined(GEOMETRY_NEON)
+	printf("Vector4f path: NEON\n");
+#else
+	printf("Vector4f path: portable\n");
+#endif
+
+	printf("Vector2:\n");
+	{
+		const Vector2<float> a(3.0f, 4.0f), b(1.0f, -2.0f);
+		Vector2<float> sum = a + b, diff = a - b, neg = -a, scaled = a * 2.0f,
+		               left = 2.0f * a, divided = a / 2.0f;
+		check(sum == Vector2<float>(4.0f, 2.0f)
+				&& diff == Vector2<float>(2.0f, 6.0f)
+				&& neg == Vector2<float>(-3.0f, -4.0f),
+				"add, subtract, negate (const operands)");
+		check(scaled == Vector2<float>(6.0f, 8.0f) && left == scaled
+				&& divided == Vector2<float>(1.5f, 2.0f),
+				"scale and divide");
+
+		Vector2<float> c = a;
+		(c += b) -= Vector2<float>(1.0f, 1.0f);
+		c *= 2.0f;
+		c /= 4.0f;
+		check(c == Vector2<float>(1.5f, 0.5f), "compound assignment, chained");
+		check(dot(a, b) == -5.0f && magnitude(a) == 5.0f
+				&& magnitudeSquared(a) == 25.0f, "dot, magnitude");
+		check(near(magnitude(normalize(a)), 1.0f, 1e-6f)
+				&& normalize(Vector2<float>(0.0f, 0.0f))
+				== Vector2<float>(0.0f, 0.0f), "normalize (and zero)");
+		check(a != b && !(a != a), "comparison");
+	}
+
+	printf("Vector3:\n");
+	{
+		const Vector3<float> a(1.0f, 2.0f, 3.0f), b(-2.0f, 0.5f, 4.0f);
+		check(a + b == Vector3<float>(-1.0f, 2.5f, 7.0f)
+				&& a - b == Vector3<float>(3.0f, 1.5f, -1.0f)
+				&& -a == Vector3<float>(-1.0f, -2.0f, -3.0f),
+				"add, subtract, negate (const operands)");
+		check(a * 2.0f == Vector3<float>(2.0f, 4.0f, 6.0f)
+				&& 2.0f * a == a * 2.0f
+				&& a / 2.0f == Vector3<float>(0.5f, 1.0f, 1.5f),
+				"scale and divide keep z");
+
+		Vector3<float> c = a;
+		(c += b) -= Vector3<float>(1.0f, 1.0f, 1.0f);
+		c *= 2.0f;
+		c /= 4.0f;
+		check(c == Vector3<float>(-1.0f, 0.75f, 3.0f),
+				"compound assignment, chained");
+
+		check(dot(a, b) == 11.0f && magnitudeSquared(a) == 14.0f
+				&& near(magnitude(a), sqrtf(14.0f), 1e-6f), "dot, magnitude");
+
+		const Vector3<float> x(1, 0, 0), y(0, 1, 0), z(0, 0, 1);
+		check(cross(x, y) == z && cross(y, z) == x && cross(z, x) == y,
+				"cross is right-handed");
+
+		bool ok = true;
+		for (int i = 0; i < RANDOM_TRIALS; ++i) {
+			Vector3<float> u = randomVector(10.0f), v = randomVector(10.0f),
+			               w = cross(u, v);
+			ok = ok && near(dot(w, u), 0.0f, 1e-3f)
+					&& near(dot(w, v), 0.0f, 1e-3f)
+					&& near(w, -cross(v, u), 1e-5f);
+		}
+		check(ok, "cross: orthogonal, anticommutative");
+
+		ok = true;
+		for (int i = 0; i < RANDOM_TRIALS; ++i) {
+			Vector3<float> u = randomVector(100.0f);
+			ok = ok && near(magnitude(normalize(u)), 1.0f, 1e-5f)
+					&& near(normalize(u) * magnitude(u), u, 1e-4f);
+		}
+		check(ok && normalize(Vector3<float>(0, 0, 0))
+				== Vector3<float>(0, 0, 0), "normalize (and zero)");
+
+		Vector3<double> d(1.0, 2.0, 2.0);
+		check(magnitude(d) == 3.0 && dot(d, d) == 9.0, "double");
+	}
+
+	printf("Matrix3:\n");
+	{
+		Matrix3<double> i(1.0), m(Vector3<double>(1, 2, 3),
+				Vector3<double>(0, 1, 4), Vector3<double>(5, 6, 0));
+		Vector3<double> v(1.0, -1.0, 2.0);
+		check(i * v == v && near(i * m, m, 0.0) && near(m * i, m, 0.0),
+				"identity");
+		check(m * v == Vector3<double>(5.0, 7.0, -1.0), "times vector");
+		check(m.row(1) == Vector3<double>(0, 1, 4)
+				&& m.column(1) == Vector3<double>(2, 1, 6), "rows, columns");
+		check(m.transpose().row(0) == m.column(0)
+				&& near(m.transpose().transpose(), m, 0.0), "transpose");
+		check(m.determinant() == 1.0 && (m * 2.0).determinant() == 8.0,
+				"determinant, scale");
+
+		Matrix3<double> mm = m * m;
+		check(mm * v == m * (m * v), "product");
+	}
+
+	printf("Quaternion:\n");
+	{
+		typedef Quaternion<double> Q;
+		const Vector3<double> x(1, 0, 0), y(0, 1, 0), z(0, 0, 1);
+		Q identity;
+		check(identity.rotate(Vector3<double>(1, 2, 3))
+				== Vector3<double>(1, 2, 3), "identity");
+
+		Q yaw = Q::fromAxisAngle(z, 90.0);
+		check(near(yaw.rotate(x), y, 1e-9) && near(yaw.rotate(y), -x, 1e-9),
+				"90 degrees about Z: X to Y (right-handed)");
+
+		bool ok = true, matrix = true, compose = true, inverse = true;
+		for (int i = 0; i < RANDOM_TRIALS; ++i) {
+			Vector3<float> a = randomVector(1.0f), b = randomVector(1.0f),
+			               p = randomVector(10.0f);
+			Vector3<double> v(p.x, p.y, p.z);
+			Q q1 = Q::fromAxisAngle(normalize(Vector3<double>(a.x, a.y, a.z)),
+					uniform(-180.0f, 180.0f));
+			Q q2 = Q::fromAxisAngle(normalize(Vector3<double>(b.x, b.y, b.z)),
+					uniform(-180.0f, 180.0f));
+
+			ok = ok && near(magnitude(q1), 1.0, 1e-12)
+					&& near(magnitude(q1.rotate(v)), magnitude(v), 1e-9);
+			matrix = matrix && near(q1.toMatrix() * v, q1.rotate(v), 1e-9)
+					&& near(q1.toMatrix().determinant(), 1.0, 1e-9)
+					&& near(q1.toMatrix() * q1.toMatrix().transpose(),
+						Matrix3<double>(1.0), 1e-9);
+			compose = compose && near((q1 * q2).rotate(v),
+					q1.rotate(q2.rotate(v)), 1e-9);
+			inverse = inverse && near(q1.conjugate().rotate(q1.rotate(v)), v,
+					1e-9);
+		}
+		check(ok, "unit, rotation keeps length");
+		check(matrix, "toMatrix: same rotation, orthonormal");
+		check(compose, "product composes rotations");
+		check(inverse, "conjugate is the inverse");
+
+		Q small = Q::fromRotationVector(Vector3<double>(1e-8, 0.0, 0.0)),
+		  large = Q::fromRotationVector(Vector3<double>(0.0, 0.0, 90.0));
+		check(near(small.x, 1e-8 * PI / 360.0, 1e-20)
+				&& near(large.rotate(x), y, 1e-9),
+				"fromRotationVector: tiny and large");
+
+		Q drift(2.0, 0.0, 0.0, 0.0);
+		check(magnitude(normalize(drift)) == 1.0
+				&& normalize(Q(0, 0, 0, 0)).w == 1.0, "normalize (and zero)");
+	}
+
+	printf("Vector4f:\n");
+	{
+		static Vector4f array[3];
+		check(((uintptr_t)&array[1] & 15) == 0, "aligned to 16 bytes");
+
+		bool add = true, scale = true, dots = true, crosses = true,
+		     norms = true;
+		for (int i = 0; i < RANDOM_TRIALS; ++i) {
+			Vector3<float> a = randomVector(10.0f), b = randomVector(10.0f);
+			Vector4f va(a), vb(b);
+			float s = uniform(-5.0f, 5.0f);
+
+			Vector4f acc = va;
+			acc += vb;
+			acc -= va * 2.0f;
+			add = add && near(va + vb, a + b, 1e-5f)
+					&& near(va - vb, a - b, 1e-5f)
+					&& near(-va, -a, 0.0f) && near(acc, b - a, 1e-5f);
+			scale = scale && near(va * s, a * s, 1e-5f)
+					&& near(s * va, a * s, 1e-5f)
+					&& near(multiply(va, vb),
+						Vector3<float>(a.x * b.x, a.y * b.y, a.z * b.z), 1e-4f);
+			dots = dots && near(dot(va, vb), dot(a, b), 1e-4f)
+					&& near(magnitude(va), magnitude(a), 1e-5f);
+			crosses = crosses && near(cross(va, vb), cross(a, b), 1e-4f);
+			norms = norms && near(normalize(va), normalize(a), 1e-6f);
+		}
+		check(add, "add, subtract, negate, compound");
+		check(scale, "scale, component-wise multiply");
+		check(dots, "dot, magnitude");
+		check(crosses, "cross (w stays 0)");
+		check(norms && normalize(Vector4f(0, 0, 0)).x == 0.0f,
+				"normalize (and zero)");
+		check(dot(Vector4f(1, 2, 3, 4), Vector4f(5, 6, 7, 8)) == 70.0f,
+				"dot uses all four lanes");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
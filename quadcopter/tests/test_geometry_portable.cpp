@@ -0,0 +1,9 @@
+/*
+	test_geometry_portable.cpp
+
+	test_geometry.cpp's checks on geometry.h's plain C++ path (as on a
+	target without SSE or NEON, e.g. the original Raspberry Pi).
+*/
+
+#define GEOMETRY_NO_SIMD
+#include "test_geometry.cpp"
@@ -0,0 +1,299 @@
+/*
+	test_i2cengine.cpp
+
+	Tests the asynchronous I2C engine against a simulated bus: transfers
+	take as long as they would at 100kHz (about 90us per byte, address
+	bytes included), reads are filled with a known pattern, and slave 0x7F
+	doesn't acknowledge.
+
+	Checks completion (polled, waited for and by callback), ordering,
+	failures, a full queue, submission from several threads and from a
+	signal handler, and that a control loop reading its sensors through the
+	engine overlaps the bus time with its computation.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cengine.h"
+
+#define BYTE_US    90
+#define BAD_SLAVE  0x7F
+#define QUEUE_SIZE 8
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/*
+	Simulated bus
+*/
+class SimEngine : public I2CEngine {
+	public:
+		bool     blocked;    // Transfers wait while set
+		int      transfers;
+		uint16_t order[64];  // First address of each transfer
+		uint8_t  written;    // First byte of the last write
+
+		SimEngine(int queuesize = QUEUE_SIZE) : I2CEngine(0, queuesize),
+				blocked(false), transfers(0), written(0) { }
+
+		~SimEngine() {
+			shutdown();
+		}
+
+	protected:
+		bool transfer(struct i2c_msg *msgs, int count) {
+			while (__atomic_load_n(&blocked, __ATOMIC_ACQUIRE))
+				usleep(100);
+
+			if (transfers < 64)
+				order[transfers] = msgs[0].addr;
+			++transfers;
+
+			int bytes = 0;
+			for (int i = 0; i < count; ++i) {
+				if (msgs[i].addr == BAD_SLAVE)
+					return false;
+				if (msgs[i].flags & I2C_M_RD)
+					for (int j = 0; j < msgs[i].len; ++j)
+						msgs[i].buf[j] = msgs[i].addr + j;
+				else
+					written = msgs[i].buf[0];
+				bytes += msgs[i].len + 1;
+			}
+			usleep(bytes * BYTE_US);
+			return true;
+		}
+};
+
+struct Counter {
+	int            calls;
+	I2CTransaction *last;
+	pthread_t      thread;
+};
+
+static void countCallback(I2CTransaction *transaction, void *data) {
+	Counter *counter = (Counter *)data;
+	++counter->calls;
+	counter->last = transaction;
+	counter->thread = pthread_self();
+}
+
+struct Producer {
+	SimEngine *engine;
+	int       count;
+	int       done;
+};
+
+static void *produce(void *arg) {
+	Producer *p = (Producer *)arg;
+	uint8_t        reg = 0x10, value;
+	I2CTransaction transaction;
+	transaction.addWrite(0x20, &reg, 1);
+	transaction.addRead(0x20, &value, 1);
+	for (int i = 0; i < p->count; ++i) {
+		while (!p->engine->submit(&transaction))
+			usleep(50);
+		if (p->engine->wait(&transaction))
+			++p->done;
+	}
+	return NULL;
+}
+
+static SimEngine      *signalEngine = 0;
+static I2CTransaction *signalTransaction = 0;
+static bool           signalSubmitted = false;
+
+static void signalHandler(int sig) {
+	signalSubmitted = signalEngine->submit(signalTransaction);
+}
+
+/**
+	Busy for the given time, standing in for the control loop's computation
+*/
+static void compute(double seconds) {
+	double end = now() + seconds;
+	while (now() < end)
+		;
+}
+
+int main(int argc, char **argv) {
+	printf("Transactions:\n");
+	{
+		SimEngine engine;
+		uint8_t   reg = 0x32, values[6];
+		memset(values, 0, sizeof(values));
+
+		I2CTransaction transaction;
+		check(transaction.getStatus() == I2CTransaction::STATUS_IDLE
+				&& !engine.wait(&transaction, 10),
+				"new transaction idle, wait returns");
+
+		transaction.addWrite(0x53, &reg, 1);
+		transaction.addRead(0x53, values, 6);
+		check(engine.submit(&transaction)
+				&& transaction.getStatus() == I2CTransaction::STATUS_PENDING,
+				"submitted, pending");
+		check(!engine.submit(&transaction), "pending transaction refused");
+		check(engine.wait(&transaction)
+				&& transaction.getStatus() == I2CTransaction::STATUS_DONE,
+				"wait for completion");
+		check(engine.written == 0x32 && values[0] == 0x53
+				&& values[5] == 0x58, "write sent, read filled");
+
+		Counter counter = { 0, 0, 0 };
+		transaction.setCallback(countCallback, &counter);
+		engine.submit(&transaction);
+		while (!transaction.isComplete())
+			usleep(100);
+		usleep(1000);
+		check(counter.calls == 1 && counter.last == &transaction
+				&& !pthread_equal(counter.thread, pthread_self()),
+				"callback once, from the bus thread");
+
+		bool thrown = false;
+		try {
+			for (int i = 0; i < I2C_TRANSACTION_MAX_MSGS; ++i)
+				transaction.addRead(0x53, values, 1);
+		} catch (I2CException &e) {
+			thrown = true;
+		}
+		check(thrown, "too many messages throws");
+
+		I2CTransaction bad;
+		bad.addRead(BAD_SLAVE, values, 1);
+		engine.submit(&bad);
+		check(!engine.wait(&bad)
+				&& bad.getStatus() == I2CTransaction::STATUS_FAILED
+				&& engine.getFailed() == 1, "failed transfer reported");
+	}
+
+	printf("Queue:\n");
+	{
+		SimEngine      engine;
+		uint8_t        value;
+		I2CTransaction transactions[QUEUE_SIZE + 2];
+		for (int i = 0; i < QUEUE_SIZE + 2; ++i)
+			transactions[i].addRead(0x10 + i, &value, 1);
+
+		// The first is taken by the bus thread, which then blocks
+		engine.blocked = true;
+		engine.submit(&transactions[0]);
+		usleep(10000);
+		int accepted = 1;
+		while (accepted < QUEUE_SIZE + 2
+				&& engine.submit(&transactions[accepted]))
+			++accepted;
+		check(accepted == QUEUE_SIZE + 1
+				&& transactions[accepted].getStatus()
+					== I2CTransaction::STATUS_IDLE,
+				"full queue refuses, transaction untouched");
+
+		__atomic_store_n(&engine.blocked, false, __ATOMIC_RELEASE);
+		engine.wait(&transactions[accepted - 1]);
+		bool ordered = true;
+		for (int i = 0; i < accepted; ++i)
+			ordered = ordered && engine.order[i] == 0x10 + i;
+		check(ordered, "sent in submission order");
+	}
+
+	printf("Producers:\n");
+	{
+		SimEngine engine;
+		Producer  producers[4];
+		pthread_t threads[4];
+		for (int i = 0; i < 4; ++i) {
+			producers[i].engine = &engine;
+			producers[i].count = 200;
+			producers[i].done = 0;
+			pthread_create(&threads[i], NULL, produce, &producers[i]);
+		}
+		int done = 0;
+		for (int i = 0; i < 4; ++i) {
+			pthread_join(threads[i], NULL);
+			done += producers[i].done;
+		}
+		check(done == 800 && engine.getCompleted() == 800,
+				"4 threads, all transactions complete");
+
+		uint8_t        value;
+		I2CTransaction transaction;
+		transaction.addRead(0x30, &value, 1);
+		signalEngine = &engine;
+		signalTransaction = &transaction;
+		signal(SIGUSR1, signalHandler);
+		raise(SIGUSR1);
+		check(signalSubmitted && engine.wait(&transaction, 1000),
+				"submitted from a signal handler");
+	}
+
+	printf("Control loop:\n");
+	{
+		// Accelerometer and gyroscope, as Drive reads them
+		SimEngine engine;
+		uint8_t   accelreg = 0x32, gyroreg = 0xA8,
+		          accel[6], gyro[6];
+		I2CTransaction sensors;
+		sensors.addWrite(0x53, &accelreg, 1);
+		sensors.addRead(0x53, accel, 6);
+		sensors.addWrite(0x69, &gyroreg, 1);
+		sensors.addRead(0x69, gyro, 6);
+
+		const int    ticks = 50;
+		const double work = 0.0015;
+
+		double start = now();
+		for (int i = 0; i < ticks; ++i) {
+			engine.submit(&sensors);
+			engine.wait(&sensors);
+			compute(work);
+		}
+		double sync = (now() - start) / ticks;
+
+		start = now();
+		int stale = 0;
+		engine.submit(&sensors);
+		for (int i = 0; i < ticks; ++i) {
+			if (!sensors.isComplete())
+				++stale;
+			engine.wait(&sensors);
+			engine.submit(&sensors);
+			compute(work);
+		}
+		engine.wait(&sensors);
+		double async = (now() - start) / ticks;
+
+		printf("    per update: %.2fms waiting for the bus, %.2fms overlapped\n",
+				sync * 1000.0, async * 1000.0);
+		check(async < sync * 0.75, "bus time overlaps computation");
+		check(accel[0] == 0x53 && gyro[0] == 0x69, "values read");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+	test_i2crecovery.cpp
+
+	Tests I2C error recovery on a simulated bus (SimI2C): retries with
+	backoff within the time budget, which errors are retried, and the
+	GPIO bus-clear sequence against a simulated slave holding SDA low.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cbusclear.h"
+#include "i2cstats.h"
+#include "simulator.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/*
+	Simulated bus lines, with a slave that holds SDA low for the given
+	number of clocks. Records the lines' transitions, to check that
+	a stop is sent.
+*/
+class SimBusClear : public I2CBusClear {
+	public:
+		int  held;      // Clocks until the slave lets go, -1 for never
+		bool sda, scl;  // Levels driven by the master (true = released)
+		bool stopped;   // SDA rose while SCL was high
+		bool restored;
+
+		SimBusClear(int clocks) : held(clocks), sda(true), scl(true),
+				stopped(false), restored(false) { }
+
+		bool isHeld() { return held != 0; }
+
+	protected:
+		void setSDA(bool high) {
+			if (high && !sda && scl && !isHeld())
+				stopped = true;
+			sda = high;
+		}
+
+		void setSCL(bool high) {
+			// The slave shifts out a bit on each falling edge
+			if (scl && !high && held > 0)
+				--held;
+			scl = high;
+		}
+
+		bool readSDA() { return sda && !isHeld(); }
+		void restore() { restored = true; }
+		void delay() { }
+};
+
+/*
+	Bus whose transfers time out while the simulated lines are held
+*/
+class StuckI2C : public SimI2C {
+	public:
+		SimBusClear *lines;
+
+		StuckI2C(SimBusClear *busclear) : lines(busclear) { }
+
+	protected:
+		int fault(uint8_t addr) {
+			int error = SimI2C::fault(addr);
+			return (error == 0 && lines->isHeld() ? ETIMEDOUT : error);
+		}
+};
+
+int main(int argc, char **argv) {
+	uint8_t data[2] = { 0x2D, 0x08 }, values[6];
+
+	printf("Retries:\n");
+	{
+		SimI2C i2c;
+		i2c.addSlave(0x53);
+
+		i2c.failNext(1, EREMOTEIO);
+		bool thrown = false;
+		try {
+			i2c.write(0x53, data, 2);
+		} catch (I2CException &e) {
+			thrown = true;
+		}
+		check(!thrown && i2c.attempts == 2 && i2c.getRetries() == 1
+				&& i2c.registers[0x53][0x2D] == 0x08,
+				"transient NACK costs one retry");
+
+		I2CStatsSnapshot snap = i2c.getStats()->snapshot();
+		check(snap.slaves.size() == 1 && snap.slaves[0].transactions == 2
+				&& snap.slaves[0].errors == 1,
+				"failed attempt in the statistics");
+
+		i2c.attempts = 0;
+		i2c.failNext(I2C_RETRY_COUNT + 1, EIO);
+		thrown = false;
+		try {
+			i2c.write(0x53, data, 2);
+		} catch (I2CException &e) {
+			thrown = true;
+		}
+		check(thrown && i2c.attempts == I2C_RETRY_COUNT + 1,
+				"throws once retries run out");
+
+		i2c.attempts = 0;
+		i2c.failNext(1, EINVAL);
+		thrown = false;
+		try {
+			i2c.write(0x53, data, 2);
+		} catch (I2CException &e) {
+			thrown = true;
+		}
+		check(thrown && i2c.attempts == 1, "EINVAL not retried");
+
+		i2c.attempts = 0;
+		i2c.failNext(2, ETIMEDOUT);
+		i2c.enqueueWrite(0x53, data, 1);
+		i2c.enqueueRead(0x53, values, 6);
+		thrown = false;
+		try {
+			i2c.sendTransaction();
+		} catch (I2CException &e) {
+			thrown = true;
+		}
+		check(!thrown && i2c.attempts == 3, "transactions retried");
+
+		i2c.attempts = 0;
+		i2c.failNext(1, EAGAIN);
+		size_t got = 0;
+		try {
+			got = i2c.read(0x53, values, 6);
+		} catch (I2CException &e) { }
+		check(got == 6 && i2c.attempts == 2, "reads retried");
+	}
+
+	printf("Backoff:\n");
+	{
+		SimI2C i2c;
+		i2c.addSlave(0x40);
+
+		I2CRetryPolicy policy;
+		policy.retries = 3;
+		policy.backoff = 1000;
+		policy.maxBackoff = 2000;
+		policy.budget = 100000;
+		i2c.setRetryPolicy(policy);
+
+		i2c.failNext(3, EREMOTEIO);
+		double start = now();
+		i2c.write(0x40, data, 2);
+		double taken = now() - start;
+		check(i2c.attempts == 4 && taken >= 0.005 && taken < 0.05,
+				"doubling, capped at maxBackoff (1+2+2ms)");
+
+		policy.budget = 2500;
+		i2c.setRetryPolicy(policy);
+		i2c.attempts = 0;
+		i2c.failNext(10, EREMOTEIO);
+		start = now();
+		bool thrown = false;
+		try {
+			i2c.write(0x40, data, 2);
+		} catch (I2CException &e) {
+			thrown = true;
+		}
+		taken = now() - start;
+		check(thrown && i2c.attempts == 2 && taken < 0.0025,
+				"stops before exceeding the budget");
+	}
+
+	printf("Bus clear:\n");
+	{
+		SimBusClear lines(5);
+		check(lines.isStuck(), "held SDA detected");
+		check(lines.clear() && lines.getClocks() == 5 && lines.stopped
+				&& lines.restored, "released after 5 clocks, stop sent");
+
+		check(lines.clear() && lines.getClears() == 1,
+				"free bus left alone");
+
+		SimBusClear dead(-1);
+		check(!dead.clear() && dead.getClocks() == I2C_BUSCLEAR_CLOCKS
+				&& dead.restored, "gives up after 9 clocks");
+
+		SimBusClear held(3);
+		StuckI2C    i2c(&held);
+		i2c.addSlave(0x69);
+		i2c.setBusClear(&held);
+		bool thrown = false;
+		try {
+			i2c.write(0x69, data, 2);
+		} catch (I2CException &e) {
+			thrown = true;
+		}
+		check(!thrown && i2c.getBusClears() == 1 && i2c.attempts == 2,
+				"retry clears a stuck bus, then succeeds");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
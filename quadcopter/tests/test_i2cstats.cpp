@@ -0,0 +1,161 @@
+/*
+	test_i2cstats.cpp
+
+	Tests the I2C statistics (I2CStats) by recording simulated traffic: the
+	accelerometer and gyroscope read every 10ms as Drive does, PWM writes,
+	and NACKs from an intermittent slave.
+
+	Checks the per-slave counters, error kinds, latency histogram buckets,
+	utilization estimates, interval differences, and recording from several
+	threads at once.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+
+#include <linux/i2c.h>
+
+#include "i2cstats.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static const I2CSlaveStats *find(const I2CStatsSnapshot &snap,
+		uint8_t address) {
+	for (size_t i = 0; i < snap.slaves.size(); ++i)
+		if (snap.slaves[i].address == address)
+			return &snap.slaves[i];
+	return 0;
+}
+
+static void *recordMany(void *arg) {
+	I2CStats *stats = (I2CStats *)arg;
+	for (int i = 0; i < 100000; ++i)
+		stats->record(0x40, 5, 100, 0);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	printf("Counters:\n");
+	{
+		I2CStats stats;
+		I2CStatsSnapshot empty = stats.snapshot();
+		check(empty.slaves.size() == 0 && empty.busyTime == 0,
+				"starts empty");
+
+		// Accelerometer and gyroscope in one transaction, as Drive reads
+		// them through an I2CEngine
+		uint8_t reg, values[6];
+		struct i2c_msg msgs[4] = {
+			{ 0x53, 0, 1, &reg }, { 0x53, I2C_M_RD, 6, values },
+			{ 0x69, 0, 1, &reg }, { 0x69, I2C_M_RD, 6, values }
+		};
+		for (int i = 0; i < 100; ++i)
+			stats.record(msgs, 4, 1800, 0);
+
+		stats.record(0x40, 5, 500, 0);
+		stats.record(0x40, 5, 40, EREMOTEIO);
+		stats.record(0x40, 5, 300, -1);
+		stats.record(0x40, 5, 20000, ETIMEDOUT);
+		stats.record(0x40, 5, 1000000, EPROTO);
+
+		I2CStatsSnapshot snap = stats.snapshot();
+		const I2CSlaveStats *accel = find(snap, 0x53),
+		                    *gyro = find(snap, 0x69),
+		                    *pwm = find(snap, 0x40);
+		check(snap.slaves.size() == 3 && accel && gyro && pwm,
+				"one entry per slave used");
+		check(accel->transactions == 100 && accel->bytes == 700
+				&& gyro->transactions == 100 && gyro->bytes == 700,
+				"shared transaction counted for each slave");
+		check(fabs(accel->getMeanLatency() - 900.0f) < 1.0f
+				&& accel->histogram[4] == 100,
+				"latency split by bytes, <1024us bucket");
+		check(pwm->errors == 4
+				&& pwm->errorCounts[I2CStats::ERROR_REMOTEIO] == 1
+				&& pwm->errorCounts[I2CStats::ERROR_SHORT] == 1
+				&& pwm->errorCounts[I2CStats::ERROR_TIMEDOUT] == 1
+				&& pwm->errorCounts[I2CStats::ERROR_OTHER] == 1
+				&& fabs(pwm->getErrorRate() - 0.8f) < 1e-6f,
+				"errors by kind");
+		check(pwm->histogram[0] == 1 && pwm->histogram[3] == 2
+				&& pwm->histogram[9] == 1
+				&& pwm->histogram[I2C_STATS_BUCKETS - 1] == 1
+				&& pwm->latencyMax == 1000000,
+				"histogram buckets and max");
+
+		// 18 bytes (with addresses) * 9 + 4 starts + stop = 167 bits, and
+		// 6 * 9 + 2 = 56 bits for each PWM write
+		check(snap.wireTime == 100 * 1670 + 5 * 560
+				&& snap.busyTime == 100 * 1800 + 500 + 40 + 300 + 20000
+					+ 1000000,
+				"busy and wire time");
+	}
+
+	printf("Intervals:\n");
+	{
+		I2CStats stats(400000);
+		stats.record(0x40, 5, 100, 0);
+		I2CStatsSnapshot before = stats.snapshot();
+		for (int i = 0; i < 10; ++i)
+			stats.record(0x53, 6, 200, 0);
+		stats.record(0x40, 5, 100, 0);
+		I2CStatsSnapshot after = stats.snapshot();
+		I2CStatsSnapshot diff = after.since(before);
+
+		const I2CSlaveStats *pwm = find(diff, 0x40),
+		                    *accel = find(diff, 0x53);
+		check(pwm && pwm->transactions == 1 && accel
+				&& accel->transactions == 10 && diff.busyTime == 2100,
+				"difference covers only the interval");
+		check(diff.elapsed == after.time - before.time
+				&& diff.getUtilization() > 0.0f,
+				"utilization over the interval");
+		check(diff.wireTime == (10 * 65 + 56) * 1000000LL / 400000,
+				"wire time at 400kHz");
+
+		std::ostringstream out;
+		diff.print(out);
+		std::string text = out.str();
+		check(text.find("0x40: 1 transactions") != std::string::npos
+				&& text.find("0x53: 10 transactions") != std::string::npos
+				&& text.find("busy") != std::string::npos,
+				"printed report");
+	}
+
+	printf("Threads:\n");
+	{
+		I2CStats  stats;
+		pthread_t threads[4];
+		for (int i = 0; i < 4; ++i)
+			pthread_create(&threads[i], NULL, recordMany, &stats);
+		for (int i = 0; i < 4; ++i)
+			pthread_join(threads[i], NULL);
+
+		I2CStatsSnapshot snap = stats.snapshot();
+		const I2CSlaveStats *pwm = find(snap, 0x40);
+		check(pwm && pwm->transactions == 400000
+				&& pwm->bytes == 2000000 && snap.busyTime == 40000000,
+				"no counts lost between threads");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
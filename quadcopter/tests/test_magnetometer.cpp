@@ -0,0 +1,237 @@
+/*
+	test_magnetometer.cpp
+
+	Tests the Magnetometer (HMC5883L) driver against a simulated chip
+	(SimMagnetometer): configuration, burst reads synchronously and through
+	an I2CEngine, and overflow. Then the tilt-compensated heading over a
+	range of attitudes, and hard and soft iron calibration (MagCalibrator)
+	from readings of a distorted field in random orientations.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cengine.h"
+#include "magnetometer.h"
+#include "calibration.h"
+#include "simulator.h"
+
+#define MAG_ADDR 0x1E
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static bool near(const Vector3<float> &a, const Vector3<float> &b,
+		float tolerance) {
+	return fabs(a.x - b.x) <= tolerance && fabs(a.y - b.y) <= tolerance
+			&& fabs(a.z - b.z) <= tolerance;
+}
+
+/*
+	Rotation matrices about the quadcopter's axes (degrees)
+*/
+static Matrix3<float> rotation(int axis, float degrees) {
+	float c = cos(degrees * PI / 180.0), s = sin(degrees * PI / 180.0);
+	int   i = (axis + 1) % 3, j = (axis + 2) % 3;
+	Matrix3<float> m(1.0f);
+	m.m[i][i] = c;
+	m.m[i][j] = -s;
+	m.m[j][i] = s;
+	m.m[j][j] = c;
+	return m;
+}
+
+static Matrix3<float> multiply(const Matrix3<float> &a,
+		const Matrix3<float> &b) {
+	Matrix3<float> m(0.0f);
+	for (int r = 0; r < 3; ++r)
+		for (int c = 0; c < 3; ++c)
+			for (int k = 0; k < 3; ++k)
+				m.m[r][c] += a.m[r][k] * b.m[k][c];
+	return m;
+}
+
+static Matrix3<float> transpose(const Matrix3<float> &a) {
+	Matrix3<float> m;
+	for (int r = 0; r < 3; ++r)
+		for (int c = 0; c < 3; ++c)
+			m.m[r][c] = a.m[c][r];
+	return m;
+}
+
+/*
+	The quadcopter turned to heading yaw, then pitched and rolled. World
+	vectors are given in the axes of the level quadcopter at heading 0 (X
+	to magnetic north, Z down, as the accelerometer reads -1g on Z when
+	level). Returns world-to-body.
+*/
+static Matrix3<float> attitude(float yaw, float pitch, float roll) {
+	return transpose(multiply(rotation(2, yaw),
+			multiply(rotation(1, pitch), rotation(0, roll))));
+}
+
+// The Earth's field: 0.2 gauss north, 0.4 gauss down; and "up"
+static const Vector3<float> EARTH(0.2f, 0.0f, 0.4f),
+                            UP(0.0f, 0.0f, -1.0f);
+
+static float uniform(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+
+	printf("Driver:\n");
+	{
+		SimI2C          bus;
+		SimMagnetometer chip(&bus, MAG_ADDR);
+		Magnetometer    mag(&bus, MAG_ADDR);
+
+		check(bus.registers[MAG_ADDR][0x00] == 0x18
+				&& bus.registers[MAG_ADDR][0x01] == 0x20
+				&& bus.registers[MAG_ADDR][0x02] == 0x00,
+				"75Hz, 1.3Ga, continuous measurement");
+
+		Vector3<float> field(0.21f, -0.13f, 0.42f);
+		chip.set(field);
+		int before = bus.attempts;
+		Vector3<float> got = mag.read();
+		check(near(got, field, 1.0f / 1090.0f) && !mag.isSaturated(),
+				"read in gauss, axes reordered");
+		check(bus.attempts == before + 1, "one burst transaction per read");
+
+		I2CEngine      engine(&bus);
+		I2CTransaction read;
+		mag.queueRead(&read);
+		chip.set(Vector3<float>(-0.3f, 0.05f, 0.1f));
+		check(engine.submit(&read) && engine.wait(&read, 1000)
+				&& near(mag.readQueued(), Vector3<float>(-0.3f, 0.05f, 0.1f),
+					1.0f / 1090.0f),
+				"queued read through an I2CEngine");
+
+		chip.set(Vector3<float>(2.0f, 0.0f, 0.0f));
+		mag.read();
+		check(mag.isSaturated(), "overflow detected");
+
+		mag.setGain(Magnetometer::GAIN_8_1GA);
+		chip.set(Vector3<float>(2.0f, 0.0f, 0.0f));
+		got = mag.read();
+		check(!mag.isSaturated() && fabs(got.x - 2.0f) < 1.0f / 230.0f,
+				"in range at a lower gain");
+
+		mag.setSleep(true);
+		check(bus.registers[MAG_ADDR][0x02] == 0x02, "idle mode");
+	}
+
+	printf("Heading:\n");
+	{
+		float worst = 0.0f;
+		for (int yaw = -180; yaw < 180; yaw += 15)
+			for (int pitch = -30; pitch <= 30; pitch += 15)
+				for (int roll = -30; roll <= 30; roll += 15) {
+					Matrix3<float> r = attitude(yaw, pitch, roll);
+					float heading = Magnetometer::getHeading(r * EARTH,
+							r * UP);
+					float error = fabs(angleDifference(heading, (float)yaw));
+					if (error > worst)
+						worst = error;
+				}
+		check(worst < 0.01f, "exact over +/-30 degrees of tilt");
+
+		Matrix3<float> level = attitude(40.0f, 0.0f, 0.0f),
+		               tilted = attitude(40.0f, 0.0f, 30.0f);
+		Vector3<float> uncompensated = tilted * EARTH;
+		float naive = atan2(uncompensated.y, uncompensated.x) * 180.0 / PI;
+		check(fabs(angleDifference(-naive, 40.0f)) > 10.0f
+				&& fabs(Magnetometer::getHeading(level * EARTH, level * UP)
+					- 40.0f) < 0.01f,
+				"tilt matters without compensation");
+
+		// Turning about Z the way the gyroscope reads positive
+		Vector3<float> before = attitude(10.0f, 0.0f, 0.0f) * EARTH,
+		               after = attitude(20.0f, 0.0f, 0.0f) * EARTH;
+		check(Magnetometer::getHeading(after, UP)
+				> Magnetometer::getHeading(before, UP),
+				"heading grows with positive yaw");
+	}
+
+	printf("Calibration:\n");
+	{
+		SimI2C          bus;
+		SimMagnetometer chip(&bus, MAG_ADDR);
+		Magnetometer    mag(&bus, MAG_ADDR);
+		chip.hardIron = Vector3<float>(0.12f, -0.2f, 0.05f);
+		chip.softIron.m[0][0] = 1.2f;
+		chip.softIron.m[1][1] = 0.85f;
+		chip.softIron.m[2][2] = 1.05f;
+
+		MagCalibrator calibrator;
+		for (int i = 0; i < 500; ++i) {
+			chip.set(attitude(uniform(-180.0f, 180.0f), uniform(-90.0f, 90.0f),
+					uniform(-180.0f, 180.0f)) * EARTH);
+			calibrator.addSample(mag.read());
+		}
+		MagCalibration cal = calibrator.fit();
+		check(near(cal.offset, chip.hardIron, 0.005f), "hard iron offset found");
+
+		float strength = magnitude(EARTH), worst = 0.0f, worstheading = 0.0f,
+		      rawworst = 0.0f;
+		for (int yaw = -180; yaw < 180; yaw += 10) {
+			Matrix3<float> r = attitude(yaw, 10.0f, -20.0f);
+			chip.set(r * EARTH);
+			Vector3<float> raw = mag.read(), field = cal.apply(raw);
+
+			// The fit keeps the mean radius, which soft iron changed
+			worst = fmax(worst, fabs(magnitude(field) - strength * 1.0333f));
+			worstheading = fmax(worstheading, fabs(angleDifference(
+					Magnetometer::getHeading(field, r * UP), (float)yaw)));
+			rawworst = fmax(rawworst, fabs(angleDifference(
+					Magnetometer::getHeading(raw, r * UP), (float)yaw)));
+		}
+		check(worst < 0.01f, "calibrated readings on a sphere");
+		check(worstheading < 1.0f && rawworst > 20.0f,
+				"heading within 1 degree (>20 uncalibrated)");
+
+		MagCalibrator few;
+		for (int i = 0; i < MAGCAL_MIN_SAMPLES - 1; ++i)
+			few.addSample(Vector3<float>(i * 0.01f, 0.0f, 0.0f));
+		bool thrown = false;
+		try {
+			few.fit();
+		} catch (CalibrationException &e) {
+			thrown = true;
+		}
+		check(thrown, "too few readings throws");
+
+		// Turned about Z only: nothing is learnt about Z
+		MagCalibrator flat;
+		for (int yaw = 0; yaw < 360; yaw += 3)
+			flat.addSample(attitude(yaw, 0.0f, 0.0f) * EARTH);
+		thrown = false;
+		try {
+			flat.fit();
+		} catch (CalibrationException &e) {
+			thrown = true;
+		}
+		check(thrown, "one axis not turned through throws");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,186 @@
+/*
+	test_multibus.cpp
+
+	Tests the PWM's queued output through an I2CEngine, and the control
+	loop's pipelining when the sensors and PCA9685 are on separate buses,
+	each with its own engine, against one bus shared by both.
+
+	Uses simulated buses (SimI2C) that hold the bus for a fixed time per
+	byte. Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cengine.h"
+#include "pwm.h"
+#include "simulator.h"
+
+#define PWM_ADDR   0x40
+#define ACCEL_ADDR 0x53
+#define GYRO_ADDR  0x69
+
+// Simulated bus time per byte (roughly 100kHz), and control loop work
+#define BYTE_TIME    90
+#define COMPUTE_TIME 1000
+#define TICKS        100
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/*
+	Returns the count written to a PCA9685 channel
+*/
+static int count(SimI2C &bus, int channel) {
+	return bus.registers[PWM_ADDR][0x08 + channel * 4]
+			| (bus.registers[PWM_ADDR][0x09 + channel * 4] << 8);
+}
+
+/*
+	Run TICKS updates the way Drive does: use the sensor read submitted by
+	the last update and submit the next, compute, then set and flush the
+	four motors. Waits whenever a read or the last motor writes are still on
+	the bus. Returns the mean time per update, in seconds.
+*/
+static double runLoop(I2CEngine *sensors, PWM *pwm) {
+	uint8_t        reg = 0x32, values[12];
+	I2CTransaction read;
+	read.addWrite(ACCEL_ADDR, &reg, 1);
+	read.addRead(ACCEL_ADDR, values, 6);
+	read.addWrite(GYRO_ADDR, &reg, 1);
+	read.addRead(GYRO_ADDR, values + 6, 6);
+
+	double start = now();
+	for (int tick = 0; tick < TICKS; ++tick) {
+		while (read.getStatus() == I2CTransaction::STATUS_PENDING)
+			usleep(50);
+		sensors->submit(&read);
+
+		usleep(COMPUTE_TIME);
+
+		int channels[4] = { 0, 2, 5, 7 };
+		for (int i = 0; i < 4; ++i)
+			pwm->setExactLoad(channels[i], 1000 + tick * 10 + i);
+		while (pwm->flush() != PWM::FLUSH_SENT)
+			usleep(50);
+	}
+	sensors->wait(&read, 1000);
+	double taken = (now() - start) / TICKS;
+
+	pwm->setEngine(0);
+	return taken;
+}
+
+int main(int argc, char **argv) {
+	printf("Queued PWM output:\n");
+	{
+		SimI2C bus;
+		bus.addSlave(PWM_ADDR);
+		PWM       pwm(&bus, PWM_ADDR);
+		I2CEngine engine(&bus);
+
+		pwm.setEngine(&engine);
+		int before = bus.attempts;
+		pwm.setExactLoad(0, 300);
+		pwm.setExactLoad(5, 5000);
+		check(bus.attempts == before && count(bus, 0) == 0,
+				"loads queued, not written");
+
+		check(pwm.flush() == PWM::FLUSH_SENT, "flush submits");
+		usleep(20000);
+		check(count(bus, 0) == 300 && count(bus, 5) == 4095
+				&& engine.getCompleted() == 1 && bus.attempts == before + 1,
+				"one transaction, counts clipped");
+
+		check(pwm.flush() == PWM::FLUSH_SENT && engine.getCompleted() == 1,
+				"nothing to flush, nothing sent");
+
+		bus.byteTime = 1000;
+		pwm.setExactLoad(2, 700);
+		pwm.flush();
+		pwm.setExactLoad(7, 800);
+		check(pwm.flush() == PWM::FLUSH_DEFERRED && count(bus, 7) == 0,
+				"writes in flight: later loads deferred");
+		usleep(50000);
+		check(pwm.flush() == PWM::FLUSH_SENT, "flushed once the bus is free");
+		usleep(50000);
+		check(count(bus, 2) == 700 && count(bus, 7) == 800,
+				"both loads written");
+		bus.byteTime = 0;
+
+		bus.failNext(I2C_RETRY_COUNT + 1, EIO);
+		pwm.setExactLoad(3, 900);
+		pwm.flush();
+		usleep(20000);
+		check(pwm.flush() == PWM::FLUSH_FAILED, "failed writes reported");
+		usleep(20000);
+		check(count(bus, 3) == 900, "failed writes sent again");
+
+		pwm.setExactLoad(4, 1100);
+		pwm.setEngine(0);
+		check(count(bus, 4) == 1100, "queued loads written when detached");
+
+		pwm.setExactLoad(4, 1200);
+		check(count(bus, 4) == 1200, "synchronous writes without an engine");
+	}
+
+	printf("Pipelining:\n");
+	{
+		SimI2C bus;
+		bus.addSlave(PWM_ADDR);
+		bus.addSlave(ACCEL_ADDR);
+		bus.addSlave(GYRO_ADDR);
+		PWM pwm(&bus, PWM_ADDR);
+		bus.byteTime = BYTE_TIME;
+		I2CEngine engine(&bus);
+		pwm.setEngine(&engine);
+		double shared = runLoop(&engine, &pwm);
+
+		SimI2C sensorbus, pwmbus;
+		sensorbus.addSlave(ACCEL_ADDR);
+		sensorbus.addSlave(GYRO_ADDR);
+		pwmbus.addSlave(PWM_ADDR);
+		PWM pwm2(&pwmbus, PWM_ADDR);
+		sensorbus.byteTime = BYTE_TIME;
+		pwmbus.byteTime = BYTE_TIME;
+		I2CEngine sensorengine(&sensorbus),
+		          pwmengine(&pwmbus);
+		pwm2.setEngine(&pwmengine);
+		double separate = runLoop(&sensorengine, &pwm2);
+
+		printf("  shared bus %.2fms, separate buses %.2fms per update\n",
+				shared * 1000.0, separate * 1000.0);
+		check(count(bus, 7) == 1000 + (TICKS - 1) * 10 + 3
+				&& count(pwmbus, 7) == count(bus, 7),
+				"every update's motor writes sent");
+		check(pwmbus.attempts > 0 && sensorbus.attempts > 0
+				&& !sensorbus.present[PWM_ADDR],
+				"each device group on its own bus");
+		check(separate < shared * 0.8,
+				"separate buses overlap sensing and actuation");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,307 @@
+/*
+	test_notchbank.cpp
+
+	Tests Biquad::setNotch() and the NotchBank: its response against scalar
+	Biquads, how much of a motor-like vibration it removes and how little it
+	delays the rates below it compared with more smoothing, the handover of
+	new coefficients (including from another thread while filtering), and
+	the centres worked out from vibration peaks and from the motor speed.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "geometry.h"
+#include "biquad.h"
+#include "vibrationanalyzer.h"
+#include "notchbank.h"
+
+#define RATE 400.0f
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static bool near(float value, float expected, float tolerance) {
+	return fabs(value - expected) <= tolerance;
+}
+
+/*
+	Amplitude of a Biquad's output to a unit sine of the given frequency,
+	once settled
+*/
+static float biquadGain(Biquad &biquad, float frequency) {
+	biquad.reset();
+	float peak = 0.0f;
+	for (int i = 0; i < 4000; ++i) {
+		float out = biquad.process(sin(2.0f * M_PI * frequency * i / RATE));
+		if (i >= 3000)
+			peak = fmax(peak, fabs(out));
+	}
+	return peak;
+}
+
+/*
+	Amplitude of a NotchBank's X output to a unit sine of the given
+	frequency, once settled
+*/
+static float bankGain(NotchBank &bank, float frequency) {
+	bank.reset();
+	float peak = 0.0f;
+	for (int i = 0; i < 4000; ++i) {
+		float in = sin(2.0f * M_PI * frequency * i / RATE);
+		float out = bank.process(Vector3<float>(in, 0.0f, 0.0f)).x;
+		if (i >= 3000)
+			peak = fmax(peak, fabs(out));
+	}
+	return peak;
+}
+
+/*
+	Delay (samples) of a settled sine of the given frequency through the
+	filter, from the phase of its output: correlated against the input's
+	sine and cosine
+*/
+template<typename F>
+static float delay(float frequency, F filter) {
+	double s = 0.0, c = 0.0;
+	for (int i = 0; i < 4000; ++i) {
+		float phase = 2.0f * M_PI * frequency * i / RATE;
+		float out = filter(sin(phase));
+		if (i >= 2000) {
+			s += out * sin(phase);
+			c += out * cos(phase);
+		}
+	}
+	return -atan2(c, s) / (2.0f * M_PI * frequency) * RATE;
+}
+
+static volatile bool stopWriter;
+
+/*
+	Keeps moving the X notches of the bank between two sets of centres
+*/
+static void *writer(void *arg) {
+	NotchBank *bank = (NotchBank *)arg;
+	for (int i = 0; !stopWriter; ++i) {
+		for (int s = 0; s < NOTCH_SECTIONS; ++s)
+			bank->setNotch(s, 0, (i % 2 ? 60.0f : 150.0f) + 20.0f * s);
+		while (!bank->publish() && !stopWriter)
+			sched_yield();
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+
+	printf("Biquad::setNotch():\n");
+	{
+		Biquad notch;
+		notch.setNotch(30.0f, RATE, 3.0f);
+		float center = biquadGain(notch, 30.0f),
+		      low = biquadGain(notch, 5.0f),
+		      edge = biquadGain(notch, 30.0f + 30.0f / 3.0f / 2.0f);
+		printf("  gain %.4f at centre, %.4f at 5Hz, %.3f at the edge\n",
+				center, low, edge);
+		check(center < 0.01f, "removes the centre");
+		check(near(low, 1.0f, 0.01f), "passes low rates");
+		check(near(edge, 0.7071f, 0.03f), "-3dB at half the width away");
+	}
+
+	printf("NotchBank:\n");
+	{
+		// Different centres on each axis, against scalar Biquads
+		NotchBank bank(RATE);
+		Biquad scalar[3][NOTCH_SECTIONS];
+		float centers[3][NOTCH_SECTIONS] = {
+			{ 87.3f, 143.9f, 0.0f },
+			{ 60.0f, 0.0f, 120.0f },
+			{ 0.0f, 0.0f, 0.0f }
+		};
+		for (int axis = 0; axis < 3; ++axis)
+			for (int s = 0; s < NOTCH_SECTIONS; ++s) {
+				bank.setNotch(s, axis, centers[axis][s]);
+				if (centers[axis][s] > 0.0f)
+					scalar[axis][s].setNotch(centers[axis][s], RATE,
+							NOTCH_DEFAULT_Q);
+			}
+		check(bank.publish(), "publishes");
+
+		float worst = 0.0f;
+		for (int i = 0; i < 2000; ++i) {
+			float in[3];
+			for (int axis = 0; axis < 3; ++axis)
+				in[axis] = (rand() / (float)RAND_MAX - 0.5f) * 100.0f;
+			Vector3<float> out = bank.process(
+					Vector3<float>(in[0], in[1], in[2]));
+			float got[3] = { out.x, out.y, out.z };
+			for (int axis = 0; axis < 3; ++axis) {
+				float expected = in[axis];
+				for (int s = 0; s < NOTCH_SECTIONS; ++s)
+					expected = scalar[axis][s].process(expected);
+				worst = fmax(worst, fabs(got[axis] - expected));
+			}
+		}
+		check(worst < 1e-3f, "matches scalar Biquads, per axis");
+		check(bank.getRetunes() == 1, "took the coefficients once");
+
+		bank.reset(Vector3<float>(10.0f, -5.0f, 2.0f));
+		Vector3<float> settled = bank.process(Vector3<float>(10.0f, -5.0f,
+				2.0f));
+		check(near(settled.x, 10.0f, 1e-4f) && near(settled.y, -5.0f, 1e-4f)
+				&& near(settled.z, 2.0f, 1e-4f), "reset() settles");
+
+		NotchBank range(RATE);
+		range.setNotch(0, 0, NOTCH_MIN_FREQUENCY - 1.0f);
+		range.setNotch(1, 0, RATE * NOTCH_MAX_RATIO + 1.0f);
+		range.setNotch(2, 0, 100.0f);
+		range.setNotch(NOTCH_SECTIONS, 0, 100.0f);
+		range.setNotch(0, 3, 100.0f);
+		check(range.getCenter(0, 0) == 0.0f && range.getCenter(1, 0) == 0.0f
+				&& range.getCenter(2, 0) == 100.0f,
+				"passes through out of range centres");
+	}
+
+	printf("Against smoothing:\n");
+	{
+		// A vibration at 87.3Hz on a 5Hz rate. The notch removes nearly all
+		// of it; averaging 3 readings (the default smoothing) removes half,
+		// and delays the rate by a whole reading.
+		NotchBank bank(RATE);
+		bank.setNotch(0, 0, 87.3f);
+		bank.publish();
+		float notched = bankGain(bank, 87.3f);
+
+		float history[3] = { 0.0f, 0.0f, 0.0f };
+		int   pos = 0;
+		auto average = [&](float in) {
+			history[pos] = in;
+			pos = (pos + 1) % 3;
+			return (history[0] + history[1] + history[2]) / 3.0f;
+		};
+		float averaged = 0.0f;
+		for (int i = 0; i < 4000; ++i) {
+			float out = average(sin(2.0f * M_PI * 87.3f * i / RATE));
+			if (i >= 3000)
+				averaged = fmax(averaged, fabs(out));
+		}
+
+		float notchdelay = delay(5.0f, [&](float in) {
+			return bank.process(Vector3<float>(in, 0.0f, 0.0f)).x;
+		});
+		float averagedelay = delay(5.0f, average);
+		printf("  vibration left %.3f notched, %.3f averaged\n", notched,
+				averaged);
+		printf("  5Hz delayed %.3f readings notched, %.3f averaged\n",
+				notchdelay, averagedelay);
+		check(notched < 0.01f && averaged > 0.4f, "removes more vibration");
+		check(notchdelay < 0.3f && near(averagedelay, 1.0f, 0.01f),
+				"delays the rate less");
+	}
+
+	printf("Handover:\n");
+	{
+		NotchBank bank(RATE);
+		bank.setNotch(0, 0, 87.3f);
+		check(bankGain(bank, 87.3f) > 0.99f, "nothing changes until published");
+		bank.publish();
+		bank.process(Vector3<float>(0.0f, 0.0f, 0.0f));
+		int retunes = bank.getRetunes();
+		check(bank.publish(), "publishes nothing new");
+		bank.process(Vector3<float>(0.0f, 0.0f, 0.0f));
+		check(bank.getRetunes() == retunes, "so process() takes nothing");
+
+		bank.setNotch(0, 0, 100.0f);
+		bank.publish();
+		bank.setNotch(0, 0, 87.3f);
+		check(!bank.publish(), "waits for process() to take the last");
+		bank.process(Vector3<float>(0.0f, 0.0f, 0.0f));
+		check(bank.publish() && bankGain(bank, 87.3f) < 0.01f,
+				"then hands over what is staged");
+
+		// Filtering while another thread keeps retuning. Every output must
+		// come from a whole set of coefficients: a torn set could be
+		// unstable, or notch the wrong frequencies.
+		NotchBank shared(RATE);
+		stopWriter = false;
+		pthread_t thread;
+		pthread_create(&thread, NULL, writer, &shared);
+		float worst = 0.0f;
+		for (int i = 0; i < 100000000 && shared.getRetunes() < 1000; ++i) {
+			float in = sin(2.0f * M_PI * 5.0f * i / RATE);
+			worst = fmax(worst, fabs(shared.process(
+					Vector3<float>(in, 0.0f, 0.0f)).x));
+			if (i % 64 == 0)
+				sched_yield();
+		}
+		stopWriter = true;
+		pthread_join(thread, NULL);
+		printf("  %d retunes, largest output %.3f\n", shared.getRetunes(),
+				worst);
+		check(shared.getRetunes() >= 1000 && worst < 1.5f,
+				"retuned from another thread while filtering");
+	}
+
+	printf("Tracking:\n");
+	{
+		NotchBank bank(RATE);
+		VibrationPeak peaks[3] = {
+			{ 87.3f, 3.0f }, { 143.9f, 1.2f }, { 30.0f, 0.1f }
+		};
+		bank.setPeaks(1, peaks, 3, 0.5f);
+		check(bank.getCenter(0, 1) == 87.3f && bank.getCenter(1, 1) == 143.9f
+				&& bank.getCenter(2, 1) == 0.0f && bank.getCenter(0, 0) == 0.0f,
+				"peaks above the least amplitude, on their axis");
+		bank.setPeaks(1, peaks, 1, 0.5f);
+		check(bank.getCenter(1, 1) == 0.0f, "fewer peaks than sections");
+
+		// Peaks found in readings faster than the bank's (e.g. at 800Hz):
+		// 250Hz and 310Hz alias to 150Hz and 90Hz at 400Hz
+		VibrationPeak fast[2] = { { 250.0f, 3.0f }, { 310.0f, 1.2f } };
+		bank.setPeaks(2, fast, 2, 0.5f);
+		check(near(bank.getCenter(0, 2), 150.0f, 1e-3f)
+				&& near(bank.getCenter(1, 2), 90.0f, 1e-3f),
+				"peaks above half the rate folded");
+
+		// 250Hz at full speed: the harmonics at 250, 500 and 750Hz alias to
+		// 150, 100 and 50Hz at 400Hz
+		check(bank.trackMotorSpeed(1.0f, 250.0f), "tracks the motor speed");
+		bool folded = true;
+		for (int axis = 0; axis < 3; ++axis)
+			folded = folded && near(bank.getCenter(0, axis), 150.0f, 1e-3f)
+					&& near(bank.getCenter(1, axis), 100.0f, 1e-3f)
+					&& near(bank.getCenter(2, axis), 50.0f, 1e-3f);
+		check(folded, "harmonics folded to where they alias");
+
+		bank.process(Vector3<float>(0.0f, 0.0f, 0.0f));
+		int retunes = bank.getRetunes();
+		bank.trackMotorSpeed(1.001f, 250.0f);
+		bank.process(Vector3<float>(0.0f, 0.0f, 0.0f));
+		check(bank.getRetunes() == retunes, "ignores small changes");
+
+		bank.trackMotorSpeed(0.0f, 250.0f);
+		check(bank.getCenter(0, 0) == 0.0f && bank.getCenter(2, 2) == 0.0f,
+				"nothing notched with the motors stopped");
+		bank.clear();
+		check(bank.getCenter(1, 0) == 0.0f, "clear()");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
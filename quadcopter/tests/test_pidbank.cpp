@@ -0,0 +1,131 @@
+/*
+	test_pidbank.cpp
+
+	Checks that each lane of a PIDBank produces the same output as a
+	PIDController with the same configuration, over a long pseudo-random
+	input sequence that exercises saturation, both anti-windup methods,
+	derivative filtering, setpoint weights, feed-forward and resets.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "pidcontroller.h"
+#include "pidbank.h"
+
+#define LANES 7 // Deliberately not a multiple of 4
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static float randomRange(float min, float max) {
+	return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+int main(int argc, char **argv) {
+	srand(1234);
+
+	PIDBank bank(LANES);
+	PIDController *single[LANES];
+
+	for (int i = 0; i < LANES; ++i) {
+		float p = randomRange(0.0f, 3.0f),
+		      in = randomRange(0.0f, 2.0f),
+		      d = randomRange(0.0f, 0.5f);
+		single[i] = new PIDController(0.0f, p, in, d);
+		bank.setPID(i, p, in, d);
+
+		if (i % 2 == 0) {
+			single[i]->setOutputLimits(-20.0f, 20.0f + i);
+			bank.setOutputLimits(i, -20.0f, 20.0f + i);
+		}
+		if (i % 3 == 0) {
+			single[i]->setIntegralLimit(5.0f);
+			bank.setIntegralLimit(i, 5.0f);
+		}
+		if (i % 4 == 1) {
+			single[i]->setAntiWindup(PIDController::ANTIWINDUP_BACKCALC);
+			bank.setAntiWindup(i, PIDController::ANTIWINDUP_BACKCALC);
+		}
+		if (i % 4 == 2) {
+			single[i]->setAntiWindup(PIDController::ANTIWINDUP_BACKCALC, 3.0f);
+			bank.setAntiWindup(i, PIDController::ANTIWINDUP_BACKCALC, 3.0f);
+		}
+		if (i != 3) {
+			single[i]->setDerivativeFilter(10.0f + i * 5.0f, 100.0f);
+			bank.setDerivativeFilter(i, 10.0f + i * 5.0f, 100.0f);
+		}
+		if (i == 5) {
+			single[i]->setSetpointWeights(0.5f, 0.2f);
+			bank.setSetpointWeights(i, 0.5f, 0.2f);
+			single[i]->setFeedForward(0.3f);
+			bank.setFeedForward(i, 0.3f);
+		}
+	}
+
+	float values[LANES];
+	float maxdiff = 0.0f;
+	for (int step = 0; step < 20000; ++step) {
+		if (step % 250 == 0) {
+			for (int i = 0; i < LANES; ++i) {
+				float target = randomRange(-40.0f, 40.0f);
+				single[i]->setTarget(target);
+				bank.setTarget(i, target);
+			}
+		}
+		if (step % 5000 == 4999) {
+			single[step % LANES]->reset();
+			bank.reset(step % LANES);
+		}
+
+		float dtime = randomRange(0.008f, 0.012f);
+		for (int i = 0; i < LANES; ++i) {
+			values[i] = randomRange(-30.0f, 30.0f);
+			single[i]->feed(values[i], dtime);
+		}
+		bank.feed(values, dtime);
+
+		for (int i = 0; i < LANES; ++i) {
+			float diff = fabs(bank.output(i) - single[i]->output());
+			float scale = fabs(single[i]->output()) + 1.0f;
+			if (diff / scale > maxdiff)
+				maxdiff = diff / scale;
+		}
+	}
+
+	// The bank multiplies by 1/dt where PIDController divides by dt, so the
+	// derivative terms differ in the last bits
+	printf("Largest relative difference from PIDController: %g\n", maxdiff);
+	check(maxdiff < 1e-3f, "every lane matches PIDController");
+
+	bool same = true;
+	for (int i = 0; i < LANES; ++i)
+		if (fabs(bank.getIntegral(i) - single[i]->getIntegral()) > 1e-3f)
+			same = false;
+	check(same, "integral terms match");
+
+	// Out of range lanes are ignored
+	bank.setPID(LANES, 1.0f, 1.0f, 1.0f);
+	bank.setTarget(-1, 1.0f);
+	check(bank.getLanes() == LANES, "invalid lanes ignored");
+
+	for (int i = 0; i < LANES; ++i)
+		delete single[i];
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
+
@@ -0,0 +1,266 @@
+/*
+	test_pidcontroller.cpp
+
+	Simulated step response tests for PIDController: anti-windup, output and
+	integral limits, derivative filtering, setpoint weighting and
+	feed-forward. Also checks that feed() never allocates.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <new>
+
+#include "geometry.h"
+#include "pidcontroller.h"
+
+#include "simulator.h"
+
+#define RATE 100 // Control loop rate (Hz)
+
+// Count allocations, so feed() can be checked to be allocation-free
+static unsigned long allocations = 0;
+
+void *operator new(size_t size) {
+	++allocations;
+	void *p = malloc(size);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) throw() {
+	free(p);
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+/*
+	Run an angle step on a SimAxis, with a single PID producing the motor
+	command directly. held is the number of seconds the frame is prevented
+	from moving (e.g. sitting on the ground) before it is released.
+*/
+static StepResponse runAngleStep(PIDController &pid, float target,
+		float held = 0.0f, float seconds = 10.0f) {
+	const float dtime = 1.0f / RATE;
+	SimAxis plant;
+	StepResponse resp(target, 0.0f, fabs(target) * 0.02f);
+
+	pid.setTarget(target);
+	for (int i = 0; i < seconds * RATE; ++i) {
+		float t = i * dtime;
+		pid.feed(plant.angle, dtime);
+		if (t < held) {
+			plant.rate = 0.0f;
+			plant.angle = 0.0f;
+		} else {
+			plant.step(pid.output() / 100.0f, dtime);
+			resp.record(t - held, plant.angle);
+		}
+	}
+	return resp;
+}
+
+static void testAntiWindup() {
+	printf("Anti-windup (held on the ground for 3 s, then released)\n");
+
+	PIDController limited(0.0f, 4.0f, 2.0f, 1.2f);
+	limited.setOutputLimits(-20.0f, 20.0f);
+	StepResponse free_resp = runAngleStep(limited, 30.0f);
+
+	PIDController none(0.0f, 4.0f, 2.0f, 1.2f);
+	none.setOutputLimits(-20.0f, 20.0f);
+	none.setAntiWindup(PIDController::ANTIWINDUP_BACKCALC, 0.0001f);
+	StepResponse none_resp = runAngleStep(none, 30.0f, 3.0f);
+
+	PIDController clamp(0.0f, 4.0f, 2.0f, 1.2f);
+	clamp.setOutputLimits(-20.0f, 20.0f);
+	StepResponse clamp_resp = runAngleStep(clamp, 30.0f, 3.0f);
+
+	PIDController backcalc(0.0f, 4.0f, 2.0f, 1.2f);
+	backcalc.setOutputLimits(-20.0f, 20.0f);
+	backcalc.setAntiWindup(PIDController::ANTIWINDUP_BACKCALC);
+	StepResponse backcalc_resp = runAngleStep(backcalc, 30.0f, 3.0f);
+
+	printf("  not held         : overshoot %5.1f%%, settled %.2f s\n",
+			free_resp.overshoot() * 100.0f, free_resp.settlingTime());
+	printf("  no anti-windup   : overshoot %5.1f%%, settled %.2f s\n",
+			none_resp.overshoot() * 100.0f, none_resp.settlingTime());
+	printf("  clamp            : overshoot %5.1f%%, settled %.2f s\n",
+			clamp_resp.overshoot() * 100.0f, clamp_resp.settlingTime());
+	printf("  back-calculation : overshoot %5.1f%%, settled %.2f s\n",
+			backcalc_resp.overshoot() * 100.0f, backcalc_resp.settlingTime());
+
+	check(none_resp.overshoot() > 0.5f, "windup is reproduced without it");
+	check(clamp_resp.overshoot() < free_resp.overshoot() + 0.1f,
+			"clamp removes windup overshoot");
+	check(backcalc_resp.overshoot() < free_resp.overshoot() + 0.1f,
+			"back-calculation removes windup overshoot");
+	check(clamp_resp.settlingTime() >= 0.0f
+			&& backcalc_resp.settlingTime() >= 0.0f, "both settle");
+}
+
+static void testLimits() {
+	printf("Output and integral limits\n");
+
+	PIDController pid(100.0f, 10.0f, 5.0f, 0.0f);
+	pid.setOutputLimits(-15.0f, 25.0f);
+	pid.setIntegralLimit(8.0f);
+
+	bool inrange = true;
+	for (int i = 0; i < 500; ++i) {
+		pid.feed(0.0f, 0.01f);
+		if (pid.output() > 25.0f || pid.output() < -15.0f)
+			inrange = false;
+	}
+	check(inrange && pid.output() == 25.0f, "output clipped to maximum");
+	check(fabs(pid.getIntegral()) <= 8.0f, "integral within limit");
+
+	pid.setTarget(-100.0f);
+	for (int i = 0; i < 500; ++i)
+		pid.feed(0.0f, 0.01f);
+	check(pid.output() == -15.0f, "output clipped to minimum");
+}
+
+static void testDerivativeFilter() {
+	printf("Derivative filter (45 Hz noise on a 1 Hz signal)\n");
+	const float dtime = 1.0f / RATE;
+
+	PIDController raw(0.0f, 0.0f, 0.0f, 1.0f);
+	PIDController filtered(0.0f, 0.0f, 0.0f, 1.0f);
+	filtered.setDerivativeFilter(10.0f, RATE);
+
+	float rawsq = 0.0f, filteredsq = 0.0f;
+	int   count = 0;
+	for (int i = 0; i < 5 * RATE; ++i) {
+		float t = i * dtime;
+		float signal = 10.0f * sinf(2.0f * PI * 1.0f * t);
+		float noise = 0.5f * sinf(2.0f * PI * 45.0f * t);
+		raw.feed(signal + noise, dtime);
+		filtered.feed(signal + noise, dtime);
+
+		if (i > RATE) {
+			// Derivative of the clean signal (negated: on measurement)
+			float ideal = -10.0f * 2.0f * PI * cosf(2.0f * PI * t);
+			rawsq += (raw.output() - ideal) * (raw.output() - ideal);
+			filteredsq += (filtered.output() - ideal)
+					* (filtered.output() - ideal);
+			++count;
+		}
+	}
+	float rawrms = sqrtf(rawsq / count),
+	      filteredrms = sqrtf(filteredsq / count);
+	printf("  RMS error vs. clean derivative: raw %.1f, filtered %.1f\n",
+			rawrms, filteredrms);
+	check(filteredrms < rawrms / 4.0f, "filter removes most of the noise");
+}
+
+static void testSetpointWeighting() {
+	printf("Setpoint weighting\n");
+
+	PIDController full(0.0f, 4.0f, 2.0f, 1.2f);
+	StepResponse full_resp = runAngleStep(full, 20.0f);
+
+	PIDController weighted(0.0f, 4.0f, 2.0f, 1.2f);
+	weighted.setSetpointWeights(0.3f, 0.0f);
+	StepResponse weighted_resp = runAngleStep(weighted, 20.0f);
+
+	printf("  b = 1.0 : overshoot %5.1f%%, settled %.2f s\n",
+			full_resp.overshoot() * 100.0f, full_resp.settlingTime());
+	printf("  b = 0.3 : overshoot %5.1f%%, settled %.2f s\n",
+			weighted_resp.overshoot() * 100.0f, weighted_resp.settlingTime());
+	check(weighted_resp.overshoot() < full_resp.overshoot(),
+			"lower b reduces overshoot");
+	check(weighted_resp.settlingTime() >= 0.0f, "weighted step settles");
+
+	// No derivative kick on a change of target with c = 0
+	PIDController kick(0.0f, 1.0f, 0.0f, 5.0f);
+	kick.feed(0.0f, 0.01f);
+	kick.setTarget(10.0f);
+	kick.feed(0.0f, 0.01f);
+	check(fabs(kick.output() - 10.0f) < 1e-4f, "no derivative kick");
+}
+
+static void testFeedForward() {
+	printf("Feed-forward (rate loop, 60 dps step)\n");
+	const float dtime = 1.0f / RATE;
+
+	float settle[2];
+	for (int ff = 0; ff < 2; ++ff) {
+		SimAxis plant;
+		PIDController pid(60.0f, 1.0f, 0.2f, 0.0f);
+		// Steady state command for rate r is r * damping / gain (x100)
+		if (ff)
+			pid.setFeedForward(100.0f * plant.damping / plant.gain);
+		StepResponse resp(60.0f, 0.0f, 3.0f);
+		for (int i = 0; i < 3 * RATE; ++i) {
+			pid.feed(plant.rate, dtime);
+			plant.step(pid.output() / 100.0f, dtime);
+			resp.record(i * dtime, plant.rate);
+		}
+		settle[ff] = resp.settlingTime();
+		printf("  %s : settled %.2f s\n", ff ? "with FF   " : "without FF",
+				settle[ff]);
+	}
+	check(settle[1] >= 0.0f && (settle[0] < 0.0f || settle[1] < settle[0]),
+			"feed-forward settles faster");
+}
+
+static void testBumpless() {
+	printf("Gain changes and reset\n");
+
+	PIDController pid(10.0f, 1.0f, 2.0f, 0.0f);
+	for (int i = 0; i < 100; ++i)
+		pid.feed(0.0f, 0.01f);
+	float before = pid.output();
+	pid.setI(4.0f);
+	pid.feed(0.0f, 0.0f); // Ignored: no time has passed
+	check(pid.output() == before, "feed with no elapsed time is ignored");
+	pid.feed(0.0f, 0.01f);
+	check(fabs(pid.output() - before) < 1.0f, "changing I is bumpless");
+
+	pid.reset();
+	pid.feed(0.0f, 0.01f);
+	check(fabs(pid.output() - (10.0f + 0.4f)) < 1e-4f,
+			"reset clears integral and history");
+}
+
+static void testNoAllocation() {
+	PIDController pid(1.0f, 1.0f, 1.0f, 1.0f);
+	pid.setOutputLimits(-1.0f, 1.0f);
+	pid.setDerivativeFilter(20.0f, RATE);
+
+	unsigned long before = allocations;
+	for (int i = 0; i < 1000; ++i)
+		pid.feed((float)(i % 7), 0.01f);
+	for (int i = 0; i < 1000; ++i)
+		pid.feed((float)(i % 7));
+	check(allocations == before, "feed() does not allocate");
+}
+
+int main(int argc, char **argv) {
+	testAntiWindup();
+	testLimits();
+	testDerivativeFilter();
+	testSetpointWeighting();
+	testFeedForward();
+	testBumpless();
+	testNoAllocation();
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
+
@@ -0,0 +1,172 @@
+/*
+	test_rawsamples.cpp
+
+	Tests the raw sample API of the accelerometer and gyroscope against a
+	simulated bus: readRaw() and readQueuedRaw() fill caller arrays with
+	the counts as the chip gave them and their acquisition times, stop when
+	the arrays are full, and convertRaw() turns them into what read() would
+	have given.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "i2cengine.h"
+#include "accelerometer.h"
+#include "gyroscope.h"
+#include "rawsamples.h"
+#include "simulator.h"
+
+#define ACCEL_ADDR 0x53
+#define GYRO_ADDR  0x69
+#define SAMPLES    16
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+/*
+	Put a raw reading (little-endian) into the data registers at reg
+*/
+static void setRaw(SimI2C *bus, uint8_t addr, uint8_t reg,
+		const int16_t *values) {
+	for (int i = 0; i < 3; ++i) {
+		bus->registers[addr][reg + 2 * i] = (uint16_t)values[i] & 0xFF;
+		bus->registers[addr][reg + 2 * i + 1] = (uint16_t)values[i] >> 8;
+	}
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	SimI2C bus;
+	bus.addSlave(ACCEL_ADDR);
+	bus.addSlave(GYRO_ADDR, 0x7F); // Auto-increment in the register's bit 7
+
+	printf("RawSamples:\n");
+	{
+		int16_t  x[2], y[2], z[2];
+		uint64_t t[2];
+		RawSamples samples(x, y, z, t, 2);
+		int16_t  a[3] = { 1, -2, 3 }, b[3] = { -4, 5, -6 };
+		check(samples.add(a, 10) && samples.add(b, 20) && !samples.add(a, 30)
+				&& samples.count == 2 && samples.full(),
+				"fills to capacity, then refuses");
+		check(x[0] == 1 && y[0] == -2 && z[0] == 3 && t[0] == 10
+				&& x[1] == -4 && y[1] == 5 && z[1] == -6 && t[1] == 20,
+				"one array per axis, and times");
+		samples.clear();
+		check(samples.count == 0 && !samples.full(), "clear()");
+
+		int16_t in[37];
+		float   out[37];
+		for (int i = 0; i < 37; ++i)
+			in[i] = (int16_t)(rand() % 65536 - 32768);
+		scaleRaw(in, out, 37, 0.07f);
+		bool scaled = true;
+		for (int i = 0; i < 37; ++i)
+			scaled = scaled && out[i] == in[i] * 0.07f;
+		check(scaled, "scaleRaw()");
+	}
+
+	printf("Accelerometer:\n");
+	try {
+		Accelerometer accel(&bus, ACCEL_ADDR, Accelerometer::RANGE_4G);
+		int16_t  x[SAMPLES], y[SAMPLES], z[SAMPLES], expected[SAMPLES][3];
+		uint64_t t[SAMPLES];
+		RawSamples samples(x, y, z, t, SAMPLES);
+
+		uint64_t before = rawSampleTime();
+		int reads = 0;
+		for (;;) {
+			int16_t raw[3] = { (int16_t)(reads * 100 - 700),
+					(int16_t)(-reads * 3), (int16_t)(256 + reads) };
+			setRaw(&bus, ACCEL_ADDR, 0x32, raw);
+			if (!accel.readRaw(&samples))
+				break;
+			for (int i = 0; i < 3; ++i)
+				expected[reads][i] = raw[i];
+			++reads;
+		}
+		uint64_t after = rawSampleTime();
+
+		bool counts = true, times = true;
+		for (int i = 0; i < SAMPLES; ++i) {
+			counts = counts && x[i] == expected[i][0] && y[i] == expected[i][1]
+					&& z[i] == expected[i][2];
+			times = times && t[i] >= before && t[i] <= after
+					&& (i == 0 || t[i] >= t[i - 1]);
+		}
+		check(reads == SAMPLES && samples.count == SAMPLES,
+				"readRaw() until full");
+		check(counts, "raw counts as in the registers");
+		check(times, "times in order, within the reads");
+
+		int attempts = bus.attempts;
+		check(!accel.readRaw(&samples) && bus.attempts == attempts,
+				"no transfer once full");
+
+		float gx[SAMPLES], gy[SAMPLES], gz[SAMPLES];
+		Accelerometer::convertRaw(samples, gx, gy, gz, accel.getScale());
+		bool converted = true;
+		for (int i = 0; i < SAMPLES; ++i) {
+			setRaw(&bus, ACCEL_ADDR, 0x32, expected[i]);
+			Vector3<float> value = accel.read();
+			converted = converted && gx[i] == value.x && gy[i] == value.y
+					&& gz[i] == value.z;
+		}
+		check(converted, "convertRaw() gives what read() does");
+	} catch (Exception &e) {
+		printf("  %s\n", e.getDescription().c_str());
+		check(false, "no exception");
+	}
+
+	printf("Gyroscope:\n");
+	try {
+		Gyroscope gyro(&bus, GYRO_ADDR, Gyroscope::RANGE_2000DPS);
+		int16_t  x[SAMPLES], y[SAMPLES], z[SAMPLES];
+		uint64_t t[SAMPLES];
+		RawSamples samples(x, y, z, t, SAMPLES);
+
+		int16_t raw[3] = { 1000, -2000, 300 };
+		setRaw(&bus, GYRO_ADDR, 0x28, raw);
+		check(gyro.readRaw(&samples) && x[0] == 1000 && y[0] == -2000
+				&& z[0] == 300, "readRaw() keeps the chip's axes");
+
+		I2CEngine      engine(&bus);
+		I2CTransaction read;
+		gyro.queueRead(&read);
+		int16_t queued[3] = { -5, 6, -7 };
+		setRaw(&bus, GYRO_ADDR, 0x28, queued);
+		check(engine.submit(&read) && engine.wait(&read, 1000)
+				&& gyro.readQueuedRaw(&samples, 12345) && samples.count == 2
+				&& x[1] == -5 && y[1] == 6 && z[1] == -7 && t[1] == 12345,
+				"readQueuedRaw() through an I2CEngine");
+
+		float gx[SAMPLES], gy[SAMPLES], gz[SAMPLES];
+		Gyroscope::convertRaw(samples, gx, gy, gz, gyro.getScale());
+		setRaw(&bus, GYRO_ADDR, 0x28, raw);
+		Vector3<float> value = gyro.read();
+		check(gx[0] == value.x && gy[0] == value.y && gz[0] == value.z,
+				"convertRaw() gives what read() does, X/Y swapped");
+	} catch (Exception &e) {
+		printf("  %s\n", e.getDescription().c_str());
+		check(false, "no exception");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,206 @@
+/*
+	test_sensorscale.cpp
+
+	Tests the accelerometer's and gyroscope's conversion of raw output,
+	against a simulated bus: for every range, read() must give what the
+	per-read lookup and divide gave before, and the compile-time
+	(convertRaw<R>) and bulk (convertRaw) conversions must agree with it.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "exception.h"
+#include "i2c.h"
+#include "accelerometer.h"
+#include "gyroscope.h"
+#include "simulator.h"
+
+#define ACCEL_ADDR 0x53
+#define GYRO_ADDR  0x69
+#define BATCH      32  // As the ADXL345's FIFO
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static bool same(const Vector3<float> &a, const Vector3<float> &b) {
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+/*
+	Put a raw reading (little-endian) into the data registers at reg
+*/
+static void setRaw(SimI2C *bus, uint8_t addr, uint8_t reg,
+		const int16_t *values) {
+	for (int i = 0; i < 3; ++i) {
+		bus->registers[addr][reg + 2 * i] = (uint16_t)values[i] & 0xFF;
+		bus->registers[addr][reg + 2 * i + 1] = (uint16_t)values[i] >> 8;
+	}
+}
+
+static void randomRaw(int16_t *values, int count) {
+	for (int i = 0; i < count; ++i)
+		values[i] = (int16_t)(rand() % 65536 - 32768);
+}
+
+/*
+	The conversions as they were, looking up the range on every read
+*/
+static Vector3<float> accelReference(Accelerometer::Range range,
+		const int16_t *values) {
+	float factor = 0.0f;
+	switch (range) {
+		case Accelerometer::RANGE_2G:  factor = 256.0f; break;
+		case Accelerometer::RANGE_4G:  factor = 128.0f; break;
+		case Accelerometer::RANGE_8G:  factor = 64.0f;  break;
+		case Accelerometer::RANGE_16G: factor = 32.0f;  break;
+	}
+	return Vector3<float>((float)values[0] / factor,
+			(float)values[1] / factor, (float)values[2] / factor);
+}
+
+static Vector3<float> gyroReference(Gyroscope::Range range,
+		const int16_t *values) {
+	float factor = 0.0f;
+	switch (range) {
+		case Gyroscope::RANGE_250DPS:  factor = 0.00875f; break;
+		case Gyroscope::RANGE_500DPS:  factor = 0.0175f;  break;
+		case Gyroscope::RANGE_2000DPS: factor = 0.07f;    break;
+	}
+	return Vector3<float>(factor * (int)values[1], factor * (int)values[0],
+			factor * (int)values[2]);
+}
+
+template<Accelerometer::Range R>
+static bool accelFixedMatches(const int16_t *values) {
+	return same(Accelerometer::convertRaw<R>(values),
+			accelReference(R, values));
+}
+
+template<Gyroscope::Range R>
+static bool gyroFixedMatches(const int16_t *values) {
+	return same(Gyroscope::convertRaw<R>(values), gyroReference(R, values));
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	SimI2C bus;
+	bus.addSlave(ACCEL_ADDR);
+	bus.addSlave(GYRO_ADDR, 0x7F); // Auto-increment in the register's bit 7
+
+	printf("Accelerometer:\n");
+	try {
+		Accelerometer accel(&bus, ACCEL_ADDR);
+		Accelerometer::Range ranges[] = { Accelerometer::RANGE_2G,
+				Accelerometer::RANGE_4G, Accelerometer::RANGE_8G,
+				Accelerometer::RANGE_16G };
+
+		bool reads = true, registers = true, scales = true;
+		for (int r = 0; r < 4; ++r) {
+			accel.setRange(ranges[r]);
+			registers = registers && bus.registers[ACCEL_ADDR][0x31] == r;
+			scales = scales && accel.getScale()
+					== Accelerometer::scale(ranges[r]);
+			for (int i = 0; i < 200; ++i) {
+				int16_t raw[3];
+				randomRaw(raw, 3);
+				setRaw(&bus, ACCEL_ADDR, 0x32, raw);
+				reads = reads && same(accel.read(),
+						accelReference(ranges[r], raw));
+			}
+		}
+		check(registers, "range written to DATA_FORMAT");
+		check(scales, "scale resolved by setRange()");
+		check(reads, "read() matches the per-read lookup");
+
+		bool fixed = true;
+		for (int i = 0; i < 200; ++i) {
+			int16_t raw[3];
+			randomRaw(raw, 3);
+			fixed = fixed && accelFixedMatches<Accelerometer::RANGE_2G>(raw)
+					&& accelFixedMatches<Accelerometer::RANGE_4G>(raw)
+					&& accelFixedMatches<Accelerometer::RANGE_8G>(raw)
+					&& accelFixedMatches<Accelerometer::RANGE_16G>(raw);
+		}
+		check(fixed, "convertRaw<R>() matches");
+
+		int16_t batch[3 * BATCH];
+		Vector3<float> out[BATCH];
+		randomRaw(batch, 3 * BATCH);
+		accel.setRange(Accelerometer::RANGE_8G);
+		Accelerometer::convertRaw(batch, out, BATCH, accel.getScale());
+		bool bulk = true;
+		for (int i = 0; i < BATCH; ++i)
+			bulk = bulk && same(out[i], accelReference(
+					Accelerometer::RANGE_8G, &batch[3 * i]));
+		check(bulk, "bulk convertRaw() matches");
+	} catch (Exception &e) {
+		printf("  %s\n", e.getDescription().c_str());
+		check(false, "no exception");
+	}
+
+	printf("Gyroscope:\n");
+	try {
+		Gyroscope gyro(&bus, GYRO_ADDR);
+		Gyroscope::Range ranges[] = { Gyroscope::RANGE_250DPS,
+				Gyroscope::RANGE_500DPS, Gyroscope::RANGE_2000DPS };
+
+		bool reads = true, registers = true, scales = true;
+		for (int r = 0; r < 3; ++r) {
+			gyro.setRange(ranges[r]);
+			registers = registers
+					&& bus.registers[GYRO_ADDR][0x23] == (r << 4);
+			scales = scales && gyro.getScale() == Gyroscope::scale(ranges[r]);
+			for (int i = 0; i < 200; ++i) {
+				int16_t raw[3];
+				randomRaw(raw, 3);
+				setRaw(&bus, GYRO_ADDR, 0x28, raw);
+				reads = reads && same(gyro.read(),
+						gyroReference(ranges[r], raw));
+			}
+		}
+		check(registers, "range written to CTRL_REG4");
+		check(scales, "scale resolved by setRange()");
+		check(reads, "read() matches the per-read lookup, X/Y swapped");
+
+		bool fixed = true;
+		for (int i = 0; i < 200; ++i) {
+			int16_t raw[3];
+			randomRaw(raw, 3);
+			fixed = fixed && gyroFixedMatches<Gyroscope::RANGE_250DPS>(raw)
+					&& gyroFixedMatches<Gyroscope::RANGE_500DPS>(raw)
+					&& gyroFixedMatches<Gyroscope::RANGE_2000DPS>(raw);
+		}
+		check(fixed, "convertRaw<R>() matches");
+
+		int16_t batch[3 * BATCH];
+		Vector3<float> out[BATCH];
+		randomRaw(batch, 3 * BATCH);
+		gyro.setRange(Gyroscope::RANGE_2000DPS);
+		Gyroscope::convertRaw(batch, out, BATCH, gyro.getScale());
+		bool bulk = true;
+		for (int i = 0; i < BATCH; ++i)
+			bulk = bulk && same(out[i], gyroReference(
+					Gyroscope::RANGE_2000DPS, &batch[3 * i]));
+		check(bulk, "bulk convertRaw() matches");
+	} catch (Exception &e) {
+		printf("  %s\n", e.getDescription().c_str());
+		check(false, "no exception");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
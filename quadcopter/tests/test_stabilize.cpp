@@ -78,16 +78,19 @@ int main(int argc, char **argv) {
 
 		Drive drive(&pwm, &accel, &gyro, 0, 2, 5, 7, 100, 40);
 		drive.startTimer();
+		drive.arm();
 
 		char   c;
 		bool   running = true;
 		int    count_comm = 0;
 		Packet *pkt = 0;
+		bool   tuning = false;
 
 		while (running && read(STDIN_FILENO, &c, 1) == 0) {
 
 			// Read any available packets
 			while ((pkt = connection.receive()) != 0) {
+				drive.packetReceived();
 				switch (pkt->getHeader()) {
 					case PKT_MOTION:
 					{
@@ -120,6 +123,14 @@ int main(int argc, char **argv) {
 							drive.setPIDAngle(p->getAccelX(), p->getAccelY(), p->getAccelZ());
 						else if (p->getBattery() == 1)
 							drive.setPIDRate(p->getAccelX(), p->getAccelY(), p->getAccelZ());
+						else if (p->getBattery() == 2) {
+							// Auto-tune: X = axis, Y = 0 Angle / 1 Rate,
+							// Z = relay amplitude
+							drive.startAutoTune((Drive::Axis)(int)p->getAccelX(),
+									(p->getAccelY() == 0 ? Drive::TUNE_ANGLE
+									: Drive::TUNE_RATE), p->getAccelZ());
+							tuning = true;
+						}
 
 					}	break;
 
@@ -130,6 +141,16 @@ int main(int argc, char **argv) {
 				pkt = 0;
 			}
 
+			if (tuning && drive.getAutoTuneState() != RelayTuner::STATE_RUNNING) {
+				tuning = false;
+				float tp, ti, td;
+				if (drive.getAutoTuneResult(tp, ti, td))
+					std::cout << "Auto-tune applied: P = " << tp << ", I = "
+							<< ti << ", D = " << td << std::endl;
+				else
+					std::cout << "Auto-tune FAILED" << std::endl;
+			}
+
 			++count_comm;
 			if (count_comm >= 5) {
 				count_comm = 0;
@@ -0,0 +1,201 @@
+/*
+	test_startupsequence.cpp
+
+	Tests StartupSequence: stages completed from several threads in any
+	order, waiting with and without a timeout, the ready callback, failure
+	and cancellation.
+
+	Also simulates a boot (at a tenth of the real timings) the way Drive
+	did it before, with the radio, motor priming, buffer fill and
+	calibration load one after another, against the stages overlapping as
+	they do now, and checks that readiness comes sooner.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "startupsequence.h"
+
+// Simulated boot timings, in milliseconds (a tenth of the real ones)
+#define SIM_RADIO_TIME   200 // Waiting for the radio connection
+#define SIM_PRIME_TIME   300 // DRIVE_PRIME_TIME
+#define SIM_WARMUP_TIME  30  // Filling the smoothing buffers
+#define SIM_CONFIG_TIME  10  // Loading calibration (was an INI parse)
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+struct StageThread {
+	StartupSequence        *sequence;
+	StartupSequence::Stage stage;
+	unsigned int           millis;
+	pthread_t              thread;
+};
+
+static void *stageEntry(void *arg) {
+	StageThread *st = (StageThread *)arg;
+	if (st->sequence->sleep(st->millis))
+		st->sequence->complete(st->stage);
+	return NULL;
+}
+
+static void startStage(StageThread &st, StartupSequence *sequence,
+		StartupSequence::Stage stage, unsigned int millis) {
+	st.sequence = sequence;
+	st.stage = stage;
+	st.millis = millis;
+	pthread_create(&st.thread, NULL, stageEntry, &st);
+}
+
+struct CallbackRecord {
+	int  calls;
+	bool ready;
+};
+
+static void recordCallback(bool ready, void *data) {
+	CallbackRecord *record = (CallbackRecord *)data;
+	++record->calls;
+	record->ready = ready;
+}
+
+int main(int argc, char **argv) {
+	printf("Stages:\n");
+	{
+		StartupSequence sequence;
+		CallbackRecord  record = { 0, false };
+		sequence.setCallback(recordCallback, &record);
+
+		check(sequence.getState() == StartupSequence::STATE_STARTING
+				&& !sequence.isReady(), "starts not ready");
+
+		sequence.complete(StartupSequence::STAGE_CONFIG);
+		sequence.complete(StartupSequence::STAGE_CONFIG);
+		sequence.complete(StartupSequence::STAGE_PRIMING);
+		check(sequence.isComplete(StartupSequence::STAGE_CONFIG)
+				&& !sequence.isComplete(StartupSequence::STAGE_WARMUP)
+				&& !sequence.isReady(), "not ready with a stage left");
+		check(!sequence.wait(20), "timed wait returns false");
+		check(record.calls == 0, "callback not called yet");
+
+		sequence.complete(StartupSequence::STAGE_WARMUP);
+		check(sequence.isReady() && sequence.wait(),
+				"ready once every stage is complete");
+		check(record.calls == 1 && record.ready, "callback called once, ready");
+		check(sequence.getReadyTime()
+				== sequence.getStageTime(StartupSequence::STAGE_WARMUP),
+				"ready time is that of the last stage");
+
+		sequence.fail("too late");
+		check(sequence.isReady() && sequence.getError().empty()
+				&& record.calls == 1, "failing after ready has no effect");
+
+		CallbackRecord late = { 0, false };
+		sequence.setCallback(recordCallback, &late);
+		check(late.calls == 1 && late.ready, "late callback called right away");
+	}
+
+	printf("Threads:\n");
+	{
+		StartupSequence sequence;
+		CallbackRecord  record = { 0, false };
+		sequence.setCallback(recordCallback, &record);
+
+		StageThread threads[3];
+		startStage(threads[0], &sequence, StartupSequence::STAGE_PRIMING, 150);
+		startStage(threads[1], &sequence, StartupSequence::STAGE_WARMUP, 100);
+		startStage(threads[2], &sequence, StartupSequence::STAGE_CONFIG, 50);
+
+		check(sequence.wait(2000), "wait returns true when ready");
+		for (int i = 0; i < 3; ++i)
+			pthread_join(threads[i].thread, NULL);
+
+		float ready = sequence.getReadyTime();
+		check(ready >= 0.14f && ready < 0.25f,
+				"ready after the longest stage, not the sum");
+		check(sequence.getStageTime(StartupSequence::STAGE_CONFIG)
+				< sequence.getStageTime(StartupSequence::STAGE_WARMUP),
+				"stage times recorded in completion order");
+		check(record.calls == 1 && record.ready, "callback called once");
+	}
+
+	printf("Failure and cancellation:\n");
+	{
+		StartupSequence sequence;
+		CallbackRecord  record = { 0, true };
+		sequence.setCallback(recordCallback, &record);
+
+		sequence.complete(StartupSequence::STAGE_CONFIG);
+		sequence.fail("sensor read failed");
+		sequence.complete(StartupSequence::STAGE_WARMUP);
+		sequence.complete(StartupSequence::STAGE_PRIMING);
+		check(sequence.getState() == StartupSequence::STATE_FAILED
+				&& !sequence.isReady() && !sequence.wait(),
+				"failed sequence is never ready");
+		check(sequence.getError() == "sensor read failed", "failure reason kept");
+		check(record.calls == 1 && !record.ready, "callback told of failure");
+
+		StartupSequence cancelled;
+		StageThread st;
+		startStage(st, &cancelled, StartupSequence::STAGE_PRIMING, 5000);
+		usleep(20000);
+		cancelled.cancel();
+		pthread_join(st.thread, NULL);
+		check(cancelled.getElapsed() < 1.0f
+				&& !cancelled.isComplete(StartupSequence::STAGE_PRIMING),
+				"cancel wakes a sleeping stage");
+		check(!cancelled.sleep(1000) && cancelled.isCancelled(),
+				"sleep after cancel returns at once");
+	}
+
+	printf("Simulated boot (1/10 time):\n");
+	{
+		// Before: connect the radio, then construct Drive, which primed,
+		// loaded the calibration and filled the buffers in turn
+		StartupSequence before;
+		before.sleep(SIM_RADIO_TIME);
+		before.sleep(SIM_CONFIG_TIME);
+		before.complete(StartupSequence::STAGE_CONFIG);
+		before.sleep(SIM_PRIME_TIME);
+		before.complete(StartupSequence::STAGE_PRIMING);
+		before.sleep(SIM_WARMUP_TIME);
+		before.complete(StartupSequence::STAGE_WARMUP);
+
+		// Now: Drive starts priming first, and its startup thread does the
+		// rest while the main thread waits for the radio
+		StartupSequence after;
+		StageThread prime, warmup, config;
+		startStage(config, &after, StartupSequence::STAGE_CONFIG,
+				SIM_CONFIG_TIME);
+		startStage(warmup, &after, StartupSequence::STAGE_WARMUP,
+				SIM_CONFIG_TIME + SIM_WARMUP_TIME);
+		startStage(prime, &after, StartupSequence::STAGE_PRIMING,
+				SIM_PRIME_TIME);
+		after.sleep(SIM_RADIO_TIME);
+		after.wait();
+		float afterready = after.getElapsed();
+		pthread_join(config.thread, NULL);
+		pthread_join(warmup.thread, NULL);
+		pthread_join(prime.thread, NULL);
+
+		printf("  sequential %.3fs, overlapped %.3fs\n", before.getReadyTime(),
+				afterready);
+		check(afterready < before.getReadyTime() * 0.7f,
+				"overlapped boot is ready sooner");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
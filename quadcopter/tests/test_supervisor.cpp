@@ -0,0 +1,171 @@
+/*
+	test_supervisor.cpp
+
+	Tests the control-loop Supervisor against a simulated watchdog device
+	(SimWatchdog, a FIFO): a thread stands in for the 100Hz control loop,
+	sending heartbeats until it "hangs".
+
+	Checks that the supervisor pets the watchdog while the loop runs, trips
+	within (missedticks + 1) periods of the last heartbeat, stops petting
+	(so the watchdog fires), tries to send the all-off frame, and disarms
+	the watchdog on a clean stop.
+
+	Does not need any hardware: the I2C device is a plain file, so sending
+	the frame is attempted but fails. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "pwm.h"
+#include "supervisor.h"
+#include "simulator.h"
+
+#define RATE    100
+#define PERIOD  (1.0f / RATE)
+#define MISSED  3
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+/*
+	Simulated control loop, sending heartbeats every period until hung
+*/
+struct Loop {
+	Supervisor *supervisor;
+	bool       hung;
+	pthread_t  thread;
+
+	Loop(Supervisor *s) : supervisor(s), hung(false) {
+		pthread_create(&thread, NULL, entry, this);
+	}
+
+	~Loop() {
+		hang();
+		pthread_join(thread, NULL);
+	}
+
+	void hang() {
+		__atomic_store_n(&hung, true, __ATOMIC_RELEASE);
+	}
+
+	static void *entry(void *arg) {
+		Loop *loop = (Loop *)arg;
+		while (!__atomic_load_n(&loop->hung, __ATOMIC_ACQUIRE)) {
+			loop->supervisor->heartbeat();
+			usleep(1000000 / RATE);
+		}
+		return NULL;
+	}
+};
+
+int main(int argc, char **argv) {
+	printf("All-off frame:\n");
+	{
+		uint8_t frame[PWM_ALLOFF_FRAME_SIZE];
+		PWM::getAllOffFrame(frame);
+		check(frame[0] == 0xFA && frame[1] == 0 && frame[2] == 0
+				&& frame[3] == 0 && frame[4] == 0x10,
+				"ALL_LED registers, full off bit set");
+	}
+
+	// Stands in for the I2C bus: opens, but every transfer fails
+	char i2cpath[] = "/tmp/test_supervisor.XXXXXX";
+	int i2cfd = mkstemp(i2cpath);
+	close(i2cfd);
+
+	printf("Healthy loop:\n");
+	{
+		SimWatchdog watchdog(0.5f);
+		{
+			Supervisor supervisor(watchdog.path, i2cpath, 0x40, RATE, MISSED);
+			supervisor.start();
+			usleep(100000);
+			check(!supervisor.isTripped(), "no trip before the first heartbeat");
+
+			Loop loop(&supervisor);
+			usleep(1000000);
+			check(!supervisor.isTripped()
+					&& supervisor.getFrameAttempts() == 0,
+					"no trip while heartbeats arrive");
+			check(watchdog.getPets() > RATE / 2, "watchdog petted");
+
+			supervisor.stop();
+			loop.hang();
+		}
+		usleep(100000);
+		check(watchdog.isDisarmed() && !watchdog.hasFired(),
+				"clean stop disarms the watchdog");
+		usleep(700000);
+		check(!watchdog.hasFired(), "disarmed watchdog never fires");
+	}
+
+	printf("Hung loop:\n");
+	{
+		SimWatchdog watchdog(0.5f);
+		Supervisor supervisor(watchdog.path, i2cpath, 0x40, RATE, MISSED);
+		supervisor.start();
+
+		Loop loop(&supervisor);
+		usleep(300000);
+		loop.hang();
+		usleep(200000);
+
+		float reaction = supervisor.getReactionTime();
+		check(supervisor.isTripped(), "trips when heartbeats stop");
+		check(reaction > MISSED * PERIOD
+				&& reaction <= (MISSED + 1) * PERIOD + 0.005f,
+				"within (missedticks + 1) periods");
+		printf("    reaction %.1fms (deadline %.0fms)\n", reaction * 1000.0f,
+				MISSED * PERIOD * 1000.0f);
+
+		check(supervisor.getFrameAttempts() > 1 && !supervisor.isFrameSent(),
+				"failed all-off frame retried");
+
+		int pets = watchdog.getPets();
+		usleep(700000);
+		check(watchdog.getPets() == pets && watchdog.hasFired(),
+				"petting stops, watchdog fires");
+
+		Loop again(&supervisor);
+		usleep(100000);
+		check(supervisor.isTripped(), "trip latches when heartbeats return");
+	}
+
+	printf("No devices:\n");
+	{
+		Supervisor supervisor("", "", 0x40, RATE, MISSED);
+		supervisor.start();
+		Loop loop(&supervisor);
+		usleep(100000);
+		loop.hang();
+		usleep(100000);
+		check(supervisor.isTripped() && !supervisor.isFrameSent(),
+				"trips without a watchdog or bus");
+
+		bool thrown = false;
+		try {
+			Supervisor missing("/nonexistent/watchdog", "", 0x40, RATE);
+		} catch (SupervisorException &e) {
+			thrown = true;
+		}
+		check(thrown, "missing device throws");
+	}
+
+	unlink(i2cpath);
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,318 @@
+/*
+	test_vibration.cpp
+
+	Tests RealFFT against a direct DFT, then the VibrationAnalyzer on
+	simulated readings: peak frequencies and amplitudes of motor-like
+	vibration on top of a steady rate, gravity and noise, the tap dropping
+	readings rather than waiting when full, and the analyzer's own thread.
+	Then the readings' times: frequencies at the rate they were actually
+	taken at, and the window starting again after a gap. Finally
+	PacketVibration, which carries the peaks over the radio.
+
+	Does not need any hardware. Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <math.h>
+
+#include <unistd.h>
+
+#include "geometry.h"
+#include "fft.h"
+#include "vibrationanalyzer.h"
+#include "packetvibration.h"
+
+#define RATE 400.0f
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static float uniform(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+/*
+	Worst difference of RealFFT from a direct DFT (in double) on random
+	samples, relative to the largest bin
+*/
+static double fftError(int size) {
+	RealFFT fft(size);
+	float  *data = new float[size];
+	double *x = new double[size];
+	for (int n = 0; n < size; ++n)
+		data[n] = x[n] = uniform(-1.0f, 1.0f);
+	fft.transform(data);
+
+	double worst = 0.0, largest = 0.0;
+	for (int k = 0; k <= size / 2; ++k) {
+		double re = 0.0, im = 0.0;
+		for (int n = 0; n < size; ++n) {
+			re += x[n] * cos(2.0 * M_PI * k * n / size);
+			im -= x[n] * sin(2.0 * M_PI * k * n / size);
+		}
+		double gotre, gotim;
+		if (k == 0) {
+			gotre = data[0];
+			gotim = 0.0;
+		} else if (k == size / 2) {
+			gotre = data[1];
+			gotim = 0.0;
+		} else {
+			gotre = data[2 * k];
+			gotim = data[2 * k + 1];
+		}
+		worst = fmax(worst, hypot(gotre - re, gotim - im));
+		largest = fmax(largest, hypot(re, im));
+	}
+
+	delete[] data;
+	delete[] x;
+	return worst / largest;
+}
+
+/*
+	Returns the time of reading i at rate, in nanoseconds
+*/
+static uint64_t timeOf(int i, float rate = RATE) {
+	return (uint64_t)(i * (1e9 / rate));
+}
+
+/*
+	Simulated readings at reading i, taken at rate: gyro X has two motor
+	harmonics on a steady 5 dps turn, accelerometer Z the first harmonic on
+	gravity, all with noise
+*/
+static void simulate(int i, Vector3<float> &gyro, Vector3<float> &accel,
+		float rate = RATE) {
+	float t = i / rate;
+	gyro.x = 5.0f + 3.0f * sin(2.0f * M_PI * 87.3f * t)
+			+ 1.2f * sin(2.0f * M_PI * 143.9f * t + 1.0f)
+			+ uniform(-0.2f, 0.2f);
+	gyro.y = uniform(-0.2f, 0.2f);
+	gyro.z = 0.0f;
+	accel.x = 0.0f;
+	accel.y = 0.0f;
+	accel.z = -1.0f + 0.05f * sin(2.0f * M_PI * 87.3f * t + 0.3f)
+			+ uniform(-0.01f, 0.01f);
+}
+
+static bool near(float value, float expected, float tolerance) {
+	return fabs(value - expected) <= tolerance;
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+
+	printf("RealFFT:\n");
+	{
+		double worst = 0.0;
+		int sizes[] = { 4, 8, 64, 256, 1024 };
+		for (int i = 0; i < 5; ++i)
+			worst = fmax(worst, fftError(sizes[i]));
+		printf("  worst error %g of the largest bin\n", worst);
+		check(worst < 1e-5, "matches a direct DFT, sizes 4 to 1024");
+
+		RealFFT odd(100), tiny(1), huge(1 << 20);
+		check(odd.getSize() == 64 && tiny.getSize() == FFT_MIN_SIZE
+				&& huge.getSize() == FFT_MAX_SIZE,
+				"sizes rounded down to a power of two");
+
+		float data[16], power[9];
+		for (int n = 0; n < 16; ++n)
+			data[n] = cos(2.0 * M_PI * 3 * n / 16);
+		RealFFT fft(16);
+		fft.transform(data);
+		fft.power(data, power);
+		bool tone = near(power[3], 64.0f, 1e-3f);
+		for (int k = 0; k <= 8; ++k)
+			tone = tone && (k == 3 || power[k] < 1e-6f);
+		check(tone, "power of a bin-centred tone");
+	}
+
+	printf("VibrationAnalyzer:\n");
+	{
+		VibrationAnalyzer analyzer(RATE, 256);
+		check(analyzer.getSize() == 256
+				&& near(analyzer.getResolution(), RATE / 256, 1e-6f),
+				"size and resolution");
+
+		VibrationPeak peaks[VIBRATION_PEAKS];
+		check(analyzer.getPeaks(VibrationAnalyzer::CHANNEL_GYRO_X, peaks)
+				== 0 && !analyzer.analyze(), "nothing before a full window");
+
+		Vector3<float> gyro, accel;
+		int analyses = 0;
+		for (int i = 0; i < 1024; ++i) {
+			simulate(i, gyro, accel);
+			analyzer.tap(gyro, accel, timeOf(i));
+			if (i % 50 == 49)
+				while (analyzer.analyze())
+					++analyses;
+		}
+		while (analyzer.analyze())
+			++analyses;
+		// Windows end at 256, then every 128 readings
+		check(analyses == 7 && analyzer.getAnalyses() == 7,
+				"a spectrum every half window");
+
+		int count = analyzer.getPeaks(VibrationAnalyzer::CHANNEL_GYRO_X,
+				peaks);
+		printf("  gyro X: %.2fHz %.3fdps, %.2fHz %.3fdps\n",
+				peaks[0].frequency, peaks[0].amplitude, peaks[1].frequency,
+				peaks[1].amplitude);
+		check(count >= 2 && near(peaks[0].frequency, 87.3f, 0.2f)
+				&& near(peaks[0].amplitude, 3.0f, 0.15f),
+				"strongest peak, between bins");
+		check(near(peaks[1].frequency, 143.9f, 0.2f)
+				&& near(peaks[1].amplitude, 1.2f, 0.06f), "second peak");
+		check(count < 3 || peaks[2].amplitude < 0.3f,
+				"then only noise, and no steady turn");
+
+		count = analyzer.getPeaks(VibrationAnalyzer::CHANNEL_ACCEL_Z, peaks);
+		printf("  accel Z: %.2fHz %.4fg\n", peaks[0].frequency,
+				peaks[0].amplitude);
+		check(count >= 1 && near(peaks[0].frequency, 87.3f, 0.2f)
+				&& near(peaks[0].amplitude, 0.05f, 0.0025f),
+				"accelerometer peak, gravity removed");
+
+		bool ordered = true;
+		float lowest = VIBRATION_MIN_FREQUENCY - analyzer.getResolution() / 2;
+		for (int c = 0; c < VIBRATION_CHANNELS; ++c) {
+			count = analyzer.getPeaks((VibrationAnalyzer::Channel)c, peaks);
+			for (int i = 0; i < count; ++i)
+				ordered = ordered && peaks[i].frequency >= lowest
+						&& (i == 0 || peaks[i].amplitude
+							<= peaks[i - 1].amplitude);
+		}
+		check(ordered, "peaks above the minimum, strongest first");
+
+		float spectrum[129];
+		analyzer.getSpectrum(VibrationAnalyzer::CHANNEL_GYRO_X, spectrum);
+		int bin = (int)(87.3f / analyzer.getResolution() + 0.5f);
+		check(spectrum[bin] > 2.0f && spectrum[bin + 20] < 0.3f,
+				"spectrum");
+	}
+
+	printf("Tap:\n");
+	{
+		VibrationAnalyzer analyzer(RATE, 256);
+		Vector3<float> gyro, accel;
+		for (int i = 0; i < VIBRATION_TAP_SIZE + 10; ++i) {
+			simulate(i, gyro, accel);
+			analyzer.tap(gyro, accel, timeOf(i));
+		}
+		check(analyzer.getDropped() == 10, "drops readings once full");
+		while (analyzer.analyze())
+			;
+		analyzer.tap(gyro, accel, timeOf(VIBRATION_TAP_SIZE + 10));
+		check(analyzer.getDropped() == 10, "takes them again once drained");
+	}
+
+	printf("Thread:\n");
+	{
+		VibrationAnalyzer analyzer(RATE, 256);
+		analyzer.start();
+
+		Vector3<float> gyro, accel;
+		for (int i = 0; i < 2048; ++i) {
+			simulate(i, gyro, accel);
+			analyzer.tap(gyro, accel, timeOf(i));
+			if (i % 16 == 15)
+				usleep(1000);
+		}
+		for (int wait = 0; wait < 200 && analyzer.getAnalyses() < 15; ++wait)
+			usleep(10000);
+		analyzer.stop();
+
+		VibrationPeak peaks[VIBRATION_PEAKS];
+		int count = analyzer.getPeaks(VibrationAnalyzer::CHANNEL_GYRO_X,
+				peaks);
+		check(analyzer.getAnalyses() == 15 && analyzer.getDropped() == 0,
+				"keeps up with the readings");
+		check(count >= 1 && near(peaks[0].frequency, 87.3f, 0.2f),
+				"peaks from the thread");
+	}
+
+	printf("Timing:\n");
+	{
+		// Nominally RATE, but actually taken 3% slower
+		float actual = RATE * 0.97f;
+		VibrationAnalyzer analyzer(RATE, 256);
+		Vector3<float> gyro, accel;
+		for (int i = 0; i < 512; ++i) {
+			simulate(i, gyro, accel, actual);
+			analyzer.tap(gyro, accel, timeOf(i, actual));
+			while (analyzer.analyze())
+				;
+		}
+
+		VibrationPeak peaks[VIBRATION_PEAKS];
+		int count = analyzer.getPeaks(VibrationAnalyzer::CHANNEL_GYRO_X,
+				peaks);
+		check(near(analyzer.getSampleRate(), actual, 0.01f)
+				&& near(analyzer.getResolution(), actual / 256, 1e-4f),
+				"sample rate measured from the times");
+		check(count >= 1 && near(peaks[0].frequency, 87.3f, 0.2f),
+				"peaks at the measured rate");
+	}
+	{
+		// Three readings missing after the 200th
+		VibrationAnalyzer analyzer(RATE, 256);
+		Vector3<float> gyro, accel;
+		int analyses = 0;
+		for (int i = 0; i < 503; ++i) {
+			if (i >= 200 && i < 203)
+				continue;
+			simulate(i, gyro, accel);
+			analyzer.tap(gyro, accel, timeOf(i));
+			while (analyzer.analyze())
+				++analyses;
+		}
+		// 300 readings since the gap make a window, but not another
+		check(analyzer.getGaps() == 1 && analyses == 1,
+				"window starts again after a gap");
+		analyzer.tap(gyro, accel, timeOf(502));
+		analyzer.analyze();
+		check(analyzer.getGaps() == 2, "and after time going backwards");
+	}
+
+	printf("PacketVibration:\n");
+	{
+		PacketVibration sent(VibrationAnalyzer::CHANNEL_ACCEL_Z);
+		sent.setPeak(0, 87.3f, 0.05f);
+		sent.setPeak(1, 174.6f, 0.01f);
+		std::string data = sent.serialize();
+		check(data.size() == 1 + 8 * PKT_VIBRATION_PEAKS, "serialized size");
+
+		// Data left unused by a call comes first in the next (see Packet)
+		PacketVibration received;
+		std::string buffer = data.substr(0, 7);
+		bool partial = !received.feedData(buffer);
+		buffer += data.substr(7) + "x";
+		check(partial && received.feedData(buffer) && buffer == "x"
+				&& received.getComplete(), "fed in two parts");
+		check(received.getChannel() == VibrationAnalyzer::CHANNEL_ACCEL_Z
+				&& received.getFrequency(0) == 87.3f
+				&& received.getAmplitude(0) == 0.05f
+				&& received.getFrequency(1) == 174.6f
+				&& received.getAmplitude(1) == 0.01f
+				&& received.getFrequency(2) == 0.0f
+				&& received.getHeader() == PKT_VIBRATION, "fields");
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*
+	test_vibrationsampler.cpp
+
+	Tests the VibrationSampler against simulated sensors on a SimI2C bus,
+	through an I2CEngine: the gyroscope vibrates at 150Hz, above what the
+	control loop's 100Hz reads can show, and the sampler reads it at 400Hz
+	for a VibrationAnalyzer, which must find it where it is. Then that
+	failed reads are counted, and leave a gap the analyzer starts again
+	after.
+
+	Does not need any hardware, but runs in real time (a few seconds).
+	Returns non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <errno.h>
+
+#include <unistd.h>
+
+#include "exception.h"
+#include "geometry.h"
+#include "i2c.h"
+#include "i2cengine.h"
+#include "accelerometer.h"
+#include "gyroscope.h"
+#include "rawsamples.h"
+#include "vibrationanalyzer.h"
+#include "vibrationsampler.h"
+#include "simulator.h"
+
+#define ACCEL_ADDR 0x53
+#define GYRO_ADDR  0x69
+
+#define RATE      400.0f
+#define VIBRATION 150.0f  // Hz
+#define AMPLITUDE 5.0f    // dps
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+	printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+static bool near(float value, float expected, float tolerance) {
+	return fabs(value - expected) <= tolerance;
+}
+
+/*
+	A bus whose gyroscope vibrates about its Y axis: every transfer first
+	sets the gyroscope's output to the vibration at that moment
+*/
+class VibratingI2C : public SimI2C {
+	public:
+		SimGyroscope *gyro;
+		uint64_t     start;
+
+		VibratingI2C() : SimI2C(), gyro(0), start(rawSampleTime()) { }
+
+	protected:
+		int rawTransfer(struct i2c_msg *msgs, int count) {
+			if (gyro) {
+				double t = (rawSampleTime() - start) / 1e9;
+				gyro->set(Vector3<float>(0.0f,
+						AMPLITUDE * sin(2.0 * M_PI * VIBRATION * t), 0.0f));
+			}
+			return SimI2C::rawTransfer(msgs, count);
+		}
+};
+
+int main(int argc, char **argv) {
+	try {
+		VibratingI2C bus;
+		SimAccelerometer simaccel(&bus, ACCEL_ADDR);
+		SimGyroscope simgyro(&bus, GYRO_ADDR);
+		simaccel.set(Vector3<float>(0.0f, 0.0f, 1.0f));
+		bus.gyro = &simgyro;
+
+		Accelerometer accel(&bus, ACCEL_ADDR, Accelerometer::RANGE_2G,
+				Accelerometer::SRATE_400HZ);
+		Gyroscope gyro(&bus, GYRO_ADDR, Gyroscope::RANGE_250DPS,
+				Gyroscope::SRATE_400HZ);
+		I2CEngine engine(&bus);
+
+		printf("Sampling at the output data rate:\n");
+		{
+			VibrationAnalyzer analyzer(RATE, 128);
+			VibrationSampler sampler(&engine, &accel, &gyro, &analyzer,
+					RATE);
+			sampler.start();
+			usleep(1500000);
+			sampler.stop();
+
+			int analyses = 0;
+			while (analyzer.analyze())
+				++analyses;
+
+			printf("  %ld samples, %ld missed, %d gaps, %.1fHz measured\n",
+					sampler.getSamples(), sampler.getMissed(),
+					analyzer.getGaps(), analyzer.getSampleRate());
+			check(sampler.getSamples() + sampler.getMissed() > 0.9f * 1.5f
+					* RATE && sampler.getFailed() == 0,
+					"reads every sample period");
+			check(analyses > 0 && near(analyzer.getSampleRate(), RATE,
+					0.05f * RATE), "rate measured from the sample times");
+
+			VibrationPeak peaks[VIBRATION_PEAKS];
+			int count = analyzer.getPeaks(VibrationAnalyzer::CHANNEL_GYRO_Y,
+					peaks);
+			if (count > 0)
+				printf("  gyro Y: %.2fHz %.3fdps\n", peaks[0].frequency,
+						peaks[0].amplitude);
+			check(count > 0 && near(peaks[0].frequency, VIBRATION,
+					2.0f * analyzer.getResolution()),
+					"vibration found above the loop's Nyquist limit");
+			check(count > 0 && peaks[0].amplitude > 0.5f * AMPLITUDE,
+					"at about its amplitude");
+		}
+
+		printf("Failed reads:\n");
+		{
+			VibrationAnalyzer analyzer(RATE, 128);
+			VibrationSampler sampler(&engine, &accel, &gyro, &analyzer,
+					RATE);
+			sampler.start();
+			usleep(200000);
+			// Three reads in a row, past the retries
+			bus.failNext(3 * (I2C_RETRY_COUNT + 1), EIO);
+			usleep(200000);
+			sampler.stop();
+			while (analyzer.analyze())
+				;
+
+			check(sampler.getFailed() == 3, "counted");
+			check(analyzer.getGaps() >= 1, "analyzer starts again after");
+		}
+	} catch (Exception &e) {
+		printf("Exception: %s\n", e.getDescription().c_str());
+		++failures;
+	}
+
+	if (failures) {
+		printf("\n%d check(s) FAILED\n", failures);
+		return 1;
+	}
+
+	printf("\nDone!\n");
+	return 0;
+}